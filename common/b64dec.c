@@ -27,6 +27,7 @@
 
 #include "i18n.h"
 #include "util.h"
+#include "base64.h"
 
 
 /* The reverse base-64 list used for base-64 decoding. */
@@ -167,8 +168,17 @@ b64dec_proc (struct b64state *state, void *buffer, size_t length,
         case s_b64_3:
           {
             int c;
+            size_t n;
 
-            if (*s == '-' && state->title)
+            if (ds == s_b64_0 && length >= 4
+                && (n = base64_decode_quads (d, length, s, length)))
+              {
+                /* Converted complete quads at once.  */
+                d += n / 4 * 3;
+                s += n - 1;
+                length -= n - 1;
+              }
+            else if (*s == '-' && state->title)
               {
                 /* Not a valid Base64 character: assume end
                    header.  */
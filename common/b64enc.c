@@ -29,6 +29,7 @@
 
 #include "i18n.h"
 #include "util.h"
+#include "base64.h"
 
 #define B64ENC_DID_HEADER   1
 #define B64ENC_DID_TRAILER  2
@@ -249,9 +250,36 @@ b64enc_write (struct b64state *state, const void *buffer, size_t nbytes)
       state->crc = (crc & 0x00ffffff);
     }
 
-  for (p=buffer; nbytes; p++, nbytes--)
+  p = buffer;
+  while (nbytes)
     {
-      radbuf[idx++] = *p;
+      if (!idx && !quad_count && nbytes >= (64/4)*3)
+        {
+          /* Convert up to 16 complete lines at once.  */
+          unsigned char linebuf[16 * (64+1)];
+          size_t n, len;
+
+          for (n=len=0; n < 16 && nbytes >= (64/4)*3; n++)
+            {
+              base64_encode_line (linebuf + len, p);
+              len += 64;
+              if (!(state->flags & B64ENC_NO_LINEFEEDS))
+                linebuf[len++] = '\n';
+              p += (64/4)*3;
+              nbytes -= (64/4)*3;
+            }
+          if (state->stream)
+            {
+              if (es_write (state->stream, linebuf, len, NULL))
+                goto write_error;
+            }
+          else if (fwrite (linebuf, len, 1, state->fp) != 1)
+            goto write_error;
+          continue;
+        }
+
+      radbuf[idx++] = *p++;
+      nbytes--;
       if (idx > 2)
         {
           char tmp[4];
@@ -0,0 +1,483 @@
+/* base64.c - Vectorized base-64 conversion of complete blocks
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This module provides the bulk conversion used by the base-64
+ * encoders and decoders in b64enc.c, b64dec.c, and g10/armor.c.  The
+ * callers keep their own streaming state and handle partial blocks,
+ * line endings, padding, and armor headers; the functions here only
+ * convert complete lines or quads using the fastest implementation
+ * the CPU supports.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_X86_SIMD_INTRINSICS
+# include <immintrin.h>
+#endif
+
+#include "util.h"
+#include "base64.h"
+
+
+/* The base-64 character list.  */
+static const byte bintoasc[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                 "abcdefghijklmnopqrstuvwxyz"
+                                 "0123456789+/";
+
+/* The reverse base-64 list with 0xff for invalid characters.  */
+static const byte asctobin[256] =
+  {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+    0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+  };
+
+
+static void encode_line_select (byte *dst, const byte *src);
+static size_t decode_quads_select (byte *dst, size_t dstlen,
+                                   const byte *src, size_t srclen);
+
+/* The implementations in use.  They are set by select_impl on first
+ * use.  */
+static void (*encode_line_fnc) (byte *dst, const byte *src)
+  = encode_line_select;
+static size_t (*decode_quads_fnc) (byte *dst, size_t dstlen,
+                                   const byte *src, size_t srclen)
+  = decode_quads_select;
+static const char *impl_name = "generic";
+
+
+
+static void
+encode_line_generic (byte *dst, const byte *src)
+{
+  u32 in, in2;
+  int i;
+
+  for (i = 0; i < (64/8); i++)
+    {
+      in = (u32)src[0] << (2 * 8);
+      in |= (u32)src[1] << (1 * 8);
+      in |= (u32)src[2] << (0 * 8);
+      in2 = (u32)src[3] << (2 * 8);
+      in2 |= (u32)src[4] << (1 * 8);
+      in2 |= (u32)src[5] << (0 * 8);
+      dst[i*8+0] = bintoasc[(in >> 18) & 077];
+      dst[i*8+1] = bintoasc[(in >> 12) & 077];
+      dst[i*8+2] = bintoasc[(in >> 6) & 077];
+      dst[i*8+3] = bintoasc[(in >> 0) & 077];
+      dst[i*8+4] = bintoasc[(in2 >> 18) & 077];
+      dst[i*8+5] = bintoasc[(in2 >> 12) & 077];
+      dst[i*8+6] = bintoasc[(in2 >> 6) & 077];
+      dst[i*8+7] = bintoasc[(in2 >> 0) & 077];
+      src += 6;
+    }
+}
+
+
+static size_t
+decode_quads_generic (byte *dst, size_t dstlen,
+                      const byte *src, size_t srclen)
+{
+  size_t n;
+  u32 a, b, c, d;
+
+  for (n = 0; srclen - n >= 4 && dstlen >= 3; n += 4)
+    {
+      a = asctobin[src[n]];
+      b = asctobin[src[n+1]];
+      c = asctobin[src[n+2]];
+      d = asctobin[src[n+3]];
+      if (((a | b | c | d) & 0x80))
+        break;
+      a = (a << 18) | (b << 12) | (c << 6) | d;
+      *dst++ = a >> 16;
+      *dst++ = a >> 8;
+      *dst++ = a;
+      dstlen -= 3;
+    }
+  return n;
+}
+
+
+#ifdef HAVE_X86_SIMD_INTRINSICS
+/* The vectorized versions follow the algorithms described by Wojciech
+ * Muła and Daniel Lemire in "Faster Base64 Encoding and Decoding using
+ * AVX2 Instructions" (2018).  The SSSE3 and AVX2 instructions are
+ * enabled by target attributes so that the rest of GnuPG does not
+ * need to be built for these CPUs.  */
+
+/* Convert the 12 bytes in the lower 12 bytes of each 32 bit word
+ * triple of IN, as arranged by the caller, to 16 radix64
+ * characters.  */
+__attribute__ ((target ("ssse3"))) static inline __m128i
+encode_ssse3 (__m128i in)
+{
+  const __m128i shift_lut = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '+' - 62,
+                                           '/' - 63, 'A', 0, 0);
+  __m128i t0, t1, t2, t3, indices, result;
+
+  /* Split each 3 bytes into 4 indices of 6 bits.  */
+  t0 = _mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00));
+  t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+  t2 = _mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0));
+  t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+  indices = _mm_or_si128 (t1, t3);
+
+  /* Map the indices to the characters.  */
+  result = _mm_subs_epu8 (indices, _mm_set1_epi8 (51));
+  result = _mm_or_si128 (result,
+                         _mm_and_si128 (_mm_cmpgt_epi8 (_mm_set1_epi8 (26),
+                                                        indices),
+                                        _mm_set1_epi8 (13)));
+  result = _mm_shuffle_epi8 (shift_lut, result);
+  return _mm_add_epi8 (result, indices);
+}
+
+/* Load 16 bytes from P and arrange the 12 bytes starting at offset
+ * OFF (0 or 4) for encode_ssse3.  */
+#define ENCODE_SHUFFLE(off)                                             \
+  _mm_setr_epi8 ((off)+1, (off)+0, (off)+2, (off)+1,                    \
+                 (off)+4, (off)+3, (off)+5, (off)+4,                    \
+                 (off)+7, (off)+6, (off)+8, (off)+7,                    \
+                 (off)+10, (off)+9, (off)+11, (off)+10)
+
+__attribute__ ((target ("ssse3"))) static void
+encode_line_ssse3 (byte *dst, const byte *src)
+{
+  __m128i in;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    {
+      in = _mm_loadu_si128 ((const __m128i *)(src + i * 12));
+      in = _mm_shuffle_epi8 (in, ENCODE_SHUFFLE (0));
+      _mm_storeu_si128 ((__m128i *)(dst + i * 16), encode_ssse3 (in));
+    }
+  /* Don't read beyond the 48 input bytes.  */
+  in = _mm_loadu_si128 ((const __m128i *)(src + 32));
+  in = _mm_shuffle_epi8 (in, ENCODE_SHUFFLE (4));
+  _mm_storeu_si128 ((__m128i *)(dst + 48), encode_ssse3 (in));
+}
+
+
+/* Decode the 16 radix64 characters at SRC to 12 bytes at DST.
+ * Returns false if SRC has an invalid character.  */
+__attribute__ ((target ("ssse3"))) static inline int
+decode_ssse3 (byte *dst, const byte *src)
+{
+  const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1a,
+                                        0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02,
+                                        0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10,
+                                        0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+                                          0, 0, 0, 0, 0, 0, 0, 0);
+  __m128i in, hi_nibbles, lo_nibbles, lo, hi, roll, out;
+  byte tmp[16];
+
+  in = _mm_loadu_si128 ((const __m128i *)src);
+  hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (in, 4), _mm_set1_epi8 (0x0f));
+  lo_nibbles = _mm_and_si128 (in, _mm_set1_epi8 (0x0f));
+  lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+  hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+  if (_mm_movemask_epi8 (_mm_cmpgt_epi8 (_mm_and_si128 (lo, hi),
+                                         _mm_setzero_si128 ())))
+    return 0;
+
+  /* Map the characters to their 6 bit values.  */
+  roll = _mm_shuffle_epi8 (lut_roll,
+                           _mm_add_epi8 (_mm_cmpeq_epi8 (in,
+                                                         _mm_set1_epi8 ('/')),
+                                         hi_nibbles));
+  out = _mm_add_epi8 (in, roll);
+
+  /* Pack each 4 values of 6 bit into 3 bytes.  */
+  out = _mm_maddubs_epi16 (out, _mm_set1_epi32 (0x01400140));
+  out = _mm_madd_epi16 (out, _mm_set1_epi32 (0x00011000));
+  out = _mm_shuffle_epi8 (out, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                              14, 13, 12, -1, -1, -1, -1));
+  _mm_storeu_si128 ((__m128i *)tmp, out);
+  memcpy (dst, tmp, 12);
+  return 1;
+}
+
+__attribute__ ((target ("ssse3"))) static size_t
+decode_blocks_ssse3 (byte *dst, size_t dstlen,
+                     const byte *src, size_t srclen)
+{
+  size_t n = 0;
+
+  while (srclen - n >= 16 && dstlen >= 12 && decode_ssse3 (dst, src + n))
+    {
+      dst += 12;
+      dstlen -= 12;
+      n += 16;
+    }
+  return n + decode_quads_generic (dst, dstlen, src + n, srclen - n);
+}
+
+
+__attribute__ ((target ("avx2"))) static void
+encode_line_avx2 (byte *dst, const byte *src)
+{
+  const __m256i shift_lut = _mm256_setr_epi8 ('a' - 26, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0,
+                                              'a' - 26, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0);
+  __m256i in, t0, t1, t2, t3, indices, result;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      /* Each lane gets 12 input bytes; the last lane is loaded from
+       * offset 32 so that we don't read beyond the 48 input bytes.  */
+      in = _mm256_inserti128_si256
+        (_mm256_castsi128_si256
+         (_mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(src + i*24)),
+                            ENCODE_SHUFFLE (0))),
+         i? _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(src + 32)),
+                              ENCODE_SHUFFLE (4))
+          : _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(src + 12)),
+                              ENCODE_SHUFFLE (0)), 1);
+
+      t0 = _mm256_and_si256 (in, _mm256_set1_epi32 (0x0fc0fc00));
+      t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+      t2 = _mm256_and_si256 (in, _mm256_set1_epi32 (0x003f03f0));
+      t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+      indices = _mm256_or_si256 (t1, t3);
+
+      result = _mm256_subs_epu8 (indices, _mm256_set1_epi8 (51));
+      result = _mm256_or_si256
+        (result, _mm256_and_si256 (_mm256_cmpgt_epi8 (_mm256_set1_epi8 (26),
+                                                      indices),
+                                   _mm256_set1_epi8 (13)));
+      result = _mm256_shuffle_epi8 (shift_lut, result);
+      _mm256_storeu_si256 ((__m256i *)(dst + i * 32),
+                           _mm256_add_epi8 (result, indices));
+    }
+}
+
+
+__attribute__ ((target ("avx2"))) static size_t
+decode_blocks_avx2 (byte *dst, size_t dstlen,
+                    const byte *src, size_t srclen)
+{
+  const __m256i lut_lo = _mm256_setr_epi8 (0x15, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a,
+                                           0x1b, 0x1b, 0x1b, 0x1a,
+                                           0x15, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1a,
+                                           0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8 (0x10, 0x10, 0x01, 0x02,
+                                           0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02,
+                                           0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0);
+  __m256i in, hi_nibbles, lo_nibbles, lo, hi, roll, out;
+  byte tmp[32];
+  size_t n = 0;
+
+  while (srclen - n >= 32 && dstlen >= 24)
+    {
+      in = _mm256_loadu_si256 ((const __m256i *)(src + n));
+      hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (in, 4),
+                                     _mm256_set1_epi8 (0x0f));
+      lo_nibbles = _mm256_and_si256 (in, _mm256_set1_epi8 (0x0f));
+      lo = _mm256_shuffle_epi8 (lut_lo, lo_nibbles);
+      hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+      if (_mm256_movemask_epi8
+          (_mm256_cmpgt_epi8 (_mm256_and_si256 (lo, hi),
+                              _mm256_setzero_si256 ())))
+        break;
+
+      roll = _mm256_shuffle_epi8
+        (lut_roll, _mm256_add_epi8 (_mm256_cmpeq_epi8
+                                    (in, _mm256_set1_epi8 ('/')),
+                                    hi_nibbles));
+      out = _mm256_add_epi8 (in, roll);
+      out = _mm256_maddubs_epi16 (out, _mm256_set1_epi32 (0x01400140));
+      out = _mm256_madd_epi16 (out, _mm256_set1_epi32 (0x00011000));
+      out = _mm256_shuffle_epi8 (out, _mm256_setr_epi8
+                                 (2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                  14, 13, 12, -1, -1, -1, -1,
+                                  2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                  14, 13, 12, -1, -1, -1, -1));
+      /* Move the 12 bytes of the upper lane next to the lower lane.  */
+      out = _mm256_permutevar8x32_epi32 (out, _mm256_setr_epi32 (0, 1, 2,
+                                                                  4, 5, 6,
+                                                                  3, 7));
+      _mm256_storeu_si256 ((__m256i *)tmp, out);
+      memcpy (dst, tmp, 24);
+      dst += 24;
+      dstlen -= 24;
+      n += 32;
+    }
+
+  /* The SSSE3 version handles the remaining characters.  Clear the
+   * upper halves of the registers first to avoid the penalty for
+   * switching to non-VEX instructions.  */
+  _mm256_zeroupper ();
+  return n + decode_blocks_ssse3 (dst, dstlen, src + n, srclen - n);
+}
+#endif /*HAVE_X86_SIMD_INTRINSICS*/
+
+
+/* Select the implementations for this CPU.  */
+static void
+select_impl (void)
+{
+  void (*encode_line) (byte *dst, const byte *src) = encode_line_generic;
+  size_t (*decode_quads) (byte *dst, size_t dstlen,
+                          const byte *src, size_t srclen)
+    = decode_quads_generic;
+
+#ifdef HAVE_X86_SIMD_INTRINSICS
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      encode_line = encode_line_avx2;
+      decode_quads = decode_blocks_avx2;
+      impl_name = "avx2";
+    }
+  else if (__builtin_cpu_supports ("ssse3"))
+    {
+      encode_line = encode_line_ssse3;
+      decode_quads = decode_blocks_ssse3;
+      impl_name = "ssse3";
+    }
+#endif /*HAVE_X86_SIMD_INTRINSICS*/
+
+  /* Storing a pointer is atomic on all supported platforms and all
+   * threads select the same functions.  */
+  encode_line_fnc = encode_line;
+  decode_quads_fnc = decode_quads;
+}
+
+
+static void
+encode_line_select (byte *dst, const byte *src)
+{
+  select_impl ();
+  encode_line_fnc (dst, src);
+}
+
+
+static size_t
+decode_quads_select (byte *dst, size_t dstlen,
+                     const byte *src, size_t srclen)
+{
+  select_impl ();
+  return decode_quads_fnc (dst, dstlen, src, srclen);
+}
+
+
+
+/* Convert the 48 bytes at SRC to a line of 64 base-64 characters at
+ * DST.  No line ending is appended.  */
+void
+base64_encode_line (void *dst, const void *src)
+{
+  encode_line_fnc (dst, src);
+}
+
+
+/* Convert the base-64 characters at SRC of length SRCLEN in quads of
+ * 4 characters to at most DSTLEN bytes at DST.  This stops at the
+ * first quad with a character which is not a base-64 character, that
+ * is also at white space, padding, and line endings.  Returns the
+ * number of characters converted which is a multiple of 4; each quad
+ * yields 3 bytes.  DST may be the same as SRC for in-place
+ * conversion.  */
+size_t
+base64_decode_quads (void *dst, size_t dstlen,
+                     const void *src, size_t srclen)
+{
+  return decode_quads_fnc (dst, dstlen, src, srclen);
+}
+
+
+/* Return the name of the implementation in use.  */
+const char *
+base64_impl_name (void)
+{
+  if (encode_line_fnc == encode_line_select)
+    select_impl ();
+  return impl_name;
+}
@@ -0,0 +1,44 @@
+/* base64.h - Vectorized base-64 conversion of complete blocks
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_BASE64_H
+#define GNUPG_COMMON_BASE64_H
+
+/* Convert 48 bytes to a line of 64 base-64 characters.  */
+void base64_encode_line (void *dst, const void *src);
+
+/* Convert complete quads of base-64 characters up to the first
+ * invalid character.  */
+size_t base64_decode_quads (void *dst, size_t dstlen,
+                            const void *src, size_t srclen);
+
+/* Return the name of the implementation in use.  */
+const char *base64_impl_name (void);
+
+#endif /*GNUPG_COMMON_BASE64_H*/
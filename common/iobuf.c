@@ -59,9 +59,18 @@
 
 /*-- Begin configurable part.  --*/
 
-/* The standard size of the internal buffers.  */
+/* The standard size of the internal buffers.  This is the size up
+   to which buffers grow.  */
 #define DEFAULT_IOBUF_BUFFER_SIZE  (64*1024)
 
+/* The size new buffers start with.  This must not be larger than
+   the smallest value accepted by iobuf_set_buffer_size.  */
+#define INITIAL_IOBUF_BUFFER_SIZE  (4*1024)
+
+/* The number of consecutive completely filled or flushed buffers
+   after which the buffer of a filter is doubled.  */
+#define IOBUF_GROW_THRESHOLD 2
+
 /* To avoid a potential DoS with compression packets we better limit
    the number of filters in a chain.  */
 #define MAX_NESTING_FILTER 64
@@ -173,7 +182,8 @@ static int translate_file_handle (int fd, int for_write);
    to be sent to A's filter function.
 
    If A is a IOBUF_OUTPUT_TEMP filter, then this also enlarges the
-   buffer by iobuf_buffer_size.
+   buffer: it is doubled until it reaches iobuf_buffer_size and
+   enlarged by iobuf_buffer_size after that.
 
    May only be called on an IOBUF_OUTPUT or IOBUF_OUTPUT_TEMP filters.  */
 static int filter_flush (iobuf_t a);
@@ -1216,6 +1226,35 @@ iobuf_alloc (int use, size_t bufsize)
   return a;
 }
 
+
+/* Double the buffer of the filter A up to IOBUF_BUFFER_SIZE.  This
+ * is used once A has seen enough completely filled or flushed
+ * buffers in a row to assume that it is streaming bulk data.  */
+static void
+grow_buffer (iobuf_t a)
+{
+  size_t newsize;
+  byte *newbuf;
+
+  a->nfull = 0;
+  newsize = a->d.size * 2;
+  if (newsize > iobuf_buffer_size)
+    newsize = iobuf_buffer_size;
+  if (newsize <= a->d.size)
+    return;
+  if (DBG_IOBUF)
+    log_debug ("iobuf-%d.%d: increasing buffer from %lu to %lu\n",
+               a->no, a->subno, (ulong) a->d.size, (ulong) newsize);
+  /* Do not use realloc so that we can erase the old buffer; it may
+   * hold plaintext.  */
+  newbuf = xmalloc (newsize);
+  memcpy (newbuf, a->d.buf, a->d.size);
+  wipememory (a->d.buf, a->d.size);
+  xfree (a->d.buf);
+  a->d.buf = newbuf;
+  a->d.size = newsize;
+}
+
 int
 iobuf_close (iobuf_t a)
 {
@@ -1311,7 +1350,7 @@ iobuf_cancel (iobuf_t a)
 iobuf_t
 iobuf_temp (void)
 {
-  return iobuf_alloc (IOBUF_OUTPUT_TEMP, iobuf_buffer_size);
+  return iobuf_alloc (IOBUF_OUTPUT_TEMP, INITIAL_IOBUF_BUFFER_SIZE);
 }
 
 iobuf_t
@@ -1386,7 +1425,7 @@ do_open (const char *fname, int special_filenames,
 	return NULL;
     }
 
-  a = iobuf_alloc (use, iobuf_buffer_size);
+  a = iobuf_alloc (use, INITIAL_IOBUF_BUFFER_SIZE);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1433,7 +1472,7 @@ do_iobuf_fdopen (int fd, const char *mode, int keep_open)
   fp = INT2FD (fd);
 
   a = iobuf_alloc (strchr (mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-		   iobuf_buffer_size);
+		   INITIAL_IOBUF_BUFFER_SIZE);
   fcx = xmalloc (sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
@@ -1472,7 +1511,7 @@ iobuf_esopen (estream_t estream, const char *mode, int keep_open,
   size_t len = 0;
 
   a = iobuf_alloc (strchr (mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-		   iobuf_buffer_size);
+		   INITIAL_IOBUF_BUFFER_SIZE);
   fcx = xtrymalloc (sizeof *fcx + 30);
   fcx->fp = estream;
   fcx->print_only_name = 1;
@@ -1499,7 +1538,7 @@ iobuf_sockopen (int fd, const char *mode)
   size_t len;
 
   a = iobuf_alloc (strchr (mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-		   iobuf_buffer_size);
+		   INITIAL_IOBUF_BUFFER_SIZE);
   scx = xmalloc (sizeof *scx + 25);
   scx->sock = fd;
   scx->print_only_name = 1;
@@ -1698,15 +1737,15 @@ iobuf_push_filter2 (iobuf_t a,
 
       /* When pipeline is written to, the temp buffer's size is
 	 increased accordingly.  We don't need to allocate a 10 MB
-	 buffer for a non-terminal filter.  Just use the default
+	 buffer for a non-terminal filter.  Just use the initial
 	 size.  */
-      a->d.size = iobuf_buffer_size;
+      a->d.size = INITIAL_IOBUF_BUFFER_SIZE;
     }
   else if (a->use == IOBUF_INPUT_TEMP)
     /* Same idea as above.  */
     {
       a->use = IOBUF_INPUT;
-      a->d.size = iobuf_buffer_size;
+      a->d.size = INITIAL_IOBUF_BUFFER_SIZE;
     }
 
   /* The new filter (A) gets a new buffer.
@@ -1723,6 +1762,7 @@ iobuf_push_filter2 (iobuf_t a,
   a->d.buf = xmalloc (a->d.size);
   a->d.len = 0;
   a->d.start = 0;
+  a->nfull = 0;
 
   /* disable nlimit for the new stream */
   a->ntotal = b->ntotal + b->nbytes;
@@ -1882,6 +1922,8 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
   a->d.len -= a->d.start;
   memmove (a->d.buf, &a->d.buf[a->d.start], a->d.len);
   a->d.start = 0;
+  if (a->nfull >= IOBUF_GROW_THRESHOLD)
+    grow_buffer (a);
 
   if (a->d.len < target && a->filter_eof)
     /* The last time we tried to read from this filter, we got an EOF.
@@ -1942,6 +1984,12 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
 			&a->d.buf[a->d.len], &len);
       a->d.len += len;
+      /* Only count the fill here; the buffer is grown on the next
+       * underflow so that we don't realloc a buffer still in use.  */
+      if (!rc && a->d.len == a->d.size)
+        a->nfull++;
+      else
+        a->nfull = 0;
 
       if (DBG_IOBUF)
 	log_debug ("iobuf-%d.%d: A->FILTER() returned rc=%d (%s), read %lu bytes\n",
@@ -2023,7 +2071,14 @@ filter_flush (iobuf_t a)
 
   if (a->use == IOBUF_OUTPUT_TEMP)
     {				/* increase the temp buffer */
-      size_t newsize = a->d.size + iobuf_buffer_size;
+      size_t newsize;
+
+      /* Grow geometrically until the standard size is reached and
+       * then linearly.  */
+      if (a->d.size < iobuf_buffer_size)
+        newsize = a->d.size * 2;
+      else
+        newsize = a->d.size + iobuf_buffer_size;
 
       if (DBG_IOBUF)
 	log_debug ("increasing temp iobuf from %lu to %lu\n",
@@ -2046,6 +2101,10 @@ filter_flush (iobuf_t a)
     }
   else if (rc)
     a->error = rc;
+  else if (a->d.len < a->d.size)
+    a->nfull = 0;
+  else if (++a->nfull >= IOBUF_GROW_THRESHOLD)
+    grow_buffer (a);
   a->d.len = 0;
 
   return rc;
@@ -2198,6 +2257,65 @@ iobuf_peek (iobuf_t a, byte * buf, unsigned buflen)
 }
 
 
+const byte *
+iobuf_borrow (iobuf_t a, size_t maxlen, size_t *r_len)
+{
+  size_t n;
+
+  *r_len = 0;
+
+  if (a->use == IOBUF_OUTPUT || a->use == IOBUF_OUTPUT_TEMP)
+    {
+      log_bug ("iobuf_borrow called on a non-INPUT pipeline!\n");
+      return NULL;
+    }
+
+  if (a->nlimit)
+    {
+      if (a->nbytes >= a->nlimit)
+        return NULL;  /* Forced EOF.  */
+      if (maxlen > a->nlimit - a->nbytes)
+        maxlen = a->nlimit - a->nbytes;
+    }
+
+  if (!maxlen)
+    return NULL;
+
+  assert (a->d.start <= a->d.len);
+  if (a->d.start == a->d.len)
+    {
+      /* Nothing buffered.  Ask the filter for more data.  Underflow
+       * consumes the first byte (it's the return value); unget it by
+       * resetting the "file position".  Note that on EOF the filter
+       * may be popped which is fine because A is the head of the
+       * pipeline.  */
+      if (underflow (a, 1) == -1)
+        return NULL;  /* EOF */
+      assert (a->d.start == 1);
+      a->d.start = 0;
+    }
+
+  n = a->d.len - a->d.start;
+  if (n > maxlen)
+    n = maxlen;
+
+  *r_len = n;
+  return a->d.buf + a->d.start;
+}
+
+
+void
+iobuf_consume (iobuf_t a, size_t n)
+{
+  assert (a->d.start <= a->d.len);
+  if (n > a->d.len - a->d.start)
+    log_bug ("iobuf_consume: consuming more than borrowed\n");
+
+  a->d.start += n;
+  a->nbytes += n;
+}
+
+
 
 
 int
@@ -202,6 +202,12 @@ struct iobuf_struct
     byte *buf;
   } d;
 
+  /* The number of consecutive reads which completely filled the
+     buffer, respectively consecutive flushes of a full buffer.  The
+     buffer starts small and is grown when this reaches a threshold;
+     thus only filters which stream bulk data get large buffers.  */
+  unsigned int nfull;
+
   /* When FILTER is called to read some data, it may read some data
      and then return EOF.  We can't return the EOF immediately.
      Instead, we note that we observed the EOF and when the buffer is
@@ -252,10 +258,11 @@ struct iobuf_struct
 extern int iobuf_debug_mode;
 
 
-/* Change the default size for all IOBUFs to KILOBYTE.  This needs to
- * be called before any iobufs are used and can only be used once.
- * Returns the current value.  Using 0 has no effect except for
- * returning the current value.  */
+/* Change the maximum size for all IOBUFs to KILOBYTE.  Buffers start
+ * small and grow up to this size if a filter streams data.  This
+ * needs to be called before any iobufs are used and can only be used
+ * once.  Returns the current value.  Using 0 has no effect except
+ * for returning the current value.  */
 unsigned int iobuf_set_buffer_size (unsigned int kilobyte);
 
 /* Returns whether the specified filename corresponds to a pipe.  In
@@ -520,6 +527,23 @@ unsigned iobuf_read_line (iobuf_t a, byte ** addr_of_buffer,
    EOF before returning the data from the second filter.  */
 int iobuf_peek (iobuf_t a, byte * buf, unsigned buflen);
 
+/* Lend the caller a contiguous span of the data buffered in the input
+   pipeline A without copying it.  If nothing is buffered, the filter
+   is asked for more data.  On success a pointer to the data is
+   returned and the number of available bytes (at most MAXLEN) is
+   stored at R_LEN; NULL is returned on EOF.  Any limit set with
+   iobuf_set_limit is honored.
+
+   The data is not consumed; the caller needs to call iobuf_consume
+   with the number of bytes actually used.  The returned pointer is
+   only valid until the next operation on A.  Like iobuf_read, this
+   function pops a filter from the pipeline when returning EOF.  */
+const byte *iobuf_borrow (iobuf_t a, size_t maxlen, size_t *r_len);
+
+/* Mark N bytes of the span returned by the last iobuf_borrow as
+   consumed.  N may be less than the borrowed length.  */
+void iobuf_consume (iobuf_t a, size_t n);
+
 /* Write a byte to the pipeline.  Returns 0 on success and an error
    code otherwise.  */
 int iobuf_writebyte (iobuf_t a, unsigned c);
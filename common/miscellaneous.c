@@ -459,27 +459,56 @@ is_openpgp_compressed_packet (unsigned char *buf, size_t len)
 
 
 
-/*
- * Check if the file is compressed.
- */
+/* Check whether (BUFFER,LENGTH) starts with the magic of a known
+ * compressed file format or with an OpenPGP compressed packet.  At
+ * least 8 bytes are required to detect all formats.  */
 int
-is_file_compressed (const char *s, int *ret_rc)
+is_buffer_compressed (const void *buffer, size_t length)
 {
-    iobuf_t a;
-    byte buf[6];
+    const byte *buf = buffer;
     int i;
-    int rc = 0;
-    int overflow;
 
     struct magic_compress_s {
         size_t len;
-        byte magic[4];
+        byte magic[6];
     } magic[] = {
-        { 3, { 0x42, 0x5a, 0x68, 0x00 } }, /* bzip2 */
-        { 3, { 0x1f, 0x8b, 0x08, 0x00 } }, /* gzip */
+        { 3, { 0x42, 0x5a, 0x68 } }, /* bzip2 */
+        { 3, { 0x1f, 0x8b, 0x08 } }, /* gzip */
         { 4, { 0x50, 0x4b, 0x03, 0x04 } }, /* (pk)zip */
+        { 6, { 0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00 } }, /* xz */
+        { 4, { 0x28, 0xb5, 0x2f, 0xfd } }, /* zstd */
+        { 4, { 0x4c, 0x5a, 0x49, 0x50 } }, /* lzip */
+        { 6, { 0x37, 0x7a, 0xbc, 0xaf, 0x27, 0x1c } }, /* 7z */
+        { 6, { 0x52, 0x61, 0x72, 0x21, 0x1a, 0x07 } }, /* rar */
+        { 3, { 0xff, 0xd8, 0xff } }, /* jpeg */
+        { 4, { 0x89, 0x50, 0x4e, 0x47 } }, /* png */
     };
 
+    for ( i = 0; i < DIM( magic ); i++ ) {
+        if ( length >= magic[i].len
+             && !memcmp( buf, magic[i].magic, magic[i].len ) )
+            return 1;
+    }
+
+    if ( length >= 6 && is_openpgp_compressed_packet ((byte *)buf, length))
+        return 1;
+
+    return 0;
+}
+
+
+/*
+ * Check if the file is compressed.
+ */
+int
+is_file_compressed (const char *s, int *ret_rc)
+{
+    iobuf_t a;
+    byte buf[8];
+    int n;
+    int rc = 0;
+    int overflow;
+
     if ( iobuf_is_pipe_filename (s) || !ret_rc )
         return 0; /* We can't check stdin or no file was given */
 
@@ -495,24 +524,13 @@ is_file_compressed (const char *s, int *ret_rc)
         goto leave;
     }
 
-    if ( iobuf_read( a, buf, 6 ) == -1 ) {
+    if ( (n = iobuf_read( a, buf, sizeof buf )) == -1 ) {
         *ret_rc = a->error;
         goto leave;
     }
 
-    for ( i = 0; i < DIM( magic ); i++ ) {
-        if ( !memcmp( buf, magic[i].magic, magic[i].len ) ) {
-            *ret_rc = 0;
-            rc = 1;
-            goto leave;
-        }
-    }
-
-    if (is_openpgp_compressed_packet (buf, 6))
-      {
-        *ret_rc = 0;
-        rc = 1;
-      }
+    *ret_rc = 0;
+    rc = is_buffer_compressed (buf, n);
 
  leave:
     iobuf_close( a );
@@ -72,6 +72,14 @@
 # include <sys/socket.h>
 # include <sys/un.h>
 #endif
+#ifdef __linux__
+# include <sys/vfs.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) \
+  || defined(__NetBSD__) || defined(__DragonFly__)
+# include <sys/param.h>
+# include <sys/mount.h>
+# define HAVE_STATFS_MNT_LOCAL 1
+#endif
 #ifdef HAVE_INOTIFY_INIT
 # include <sys/inotify.h>
 #endif /*HAVE_INOTIFY_INIT*/
@@ -527,6 +535,26 @@ gnupg_usleep (unsigned int usecs)
 }
 
 
+/* Return the number of online CPUs or 1 if that can't be
+ * determined.  */
+unsigned int
+gnupg_get_ncpus (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  SYSTEM_INFO si;
+
+  GetSystemInfo (&si);
+  return si.dwNumberOfProcessors? si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0? n : 1;
+#else
+  return 1;
+#endif
+}
+
+
 /* This function is a NOP for POSIX systems but required under Windows
    as the file handles as returned by OS calls (like CreateFile) are
    different from the libc file descriptors (like open). This function
@@ -1306,6 +1334,60 @@ gnupg_stat (const char *name, struct stat *statbuf)
 #endif /*HAVE_STAT*/
 
 
+/* Return true if the file or directory NAME is on a network file
+ * system.  SQLite's WAL mode for example does not work there because
+ * it uses shared memory for the locks.  Returns false if this can't
+ * be determined.  */
+int
+gnupg_is_network_fs (const char *name)
+{
+#ifdef HAVE_W32_SYSTEM
+  char root[4];
+
+  if ((name[0] == '\\' || name[0] == '/')
+      && (name[1] == '\\' || name[1] == '/'))
+    return 1;  /* UNC name.  */
+  if (!name[0] || name[1] != ':')
+    return 0;
+  root[0] = name[0];
+  root[1] = ':';
+  root[2] = '\\';
+  root[3] = 0;
+  return GetDriveTypeA (root) == DRIVE_REMOTE;
+#elif defined(__linux__)
+  struct statfs sfs;
+
+  if (statfs (name, &sfs))
+    return 0;
+  switch ((unsigned long)sfs.f_type & 0xffffffff)
+    {
+    case 0x6969:      /* NFS */
+    case 0x517b:      /* SMB */
+    case 0xff534d42:  /* CIFS */
+    case 0xfe534d42:  /* SMB2 */
+    case 0x5346414f:  /* AFS */
+    case 0x6b414653:  /* kAFS */
+    case 0x73757245:  /* Coda */
+    case 0x564c:      /* NCP */
+    case 0x01021997:  /* 9P */
+    case 0x00c36400:  /* Ceph */
+      return 1;
+    default:
+      return 0;
+    }
+#elif defined(HAVE_STATFS_MNT_LOCAL)
+  struct statfs sfs;
+
+  if (statfs (name, &sfs))
+    return 0;
+  return !(sfs.f_flags & MNT_LOCAL);
+#else
+  (void)name;
+  return 0;
+#endif
+}
+
+
 /* A wrapper around open to handle Unicode file names under Windows.  */
 int
 gnupg_open (const char *name, int flags, unsigned int mode)
@@ -72,6 +72,7 @@ unsigned int get_uint_nonce (void);
 /*int check_permissions (const char *path,int extension,int checkonly);*/
 void gnupg_sleep (unsigned int seconds);
 void gnupg_usleep (unsigned int usecs);
+unsigned int gnupg_get_ncpus (void);
 int translate_sys2libc_fd (gnupg_fd_t fd, int for_write);
 int translate_sys2libc_fd_int (int fd, int for_write);
 int check_special_filename (const char *fname, int for_write, int notranslate);
@@ -94,6 +95,7 @@ gpg_err_code_t gnupg_access (const char *name, int mode);
 #ifdef HAVE_STAT
 int gnupg_stat (const char *name, struct stat *statbuf);
 #endif /*HAVE_STAT*/
+int gnupg_is_network_fs (const char *name);
 int gnupg_open (const char *name, int flags, unsigned int mode);
 
 gnupg_dir_t gnupg_opendir (const char *name);
@@ -19,7 +19,9 @@
 
 /*
 
-   As of now this is only a test program for manual tests.
+   As of now this is only a test program for manual tests.  Use
+   --bench to compare the speed of b64enc and b64dec with a byte at
+   a time implementation.
 
  */
 
@@ -28,8 +30,10 @@
 #include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "util.h"
+#include "base64.h"
 
 #define pass()  do { ; } while(0)
 #define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
@@ -145,11 +149,192 @@ test_b64dec_file (const char *fname)
 
 
 
+/* The byte-at-a-time conversion used by b64enc and b64dec before they
+ * used base64.c; used as a reference for the benchmark.  */
+static size_t
+ref_encode (char *dst, const unsigned char *src, size_t length)
+{
+  static const char bintoasc[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                   "abcdefghijklmnopqrstuvwxyz"
+                                   "0123456789+/";
+  unsigned char radbuf[3];
+  int idx = 0, quad_count = 0;
+  char *d = dst;
+
+  for (; length; src++, length--)
+    {
+      radbuf[idx++] = *src;
+      if (idx > 2)
+        {
+          *d++ = bintoasc[(*radbuf >> 2) & 077];
+          *d++ = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
+          *d++ = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
+          *d++ = bintoasc[radbuf[2]&077];
+          idx = 0;
+          if (++quad_count >= (64/4))
+            {
+              quad_count = 0;
+              *d++ = '\n';
+            }
+        }
+    }
+  return d - dst;
+}
+
+
+static size_t
+ref_decode (unsigned char *dst, const char *src, size_t length)
+{
+  unsigned char *d = dst;
+  unsigned char val = 0;
+  int ds = 0;
+  int c;
+
+  for (; length; src++, length--)
+    {
+      if (*src >= 'A' && *src <= 'Z')
+        c = *src - 'A';
+      else if (*src >= 'a' && *src <= 'z')
+        c = *src - 'a' + 26;
+      else if (*src >= '0' && *src <= '9')
+        c = *src - '0' + 52;
+      else if (*src == '+')
+        c = 62;
+      else if (*src == '/')
+        c = 63;
+      else
+        continue;
+      switch (ds)
+        {
+        case 0: val = c << 2; break;
+        case 1: val |= (c>>4)&3; *d++ = val; val = (c<<4)&0xf0; break;
+        case 2: val |= (c>>2)&15; *d++ = val; val = (c<<6)&0xc0; break;
+        case 3: val |= c&0x3f; *d++ = val; break;
+        }
+      ds = (ds + 1) % 4;
+    }
+  return d - dst;
+}
+
+
+static double
+mbps (size_t nbytes, clock_t start)
+{
+  double secs = (double)(clock () - start) / CLOCKS_PER_SEC;
+
+  return secs > 0? nbytes / secs / (1024*1024) : 0;
+}
+
+
+/* Compare the speed of b64enc and b64dec with the reference for
+ * inputs of SIZE bytes.  */
+static void
+bench_one (size_t size)
+{
+  gpg_error_t err;
+  struct b64state state;
+  unsigned char *data, *back;
+  char *encoded, *work;
+  estream_t fp;
+  void *mem;
+  size_t i, n, memlen, enclen, nbytes, nrounds, total;
+  clock_t start;
+  double ref_enc, ref_dec, enc, dec;
+
+  nrounds = (64*1024*1024) / size;
+  total = nrounds * size;
+  data = xmalloc (size);
+  back = xmalloc (size);
+  encoded = xmalloc (size / 48 * 65 + 70);
+  work = xmalloc (size / 48 * 65 + 70);
+  for (i=0; i < size; i++)
+    data[i] = rand ();
+
+  start = clock ();
+  for (i=0; i < nrounds; i++)
+    enclen = ref_encode (encoded, data, size);
+  ref_enc = mbps (total, start);
+
+  start = clock ();
+  for (i=0; i < nrounds; i++)
+    {
+      memcpy (work, encoded, enclen);
+      n = ref_decode (back, work, enclen);
+    }
+  ref_dec = mbps (total, start);
+  if (n != size / 3 * 3 || memcmp (back, data, n))
+    fail (1);
+
+  mem = NULL;
+  memlen = 0;
+  start = clock ();
+  for (i=0; i < nrounds; i++)
+    {
+      xfree (mem);
+      fp = es_fopenmem (0, "w+b");
+      if (!fp)
+        {
+          fail (2);
+          goto leave;
+        }
+      err = b64enc_start_es (&state, fp, NULL);
+      if (!err)
+        err = b64enc_write (&state, data, size);
+      if (!err)
+        err = b64enc_finish (&state);
+      if (err)
+        fail (3);
+      if (es_fclose_snatch (fp, &mem, &memlen))
+        fail (4);
+    }
+  enc = mbps (total, start);
+  if (memlen < enclen || memcmp (mem, encoded, enclen))
+    fail (5);
+  xfree (mem);
+
+  start = clock ();
+  for (i=0; i < nrounds; i++)
+    {
+      memcpy (work, encoded, enclen);
+      err = b64dec_start (&state, NULL);
+      if (!err)
+        err = b64dec_proc (&state, work, enclen, &nbytes);
+      if (err)
+        fail (6);
+      b64dec_finish (&state);
+    }
+  dec = mbps (total, start);
+  if (nbytes != size / 3 * 3 || memcmp (work, data, nbytes))
+    fail (7);
+
+  printf ("%8zu bytes: encode %7.1f MiB/s (ref %7.1f)"
+          "  decode %7.1f MiB/s (ref %7.1f)\n",
+          size, enc, ref_enc, dec, ref_dec);
+
+ leave:
+  xfree (work);
+  xfree (encoded);
+  xfree (back);
+  xfree (data);
+}
+
+
+static void
+run_bench (void)
+{
+  printf ("base64 implementation: %s\n", base64_impl_name ());
+  bench_one (1024);
+  bench_one (64*1024);
+  bench_one (64*1024*1024);
+}
+
+
 int
 main (int argc, char **argv)
 {
   int do_encode = 0;
   int do_decode = 0;
+  int do_bench = 0;
 
   if (argc)
     { argc--; argv++; }
@@ -169,11 +354,18 @@ main (int argc, char **argv)
       do_decode = 1;
       argc--; argv++;
     }
+  else if (argc && !strcmp (argv[0], "--bench"))
+    {
+      do_bench = 1;
+      argc--; argv++;
+    }
 
   if (do_encode)
     test_b64enc_file (argc? *argv: NULL);
   else if (do_decode)
     test_b64dec_file (argc? *argv: NULL);
+  else if (do_bench)
+    run_bench ();
   else
     test_b64enc_pgp (argc? *argv: NULL);
 
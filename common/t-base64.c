@@ -0,0 +1,293 @@
+/* t-base64.c - Module tests for base64.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* We include base64.c so that we can compare the vectorized versions
+ * with the generic version.  */
+#include "base64.c"
+
+#define PGM "t-base64"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+static int verbose;
+static int errcount;
+
+/* The implementations supported by this CPU.  */
+struct impl_s
+{
+  const char *name;
+  void (*encode_line) (byte *dst, const byte *src);
+  size_t (*decode_quads) (byte *dst, size_t dstlen,
+                          const byte *src, size_t srclen);
+};
+static struct impl_s impls[3];
+static int nimpls;
+
+/* Characters which are not in the base-64 alphabet.  */
+static const byte invalid_chars[] = { '=', '\n', '\r', ' ', '\t', '-', '.',
+                                      '@', '[', '`', '{', ':', 0, 0x7f,
+                                      0x80, 0xab, 0xff };
+
+
+static void
+setup_impls (void)
+{
+#ifdef HAVE_X86_SIMD_INTRINSICS
+  if (__builtin_cpu_supports ("ssse3"))
+    {
+      impls[nimpls].name = "ssse3";
+      impls[nimpls].encode_line = encode_line_ssse3;
+      impls[nimpls].decode_quads = decode_blocks_ssse3;
+      nimpls++;
+    }
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      impls[nimpls].name = "avx2";
+      impls[nimpls].encode_line = encode_line_avx2;
+      impls[nimpls].decode_quads = decode_blocks_avx2;
+      nimpls++;
+    }
+#endif /*HAVE_X86_SIMD_INTRINSICS*/
+  if (verbose)
+    {
+      int i;
+
+      fprintf (stderr, PGM ": testing generic");
+      for (i=0; i < nimpls; i++)
+        fprintf (stderr, " %s", impls[i].name);
+      fprintf (stderr, " (in use: %s)\n", base64_impl_name ());
+    }
+}
+
+
+static void
+random_bytes (byte *buf, size_t len)
+{
+  while (len--)
+    *buf++ = rand ();
+}
+
+
+static void
+random_chars (byte *buf, size_t len)
+{
+  while (len--)
+    *buf++ = bintoasc[rand () % 64];
+}
+
+
+/* Compare the encoding of single lines with the generic version.  */
+static void
+test_encode_line (void)
+{
+  byte src[48], expected[64], result[64 + 16];
+  int round, i;
+
+  for (round=0; round < 1000; round++)
+    {
+      if (round < 256)
+        memset (src, round, sizeof src);
+      else
+        random_bytes (src, sizeof src);
+      encode_line_generic (expected, src);
+      for (i=0; i < nimpls; i++)
+        {
+          /* Check that no more than 64 bytes are written.  */
+          memset (result, 0xa5, sizeof result);
+          impls[i].encode_line (result, src);
+          if (memcmp (result, expected, 64))
+            fail (round);
+          if (result[64] != 0xa5 || result[64+15] != 0xa5)
+            fail (round);
+        }
+      base64_encode_line (result, src);
+      if (memcmp (result, expected, 64))
+        fail (round);
+    }
+}
+
+
+/* Decode the SRCLEN characters at SRC with DSTLEN bytes of space
+ * with all implementations and compare the result with the generic
+ * version.  TESTNO is printed on failure.  */
+static void
+check_decode (int testno, const byte *src, size_t srclen, size_t dstlen)
+{
+  byte expected[300], result[300 + 32], inplace[300 + 32];
+  size_t nexpected, n;
+  int i;
+
+  nexpected = decode_quads_generic (expected, dstlen, src, srclen);
+  if (nexpected % 4 || nexpected > srclen || nexpected / 4 * 3 > dstlen)
+    fail (testno);
+
+  for (i=0; i < nimpls; i++)
+    {
+      memset (result, 0xa5, sizeof result);
+      n = impls[i].decode_quads (result, dstlen, src, srclen);
+      if (n != nexpected)
+        {
+          if (verbose)
+            fprintf (stderr, PGM ": %s: srclen=%zu dstlen=%zu:"
+                     " got %zu, expected %zu\n",
+                     impls[i].name, srclen, dstlen, n, nexpected);
+          fail (testno);
+          continue;
+        }
+      if (memcmp (result, expected, n / 4 * 3))
+        fail (testno);
+      /* Check that nothing is written beyond DSTLEN.  */
+      if (result[dstlen] != 0xa5)
+        fail (testno);
+
+      /* The same in place.  */
+      memcpy (inplace, src, srclen);
+      n = impls[i].decode_quads (inplace, dstlen, inplace, srclen);
+      if (n != nexpected || memcmp (inplace, expected, n / 4 * 3))
+        fail (testno);
+    }
+}
+
+
+/* Compare the decoding of all lengths around the vector widths with
+ * the generic version.  */
+static void
+test_decode_lengths (void)
+{
+  byte src[300];
+  size_t srclen, dstlen;
+
+  for (srclen=0; srclen <= 260; srclen++)
+    {
+      random_chars (src, srclen);
+      check_decode (1, src, srclen, sizeof src);
+      /* Limit the output space around the needed size.  */
+      for (dstlen=0; dstlen <= srclen / 4 * 3 + 3; dstlen++)
+        check_decode (2, src, srclen, dstlen);
+    }
+}
+
+
+/* Put each invalid character at every offset and compare the result
+ * with the generic version.  */
+static void
+test_decode_invalid (void)
+{
+  byte src[300];
+  size_t srclen, off;
+  int i;
+
+  for (srclen=1; srclen <= 132; srclen++)
+    for (off=0; off < srclen; off++)
+      for (i=0; i < DIM (invalid_chars); i++)
+        {
+          random_chars (src, srclen);
+          src[off] = invalid_chars[i];
+          check_decode (3, src, srclen, sizeof src);
+        }
+}
+
+
+/* Encode random data with b64enc, decode it in place with b64dec
+ * using various chunk sizes and compare with the original.  */
+static void
+test_b64dec_inplace (void)
+{
+  gpg_error_t err;
+  struct b64state state;
+  estream_t fp;
+  void *mem;
+  size_t memlen, datalen, chunk, off, n, nbytes, total;
+  byte data[1000], *buf;
+  int round;
+
+  for (round=0; round < 200; round++)
+    {
+      datalen = round < 100? round : rand () % sizeof data;
+      random_bytes (data, datalen);
+
+      fp = es_fopenmem (0, "w+b");
+      if (!fp)
+        {
+          fail (round);
+          return;
+        }
+      err = b64enc_start_es (&state, fp, NULL);
+      if (!err)
+        err = b64enc_write (&state, data, datalen);
+      if (!err)
+        err = b64enc_finish (&state);
+      if (err)
+        fail (round);
+      if (es_fclose_snatch (fp, &mem, &memlen))
+        {
+          fail (round);
+          continue;
+        }
+      buf = mem;
+
+      chunk = 1 + rand () % 80;
+      err = b64dec_start (&state, NULL);
+      total = 0;
+      for (off=0; !err && off < memlen; off += n)
+        {
+          n = memlen - off < chunk? memlen - off : chunk;
+          err = b64dec_proc (&state, buf + off, n, &nbytes);
+          if (!err)
+            {
+              memmove (buf + total, buf + off, nbytes);
+              total += nbytes;
+            }
+        }
+      if (err)
+        fail (round);
+      if (b64dec_finish (&state))
+        fail (round);
+      if (total != datalen || memcmp (buf, data, datalen))
+        {
+          if (verbose)
+            fprintf (stderr, PGM ": datalen=%zu chunk=%zu: got %zu bytes\n",
+                     datalen, chunk, total);
+          fail (round);
+        }
+      xfree (mem);
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  srand (42);
+  setup_impls ();
+  test_encode_line ();
+  test_decode_lengths ();
+  test_decode_invalid ();
+  test_b64dec_inplace ();
+
+  return !!errcount;
+}
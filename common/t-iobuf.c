@@ -390,5 +390,211 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Check that iobuf_borrow and iobuf_consume work, honor a limit
+     and return each EOF exactly once.  */
+  {
+    char *content = "abcdefghijklmnopq";
+    char *content2 = "0123456789";
+    iobuf_t iobuf;
+    int rc;
+    const byte *p;
+    size_t len;
+    struct content_filter_state *state;
+
+    iobuf = iobuf_temp_with_content (content, strlen (content));
+    rc = iobuf_push_filter (iobuf,
+			    content_filter,
+                            state=content_filter_new (content2));
+    assert (rc == 0);
+
+    /* Borrowing does not consume anything.  */
+    p = iobuf_borrow (iobuf, 3, &len);
+    assert (p && len == 3);
+    assert (memcmp (p, "012", 3) == 0);
+    p = iobuf_borrow (iobuf, 100, &len);
+    assert (p && len == 10);
+    assert (memcmp (p, content2, 10) == 0);
+    iobuf_consume (iobuf, 4);
+    assert (iobuf_tell (iobuf) == 4);
+    assert (iobuf_get (iobuf) == '4');
+
+    /* The limit is honored.  */
+    iobuf_set_limit (iobuf, 2);
+    p = iobuf_borrow (iobuf, 100, &len);
+    assert (p && len == 2);
+    assert (memcmp (p, "56", 2) == 0);
+    iobuf_consume (iobuf, 2);
+    assert (!iobuf_borrow (iobuf, 100, &len));
+    iobuf_set_limit (iobuf, 0);
+
+    p = iobuf_borrow (iobuf, 100, &len);
+    assert (p && len == 3);
+    assert (memcmp (p, "789", 3) == 0);
+    iobuf_consume (iobuf, 3);
+
+    /* The first EOF pops the content filter.  */
+    assert (!iobuf_borrow (iobuf, 100, &len));
+    assert (len == 0);
+
+    p = iobuf_borrow (iobuf, 100, &len);
+    assert (p && len == strlen (content));
+    assert (memcmp (p, content, len) == 0);
+    iobuf_consume (iobuf, len);
+    assert (!iobuf_borrow (iobuf, 100, &len));
+
+    iobuf_close (iobuf);
+    free (state);
+  }
+
+  /* Check that buffers start small and only grow for filters which
+     stream data.  */
+  {
+    const size_t size = 1024 * 1024;
+    size_t maxsize = iobuf_set_buffer_size (0) * 1024;
+    size_t initsize;
+    char *content;
+    byte *buffer;
+    iobuf_t iobuf;
+    struct content_filter_state *state;
+    size_t i, n;
+    int rc;
+
+    content = malloc (size + 1);
+    buffer = malloc (2 * size);
+    assert (content && buffer);
+    for (i = 0; i < size; i++)
+      content[i] = 'a' + i % 26;
+    content[size] = 0;
+
+    /* A short read does not grow the buffer.  */
+    iobuf = iobuf_temp_with_content ("x", 1);
+    rc = iobuf_push_filter (iobuf, content_filter,
+                            state = content_filter_new (content + size - 300));
+    assert (rc == 0);
+    initsize = iobuf->d.size;
+    assert (initsize < maxsize);
+    assert (iobuf_read (iobuf, buffer, 300) == 300);
+    assert (memcmp (buffer, content + size - 300, 300) == 0);
+    assert (iobuf->d.size == initsize);
+    iobuf_close (iobuf);
+    free (state);
+
+    /* Streaming data grows the buffer up to the maximum.  */
+    iobuf = iobuf_temp_with_content ("x", 1);
+    rc = iobuf_push_filter (iobuf, content_filter,
+                            state = content_filter_new (content));
+    assert (rc == 0);
+    for (i = 0; i < size; i += n)
+      {
+        n = iobuf_read (iobuf, buffer + i, 1000);
+        assert (n > 0 && n <= 1000);
+        if (i >= size / 2 && i + n < size)
+          assert (iobuf->d.size == maxsize);
+      }
+    assert (i == size);
+    assert (memcmp (buffer, content, size) == 0);
+    iobuf_close (iobuf);
+    free (state);
+
+    /* Same for output pipelines.  */
+    iobuf = iobuf_temp ();
+    assert (iobuf->d.size == initsize);
+    rc = iobuf_push_filter (iobuf, double_filter, NULL);
+    assert (rc == 0);
+    assert (iobuf->d.size == initsize);
+    for (i = 0; i < size; i += 1000)
+      {
+        n = size - i < 1000 ? size - i : 1000;
+        rc = iobuf_write (iobuf, content + i, n);
+        assert (rc == 0);
+      }
+    assert (iobuf->d.size == maxsize);
+    rc = iobuf_pop_filter (iobuf, double_filter, NULL);
+    assert (rc == 0);
+    assert (iobuf_get_temp_length (iobuf) == 2 * size);
+    assert (iobuf_temp_to_buffer (iobuf, buffer, 2 * size) == 2 * size);
+    for (i = 0; i < size; i++)
+      assert (buffer[2 * i] == content[i] && buffer[2 * i + 1] == content[i]);
+    iobuf_close (iobuf);
+
+    free (buffer);
+    free (content);
+  }
+
+  /* Check reading a file which is larger than the buffer size.  Use
+     the smallest buffer size so that the data spans many buffers and
+     check that seeking and limits work at offsets which are not
+     aligned to the buffer size.  */
+  {
+    const char *fname = "t-iobuf.tmp";
+    const size_t size = 300000;
+    unsigned int bufsize;
+    byte *content, *buffer;
+    FILE *fp;
+    iobuf_t iobuf;
+    size_t i, n;
+    int c;
+
+    bufsize = iobuf_set_buffer_size (4) * 1024;
+    assert (size > 64 * bufsize);
+
+    content = malloc (size);
+    buffer = malloc (size);
+    assert (content && buffer);
+    for (i = 0; i < size; i++)
+      content[i] = (i * 7) ^ (i >> 8);
+    fp = fopen (fname, "wb");
+    assert (fp);
+    assert (fwrite (content, size, 1, fp) == 1);
+    assert (!fclose (fp));
+
+    /* Read it sequentially.  */
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    for (i = 0; i < size; i += n)
+      {
+        n = iobuf_read (iobuf, buffer + i, 1000);
+        assert (n > 0 && n <= 1000);
+      }
+    assert (i == size);
+    assert (memcmp (buffer, content, size) == 0);
+    assert (iobuf_read (iobuf, buffer, 1000) == -1);
+    iobuf_close (iobuf);
+
+    /* Seek to various offsets.  */
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    assert (iobuf_seek (iobuf, 3 * bufsize - 100) == 0);
+    assert (iobuf_read (iobuf, buffer, 200) == 200);
+    assert (memcmp (buffer, content + 3 * bufsize - 100, 200) == 0);
+    assert (iobuf_seek (iobuf, 5) == 0);
+    assert (iobuf_tell (iobuf) == 5);
+    assert (iobuf_read (iobuf, buffer, 200) == 200);
+    assert (memcmp (buffer, content + 5, 200) == 0);
+    assert (iobuf_seek (iobuf, 50 * bufsize + 1) == 0);
+    assert (iobuf_read (iobuf, buffer, 200) == 200);
+    assert (memcmp (buffer, content + 50 * bufsize + 1, 200) == 0);
+
+    /* A limit spanning a buffer boundary.  */
+    assert (iobuf_seek (iobuf, 7 * bufsize - 50) == 0);
+    iobuf_set_limit (iobuf, 100);
+    for (i = 0; (c = iobuf_get (iobuf)) != -1; i++)
+      assert (c == content[7 * bufsize - 50 + i]);
+    assert (i == 100);
+    iobuf_set_limit (iobuf, 0);
+
+    /* Read up to the end.  */
+    assert (iobuf_seek (iobuf, size - 10) == 0);
+    assert (iobuf_read (iobuf, buffer, 1000) == 10);
+    assert (memcmp (buffer, content + size - 10, 10) == 0);
+    assert (iobuf_read (iobuf, buffer, 1000) == -1);
+    iobuf_close (iobuf);
+
+    iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+    remove (fname);
+    free (buffer);
+    free (content);
+  }
+
   return 0;
 }
@@ -0,0 +1,314 @@
+/* workpool.c - An ordered pool of worker threads
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A work pool runs a work function in worker threads on a ring of
+ * slots and hands the slots back in the order they have been queued.
+ * The pool manages only the state of the slots; the data of a slot
+ * and any per-worker data (e.g. a cipher handle) are kept by the
+ * caller in arrays indexed by the slot or worker index.  The typical
+ * use is:
+ *
+ *   while (more input)
+ *     {
+ *       slot = workpool_fill (pool);
+ *       ... store the input in SLOT ...
+ *       workpool_queue (pool);
+ *       while ((slot = workpool_wait (pool, 0)) != -1)
+ *         {
+ *           ... consume the result in SLOT ...
+ *           workpool_pop (pool);
+ *         }
+ *     }
+ *   while ((slot = workpool_wait (pool, 1)) != -1)
+ *     ... consume and pop as above ...
+ *
+ * Only the workers may change the data of a slot between
+ * workpool_queue and workpool_wait.  The work function is called
+ * with the global npth lock held; it should release that lock with
+ * npth_unprotect only around work which does not touch global
+ * state.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <npth.h>
+
+#include "util.h"
+#include "workpool.h"
+
+
+/* The states of a slot.  */
+enum workpool_slot_states
+  {
+   WORKPOOL_SLOT_FREE = 0, /* Not used or being filled.      */
+   WORKPOOL_SLOT_QUEUED,   /* Waiting for a worker.          */
+   WORKPOOL_SLOT_BUSY,     /* Being processed.               */
+   WORKPOOL_SLOT_DONE      /* Processed but not yet popped.  */
+  };
+
+/* A worker thread.  */
+struct workpool_worker_s
+{
+  workpool_t pool;
+  int idx;
+  npth_t thread;
+};
+
+/* The pool.  The slots are used as a ring buffer in queuing order:
+ * the caller fills the slot at FILL and takes the slots starting at
+ * HEAD.  All fields are protected by LOCK but FILL and HEAD are only
+ * changed by the caller's thread.  */
+struct workpool_s
+{
+  workpool_fnc_t fnc;
+  void *opaque;
+  npth_mutex_t lock;
+  npth_cond_t work_cond;  /* Signaled when a slot has been queued.  */
+  npth_cond_t done_cond;  /* Signaled when a slot has been done.    */
+  int stop;               /* Request to terminate the workers.      */
+  int nworkers;
+  struct workpool_worker_s *workers;
+  int nslots;
+  enum workpool_slot_states *states;
+  int head;               /* The oldest slot not yet popped.        */
+  int fill;               /* The slot being filled.                 */
+  int next;               /* The next slot for a worker.            */
+  int npending;           /* Number of slots queued but not popped. */
+  int nqueued;            /* Number of slots waiting for a worker.  */
+};
+
+
+/* The thread function of a worker.  */
+static void *
+worker_main (void *arg)
+{
+  struct workpool_worker_s *worker = arg;
+  workpool_t pool = worker->pool;
+  int slot;
+
+  npth_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      while (!pool->nqueued && !pool->stop)
+        npth_cond_wait (&pool->work_cond, &pool->lock);
+      if (!pool->nqueued)
+        break;  /* Stop requested and nothing left to do.  */
+      slot = pool->next;
+      pool->next = (pool->next + 1) % pool->nslots;
+      pool->nqueued--;
+      pool->states[slot] = WORKPOOL_SLOT_BUSY;
+      npth_mutex_unlock (&pool->lock);
+
+      pool->fnc (pool->opaque, worker->idx, slot);
+
+      npth_mutex_lock (&pool->lock);
+      pool->states[slot] = WORKPOOL_SLOT_DONE;
+      npth_cond_broadcast (&pool->done_cond);
+    }
+  npth_mutex_unlock (&pool->lock);
+
+  return NULL;
+}
+
+
+/* Create a pool with up to NWORKERS threads named NAME which run FNC
+ * with OPAQUE on the queued slots.  If NSLOTS is 0 two slots per
+ * worker are used so that the workers don't need to wait while the
+ * caller consumes one result and prepares the next slot.  On success
+ * the new pool is stored at R_POOL; use workpool_nworkers to get the
+ * number of threads actually started and workpool_nslots for the
+ * number of slots.  An error is returned if no thread could be
+ * started.  */
+gpg_error_t
+workpool_new (workpool_t *r_pool, const char *name, int nworkers, int nslots,
+              workpool_fnc_t fnc, void *opaque)
+{
+  gpg_error_t err = 0;
+  workpool_t pool;
+  npth_attr_t tattr;
+  int i, rc;
+
+  *r_pool = NULL;
+  if (nworkers < 1)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->fnc = fnc;
+  pool->opaque = opaque;
+  pool->nslots = nslots? nslots : 2 * nworkers;
+  pool->states = xtrycalloc (pool->nslots, sizeof *pool->states);
+  pool->workers = xtrycalloc (nworkers, sizeof *pool->workers);
+  if (!pool->states || !pool->workers)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (pool->states);
+      xfree (pool->workers);
+      xfree (pool);
+      return err;
+    }
+  npth_mutex_init (&pool->lock, NULL);
+  npth_cond_init (&pool->work_cond, NULL);
+  npth_cond_init (&pool->done_cond, NULL);
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=0; i < nworkers; i++)
+    {
+      pool->workers[i].pool = pool;
+      pool->workers[i].idx = i;
+      rc = npth_create (&pool->workers[i].thread, &tattr, worker_main,
+                        pool->workers + i);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          break;
+        }
+      npth_setname_np (pool->workers[i].thread, name);
+      pool->nworkers++;
+    }
+  npth_attr_destroy (&tattr);
+
+  if (!pool->nworkers)
+    {
+      workpool_release (pool);
+      return err;
+    }
+  *r_pool = pool;
+  return 0;
+}
+
+
+/* Wait until the workers of POOL have processed all queued slots,
+ * terminate them and release POOL.  */
+void
+workpool_release (workpool_t pool)
+{
+  int i;
+
+  if (!pool)
+    return;
+
+  npth_mutex_lock (&pool->lock);
+  pool->stop = 1;
+  npth_cond_broadcast (&pool->work_cond);
+  npth_mutex_unlock (&pool->lock);
+  for (i=0; i < pool->nworkers; i++)
+    npth_join (pool->workers[i].thread, NULL);
+
+  npth_cond_destroy (&pool->done_cond);
+  npth_cond_destroy (&pool->work_cond);
+  npth_mutex_destroy (&pool->lock);
+  xfree (pool->workers);
+  xfree (pool->states);
+  xfree (pool);
+}
+
+
+/* Return the number of worker threads of POOL.  */
+int
+workpool_nworkers (workpool_t pool)
+{
+  return pool->nworkers;
+}
+
+
+/* Return the number of slots of POOL.  */
+int
+workpool_nslots (workpool_t pool)
+{
+  return pool->nslots;
+}
+
+
+/* Return the number of slots queued but not yet popped.  If this is
+ * equal to the number of slots no slot can be filled.  */
+int
+workpool_npending (workpool_t pool)
+{
+  return pool->npending;
+}
+
+
+/* Return the index of the slot to be filled next.  */
+int
+workpool_fill (workpool_t pool)
+{
+  return pool->fill;
+}
+
+
+/* Queue the slot returned by workpool_fill for the workers.  The
+ * caller must not touch the slot data until workpool_wait returns
+ * the slot.  */
+void
+workpool_queue (workpool_t pool)
+{
+  log_assert (pool->npending < pool->nslots);
+  log_assert (pool->states[pool->fill] == WORKPOOL_SLOT_FREE);
+
+  npth_mutex_lock (&pool->lock);
+  pool->states[pool->fill] = WORKPOOL_SLOT_QUEUED;
+  pool->fill = (pool->fill + 1) % pool->nslots;
+  pool->npending++;
+  pool->nqueued++;
+  npth_cond_signal (&pool->work_cond);
+  npth_mutex_unlock (&pool->lock);
+}
+
+
+/* Return the index of the oldest queued slot once it has been
+ * processed.  If ALL is set this waits until the slot is done; else
+ * it waits only if there is no free slot.  Returns -1 if no slot is
+ * pending or, without ALL, if the oldest slot is not yet done.  The
+ * slot stays valid until workpool_pop is called.  */
+int
+workpool_wait (workpool_t pool, int all)
+{
+  int slot;
+
+  if (!pool->npending)
+    return -1;
+
+  slot = pool->head;
+  npth_mutex_lock (&pool->lock);
+  while (pool->states[slot] != WORKPOOL_SLOT_DONE
+         && (all || pool->npending == pool->nslots))
+    npth_cond_wait (&pool->done_cond, &pool->lock);
+  if (pool->states[slot] != WORKPOOL_SLOT_DONE)
+    slot = -1;
+  npth_mutex_unlock (&pool->lock);
+
+  return slot;
+}
+
+
+/* Release the slot returned by workpool_wait so that it can be
+ * filled again.  */
+void
+workpool_pop (workpool_t pool)
+{
+  npth_mutex_lock (&pool->lock);
+  log_assert (pool->states[pool->head] == WORKPOOL_SLOT_DONE);
+  pool->states[pool->head] = WORKPOOL_SLOT_FREE;
+  pool->head = (pool->head + 1) % pool->nslots;
+  pool->npending--;
+  npth_mutex_unlock (&pool->lock);
+}
@@ -0,0 +1,45 @@
+/* workpool.h - An ordered pool of worker threads
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_COMMON_WORKPOOL_H
+#define GNUPG_COMMON_WORKPOOL_H
+
+#include <gpg-error.h>
+
+struct workpool_s;
+typedef struct workpool_s *workpool_t;
+
+/* The function run by the worker with index WORKER on the slot with
+ * index SLOT.  OPAQUE is the value passed to workpool_new.  */
+typedef void (*workpool_fnc_t) (void *opaque, int worker, int slot);
+
+gpg_error_t workpool_new (workpool_t *r_pool, const char *name,
+                          int nworkers, int nslots,
+                          workpool_fnc_t fnc, void *opaque);
+void workpool_release (workpool_t pool);
+int workpool_nworkers (workpool_t pool);
+int workpool_nslots (workpool_t pool);
+int workpool_npending (workpool_t pool);
+int workpool_fill (workpool_t pool);
+void workpool_queue (workpool_t pool);
+int workpool_wait (workpool_t pool, int all);
+void workpool_pop (workpool_t pool);
+
+#endif /*GNUPG_COMMON_WORKPOOL_H*/
@@ -77,6 +77,40 @@ struct keyboxd_local_s
 /* Flag indicating that for example bulk import is enabled.  */
 static unsigned int in_transaction;
 
+/* The maximum number of keyblocks and bytes we queue for one
+ * STORE --multi.  */
+#define PENDING_STORE_MAX_BLOBS 256
+#define PENDING_STORE_MAX_BYTES (8 * 1024 * 1024)
+
+/* The fingerprints and keyids of a queued keyblock.  The first key
+ * of a keyblock is its primary key.  */
+struct pending_key_s
+{
+  unsigned int blobidx;   /* The index of the keyblock in the queue.  */
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 kid[2];
+};
+
+/* During a bulk import the inserted keyblocks are queued here and
+ * sent with one STORE --multi.  The keys of the queued keyblocks are
+ * kept so that a search which might find them can flush the queue
+ * first.  */
+static struct
+{
+  membuf_t data;          /* The length prefixed keyblocks.  */
+  size_t datalen;         /* The bytes in DATA.  */
+  unsigned int nblobs;    /* The number of keyblocks in DATA.  */
+  struct pending_key_s *keys;
+  unsigned int nkeys;
+  unsigned int keyssize;
+  keydb_insert_error_cb_t error_cb;  /* Called for a keyblock which */
+  void *error_cb_arg;                /* could not be stored.        */
+} pending_store;
+
+
+static gpg_error_t flush_pending_store (assuan_context_t ctx);
+
 
 
 
@@ -96,6 +130,15 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
         {
           kbx_client_data_release (kbl->kcd);
           kbl->kcd = NULL;
+          if (kbl->ctx && pending_store.nblobs)
+            {
+              /* Errors for the single keys have already been
+               * reported.  */
+              flush_pending_store (kbl->ctx);
+            }
+          xfree (pending_store.keys);
+          pending_store.keys = NULL;
+          pending_store.keyssize = 0;
           if (kbl->ctx && in_transaction)
             {
               /* This is our hack to commit the changes done during a
@@ -402,7 +445,8 @@ store_inq_cb (void *opaque, const char *line)
   struct store_parm_s *parm = opaque;
   gpg_error_t err = 0;
 
-  if (has_leading_keyword (line, "BLOB"))
+  if (has_leading_keyword (line, "BLOB")
+      || has_leading_keyword (line, "BLOBS"))
     {
       if (parm->data)
         err = assuan_send_data (parm->ctx, parm->data, parm->datalen);
@@ -414,6 +458,216 @@ store_inq_cb (void *opaque, const char *line)
 }
 
 
+/* Report that the queued keyblock with index BLOBIDX could not be
+ * stored due to ERR.  */
+static void
+report_pending_store_error (unsigned int blobidx, gpg_error_t err)
+{
+  struct pending_key_s *key;
+  unsigned int n;
+
+  for (n=0, key = pending_store.keys; n < pending_store.nkeys; n++, key++)
+    if (key->blobidx == blobidx)
+      break;
+  if (n == pending_store.nkeys)
+    {
+      log_error ("error storing keyblock %u: %s\n",
+                 blobidx, gpg_strerror (err));
+      return;
+    }
+
+  if (pending_store.error_cb)
+    pending_store.error_cb (pending_store.error_cb_arg,
+                            key->fpr, key->fprlen, key->kid, err);
+  else
+    log_error ("key %s: error storing keyblock: %s\n",
+               keystr (key->kid), gpg_strerror (err));
+}
+
+
+/* Status callback for STORE --multi.  */
+static gpg_error_t
+store_status_cb (void *opaque, const char *line)
+{
+  unsigned int *nreported = opaque;
+  const char *s;
+  char *endp;
+  unsigned long blobidx;
+
+  if ((s = has_leading_keyword (line, "STORE_ERROR")))
+    {
+      blobidx = strtoul (s, &endp, 10);
+      report_pending_store_error (blobidx, strtoul (endp, NULL, 10));
+      (*nreported)++;
+    }
+
+  return 0;
+}
+
+
+/* Send the keyblocks queued by keydb_insert_keyblock using CTX.  The
+ * keyblocks which could not be stored are reported using the
+ * callback set by keydb_set_insert_error_cb; the return value
+ * indicates only an error of the whole operation.  */
+static gpg_error_t
+flush_pending_store (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  struct store_parm_s parm = {NULL};
+  void *data;
+  unsigned int idx, nblobs, nreported = 0;
+
+  if (!pending_store.nblobs)
+    return 0;
+
+  if (DBG_CLOCK)
+    log_clock ("%s: storing %u keyblocks", __func__, pending_store.nblobs);
+
+  nblobs = pending_store.nblobs;
+  data = get_membuf (&pending_store.data, &parm.datalen);
+  pending_store.datalen = 0;
+  pending_store.nblobs = 0;
+  if (!data)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      parm.ctx = ctx;
+      parm.data = data;
+      err = assuan_transact (ctx, "STORE --insert --multi",
+                             NULL, NULL,
+                             store_inq_cb, &parm,
+                             store_status_cb, &nreported);
+      xfree (data);
+    }
+  if (err && !nreported)
+    {
+      /* Nothing has been stored.  */
+      for (idx=0; idx < nblobs; idx++)
+        report_pending_store_error (idx, err);
+    }
+  pending_store.nkeys = 0;
+  return err;
+}
+
+
+/* Set the callback CB which is called with CB_ARG for each keyblock
+ * queued during a bulk import which could not be stored.  Without a
+ * callback an error message is printed.  */
+void
+keydb_set_insert_error_cb (keydb_insert_error_cb_t cb, void *cb_arg)
+{
+  pending_store.error_cb = cb;
+  pending_store.error_cb_arg = cb_arg;
+}
+
+
+/* Store the keyblocks queued during a bulk import.  Errors storing
+ * single keyblocks are reported to the callback set by
+ * keydb_set_insert_error_cb.  */
+gpg_error_t
+keydb_flush_inserts (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  keyboxd_local_t kbl;
+
+  if (!pending_store.nblobs)
+    return 0;
+
+  err = open_context (ctrl, &kbl);
+  if (err)
+    return err;
+  err = flush_pending_store (kbl->ctx);
+  kbl->is_active = 0;
+  return err;
+}
+
+
+/* Queue the keyblock image (DATA,DATALEN) of KB for a later
+ * STORE --multi.  */
+static gpg_error_t
+queue_pending_store (kbnode_t kb, const void *data, size_t datalen)
+{
+  struct pending_key_s *key;
+  unsigned char lenbuf[4];
+  kbnode_t node;
+  unsigned int nkeys = pending_store.nkeys;
+
+  for (node = kb; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+
+      if (pending_store.nkeys == pending_store.keyssize)
+        {
+          unsigned int n = pending_store.keyssize + 256;
+
+          key = xtryreallocarray (pending_store.keys, pending_store.keyssize,
+                                  n, sizeof *key);
+          if (!key)
+            {
+              pending_store.nkeys = nkeys;
+              return gpg_error_from_syserror ();
+            }
+          pending_store.keys = key;
+          pending_store.keyssize = n;
+        }
+      key = pending_store.keys + pending_store.nkeys++;
+      key->blobidx = pending_store.nblobs;
+      fingerprint_from_pk (node->pkt->pkt.public_key, key->fpr, &key->fprlen);
+      keyid_from_pk (node->pkt->pkt.public_key, key->kid);
+    }
+
+  if (!pending_store.nblobs)
+    init_membuf (&pending_store.data, 64 * 1024);
+  ulongtobuf (lenbuf, datalen);
+  put_membuf (&pending_store.data, lenbuf, 4);
+  put_membuf (&pending_store.data, data, datalen);
+  pending_store.datalen += 4 + datalen;
+  pending_store.nblobs++;
+  return 0;
+}
+
+
+/* Return true if a search for (DESC,NDESC) might find one of the
+ * queued keyblocks.  */
+static int
+pending_store_matches (KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  struct pending_key_s *key;
+  unsigned int n;
+
+  for (; ndesc; desc++, ndesc--)
+    {
+      switch (desc->mode)
+        {
+        case KEYDB_SEARCH_MODE_FPR:
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+          break;
+        default:
+          return 1;  /* Can't tell.  */
+        }
+
+      for (n=0, key = pending_store.keys; n < pending_store.nkeys; n++, key++)
+        {
+          if (desc->mode == KEYDB_SEARCH_MODE_FPR)
+            {
+              if (desc->fprlen == key->fprlen
+                  && !memcmp (desc->u.fpr, key->fpr, key->fprlen))
+                return 1;
+            }
+          else if (desc->u.kid[1] == key->kid[1]
+                   && (desc->mode == KEYDB_SEARCH_MODE_SHORT_KID
+                       || desc->u.kid[0] == key->kid[0]))
+            return 1;
+        }
+    }
+
+  return 0;
+}
+
+
 /* Update the keyblock KB (i.e., extract the fingerprint and find the
  * corresponding keyblock in the keyring).
  *
@@ -442,6 +696,8 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  getkey_flush_keyblock_cache ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_update_keyblock (ctrl, hd, kb);
@@ -493,6 +749,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  getkey_flush_keyblock_cache ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_insert_keyblock (hd, kb);
@@ -512,6 +770,21 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   parm.ctx = hd->kbl->ctx;
   parm.data = iobuf_get_temp_buffer (iobuf);
   parm.datalen = iobuf_get_temp_length (iobuf);
+
+  /* During a bulk import we collect the keyblocks to save a round
+   * trip per key.  The queue is flushed before this keyblock is
+   * added so that an error returned here belongs to this keyblock;
+   * errors for the queued keyblocks are reported separately.  */
+  if (in_transaction)
+    {
+      if (pending_store.nblobs >= PENDING_STORE_MAX_BLOBS
+          || pending_store.datalen >= PENDING_STORE_MAX_BYTES)
+        err = flush_pending_store (hd->kbl->ctx);
+      if (!err)
+        err = queue_pending_store (kb, parm.data, parm.datalen);
+      goto leave;
+    }
+
   err = assuan_transact (hd->kbl->ctx, "STORE --insert",
                          NULL, NULL,
                          store_inq_cb, &parm,
@@ -538,6 +811,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  getkey_flush_keyblock_cache ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_delete_keyblock (hd);
@@ -556,6 +831,10 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       goto leave;
     }
 
+  err = flush_pending_store (hd->kbl->ctx);
+  if (err)
+    goto leave;
+
   bin2hex (hd->last_ubid, UBID_LEN, hexubid);
   snprintf (line, sizeof line, "DELETE %s", hexubid);
   err = assuan_transact (hd->kbl->ctx, line,
@@ -714,6 +993,16 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       hd->kbl->search_result = NULL;
     }
 
+  /* Make sure that queued keyblocks are found.  */
+  if (pending_store.nblobs
+      && (!hd->kbl->need_search_reset
+          || pending_store_matches (desc, ndesc)))
+    {
+      err = flush_pending_store (hd->kbl->ctx);
+      if (err)
+        goto leave;
+    }
+
   /* Check whether this is a NEXT search.  */
   if (!hd->kbl->need_search_reset)
     {
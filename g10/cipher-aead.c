@@ -23,11 +23,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/status.h"
 #include "../common/iobuf.h"
 #include "../common/util.h"
+#include "../common/workpool.h"
 #include "filter.h"
 #include "packet.h"
 #include "options.h"
@@ -38,6 +40,39 @@
  * be a multiple of the OCB blocksize (16 byte).  */
 #define AEAD_ENC_BUFFER_SIZE (64*1024)
 
+/* Chunks are encrypted by worker threads only if the chunk size is
+ * in this range.  Each slot of the parallel mode holds a complete
+ * chunk and thus the upper limit bounds the memory used.  */
+#define AEAD_MIN_PARALLEL_CHUNKSIZE AEAD_ENC_BUFFER_SIZE
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (4*1024*1024)
+
+
+/* A slot holding one chunk in the parallel mode.  */
+struct aead_slot_s
+{
+  uint64_t chunkindex;  /* The index of the chunk.            */
+  byte *buffer;         /* CHUNKSIZE bytes for the data.      */
+  size_t buflen;        /* Used length of BUFFER.             */
+  byte tag[16];         /* The authentication tag.            */
+  gpg_error_t err;      /* The error returned by the worker.  */
+};
+
+/* The state of the parallel mode.  The chunks are encrypted by a
+ * work pool: the main thread fills the slots in chunk order and
+ * writes the encrypted slots in the same order so that the output is
+ * the same as with the serial mode.  Each worker uses its own cipher
+ * handle.  */
+struct aead_parallel_s
+{
+  cipher_filter_context_t *cfx;
+  workpool_t pool;
+  int nhds;
+  gcry_cipher_hd_t *cipher_hds;  /* One cipher handle per worker.  */
+  int nslots;
+  struct aead_slot_s *slots;
+  gpg_error_t err;  /* The first error; nothing is queued after it.  */
+};
+
 
 /* Wrapper around iobuf_write to make sure that a proper error code is
  * always returned.  */
@@ -55,12 +90,13 @@ my_iobuf_write (iobuf_t a, const void *buffer, size_t buflen)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  If
- * FINAL is set the final AEAD chunk is processed.  This also reset
- * the encryption machinery so that the handle can be used for a new
- * chunk.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX
+ * into the cipher handle HD.  If FINAL is set the final AEAD chunk is
+ * processed.  This also reset the encryption machinery so that the
+ * handle can be used for a new chunk.  */
 static gpg_error_t
-set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
+set_nonce_and_ad (cipher_filter_context_t *cfx, gcry_cipher_hd_t hd,
+                  uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char nonce[16];
@@ -83,18 +119,18 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
       BUG ();
     }
 
-  nonce[i++] ^= cfx->chunkindex >> 56;
-  nonce[i++] ^= cfx->chunkindex >> 48;
-  nonce[i++] ^= cfx->chunkindex >> 40;
-  nonce[i++] ^= cfx->chunkindex >> 32;
-  nonce[i++] ^= cfx->chunkindex >> 24;
-  nonce[i++] ^= cfx->chunkindex >> 16;
-  nonce[i++] ^= cfx->chunkindex >>  8;
-  nonce[i++] ^= cfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, 15, "nonce:");
-  err = gcry_cipher_setiv (cfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -103,14 +139,14 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
   ad[2] = cfx->dek->algo;
   ad[3] = cfx->dek->use_aead;
   ad[4] = cfx->chunkbyte;
-  ad[5] = cfx->chunkindex >> 56;
-  ad[6] = cfx->chunkindex >> 48;
-  ad[7] = cfx->chunkindex >> 40;
-  ad[8] = cfx->chunkindex >> 32;
-  ad[9] = cfx->chunkindex >> 24;
-  ad[10]= cfx->chunkindex >> 16;
-  ad[11]= cfx->chunkindex >>  8;
-  ad[12]= cfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = cfx->total >> 56;
@@ -124,7 +160,239 @@ set_nonce_and_ad (cipher_filter_context_t *cfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (cfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
+}
+
+
+/* The work function of the parallel mode.  It encrypts the chunk in
+ * slot SLOTIDX using the cipher handle of WORKER.  */
+static void
+aead_work (void *opaque, int worker, int slotidx)
+{
+  struct aead_parallel_s *par = opaque;
+  struct aead_slot_s *slot = par->slots + slotidx;
+  gcry_cipher_hd_t hd = par->cipher_hds[worker];
+  gpg_error_t err;
+
+  err = set_nonce_and_ad (par->cfx, hd, slot->chunkindex, 0);
+  if (!err)
+    {
+      /* Release the global lock for the actual work.  */
+      npth_unprotect ();
+      gcry_cipher_final (hd);
+      err = gcry_cipher_encrypt (hd, slot->buffer, slot->buflen, NULL, 0);
+      if (!err)
+        err = gcry_cipher_gettag (hd, slot->tag, 16);
+      npth_protect ();
+    }
+  slot->err = err;
+}
+
+
+/* Terminate the worker threads of CFX and release the parallel
+ * mode.  This is a NOP if the parallel mode is not used.  */
+static void
+stop_parallel (cipher_filter_context_t *cfx)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  int i;
+
+  if (!par)
+    return;
+  cfx->parallel = NULL;
+
+  workpool_release (par->pool);
+  for (i=0; i < par->nhds; i++)
+    gcry_cipher_close (par->cipher_hds[i]);
+  /* The slots may still hold plaintext; wipe them.  */
+  if (par->slots)
+    for (i=0; i < par->nslots; i++)
+      if (par->slots[i].buffer)
+        {
+          wipememory (par->slots[i].buffer, cfx->chunksize);
+          xfree (par->slots[i].buffer);
+        }
+  xfree (par->cipher_hds);
+  xfree (par->slots);
+  xfree (par);
+}
+
+
+/* Start worker threads to encrypt the chunks in parallel if this has
+ * been requested and the chunk size is suitable.  CIPHERMODE is the
+ * mode for the cipher handles of the workers.  If something goes
+ * wrong we silently stay with the serial mode.  */
+static void
+start_parallel (cipher_filter_context_t *cfx,
+                enum gcry_cipher_modes ciphermode)
+{
+  struct aead_parallel_s *par;
+  gcry_cipher_hd_t hd;
+  gpg_error_t err;
+  int i;
+
+  if (opt.jobs < 2
+      || cfx->chunksize < AEAD_MIN_PARALLEL_CHUNKSIZE
+      || cfx->chunksize > AEAD_MAX_PARALLEL_CHUNKSIZE)
+    return;
+
+  par = xtrycalloc (1, sizeof *par);
+  if (!par)
+    return;
+  par->cfx = cfx;
+  cfx->parallel = par;
+
+  par->cipher_hds = xtrycalloc (opt.jobs, sizeof *par->cipher_hds);
+  if (!par->cipher_hds)
+    goto leave;
+  for (i=0; i < opt.jobs; i++)
+    {
+      err = openpgp_cipher_open (&hd, cfx->dek->algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (!err)
+        {
+          err = gcry_cipher_setkey (hd, cfx->dek->key, cfx->dek->keylen);
+          if (err)
+            gcry_cipher_close (hd);
+        }
+      if (err)
+        {
+          if (DBG_FILTER)
+            log_debug ("error setting up AEAD worker %d: %s\n",
+                       i, gpg_strerror (err));
+          break;
+        }
+      par->cipher_hds[par->nhds++] = hd;
+    }
+  if (!par->nhds)
+    goto leave;
+
+  err = workpool_new (&par->pool, "aead-worker", par->nhds, 0,
+                      aead_work, par);
+  if (err)
+    {
+      if (DBG_FILTER)
+        log_debug ("error starting AEAD workers: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+  par->nslots = workpool_nslots (par->pool);
+  par->slots = xtrycalloc (par->nslots, sizeof *par->slots);
+  if (!par->slots)
+    goto leave;
+  for (i=0; i < par->nslots; i++)
+    if (!(par->slots[i].buffer = xtrymalloc (cfx->chunksize)))
+      goto leave;
+
+  if (DBG_FILTER)
+    log_debug ("using %d threads for AEAD encryption\n",
+               workpool_nworkers (par->pool));
+  return;
+
+ leave:
+  stop_parallel (cfx);
+}
+
+
+/* Queue the slot being filled for encryption and advance to the next
+ * slot.  */
+static void
+parallel_queue (cipher_filter_context_t *cfx)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  struct aead_slot_s *slot = par->slots + workpool_fill (par->pool);
+
+  if (DBG_FILTER)
+    log_debug ("queuing chunk %ju (%zu bytes)\n",
+               (uintmax_t)cfx->chunkindex, slot->buflen);
+
+  slot->chunkindex = cfx->chunkindex++;
+  slot->err = 0;
+  cfx->total += slot->buflen;
+  workpool_queue (par->pool);
+}
+
+
+/* Write the encrypted slots in chunk order to stream A.  If ALL is
+ * set wait until all queued slots have been written; else wait only
+ * as long as there is no free slot.  */
+static gpg_error_t
+parallel_write (cipher_filter_context_t *cfx, iobuf_t a, int all)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  struct aead_slot_s *slot;
+  gpg_error_t err = 0;
+  int slotidx;
+
+  if (par->err)
+    return par->err;
+
+  while ((slotidx = workpool_wait (par->pool, all)) != -1)
+    {
+      slot = par->slots + slotidx;
+      err = slot->err;
+      if (err)
+        {
+          log_error ("encrypting chunk %ju failed: %s\n",
+                     (uintmax_t)slot->chunkindex, gpg_strerror (err));
+          break;
+        }
+      if (DBG_FILTER)
+        log_debug ("writing chunk %ju (%zu bytes)\n",
+                   (uintmax_t)slot->chunkindex, slot->buflen);
+      err = my_iobuf_write (a, slot->buffer, slot->buflen);
+      if (!err)
+        err = my_iobuf_write (a, slot->tag, 16);
+      if (err)
+        break;
+
+      slot->buflen = 0;
+      workpool_pop (par->pool);
+    }
+
+  /* The failed slot is not popped and thus the ring may be full;
+   * remember the error so that we don't queue anything else.  */
+  par->err = err;
+  return err;
+}
+
+
+/* The parallel mode version of do_flush.  */
+static gpg_error_t
+do_flush_parallel (cipher_filter_context_t *cfx, iobuf_t a,
+                   byte *buf, size_t size)
+{
+  struct aead_parallel_s *par = cfx->parallel;
+  struct aead_slot_s *slot;
+  gpg_error_t err;
+  size_t n;
+
+  if (par->err)
+    return par->err;
+
+  while (size)
+    {
+      slot = par->slots + workpool_fill (par->pool);
+      n = cfx->chunksize - slot->buflen;
+      if (n > size)
+        n = size;
+      /* Let the workers report their results while we copy.  */
+      npth_unprotect ();
+      memcpy (slot->buffer + slot->buflen, buf, n);
+      npth_protect ();
+      slot->buflen += n;
+      buf  += n;
+      size -= n;
+
+      if (slot->buflen == cfx->chunksize)
+        {
+          parallel_queue (cfx);
+          err = parallel_write (cfx, a, 0);
+          if (err)
+            return err;
+        }
+    }
+
+  return 0;
 }
 
 
@@ -200,6 +468,8 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   if (err)
     return err;
 
+  start_parallel (cfx, ciphermode);
+
   cfx->wrote_header = 1;
 
  leave:
@@ -235,7 +505,7 @@ write_final_chunk (cipher_filter_context_t *cfx, iobuf_t a)
   gpg_error_t err;
   char dummy[1];
 
-  err = set_nonce_and_ad (cfx, 1);
+  err = set_nonce_and_ad (cfx, cfx->cipher_hd, cfx->chunkindex, 1);
   if (err)
     goto leave;
 
@@ -261,6 +531,9 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
   int finalize = 0;
   size_t n;
 
+  if (cfx->parallel)
+    return do_flush_parallel (cfx, a, buf, size);
+
   /* Put the data into a buffer, flush and encrypt as needed.  */
   if (DBG_FILTER)
     log_debug ("flushing %zu bytes (cur buflen=%zu)\n", size, cfx->buflen);
@@ -298,7 +571,8 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
             {
               if (DBG_FILTER)
                 log_debug ("start encrypting a new chunk\n");
-              err = set_nonce_and_ad (cfx, 0);
+              err = set_nonce_and_ad (cfx, cfx->cipher_hd,
+                                      cfx->chunkindex, 0);
               if (err)
                 goto leave;
             }
@@ -362,6 +636,22 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   if (DBG_FILTER)
     log_debug ("do_free: buflen=%zu\n", cfx->buflen);
 
+  if (cfx->parallel)
+    {
+      /* Queue the last chunk and write all pending chunks unless an
+       * error has already been seen.  */
+      err = cfx->parallel->err;
+      if (!err)
+        {
+          if (cfx->parallel->slots[workpool_fill (cfx->parallel->pool)].buflen)
+            parallel_queue (cfx);
+          err = parallel_write (cfx, a, 1);
+        }
+      stop_parallel (cfx);
+      if (err)
+        goto leave;
+    }
+
   if (cfx->buflen)
     {
       if (DBG_FILTER)
@@ -371,7 +661,7 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
         {
           if (DBG_FILTER)
             log_debug ("start encrypting a new chunk\n");
-          err = set_nonce_and_ad (cfx, 0);
+          err = set_nonce_and_ad (cfx, cfx->cipher_hd, cfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -405,6 +695,7 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   err = write_final_chunk (cfx, a);
 
  leave:
+  stop_parallel (cfx);
   xfree (cfx->buffer);
   cfx->buffer = NULL;
   gcry_cipher_close (cfx->cipher_hd);
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <npth.h>
 #ifdef HAVE_ZIP
 # include <zlib.h>
 # if defined(__riscos__) && defined(USE_ZLIBRISCOS)
@@ -39,10 +40,12 @@
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/workpool.h"
 #include "packet.h"
 #include "filter.h"
 #include "main.h"
 #include "options.h"
+#include "../common/i18n.h"
 
 
 #ifdef __riscos__
@@ -57,6 +60,177 @@ int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
 
 #ifdef HAVE_ZIP
+
+/* In the parallel mode the plaintext is split into blocks of this
+ * size which are compressed independently by the worker threads.  */
+#define ZIP_PARALLEL_BLOCKSIZE (128*1024)
+
+/* The compressor for a block is primed with up to this many bytes of
+ * the preceding block so that the compression ratio is about the same
+ * as with the serial mode.  This is the largest deflate window.  */
+#define ZIP_PARALLEL_DICTSIZE (32*1024)
+
+
+/* A slot holding one block in the parallel mode.  */
+struct zip_slot_s
+{
+  int final;            /* This is the last block.               */
+  byte *inbuf;          /* ZIP_PARALLEL_BLOCKSIZE bytes of input. */
+  size_t inlen;         /* Used length of INBUF.                  */
+  byte *dict;           /* ZIP_PARALLEL_DICTSIZE bytes.           */
+  size_t dictlen;       /* Used length of DICT.                   */
+  byte *outbuf;         /* The compressed data.                   */
+  size_t outbufsize;    /* Allocated length of OUTBUF.            */
+  size_t outlen;        /* Used length of OUTBUF.                 */
+  uLong adler;          /* The Adler-32 checksum of INBUF.        */
+  int zrc;              /* The zlib error returned by the worker. */
+};
+
+/* The state of the parallel mode.  Each block is compressed as a raw
+ * deflate stream which ends with a sync flush so that the blocks can
+ * simply be concatenated; only the last block is finished.  For ZLIB
+ * we write the header and the trailer ourselves.  The blocks are
+ * compressed by a work pool and written in block order the same way
+ * as in cipher-aead.c.  Each worker uses its own z_stream.  */
+struct zip_parallel_s
+{
+  compress_filter_context_t *zfx;
+  workpool_t pool;
+  int level;              /* The compression level.                 */
+  int nzs;
+  z_stream *zs;           /* One z_stream per worker.               */
+  int nslots;
+  struct zip_slot_s *slots;
+  int any_queued;         /* At least one block has been queued.    */
+  uLong adler;            /* The Adler-32 checksum of the input.    */
+  int rc;                 /* The first error; nothing is queued
+                           * after it.                              */
+};
+
+
+/* Before the compression starts this many bytes are collected to
+ * check whether the data is compressible at all.  */
+#define COMPRESS_PROBE_SIZE (64*1024)
+
+/* Messages shorter than this are always compressed because the probe
+ * would not be meaningful and compressing them is cheap anyway.  */
+#define COMPRESS_PROBE_MINSIZE 4096
+
+/* Data with an order-0 entropy of at least this many 1/100 bits per
+ * byte is not compressed.  Compressed and encrypted data is well
+ * above this; even binary executables are usually below 7 bits.  */
+#define COMPRESS_PROBE_ENTROPY 780
+
+
+/* Return log2(X) as a fixed point value with 16 fractional bits.  */
+static uint64_t
+log2_fixed (u32 x)
+{
+  uint64_t result, m;
+  int n, i;
+
+  if (!x)
+    return 0;
+  for (n = 0; (x >> n) > 1; n++)
+    ;
+  result = (uint64_t)n << 16;
+  /* M is X/2^N in [1,2) with 31 fractional bits.  */
+  m = ((uint64_t)x << 31) >> n;
+  for (i = 15; i >= 0; i--)
+    {
+      m = (m * m) >> 31;
+      if (m >= ((uint64_t)2 << 31))
+        {
+          m >>= 1;
+          result |= (uint64_t)1 << i;
+        }
+    }
+  return result;
+}
+
+
+/* Return the offset of the literal data if BUF of length LEN starts
+ * with the header of a literal data packet; return 0 otherwise.  */
+static size_t
+literal_data_offset (const byte *buf, size_t len)
+{
+  size_t off = 1;
+  int ctb, pkttype, c;
+
+  if (len < 2 || !(buf[0] & 0x80))
+    return 0;
+  ctb = buf[0];
+  if ((ctb & 0x40))
+    {
+      pkttype = ctb & 0x3f;
+      c = buf[off++];
+      if (c >= 192 && c < 224)
+        off++;
+      else if (c == 255)
+        off += 4;
+    }
+  else
+    {
+      pkttype = (ctb >> 2) & 0xf;
+      off += ((ctb & 3) == 3)? 0 : (1 << (ctb & 3));
+    }
+  if (pkttype != PKT_PLAINTEXT || off + 2 > len)
+    return 0;
+  /* Skip the format octet, the file name, and the timestamp.  */
+  off += 2 + buf[off+1] + 4;
+  return off < len? off : 0;
+}
+
+
+/* Return true if the LENGTH bytes at BUFFER look like data which
+ * can't be compressed any further.  This is the case for data in a
+ * known compressed format and for data with a high entropy.  */
+static int
+is_incompressible (const byte *buffer, size_t length)
+{
+  u32 counts[256];
+  uint64_t sum;
+  size_t off, i;
+
+  if (length < COMPRESS_PROBE_MINSIZE)
+    return 0;
+
+  off = literal_data_offset (buffer, length);
+  if (off && is_buffer_compressed (buffer + off, length - off))
+    return 1;
+
+  memset (counts, 0, sizeof counts);
+  for (i = 0; i < length; i++)
+    counts[buffer[i]]++;
+
+  /* The entropy in bits of all bytes is
+   *   length*log2(length) - sum(counts[i]*log2(counts[i]))  */
+  sum = length * log2_fixed (length);
+  for (i = 0; i < 256; i++)
+    if (counts[i])
+      sum -= counts[i] * log2_fixed (counts[i]);
+  if (DBG_FILTER)
+    log_debug ("compress probe: %zu bytes, entropy=%u/100 bits per byte\n",
+               length, (unsigned int)(sum * 100 / length >> 16));
+
+  return sum * 100 >= ((uint64_t)length * COMPRESS_PROBE_ENTROPY << 16);
+}
+
+
+/* Return the zlib compression level to use.  */
+static int
+get_compress_level (void)
+{
+    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
+	return opt.compress_level;
+    else if( opt.compress_level == -1 )
+	return Z_DEFAULT_COMPRESSION;
+
+    log_error("invalid compression level; using default level\n");
+    return Z_DEFAULT_COMPRESSION;
+}
+
+
 static void
 init_compress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -70,14 +244,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
         zlib_initialized = riscos_load_module("ZLib", zlib_path, 1);
 #endif
 
-    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
-	level = opt.compress_level;
-    else if( opt.compress_level == -1 )
-	level = Z_DEFAULT_COMPRESSION;
-    else {
-	log_error("invalid compression level; using default level\n");
-	level = Z_DEFAULT_COMPRESSION;
-    }
+    level = get_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -130,6 +297,335 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
     return 0;
 }
 
+/* The work function of the parallel mode.  It compresses the block
+ * in slot SLOTIDX using the z_stream of WORKER.  */
+static void
+zip_work (void *opaque, int worker, int slotidx)
+{
+  struct zip_parallel_s *par = opaque;
+  struct zip_slot_s *slot = par->slots + slotidx;
+  z_stream *zs = par->zs + worker;
+  byte *p;
+  int flush, zrc;
+
+  /* Release the global lock for the actual work.  */
+  npth_unprotect ();
+  flush = slot->final? Z_FINISH : Z_SYNC_FLUSH;
+  slot->outlen = 0;
+  if (par->zfx->algo == COMPRESS_ALGO_ZLIB)
+    slot->adler = adler32 (adler32 (0, NULL, 0),
+                           BYTEF_CAST (slot->inbuf), slot->inlen);
+  zrc = deflateReset (zs);
+  if (zrc == Z_OK && slot->dictlen)
+    zrc = deflateSetDictionary (zs, BYTEF_CAST (slot->dict), slot->dictlen);
+  zs->next_in = BYTEF_CAST (slot->inbuf);
+  zs->avail_in = slot->inlen;
+  while (zrc == Z_OK)
+    {
+      if (slot->outlen == slot->outbufsize)
+        {
+          p = xtryrealloc (slot->outbuf, 2 * slot->outbufsize);
+          if (!p)
+            {
+              zrc = Z_MEM_ERROR;
+              break;
+            }
+          slot->outbuf = p;
+          slot->outbufsize *= 2;
+        }
+      zs->next_out = BYTEF_CAST (slot->outbuf + slot->outlen);
+      zs->avail_out = slot->outbufsize - slot->outlen;
+      zrc = deflate (zs, flush);
+      slot->outlen = slot->outbufsize - zs->avail_out;
+      if (zrc == Z_STREAM_END)
+        {
+          zrc = Z_OK;
+          break;
+        }
+      if (zrc == Z_BUF_ERROR && flush == Z_SYNC_FLUSH)
+        zrc = Z_OK;  /* The flush has already been done.  */
+      /* A sync flush is complete if there is space left.  */
+      if (zrc == Z_OK && flush == Z_SYNC_FLUSH && zs->avail_out)
+        break;
+    }
+  npth_protect ();
+
+  slot->zrc = zrc;
+}
+
+
+/* Terminate the worker threads of ZFX and release the parallel mode.
+ * This is a NOP if the parallel mode is not used.  */
+static void
+stop_parallel (compress_filter_context_t *zfx)
+{
+  struct zip_parallel_s *par = zfx->parallel;
+  int i;
+
+  if (!par)
+    return;
+  zfx->parallel = NULL;
+
+  workpool_release (par->pool);
+  for (i=0; i < par->nzs; i++)
+    deflateEnd (par->zs + i);
+  if (par->slots)
+    for (i=0; i < par->nslots; i++)
+      {
+        xfree (par->slots[i].inbuf);
+        xfree (par->slots[i].dict);
+        xfree (par->slots[i].outbuf);
+      }
+  xfree (par->zs);
+  xfree (par->slots);
+  xfree (par);
+}
+
+
+/* Start worker threads to compress the input in parallel if this has
+ * been requested.  If something goes wrong we silently stay with the
+ * serial mode.  */
+static void
+start_parallel (compress_filter_context_t *zfx)
+{
+  struct zip_parallel_s *par;
+  struct zip_slot_s *slot;
+  gpg_error_t err;
+  int i;
+
+  if (opt.jobs < 2)
+    return;
+
+  par = xtrycalloc (1, sizeof *par);
+  if (!par)
+    return;
+  par->zfx = zfx;
+  par->level = get_compress_level ();
+  par->adler = adler32 (0, NULL, 0);
+  zfx->parallel = par;
+
+  par->zs = xtrycalloc (opt.jobs, sizeof *par->zs);
+  if (!par->zs)
+    goto leave;
+  for (i=0; i < opt.jobs; i++)
+    {
+      /* See init_compress for the window size used with algo 1.  */
+      if (deflateInit2 (par->zs + i, par->level, Z_DEFLATED,
+                        zfx->algo == 1? -13 : -15,
+                        8, Z_DEFAULT_STRATEGY) != Z_OK)
+        break;
+      par->nzs++;
+    }
+  if (!par->nzs)
+    goto leave;
+
+  err = workpool_new (&par->pool, "deflate-worker", par->nzs, 0,
+                      zip_work, par);
+  if (err)
+    {
+      if (DBG_FILTER)
+        log_debug ("error starting deflate workers: %s\n",
+                   gpg_strerror (err));
+      goto leave;
+    }
+  par->nslots = workpool_nslots (par->pool);
+  par->slots = xtrycalloc (par->nslots, sizeof *par->slots);
+  if (!par->slots)
+    goto leave;
+  for (i=0; i < par->nslots; i++)
+    {
+      slot = par->slots + i;
+      /* Stored blocks may expand the data a bit; if this is not
+       * enough the worker enlarges the buffer.  */
+      slot->outbufsize = compressBound (ZIP_PARALLEL_BLOCKSIZE) + 64;
+      if (!(slot->inbuf = xtrymalloc (ZIP_PARALLEL_BLOCKSIZE))
+          || !(slot->dict = xtrymalloc (ZIP_PARALLEL_DICTSIZE))
+          || !(slot->outbuf = xtrymalloc (slot->outbufsize)))
+        goto leave;
+    }
+
+  if (DBG_FILTER)
+    log_debug ("using %d threads for compression\n",
+               workpool_nworkers (par->pool));
+  return;
+
+ leave:
+  stop_parallel (zfx);
+}
+
+
+/* Queue the slot being filled for compression and advance to the
+ * next slot.  If FINAL is set this is the last block.  */
+static void
+parallel_queue (compress_filter_context_t *zfx, int final)
+{
+  struct zip_parallel_s *par = zfx->parallel;
+  struct zip_slot_s *slot = par->slots + workpool_fill (par->pool);
+
+  if (DBG_FILTER)
+    log_debug ("queuing block of %zu bytes%s\n",
+               slot->inlen, final? " (final)":"");
+
+  slot->final = final;
+  slot->zrc = Z_OK;
+  par->any_queued = 1;
+  workpool_queue (par->pool);
+}
+
+
+/* Write the compressed slots in block order to stream A.  If ALL is
+ * set wait until all queued slots have been written; else wait only
+ * as long as there is no free slot.  */
+static int
+parallel_write (compress_filter_context_t *zfx, IOBUF a, int all)
+{
+  struct zip_parallel_s *par = zfx->parallel;
+  struct zip_slot_s *slot;
+  int rc = 0;
+  int slotidx;
+
+  if (par->rc)
+    return par->rc;
+
+  while ((slotidx = workpool_wait (par->pool, all)) != -1)
+    {
+      slot = par->slots + slotidx;
+      if (slot->zrc != Z_OK)
+        log_fatal ("zlib deflate problem: rc=%d\n", slot->zrc);
+      if (DBG_FILTER)
+        log_debug ("writing block: inlen=%zu outlen=%zu\n",
+                   slot->inlen, slot->outlen);
+      if (zfx->algo == COMPRESS_ALGO_ZLIB)
+        par->adler = adler32_combine (par->adler, slot->adler, slot->inlen);
+      if ((rc = iobuf_write (a, slot->outbuf, slot->outlen)))
+        {
+          log_debug ("deflate: iobuf_write failed\n");
+          break;
+        }
+
+      /* Keep INBUF because it primes the next block.  */
+      workpool_pop (par->pool);
+    }
+
+  /* The failed slot is not popped and thus the ring may be full;
+   * remember the error so that we don't queue anything else.  */
+  par->rc = rc;
+  return rc;
+}
+
+
+/* The parallel mode version of do_compress for the data in BUF of
+ * length SIZE.  */
+static int
+do_compress_parallel (compress_filter_context_t *zfx,
+                      byte *buf, size_t size, IOBUF a)
+{
+  struct zip_parallel_s *par = zfx->parallel;
+  struct zip_slot_s *slot, *prev;
+  size_t n;
+  int rc, fill;
+
+  if (par->rc)
+    return par->rc;
+
+  while (size)
+    {
+      fill = workpool_fill (par->pool);
+      slot = par->slots + fill;
+      if (!slot->inlen)
+        {
+          /* Start a new block with the tail of the previous block as
+           * dictionary.  The previous slot is not reused before the
+           * slot we are filling has been queued.  */
+          slot->dictlen = 0;
+          if (par->any_queued)
+            {
+              prev = par->slots + (fill + par->nslots - 1) % par->nslots;
+              slot->dictlen = prev->inlen < ZIP_PARALLEL_DICTSIZE
+                              ? prev->inlen : ZIP_PARALLEL_DICTSIZE;
+              memcpy (slot->dict, prev->inbuf + prev->inlen - slot->dictlen,
+                      slot->dictlen);
+            }
+        }
+      n = ZIP_PARALLEL_BLOCKSIZE - slot->inlen;
+      if (n > size)
+        n = size;
+      /* Let the workers report their results while we copy.  */
+      npth_unprotect ();
+      memcpy (slot->inbuf + slot->inlen, buf, n);
+      npth_protect ();
+      slot->inlen += n;
+      buf  += n;
+      size -= n;
+
+      if (slot->inlen == ZIP_PARALLEL_BLOCKSIZE)
+        {
+          parallel_queue (zfx, 0);
+          if ((rc = parallel_write (zfx, a, 0)))
+            return rc;
+          /* Mark the slot now being filled as empty.  */
+          par->slots[workpool_fill (par->pool)].inlen = 0;
+        }
+    }
+
+  return 0;
+}
+
+
+/* Finish the parallel mode by compressing the last block, writing all
+ * pending blocks and the ZLIB trailer.  */
+static int
+finish_parallel (compress_filter_context_t *zfx, IOBUF a)
+{
+  struct zip_parallel_s *par = zfx->parallel;
+  struct zip_slot_s *slot = par->slots + workpool_fill (par->pool);
+  byte trailer[4];
+  int rc;
+
+  /* After an error only release the parallel mode.  */
+  rc = par->rc;
+  if (rc)
+    goto leave;
+
+  /* The last block may be empty but we need it to end the stream.  */
+  if (!slot->inlen)
+    slot->dictlen = 0;
+  parallel_queue (zfx, 1);
+  rc = parallel_write (zfx, a, 1);
+  if (!rc && zfx->algo == COMPRESS_ALGO_ZLIB)
+    {
+      trailer[0] = par->adler >> 24;
+      trailer[1] = par->adler >> 16;
+      trailer[2] = par->adler >>  8;
+      trailer[3] = par->adler;
+      rc = iobuf_write (a, trailer, 4);
+    }
+
+ leave:
+  stop_parallel (zfx);
+  return rc;
+}
+
+
+/* Write the ZLIB header as deflateInit would do.  */
+static int
+write_zlib_header (compress_filter_context_t *zfx, IOBUF a)
+{
+  int level = zfx->parallel->level;
+  unsigned int hdr;
+  byte buf[2];
+
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+  /* CM 8 with a 32k window and the compression level hint.  */
+  hdr = (0x78 << 8) | ((level < 2? 0 : level < 6? 1 : level == 6? 2 : 3) << 6);
+  hdr += 31 - hdr % 31;
+  buf[0] = hdr >> 8;
+  buf[1] = hdr;
+  return iobuf_write (a, buf, 2);
+}
+
+
 static void
 init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -153,7 +649,9 @@ init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->inbufsize = 2048;
+    /* The input is read directly from the pipeline's buffer; we only
+     * need room for the dummy byte used with algo 1.  */
+    zfx->inbufsize = 1;
     zfx->inbuf = xmalloc( zfx->inbufsize );
     zs->avail_in = 0;
 }
@@ -165,35 +663,33 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
     int zrc;
     int rc = 0;
     int leave = 0;
-    size_t n;
-    int nread, count;
-    int refill = !zs->avail_in;
+    const byte *inbuf;
+    size_t n, ignored = 0;
 
     if( DBG_FILTER )
-	log_debug("begin inflate: avail_in=%u, avail_out=%u, inbuf=%u\n",
-		(unsigned)zs->avail_in, (unsigned)zs->avail_out,
-		(unsigned)zfx->inbufsize );
+	log_debug("begin inflate: avail_out=%u\n", (unsigned)zs->avail_out);
     do {
-	if( zs->avail_in < zfx->inbufsize && refill ) {
-	    n = zs->avail_in;
-	    if( !n )
-            zs->next_in = BYTEF_CAST (zfx->inbuf);
-	    count = zfx->inbufsize - n;
-	    nread = iobuf_read( a, zfx->inbuf + n, count );
-	    if( nread == -1 ) nread = 0;
-	    n += nread;
+	/* Let inflate read directly from the buffer of the pipeline
+	 * instead of copying it to our own input buffer first.  The
+	 * borrowed data is consumed right after the call to inflate so
+	 * that NEXT_IN never points into that buffer across calls.  */
+	inbuf = iobuf_borrow( a, ~(uInt)0, &n );
+	if( inbuf ) {
+	    zs->next_in = BYTEF_CAST ((byte *)inbuf);
+	    zs->avail_in = n;
+	}
+	else if( zfx->algo == 1 && zfx->algo1hack < 4) {
 	    /* Algo 1 has no zlib header which requires us to give
 	     * inflate an extra dummy byte to read. To be on the safe
 	     * side we allow for up to 4 ff bytes.  */
-	    if( nread < count && zfx->algo == 1 && zfx->algo1hack < 4) {
-		*(zfx->inbuf + n) = 0xFF;
-		zfx->algo1hack++;
-		n++;
-                leave = 1;
-	    }
-	    zs->avail_in = n;
+	    *zfx->inbuf = 0xFF;
+	    zfx->algo1hack++;
+	    zs->next_in = BYTEF_CAST (zfx->inbuf);
+	    zs->avail_in = 1;
+	    leave = 1;
 	}
-	refill = 1;
+	else
+	    zs->avail_in = 0;
 	if( DBG_FILTER )
 	    log_debug("enter inflate: avail_in=%u, avail_out=%u\n",
 		    (unsigned)zs->avail_in, (unsigned)zs->avail_out);
@@ -201,6 +697,14 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
 	if( DBG_FILTER )
 	    log_debug("leave inflate: avail_in=%u, avail_out=%u, zrc=%d\n",
 		   (unsigned)zs->avail_in, (unsigned)zs->avail_out, zrc);
+	if( inbuf ) {
+	    /* Data following the end of the compressed stream is
+	     * ignored as we did with our own input buffer.  */
+	    if( zrc == Z_STREAM_END )
+		ignored = zs->avail_in;
+	    iobuf_consume( a, zrc == Z_STREAM_END? n : n - zs->avail_in );
+	}
+	zs->avail_in = 0;
 	if( zrc == Z_STREAM_END )
 	    rc = -1; /* eof */
 	else if( zrc != Z_OK && zrc != Z_BUF_ERROR ) {
@@ -210,15 +714,92 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
 		log_fatal("zlib inflate problem: rc=%d\n", zrc );
 	}
     } while (zs->avail_out && zrc != Z_STREAM_END && zrc != Z_BUF_ERROR
-             && !leave);
+	     && !leave);
 
     *ret_len = zfx->outbufsize - zs->avail_out;
     if( DBG_FILTER )
 	log_debug("do_uncompress: returning %u bytes (%u ignored)\n",
-                  (unsigned int)*ret_len, (unsigned int)zs->avail_in );
+		  (unsigned int)*ret_len, (unsigned int)ignored );
+    return rc;
+}
+
+/* Compress the SIZE bytes at BUF and write them to A.  The
+ * compressed packet is started with the first call.  If the probe
+ * decided against compression (status 4) the data is written as
+ * is.  */
+static int
+compress_data( compress_filter_context_t *zfx, byte *buf, size_t size,
+	       IOBUF a )
+{
+    z_stream *zs;
+    int rc;
+
+    if( zfx->status == 4 )
+	return iobuf_write( a, buf, size );
+
+    if( !zfx->status ) {
+	PACKET pkt;
+	PKT_compressed cd;
+	if(zfx->algo != COMPRESS_ALGO_ZIP
+	   && zfx->algo != COMPRESS_ALGO_ZLIB)
+	  BUG();
+	memset( &cd, 0, sizeof cd );
+	cd.len = 0;
+	cd.algorithm = zfx->algo;
+        /* Fixme: We should force a new CTB here:
+           cd.new_ctb = zfx->new_ctb;
+        */
+	init_packet( &pkt );
+	pkt.pkttype = PKT_COMPRESSED;
+	pkt.pkt.compressed = &cd;
+	if( build_packet( a, &pkt ))
+	    log_bug("build_packet(PKT_COMPRESSED) failed\n");
+	start_parallel( zfx );
+	if( zfx->parallel ) {
+	    if( zfx->algo == COMPRESS_ALGO_ZLIB
+		&& (rc = write_zlib_header( zfx, a )) )
+		return rc;
+	}
+	else {
+	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
+	    init_compress( zfx, zs );
+	}
+	zfx->status = 2;
+    }
+
+    if( zfx->parallel )
+	return do_compress_parallel( zfx, buf, size, a );
+
+    zs = zfx->opaque;
+    zs->next_in = BYTEF_CAST (buf);
+    zs->avail_in = size;
+    return do_compress( zfx, zs, Z_NO_FLUSH, a );
+}
+
+
+/* Decide whether the data collected for the probe shall be
+ * compressed and process it accordingly.  */
+static int
+end_probe( compress_filter_context_t *zfx, IOBUF a )
+{
+    int rc;
+
+    if( is_incompressible( zfx->inbuf, zfx->inbuflen ) ) {
+	if( opt.verbose )
+	    log_info(_("data looks already compressed - not compressing\n"));
+	zfx->status = 4;
+    }
+    else
+	zfx->status = 0;
+
+    rc = compress_data( zfx, zfx->inbuf, zfx->inbuflen, a );
+    xfree( zfx->inbuf );
+    zfx->inbuf = NULL;
+    zfx->inbuflen = 0;
     return rc;
 }
 
+
 static int
 compress_filter( void *opaque, int control,
 		 IOBUF a, byte *buf, size_t *ret_len)
@@ -226,6 +807,7 @@ compress_filter( void *opaque, int control,
     size_t size = *ret_len;
     compress_filter_context_t *zfx = opaque;
     z_stream *zs = zfx->opaque;
+    size_t n;
     int rc=0;
 
     if( control == IOBUFCTRL_UNDERFLOW ) {
@@ -241,39 +823,41 @@ compress_filter( void *opaque, int control,
 	rc = do_uncompress( zfx, zs, a, ret_len );
     }
     else if( control == IOBUFCTRL_FLUSH ) {
-	if( !zfx->status ) {
-	    PACKET pkt;
-	    PKT_compressed cd;
-	    if(zfx->algo != COMPRESS_ALGO_ZIP
-	       && zfx->algo != COMPRESS_ALGO_ZLIB)
-	      BUG();
-	    memset( &cd, 0, sizeof cd );
-	    cd.len = 0;
-	    cd.algorithm = zfx->algo;
-            /* Fixme: We should force a new CTB here:
-               cd.new_ctb = zfx->new_ctb;
-            */
-	    init_packet( &pkt );
-	    pkt.pkttype = PKT_COMPRESSED;
-	    pkt.pkt.compressed = &cd;
-	    if( build_packet( a, &pkt ))
-		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
-	    zfx->status = 2;
+	if( !zfx->status && zfx->probe ) {
+	    zfx->inbuf = xmalloc( COMPRESS_PROBE_SIZE );
+	    zfx->inbuflen = 0;
+	    zfx->status = 3;
 	}
-
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if( zfx->status == 3 ) {
+	    n = COMPRESS_PROBE_SIZE - zfx->inbuflen;
+	    if( n > size )
+		n = size;
+	    memcpy( zfx->inbuf + zfx->inbuflen, buf, n );
+	    zfx->inbuflen += n;
+	    buf += n;
+	    size -= n;
+	    if( zfx->inbuflen == COMPRESS_PROBE_SIZE )
+		rc = end_probe( zfx, a );
+	}
+	if( !rc && zfx->status != 3 )
+	    rc = compress_data( zfx, buf, size, a );
     }
     else if( control == IOBUFCTRL_FREE ) {
+	if( zfx->status == 3 ) {
+	    rc = end_probe( zfx, a );
+	    zs = zfx->opaque;
+	}
 	if( zfx->status == 1 ) {
 	    inflateEnd(zs);
 	    xfree(zs);
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
+	else if( zfx->status == 2 && zfx->parallel ) {
+	    int rc2 = finish_parallel( zfx, a );
+	    if( !rc )
+		rc = rc2;
+	}
 	else if( zfx->status == 2 ) {
 	    zs->next_in = BYTEF_CAST (buf);
 	    zs->avail_in = 0;
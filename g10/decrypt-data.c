@@ -23,9 +23,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/workpool.h"
 #include "packet.h"
 #include "options.h"
 #include "../common/i18n.h"
@@ -40,6 +42,12 @@ static int mdc_decode_filter ( void *opaque, int control, IOBUF a,
 static int decode_filter ( void *opaque, int control, IOBUF a,
 					byte *buf, size_t *ret_len);
 
+/* Chunks are decrypted by worker threads only if the chunk size is in
+ * this range.  Each slot of the parallel mode holds a complete chunk
+ * and thus the upper limit bounds the memory used.  */
+#define AEAD_MIN_PARALLEL_CHUNKSIZE (64*1024)
+#define AEAD_MAX_PARALLEL_CHUNKSIZE (4*1024*1024)
+
 /* Our context object.  */
 struct decode_filter_context_s
 {
@@ -96,10 +104,43 @@ struct decode_filter_context_s
   /* Remaining bytes in the packet according to the packet header.
    * Not used if PARTIAL is true.  */
   size_t length;
+
+  /* The worker threads for parallel AEAD decryption or NULL.  */
+  struct decode_parallel_s *parallel;
 };
 typedef struct decode_filter_context_s *decode_filter_ctx_t;
 
 
+/* A slot holding one chunk in the parallel mode.  */
+struct decode_slot_s
+{
+  uint64_t chunkindex;  /* The index of the chunk.                  */
+  byte *buffer;         /* CHUNKSIZE+32 bytes for the data.         */
+  size_t buflen;        /* Length of the data w/o the tag.          */
+  size_t off;           /* Offset of the data not yet returned.     */
+  byte tag[16];         /* The authentication tag of the chunk.     */
+  gpg_error_t err;      /* The error returned by the worker.        */
+};
+
+/* The state of the parallel mode.  The chunks are decrypted by a
+ * work pool: the main thread reads the chunks into the slots and
+ * returns the plaintext of the slots in chunk order once their tags
+ * have been verified.  Each worker uses its own cipher handle.  */
+struct decode_parallel_s
+{
+  decode_filter_ctx_t dfx;
+  workpool_t pool;
+  int nhds;
+  gcry_cipher_hd_t *cipher_hds;  /* One cipher handle per worker.  */
+  int nslots;
+  struct decode_slot_s *slots;
+  int eof_seen;           /* The input EOF as seen by fill_buffer.  */
+};
+
+
+static void stop_parallel (decode_filter_ctx_t dfx);
+
+
 /* Helper to release the decode context.  */
 static void
 release_dfx_context (decode_filter_ctx_t dfx)
@@ -110,6 +151,7 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      stop_parallel (dfx);
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -119,12 +161,13 @@ release_dfx_context (decode_filter_ctx_t dfx)
 }
 
 
-/* Set the nonce and the additional data for the current chunk.  This
- * also reset the decryption machinery so that the handle can be
- * used for a new chunk.  If FINAL is set the final AEAD chunk is
- * processed.  */
+/* Set the nonce and the additional data for the chunk CHUNKINDEX
+ * into the cipher handle HD.  This also reset the decryption
+ * machinery so that the handle can be used for a new chunk.  If FINAL
+ * is set the final AEAD chunk is processed.  */
 static gpg_error_t
-aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
+aead_set_nonce_and_ad (decode_filter_ctx_t dfx, gcry_cipher_hd_t hd,
+                       uint64_t chunkindex, int final)
 {
   gpg_error_t err;
   unsigned char ad[21];
@@ -146,18 +189,18 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     default:
       BUG ();
     }
-  nonce[i++] ^= dfx->chunkindex >> 56;
-  nonce[i++] ^= dfx->chunkindex >> 48;
-  nonce[i++] ^= dfx->chunkindex >> 40;
-  nonce[i++] ^= dfx->chunkindex >> 32;
-  nonce[i++] ^= dfx->chunkindex >> 24;
-  nonce[i++] ^= dfx->chunkindex >> 16;
-  nonce[i++] ^= dfx->chunkindex >>  8;
-  nonce[i++] ^= dfx->chunkindex;
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
 
   if (DBG_CRYPTO)
     log_printhex (nonce, i, "nonce:");
-  err = gcry_cipher_setiv (dfx->cipher_hd, nonce, i);
+  err = gcry_cipher_setiv (hd, nonce, i);
   if (err)
     return err;
 
@@ -166,14 +209,14 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
   ad[2] = dfx->cipher_algo;
   ad[3] = dfx->aead_algo;
   ad[4] = dfx->chunkbyte;
-  ad[5] = dfx->chunkindex >> 56;
-  ad[6] = dfx->chunkindex >> 48;
-  ad[7] = dfx->chunkindex >> 40;
-  ad[8] = dfx->chunkindex >> 32;
-  ad[9] = dfx->chunkindex >> 24;
-  ad[10]= dfx->chunkindex >> 16;
-  ad[11]= dfx->chunkindex >>  8;
-  ad[12]= dfx->chunkindex;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
   if (final)
     {
       ad[13] = dfx->total >> 56;
@@ -187,7 +230,7 @@ aead_set_nonce_and_ad (decode_filter_ctx_t dfx, int final)
     }
   if (DBG_CRYPTO)
     log_printhex (ad, final? 21 : 13, "authdata:");
-  return gcry_cipher_authenticate (dfx->cipher_hd, ad, final? 21 : 13);
+  return gcry_cipher_authenticate (hd, ad, final? 21 : 13);
 }
 
 
@@ -213,6 +256,138 @@ aead_checktag (decode_filter_ctx_t dfx, int final, const void *tagbuf)
 }
 
 
+/* The work function of the parallel mode.  It decrypts the chunk in
+ * slot SLOTIDX and checks its tag using the cipher handle of
+ * WORKER.  */
+static void
+aead_work (void *opaque, int worker, int slotidx)
+{
+  struct decode_parallel_s *par = opaque;
+  struct decode_slot_s *slot = par->slots + slotidx;
+  gcry_cipher_hd_t hd = par->cipher_hds[worker];
+  gpg_error_t err;
+
+  err = aead_set_nonce_and_ad (par->dfx, hd, slot->chunkindex, 0);
+  if (!err)
+    {
+      /* Release the global lock for the actual work.  */
+      npth_unprotect ();
+      gcry_cipher_final (hd);
+      err = gcry_cipher_decrypt (hd, slot->buffer, slot->buflen, NULL, 0);
+      if (!err)
+        err = gcry_cipher_checktag (hd, slot->tag, 16);
+      npth_protect ();
+    }
+  slot->err = err;
+}
+
+
+/* Terminate the worker threads of DFX and release the parallel mode.
+ * This is a NOP if the parallel mode is not used.  */
+static void
+stop_parallel (decode_filter_ctx_t dfx)
+{
+  struct decode_parallel_s *par = dfx->parallel;
+  int i;
+
+  if (!par)
+    return;
+  dfx->parallel = NULL;
+
+  workpool_release (par->pool);
+  for (i=0; i < par->nhds; i++)
+    gcry_cipher_close (par->cipher_hds[i]);
+  if (par->slots)
+    for (i=0; i < par->nslots; i++)
+      if (par->slots[i].buffer)
+        {
+          /* The buffer may hold plaintext with an unverified tag.  */
+          wipememory (par->slots[i].buffer, dfx->chunksize + 32);
+          xfree (par->slots[i].buffer);
+        }
+  xfree (par->cipher_hds);
+  xfree (par->slots);
+  xfree (par);
+}
+
+
+/* Start worker threads to decrypt the chunks in parallel if this has
+ * been requested and the chunk size is suitable.  DEK and CIPHERMODE
+ * are used to setup the cipher handles of the workers.  If something
+ * goes wrong we silently stay with the serial mode.  */
+static void
+start_parallel (decode_filter_ctx_t dfx, DEK *dek,
+                enum gcry_cipher_modes ciphermode)
+{
+  struct decode_parallel_s *par;
+  gcry_cipher_hd_t hd;
+  gpg_error_t err;
+  int i;
+
+  if (opt.jobs < 2
+      || dfx->chunksize < AEAD_MIN_PARALLEL_CHUNKSIZE
+      || dfx->chunksize > AEAD_MAX_PARALLEL_CHUNKSIZE)
+    return;
+
+  par = xtrycalloc (1, sizeof *par);
+  if (!par)
+    return;
+  par->dfx = dfx;
+  dfx->parallel = par;
+
+  par->cipher_hds = xtrycalloc (opt.jobs, sizeof *par->cipher_hds);
+  if (!par->cipher_hds)
+    goto leave;
+  for (i=0; i < opt.jobs; i++)
+    {
+      err = openpgp_cipher_open (&hd, dfx->cipher_algo,
+                                 ciphermode, GCRY_CIPHER_SECURE);
+      if (!err)
+        {
+          err = gcry_cipher_setkey (hd, dek->key, dek->keylen);
+          if (gpg_err_code (err) == GPG_ERR_WEAK_KEY)
+            err = 0;  /* Already warned about.  */
+          if (err)
+            gcry_cipher_close (hd);
+        }
+      if (err)
+        {
+          if (DBG_FILTER)
+            log_debug ("error setting up AEAD worker %d: %s\n",
+                       i, gpg_strerror (err));
+          break;
+        }
+      par->cipher_hds[par->nhds++] = hd;
+    }
+  if (!par->nhds)
+    goto leave;
+
+  err = workpool_new (&par->pool, "aead-worker", par->nhds, 0,
+                      aead_work, par);
+  if (err)
+    {
+      if (DBG_FILTER)
+        log_debug ("error starting AEAD workers: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+  par->nslots = workpool_nslots (par->pool);
+  par->slots = xtrycalloc (par->nslots, sizeof *par->slots);
+  if (!par->slots)
+    goto leave;
+  for (i=0; i < par->nslots; i++)
+    if (!(par->slots[i].buffer = xtrymalloc (dfx->chunksize + 32)))
+      goto leave;
+
+  if (DBG_FILTER)
+    log_debug ("using %d threads for AEAD decryption\n",
+               workpool_nworkers (par->pool));
+  return;
+
+ leave:
+  stop_parallel (dfx);
+}
+
+
 /****************
  * Decrypt the data, specified by ED with the key DEK.
  */
@@ -374,6 +549,7 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
           goto leave;
         }
 
+      start_parallel (dfx, dek, ciphermode);
     }
   else /* CFB encryption.  */
     {
@@ -601,6 +777,60 @@ fill_buffer (decode_filter_ctx_t dfx, iobuf_t stream,
 }
 
 
+/* Borrow up to MAXLEN bytes of input from STREAM utilizing
+ * information from the context DFX.  The data is not copied; see
+ * iobuf_borrow.  Returns NULL and sets the respective flag in DFX on
+ * EOF.  */
+static const byte *
+borrow_input (decode_filter_ctx_t dfx, iobuf_t stream,
+              size_t maxlen, size_t *r_len)
+{
+  const byte *p;
+
+  if (!dfx->partial)
+    {
+      if (!dfx->length)
+        {
+          dfx->eof_seen = 1; /* Normal EOF.  */
+          *r_len = 0;
+          return NULL;
+        }
+      if (maxlen > dfx->length)
+        maxlen = dfx->length;
+    }
+
+  p = iobuf_borrow (stream, maxlen, r_len);
+  if (!p)
+    dfx->eof_seen = dfx->partial? 1 /* Normal EOF. */ : 3 /* Premature. */;
+  return p;
+}
+
+
+/* Consume N bytes of the input borrowed with borrow_input.  */
+static void
+consume_input (decode_filter_ctx_t dfx, iobuf_t stream, size_t n)
+{
+  iobuf_consume (stream, n);
+  if (!dfx->partial)
+    dfx->length -= n;
+}
+
+
+/* Decrypt N bytes from INBUF to OUTBUF and hash the plaintext for
+ * the MDC.  INBUF may be NULL to decrypt in place.  */
+static void
+mdc_decrypt (decode_filter_ctx_t dfx, byte *outbuf, const byte *inbuf,
+             size_t n)
+{
+  if (dfx->cipher_hd)
+    gcry_cipher_decrypt (dfx->cipher_hd, outbuf, n, inbuf, inbuf? n : 0);
+  else if (inbuf)
+    memcpy (outbuf, inbuf, n);
+  if (dfx->mdc_hash)
+    gcry_md_write (dfx->mdc_hash, outbuf, n);
+}
+
+
 /* The core of the AEAD decryption.  This is the underflow function of
  * the aead_decode_filter.  */
 static gpg_error_t
@@ -677,7 +907,8 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
       if (!dfx->chunklen)
         {
           /* First data for this chunk - prepare.  */
-          err = aead_set_nonce_and_ad (dfx, 0);
+          err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd,
+                                       dfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -759,7 +990,8 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
       if (!dfx->chunklen)
         {
           /* First data for this chunk - prepare.  */
-          err = aead_set_nonce_and_ad (dfx, 0);
+          err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd,
+                                       dfx->chunkindex, 0);
           if (err)
             goto leave;
         }
@@ -808,7 +1040,7 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
         }
 
       /* Check the final chunk.  */
-      err = aead_set_nonce_and_ad (dfx, 1);
+      err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd, dfx->chunkindex, 1);
       if (err)
         goto leave;
       gcry_cipher_final (dfx->cipher_hd);
@@ -847,6 +1079,161 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
 }
 
 
+/* Read the next chunk and its tag from stream A into the slot at FILL
+ * of the parallel mode and queue it for decryption.  If the end of
+ * the input is reached the final tag is checked right away; this is
+ * possible because it covers only the number of chunks and octets.
+ * Thus the plaintext of the last chunk is only returned after both
+ * of its tags have been verified.  */
+static gpg_error_t
+parallel_read_chunk (decode_filter_ctx_t dfx, iobuf_t a)
+{
+  struct decode_parallel_s *par = dfx->parallel;
+  struct decode_slot_s *slot = par->slots + workpool_fill (par->pool);
+  gpg_error_t err;
+  const byte *finaltag;
+  size_t n;
+
+  /* Read the chunk, its tag and 16 more octets to detect the last
+   * chunk; the extra octets are kept in the holdback buffer.  */
+  memcpy (slot->buffer, dfx->holdback, dfx->holdbacklen);
+  n = fill_buffer (dfx, a, slot->buffer, dfx->chunksize + 32,
+                   dfx->holdbacklen);
+  dfx->holdbacklen = 0;
+  par->eof_seen = dfx->eof_seen;
+  dfx->eof_seen = 0;  /* Would otherwise stop our filter too early.  */
+
+  if (!par->eof_seen)
+    {
+      slot->buflen = dfx->chunksize;
+      memcpy (slot->tag, slot->buffer + dfx->chunksize, 16);
+      dfx->holdbacklen = 16;
+      memcpy (dfx->holdback, slot->buffer + dfx->chunksize + 16, 16);
+      finaltag = NULL;
+    }
+  else if (n == 16)
+    {
+      /* Only the final tag is left.  */
+      finaltag = slot->buffer;
+      slot = NULL;
+    }
+  else if (n < 32)
+    {
+      /* Not enough data for the last two tags.  */
+      return gpg_error (GPG_ERR_TRUNCATED);
+    }
+  else
+    {
+      slot->buflen = n - 32;
+      memcpy (slot->tag, slot->buffer + n - 32, 16);
+      finaltag = slot->buffer + n - 16;
+    }
+
+  if (slot)
+    {
+      if (DBG_FILTER)
+        log_debug ("queuing chunk %ju (%zu bytes)\n",
+                   (uintmax_t)dfx->chunkindex, slot->buflen);
+      slot->chunkindex = dfx->chunkindex++;
+      slot->off = 0;
+      slot->err = 0;
+      dfx->total += slot->buflen;
+      workpool_queue (par->pool);
+    }
+
+  if (finaltag)
+    {
+      /* Check the final chunk.  We need to copy the tag first
+       * because the workers may use the buffer.  */
+      memcpy (dfx->holdback, finaltag, 16);
+      err = aead_set_nonce_and_ad (dfx, dfx->cipher_hd, dfx->chunkindex, 1);
+      if (err)
+        return err;
+      gcry_cipher_final (dfx->cipher_hd);
+      /* Decrypt an empty string (using HOLDBACK+16 as a dummy).  */
+      err = gcry_cipher_decrypt (dfx->cipher_hd, dfx->holdback+16, 0, NULL, 0);
+      if (err)
+        {
+          log_error ("gcry_cipher_decrypt failed (final): %s\n",
+                     gpg_strerror (err));
+          return err;
+        }
+      err = aead_checktag (dfx, 1, dfx->holdback);
+      if (err)
+        return err;
+    }
+
+  return 0;
+}
+
+
+/* The parallel mode version of aead_underflow.  */
+static gpg_error_t
+aead_underflow_parallel (decode_filter_ctx_t dfx, iobuf_t a,
+                         byte *buf, size_t *ret_len)
+{
+  struct decode_parallel_s *par = dfx->parallel;
+  const size_t size = *ret_len; /* The allocated size of BUF.  */
+  struct decode_slot_s *slot;
+  gpg_error_t err = 0;
+  size_t totallen = 0;
+  size_t n;
+
+  while (totallen < size)
+    {
+      /* Keep the workers busy.  */
+      while (!par->eof_seen && workpool_npending (par->pool) < par->nslots)
+        {
+          err = parallel_read_chunk (dfx, a);
+          if (err)
+            goto leave;
+        }
+      if (!workpool_npending (par->pool))
+        {
+          dfx->eof_seen = par->eof_seen;
+          err = gpg_error (GPG_ERR_EOF);
+          break;
+        }
+
+      slot = par->slots + workpool_wait (par->pool, 1);
+      if (slot->err)
+        {
+          err = slot->err;
+          log_error ("decrypting chunk %ju failed: %s\n",
+                     (uintmax_t)slot->chunkindex, gpg_strerror (err));
+          goto leave;
+        }
+
+      n = slot->buflen - slot->off;
+      if (n > size - totallen)
+        n = size - totallen;
+      memcpy (buf + totallen, slot->buffer + slot->off, n);
+      slot->off += n;
+      totallen += n;
+      if (slot->off == slot->buflen)
+        workpool_pop (par->pool);
+    }
+
+ leave:
+  if (DBG_FILTER)
+    log_debug ("aead_underflow_parallel: returning %zu (%s)\n",
+               totallen, gpg_strerror (err));
+
+  /* Map the error code and wipe the buffer as in aead_underflow.  */
+  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+    err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
+    {
+      memset (buf, 0, size);
+      totallen = 0;
+    }
+
+  *ret_len = totallen;
+
+  return err;
+}
+
+
 /* The IOBUF filter used to decrypt AEAD encrypted data.  */
 static int
 aead_decode_filter (void *opaque, int control, IOBUF a,
@@ -864,7 +1251,10 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
     {
       log_assert (a);
 
-      rc = aead_underflow (dfx, a, buf, ret_len);
+      if (dfx->parallel)
+        rc = aead_underflow_parallel (dfx, a, buf, ret_len);
+      else
+        rc = aead_underflow (dfx, a, buf, ret_len);
       if (gpg_err_code (rc) == GPG_ERR_EOF)
         rc = -1; /* We need to use the old convention in the filter.  */
 
@@ -905,56 +1295,72 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
     }
   else if( control == IOBUFCTRL_UNDERFLOW )
     {
+      const byte *p;
+      size_t len, k, nhold, used;
+
       log_assert (a);
       log_assert (size > 44); /* Our code requires at least this size.  */
 
-      /* Get at least 22 bytes and put it ahead in the buffer.  */
-      n = fill_buffer (dfx, a, buf, 44, 22);
-      if (n == 44)
+      /* We decrypt directly from the buffer of the pipeline into BUF.
+       * The trailing 22 bytes are the MDC packet but we can't know
+       * where the data ends before we see the EOF.  Thus we keep the
+       * last 22 bytes of ciphertext in the holdback buffer and leave
+       * any input we can't process in the pipeline's buffer.  Once
+       * we returned data the holdback buffer is always full.  */
+      n = 0;
+      while (n < size && (p = borrow_input (dfx, a, (size_t)(-1), &len)))
         {
-          /* We have enough stuff - flush the holdback buffer.  */
-          if ( !dfx->holdbacklen )  /* First time. */
-            {
-              memcpy (buf, buf+22, 22);
-              n = 22;
-	    }
-          else
+          if (dfx->holdbacklen + len <= 22)
             {
-              memcpy (buf, dfx->holdback, 22);
-	    }
+              memcpy (dfx->holdback + dfx->holdbacklen, p, len);
+              dfx->holdbacklen += len;
+              consume_input (dfx, a, len);
+              continue;
+            }
 
-          /* Fill up the buffer. */
-          n = fill_buffer (dfx, a, buf, size, n);
+          /* Everything but the last 22 bytes is data.  Take it first
+           * from the holdback buffer and then from the input.  */
+          k = dfx->holdbacklen + len - 22;
+          if (k > size - n)
+            k = size - n;
+          nhold = k < dfx->holdbacklen? k : dfx->holdbacklen;
+          if (nhold)
+            {
+              memcpy (buf + n, dfx->holdback, nhold);
+              mdc_decrypt (dfx, buf + n, NULL, nhold);
+              dfx->holdbacklen -= nhold;
+              memmove (dfx->holdback, dfx->holdback + nhold,
+                       dfx->holdbacklen);
+              n += nhold;
+            }
+          used = k - nhold;
+          if (used)
+            {
+              mdc_decrypt (dfx, buf + n, p, used);
+              n += used;
+            }
 
-          /* Move the trailing 22 bytes back to the holdback buffer.  We
-             have at least 44 bytes thus a memmove is not needed.  */
-          n -= 22;
-          memcpy (dfx->holdback, buf+n, 22 );
+          /* Fill up the holdback buffer.  There are enough bytes
+           * left in the input because we kept 22 bytes back.  */
+          len = 22 - dfx->holdbacklen;
+          memcpy (dfx->holdback + dfx->holdbacklen, p + used, len);
           dfx->holdbacklen = 22;
-	}
-      else if ( !dfx->holdbacklen ) /* EOF seen but empty holdback. */
+          consume_input (dfx, a, used + len);
+        }
+
+      if (dfx->eof_seen && dfx->holdbacklen < 22)
         {
-          /* This is bad because it means an incomplete hash. */
-          n -= 22;
-          memcpy (buf, buf+22, n );
+          /* EOF seen but less than 22 bytes at all.  This is bad
+           * because it means an incomplete hash.  */
+          log_assert (!n);
+          n = dfx->holdbacklen;
+          memcpy (buf, dfx->holdback, n);
+          mdc_decrypt (dfx, buf, NULL, n);
+          dfx->holdbacklen = 0;
           dfx->eof_seen = 2; /* EOF with incomplete hash.  */
-	}
-      else  /* EOF seen (i.e. read less than 22 bytes). */
-        {
-          memcpy (buf, dfx->holdback, 22 );
-          n -= 22;
-          memcpy (dfx->holdback, buf+n, 22 );
-          dfx->eof_seen = 1; /* Normal EOF. */
-	}
+        }
 
-      if ( n )
-        {
-          if ( dfx->cipher_hd )
-            gcry_cipher_decrypt (dfx->cipher_hd, buf, n, NULL, 0);
-          if ( dfx->mdc_hash )
-            gcry_md_write (dfx->mdc_hash, buf, n);
-	}
-      else
+      if ( !n )
         {
           log_assert ( dfx->eof_seen );
           rc = -1; /* Return EOF.  */
@@ -989,15 +1395,23 @@ decode_filter( void *opaque, int control, IOBUF a, byte *buf, size_t *ret_len)
     }
   else if ( control == IOBUFCTRL_UNDERFLOW )
     {
+      const byte *p;
+      size_t len;
+
       log_assert (a);
 
-      n = fill_buffer (fc, a, buf, size, 0);
-      if (n)
+      /* Decrypt directly from the buffer of the pipeline into BUF.  */
+      n = 0;
+      while (n < size && (p = borrow_input (fc, a, size - n, &len)))
         {
           if (fc->cipher_hd)
-            gcry_cipher_decrypt (fc->cipher_hd, buf, n, NULL, 0);
+            gcry_cipher_decrypt (fc->cipher_hd, buf + n, len, p, len);
+          else
+            memcpy (buf + n, p, len);
+          consume_input (fc, a, len);
+          n += len;
         }
-      else
+      if (!n)
         {
           if (!fc->eof_seen)
             fc->eof_seen = 1;
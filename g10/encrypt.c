@@ -483,7 +483,7 @@ encrypt_simple (const char *filename, int mode, int use_seskey)
   if ( do_compress )
     {
       if (cfx.dek && (cfx.dek->use_mdc || cfx.dek->use_aead))
-        zfx.new_ctb = 1;
+        zfx.new_ctb = zfx.probe = 1;
       push_compress_filter (out, &zfx, default_compress_algo());
     }
 
@@ -962,7 +962,7 @@ encrypt_crypt (ctrl_t ctrl, int filefd, const char *filename,
       if (compr_algo)
         {
           if (cfx.dek && (cfx.dek->use_mdc || cfx.dek->use_aead))
-            zfx.new_ctb = 1;
+            zfx.new_ctb = zfx.probe = 1;
           push_compress_filter (out,&zfx,compr_algo);
         }
     }
@@ -76,11 +76,14 @@ struct compress_filter_context_s {
     void *opaque;   /* (used for z_stream) */
     byte *inbuf;
     unsigned inbufsize;
+    unsigned inbuflen;   /* Used length of INBUF for the probe. */
     byte *outbuf;
     unsigned outbufsize;
     int algo;	 /* compress algo */
     int algo1hack;
     int new_ctb;
+    int probe;   /* Don't compress data which looks incompressible. */
+    struct zip_parallel_s *parallel; /* Worker threads for deflate or NULL. */
     void (*release)(struct compress_filter_context_s*);
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
@@ -132,6 +135,9 @@ typedef struct
   size_t bufsize;  /* Allocated length.  */
   size_t buflen;   /* Used length.       */
 
+  /* The worker threads for parallel AEAD encryption or NULL.  */
+  struct aead_parallel_s *parallel;
+
 } cipher_filter_context_t;
 
 
@@ -145,8 +151,12 @@ typedef struct {
     int not_dash_escaped;
     int escape_from;
     gcry_md_hd_t md;
-    int pending_lf;
+    int pending_lf;	    /* number of CR,LF bytes still to output */
     int pending_esc;
+    unsigned line_len;	    /* rest of the current line to output */
+    unsigned trim_len;	    /* trailing bytes of that line to skip */
+    int skip_line;	    /* skip the rest of a truncated line */
+    int eof;		    /* EOF seen on input */
 } text_filter_context_t;
 
 
@@ -282,10 +282,43 @@ copy_signature( PKT_signature *d, PKT_signature *s )
 	d->numrevkeys=0;
 	parse_revkeys(d);
       }
+    /* The regexp points into the hashed area; use the copied one.  */
+    if (s->trust_regexp)
+      d->trust_regexp = parse_sig_subpkt (d, 1, SIGSUBPKT_REGEXP, NULL);
     return d;
 }
 
 
+/* Return a deep copy of the user id S.  The reference counter of the
+ * new user id is set to 1.  */
+PKT_user_id *
+copy_user_id (PKT_user_id *s)
+{
+  PKT_user_id *d;
+
+  d = xmalloc (sizeof *d + s->len);
+  memcpy (d, s, sizeof *d + s->len);
+  d->ref = 1;
+  d->attribs = NULL;
+  d->numattribs = 0;
+  if (s->attrib_data)
+    {
+      d->attrib_data = xmalloc (s->attrib_len? s->attrib_len : 1);
+      memcpy (d->attrib_data, s->attrib_data, s->attrib_len);
+      parse_attribute_subpkts (d);
+    }
+  if (s->namehash)
+    {
+      d->namehash = xmalloc (20);
+      memcpy (d->namehash, s->namehash, 20);
+    }
+  d->prefs = copy_prefs (s->prefs);
+  d->updateurl = s->updateurl? xstrdup (s->updateurl) : NULL;
+  d->mbox = s->mbox? xstrdup (s->mbox) : NULL;
+  return d;
+}
+
+
 /*
  * shallow copy of the user ID
  */
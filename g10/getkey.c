@@ -48,6 +48,14 @@
 #error We need the cache for key creation
 #endif
 
+/* The number of merged keyblocks kept in the keyblock cache; 0
+ * disables that cache.  */
+#define MAX_KEYBLOCK_CACHE_ENTRIES  (PK_UID_CACHE_SIZE / 16)
+/* The maximum number of seconds a cached keyblock is used.  Changes
+ * made to the database by other processes are only noticed after
+ * this time.  */
+#define KEYBLOCK_CACHE_TTL  60
+
 /* Flags values returned by the lookup code.  Note that the values are
  * directly used by the KEY_CONSIDERED status line.  */
 #define LOOKUP_NOT_SELECTED        (1<<0)
@@ -131,6 +139,20 @@ static int pk_cache_entries;	/* Number of entries in pk cache.  */
 static int pk_cache_disabled;
 #endif
 
+#if MAX_KEYBLOCK_CACHE_ENTRIES
+/* The keyblock cache keeps copies of keyblocks after merge_selfsigs
+ * has been run on them.  The list is ordered by last use.  */
+typedef struct kb_cache_entry
+{
+  struct kb_cache_entry *next;
+  u32 valid_until;     /* The entry may not be used at or after this time.  */
+  kbnode_t keyblock;   /* The merged keyblock.  */
+} *kb_cache_entry_t;
+static kb_cache_entry_t kb_cache;
+static int kb_cache_entries;	/* Number of entries in kb cache.  */
+static int kb_cache_disabled;
+#endif
+
 #if MAX_UID_CACHE_ENTRIES < 5
 #error we really need the userid cache
 #endif
@@ -240,6 +262,238 @@ cache_public_key (PKT_public_key * pk)
 }
 
 
+#if MAX_KEYBLOCK_CACHE_ENTRIES
+/* Return the time until which the merged KEYBLOCK may be used.  This
+ * is the time of the next expiration or the next creation time of a
+ * key, user id, or signature but at most KEYBLOCK_CACHE_TTL seconds
+ * from now.  */
+static u32
+kb_cache_valid_until (kbnode_t keyblock, u32 curtime)
+{
+  kbnode_t node;
+  u32 until = curtime + KEYBLOCK_CACHE_TTL;
+  u32 t1, t2;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      switch (node->pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+          t1 = node->pkt->pkt.public_key->timestamp;
+          t2 = node->pkt->pkt.public_key->expiredate;
+          break;
+        case PKT_USER_ID:
+          t1 = 0;
+          t2 = node->pkt->pkt.user_id->expiredate;
+          break;
+        case PKT_SIGNATURE:
+          t1 = node->pkt->pkt.signature->timestamp;
+          t2 = node->pkt->pkt.signature->expiredate;
+          break;
+        default:
+          continue;
+        }
+      if (t1 > curtime && t1 < until)
+        until = t1;
+      if (t2 > curtime && t2 < until)
+        until = t2;
+    }
+  return until;
+}
+
+
+/* Release the keyblock cache entry CE.  */
+static void
+kb_cache_release_entry (kb_cache_entry_t ce)
+{
+  release_kbnode (ce->keyblock);
+  xfree (ce);
+}
+
+
+/* Return the entry of the keyblock cache holding a key with the
+ * fingerprint FPR/FPRLEN or NULL if there is none.  Expired entries
+ * are removed while walking the list.  A found entry is moved to the
+ * front of the list.  */
+static kb_cache_entry_t
+kb_cache_find (const byte *fpr, size_t fprlen, u32 curtime)
+{
+  kb_cache_entry_t ce, ce_prev, ce_next;
+  kbnode_t node;
+  PKT_public_key *pk;
+
+  for (ce_prev = NULL, ce = kb_cache; ce; ce = ce_next)
+    {
+      ce_next = ce->next;
+      if (curtime >= ce->valid_until)
+        {
+          if (ce_prev)
+            ce_prev->next = ce_next;
+          else
+            kb_cache = ce_next;
+          kb_cache_release_entry (ce);
+          kb_cache_entries--;
+          continue;
+        }
+
+      for (node = ce->keyblock; node; node = node->next)
+        {
+          if (node->pkt->pkttype != PKT_PUBLIC_KEY
+              && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+            continue;
+          pk = node->pkt->pkt.public_key;
+          if (pk->fprlen == fprlen && !memcmp (pk->fpr, fpr, fprlen))
+            {
+              if (ce_prev)
+                {
+                  ce_prev->next = ce_next;
+                  ce->next = kb_cache;
+                  kb_cache = ce;
+                }
+              return ce;
+            }
+        }
+      ce_prev = ce;
+    }
+  return NULL;
+}
+#endif /*MAX_KEYBLOCK_CACHE_ENTRIES*/
+
+
+/* Store a copy of the merged KEYBLOCK in the keyblock cache.  An
+ * existing entry for the same primary key is replaced.  This cache
+ * is filled by lookup for searches which may only return one key and
+ * is read by get_pubkey_byfprint.  */
+static void
+kb_cache_put (kbnode_t keyblock)
+{
+#if MAX_KEYBLOCK_CACHE_ENTRIES
+  kb_cache_entry_t ce, ce_prev;
+  kbnode_t node, copy;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 curtime;
+
+  if (kb_cache_disabled)
+    return;
+
+  copy = copy_keyblock (keyblock);
+  if (!copy)
+    return;
+
+  /* Make sure that all fingerprints are computed so that they can be
+   * compared directly by kb_cache_find.  */
+  for (node = copy; node; node = node->next)
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+      fingerprint_from_pk (node->pkt->pkt.public_key, fpr, &fprlen);
+
+  /* Remove an older version of this keyblock.  FPR is still the
+   * fingerprint of the last key; that is good enough to find it.  */
+  curtime = make_timestamp ();
+  ce = kb_cache_find (fpr, fprlen, curtime);
+  if (ce)
+    {
+      kb_cache = ce->next;
+      kb_cache_release_entry (ce);
+      kb_cache_entries--;
+    }
+
+  if (kb_cache_entries >= MAX_KEYBLOCK_CACHE_ENTRIES)
+    {
+      /* Drop the least recently used entry.  */
+      for (ce_prev = NULL, ce = kb_cache; ce->next; ce = ce->next)
+        ce_prev = ce;
+      if (ce_prev)
+        ce_prev->next = NULL;
+      else
+        kb_cache = NULL;
+      kb_cache_release_entry (ce);
+      kb_cache_entries--;
+    }
+
+  ce = xmalloc (sizeof *ce);
+  ce->keyblock = copy;
+  ce->valid_until = kb_cache_valid_until (copy, curtime);
+  ce->next = kb_cache;
+  kb_cache = ce;
+  kb_cache_entries++;
+  if (DBG_CACHE)
+    log_debug ("keyblock cache: stored %s (%d entries)\n",
+               keystr_from_pk (copy->pkt->pkt.public_key), kb_cache_entries);
+#else
+  (void)keyblock;
+#endif
+}
+
+
+/* Return a copy of the cached keyblock with a key matching the
+ * fingerprint FPR/FPRLEN or NULL if it is not in the cache.  The node
+ * flag bit 0 is set for the matching key as done by
+ * keydb_get_keyblock.  */
+static kbnode_t
+kb_cache_get (const byte *fpr, size_t fprlen)
+{
+#if MAX_KEYBLOCK_CACHE_ENTRIES
+  kb_cache_entry_t ce;
+  kbnode_t node, keyblock;
+  PKT_public_key *pk;
+
+  if (kb_cache_disabled || !kb_cache)
+    return NULL;
+
+  ce = kb_cache_find (fpr, fprlen, make_timestamp ());
+  if (!ce)
+    return NULL;
+  keyblock = copy_keyblock (ce->keyblock);
+  if (!keyblock)
+    return NULL;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      node->flag &= ~3;
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      pk = node->pkt->pkt.public_key;
+      pk->flags.exact = 0;
+      if (pk->fprlen == fprlen && !memcmp (pk->fpr, fpr, fprlen))
+        node->flag |= 1;
+    }
+  if (DBG_CACHE)
+    log_debug ("keyblock cache: using %s\n",
+               keystr_from_pk (keyblock->pkt->pkt.public_key));
+  return keyblock;
+#else
+  (void)fpr;
+  (void)fprlen;
+  return NULL;
+#endif
+}
+
+
+/* Flush the keyblock cache.  This needs to be called whenever a
+ * keyblock is inserted, updated, or deleted.  */
+void
+getkey_flush_keyblock_cache (void)
+{
+#if MAX_KEYBLOCK_CACHE_ENTRIES
+  kb_cache_entry_t ce, ce2;
+
+  if (DBG_CACHE && kb_cache)
+    log_debug ("keyblock cache: flushing %d entries\n", kb_cache_entries);
+  for (ce = kb_cache; ce; ce = ce2)
+    {
+      ce2 = ce->next;
+      kb_cache_release_entry (ce);
+    }
+  kb_cache = NULL;
+  kb_cache_entries = 0;
+#endif
+}
+
+
 /* Return a const utf-8 string with the text "[User ID not found]".
    This function is required so that we don't need to switch gettext's
    encoding temporary.  */
@@ -257,8 +511,8 @@ user_id_not_found_utf8 (void)
 
 
 /* Disable and drop the public key cache (which is filled by
-   cache_public_key and get_pubkey).  Note: there is currently no way
-   to re-enable this cache.  */
+   cache_public_key and get_pubkey) and the keyblock cache.  Note:
+   there is currently no way to re-enable these caches.  */
 void
 getkey_disable_caches ()
 {
@@ -276,6 +530,10 @@ getkey_disable_caches ()
     pk_cache_entries = 0;
     pk_cache = NULL;
   }
+#endif
+  getkey_flush_keyblock_cache ();
+#if MAX_KEYBLOCK_CACHE_ENTRIES
+  kb_cache_disabled = 1;
 #endif
   /* fixme: disable user id cache ? */
 }
@@ -1844,6 +2102,30 @@ get_pubkey_byfprint (ctrl_t ctrl, PKT_public_key *pk, kbnode_t *r_keyblock,
       struct getkey_ctx_s ctx;
       KBNODE kb = NULL;
       KBNODE found_key = NULL;
+      unsigned int infoflags;
+
+      kb = kb_cache_get (fprint, fprint_len);
+      if (kb)
+        {
+          found_key = finish_lookup (kb, pk? pk->req_usage : 0, 1, 0,
+                                     &infoflags);
+          print_status_key_considered (kb, infoflags);
+          if (!found_key)
+            rc = GPG_ERR_UNUSABLE_PUBKEY;
+          else
+            {
+              rc = 0;
+              if (pk)
+                pk_from_block (pk, kb, found_key);
+              if (r_keyblock)
+                {
+                  *r_keyblock = kb;
+                  kb = NULL;
+                }
+            }
+          release_kbnode (kb);
+          return rc;
+        }
 
       memset (&ctx, 0, sizeof ctx);
       ctx.exact = 1;
@@ -3928,6 +4210,14 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
       /* Warning: node flag bits 0 and 1 should be preserved by
        * merge_selfsigs.  */
       merge_selfsigs (ctrl, keyblock);
+      /* Searches which can only return one key are the typical
+       * lookups for signature verification; remember the merged
+       * keyblock for the next get_pubkey_byfprint.  This needs to be
+       * done before finish_lookup modifies the keyblock.  */
+      if (ctx->nitems == 1
+          && (ctx->items[0].mode == KEYDB_SEARCH_MODE_FPR
+              || ctx->items[0].mode == KEYDB_SEARCH_MODE_LONG_KID))
+        kb_cache_put (keyblock);
       found_key = finish_lookup (keyblock, ctx->req_usage, ctx->exact,
                                  want_secret, &infoflags);
       print_status_key_considered (keyblock, infoflags);
@@ -62,6 +62,8 @@
 #include "call-dirmngr.h"
 #include "tofu.h"
 #include "objcache.h"
+#include "sigcache.h"
+#include "tdbio.h"
 #include "../common/init.h"
 #include "../common/mbox-util.h"
 #include "../common/shareddefs.h"
@@ -106,6 +108,7 @@ enum cmd_and_opt_values
     oMaxOutput,
     oInputSizeHint,
     oChunkSize,
+    oJobs,
     oSigNotation,
     oCertNotation,
     oShowNotation,
@@ -750,6 +753,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oMangleDosFilenames,      "mangle-dos-filenames", "@"),
   ARGPARSE_s_n (oNoMangleDosFilenames, "no-mangle-dos-filenames", "@"),
   ARGPARSE_s_i (oChunkSize, "chunk-size", "@"),
+  ARGPARSE_s_i (oJobs, "jobs", "@"),
   ARGPARSE_s_n (oNoSymkeyCache, "no-symkey-cache", "@"),
   ARGPARSE_s_n (oSkipVerify, "skip-verify", "@"),
   ARGPARSE_s_n (oListOnly, "list-only", "@"),
@@ -2371,6 +2375,9 @@ main (int argc, char **argv)
     int fpr_maybe_cmd = 0; /* --fingerprint maybe a command.  */
     int any_explicit_recipient = 0;
     int default_akl = 1;
+#ifdef USE_TOFU
+    int tofu_batch = 0;
+#endif
     int require_secmem = 0;
     int got_secmem = 0;
     struct assuan_malloc_hooks malloc_hooks;
@@ -2425,6 +2432,7 @@ main (int argc, char **argv)
     opt.command_fd = -1; /* no command fd */
     opt.compress_level = -1; /* defaults to standard compress level */
     opt.bz2_compress_level = -1; /* defaults to standard compress level */
+    opt.jobs = 1;
     /* note: if you change these lines, look at oOpenPGP */
     opt.def_cipher_algo = 0;
     opt.def_aead_algo = 0;
@@ -2748,6 +2756,10 @@ main (int argc, char **argv)
             opt.chunk_size = pargs.r.ret_int;
             break;
 
+          case oJobs:
+            opt.jobs = pargs.r.ret_int;
+            break;
+
 	  case oQuiet: opt.quiet = 1; break;
 	  case oNoTTY: tty_no_terminal(1); break;
 	  case oDryRun: opt.dry_run = 1; break;
@@ -4000,6 +4012,14 @@ main (int argc, char **argv)
         log_info (_("chunk size invalid - using %d\n"), opt.chunk_size);
       }
 
+    /* Check the number of jobs.  0 requests one job per CPU.  */
+    if (!opt.jobs)
+      opt.jobs = gnupg_get_ncpus ();
+    if (opt.jobs < 1)
+      opt.jobs = 1;
+    else if (opt.jobs > 64)
+      opt.jobs = 64;
+
     /* We don't support all possible commands with multifile yet */
     if(multifile)
       {
@@ -4325,6 +4345,26 @@ main (int argc, char **argv)
         break;
       }
 
+#ifdef USE_TOFU
+    /* Commands which may process many messages write their TOFU
+       updates in batch transactions.  */
+    switch (cmd)
+      {
+      case aNull:
+      case aVerify:
+      case aDecrypt:
+      case aEncr:
+      case aEncrSym:
+      case aSignEncr:
+      case aSignEncrSym:
+        tofu_begin_batch_update (ctrl);
+        tofu_batch = 1;
+        break;
+      default:
+        break;
+      }
+#endif /*USE_TOFU*/
+
     /* The command dispatcher.  */
     switch( cmd )
       {
@@ -5329,6 +5369,10 @@ main (int argc, char **argv)
       }
 
     /* cleanup */
+#ifdef USE_TOFU
+    if (tofu_batch)
+      tofu_end_batch_update (ctrl);
+#endif
     gpg_deinit_default_ctrl (ctrl);
     xfree (ctrl);
     release_armor_context (afx);
@@ -5364,7 +5408,11 @@ g10_exit( int rc )
     {
       keydb_dump_stats ();
       sig_check_dump_stats ();
+      sigcache_dump_stats ();
       objcache_dump_stats ();
+#ifndef NO_TRUST_MODELS
+      tdbio_dump_cache_stats ();
+#endif
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
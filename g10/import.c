@@ -494,6 +494,28 @@ import_included_key_block (ctrl_t ctrl, kbnode_t keyblock)
 
 
 
+/* Called for a new key queued during a bulk import which could not
+ * be stored.  OPAQUE is the statistics object.  */
+static void
+insert_error_cb (void *opaque, const byte *fpr, size_t fprlen,
+                 u32 *keyid, gpg_error_t err)
+{
+  struct import_stats_s *stats = opaque;
+  char buf[2 + 2*MAX_FINGERPRINT_LEN + 1];
+
+  log_error ("key %s: error storing keyblock: %s\n",
+             keystr (keyid), gpg_strerror (err));
+  strcpy (buf, "0 ");
+  bin2hex (fpr, fprlen, buf + 2);
+  write_status_text (STATUS_IMPORT_PROBLEM, buf);
+
+  /* The key has been counted as imported when it was queued.  */
+  if (stats->imported)
+    stats->imported--;
+  stats->not_imported++;
+}
+
+
 /*
  * Import the public keys from the given filename. Input may be armored.
  * This function rejects all keys which are not validly self signed on at
@@ -534,11 +556,14 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 {
   int i;
   gpg_error_t err = 0;
+  gpg_error_t err2;
   struct import_stats_s *stats = stats_handle;
 
   if (!stats)
     stats = import_new_stats_handle ();
 
+  keydb_set_insert_error_cb (insert_error_cb, stats);
+
   if (inp)
     {
       err = import (ctrl, inp, "[stream]", stats, fpr, fpr_len, options,
@@ -580,6 +605,18 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 	}
     }
 
+  /* Store the keys queued during a bulk import so that the
+   * statistics are correct.  */
+  err2 = keydb_flush_inserts (ctrl);
+  if (err2)
+    {
+      log_error ("error storing queued keyblocks: %s\n",
+                 gpg_strerror (err2));
+      if (!err)
+        err = err2;
+    }
+  keydb_set_insert_error_cb (NULL, NULL);
+
   if (!stats_handle)
     {
       if ((options & (IMPORT_SHOW | IMPORT_DRY_RUN))
@@ -2168,7 +2205,7 @@ import_one_real (ctrl_t ctrl,
 
           clear_ownertrusts (ctrl, pk);
           if (non_self)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
         }
 
       /* Release the handle and thus unlock the keyring asap.  */
@@ -2261,7 +2298,7 @@ import_one_real (ctrl_t ctrl,
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (err));
           else if (non_self)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
 
           /* Release the handle and thus unlock the keyring asap.  */
           keydb_release (hd);
@@ -357,6 +357,55 @@ move_kbnode( KBNODE *root, KBNODE node, KBNODE where )
 
 
 
+/* Return a deep copy of the keyblock ROOT including the node flags.
+ * Only keyblocks consisting of public keys, user ids, and signatures
+ * can be copied; for other keyblocks NULL is returned.  */
+kbnode_t
+copy_keyblock (kbnode_t root)
+{
+  kbnode_t node, newnode;
+  kbnode_t newroot = NULL;
+  kbnode_t *tailp = &newroot;
+  PACKET *pkt;
+
+  for (node = root; node; node = node->next)
+    {
+      if (is_deleted_kbnode (node))
+        continue;
+
+      pkt = xmalloc_clear (sizeof *pkt);
+      pkt->pkttype = node->pkt->pkttype;
+      switch (pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+          pkt->pkt.public_key = copy_public_key (NULL,
+                                                 node->pkt->pkt.public_key);
+          break;
+        case PKT_USER_ID:
+          pkt->pkt.user_id = copy_user_id (node->pkt->pkt.user_id);
+          break;
+        case PKT_SIGNATURE:
+          pkt->pkt.signature = copy_signature (NULL,
+                                               node->pkt->pkt.signature);
+          break;
+        default:
+          xfree (pkt);
+          release_kbnode (newroot);
+          return NULL;
+        }
+
+      newnode = new_kbnode (pkt);
+      newnode->flag = node->flag;
+      newnode->tag = node->tag;
+      *tailp = newnode;
+      tailp = &newnode->next;
+    }
+
+  return newroot;
+}
+
+
 
 void
 dump_kbnode (KBNODE node)
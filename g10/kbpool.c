@@ -0,0 +1,194 @@
+/* kbpool.c - Process keyblocks in worker threads
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A keyblock pool runs a work function on a sequence of keyblocks
+ * using up to --jobs worker threads.  The caller queues keyblocks
+ * with kbpool_put and takes them back with kbpool_get in the order
+ * they have been queued; thus the overall result is the same as
+ * with a plain loop.
+ *
+ * Note that most of gpg is not thread-safe.  All threads run under
+ * the global npth lock and a worker releases it only in pk_verify
+ * (see kbpool_active_p) while the actual public key operation is
+ * done by Libgcrypt.  Thus the work function may use the usual gpg
+ * functions, including key lookups, as long as it does not expect
+ * global state to stay the same across the verification of a
+ * signature.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/workpool.h"
+#include "packet.h"
+#include "keydb.h"
+#include "options.h"
+#include "kbpool.h"
+
+
+/* A slot holding one keyblock.  */
+struct kbpool_slot_s
+{
+  kbnode_t keyblock;
+  int result;           /* The value returned by the work function.  */
+};
+
+/* The pool.  */
+struct kbpool_s
+{
+  ctrl_t ctrl;
+  kbpool_fnc_t fnc;
+  void *opaque;
+  workpool_t workpool;
+  int nslots;
+  struct kbpool_slot_s *slots;
+};
+
+
+/* The number of pools with running workers.  */
+static int active_pools;
+
+
+/* Return true if worker threads are running and thus lengthy
+ * computations should release the global lock.  */
+int
+kbpool_active_p (void)
+{
+  return !!active_pools;
+}
+
+
+/* The work function for the work pool.  */
+static void
+kbpool_work (void *opaque, int worker, int slotidx)
+{
+  kbpool_t pool = opaque;
+  struct kbpool_slot_s *slot = pool->slots + slotidx;
+
+  (void)worker;
+  slot->result = pool->fnc (pool->ctrl, slot->keyblock, pool->opaque);
+}
+
+
+/* Create a pool which runs FNC with CTRL and OPAQUE on each queued
+ * keyblock.  Returns NULL if no worker threads shall be used or if
+ * they can't be started; the caller then needs to run FNC itself.  */
+kbpool_t
+kbpool_new (ctrl_t ctrl, kbpool_fnc_t fnc, void *opaque)
+{
+  gpg_error_t err;
+  kbpool_t pool;
+
+  if (opt.jobs < 2)
+    return NULL;
+
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return NULL;
+  pool->ctrl = ctrl;
+  pool->fnc = fnc;
+  pool->opaque = opaque;
+  /* Keyblocks differ a lot in the number of signatures; a few slots
+   * per worker keep the workers busy while a large one is done.  */
+  err = workpool_new (&pool->workpool, "keyblock-worker", opt.jobs,
+                      4 * opt.jobs, kbpool_work, pool);
+  if (err)
+    {
+      if (DBG_LOOKUP)
+        log_debug ("error starting keyblock workers: %s\n",
+                   gpg_strerror (err));
+      xfree (pool);
+      return NULL;
+    }
+  pool->nslots = workpool_nslots (pool->workpool);
+  pool->slots = xtrycalloc (pool->nslots, sizeof *pool->slots);
+  if (!pool->slots)
+    {
+      workpool_release (pool->workpool);
+      xfree (pool);
+      return NULL;
+    }
+  active_pools++;
+  if (DBG_LOOKUP)
+    log_debug ("using %d threads for keyblocks\n",
+               workpool_nworkers (pool->workpool));
+  return pool;
+}
+
+
+/* Terminate the workers of POOL and release it.  Keyblocks not yet
+ * taken are released.  */
+void
+kbpool_release (kbpool_t pool)
+{
+  int i;
+
+  if (!pool)
+    return;
+
+  workpool_release (pool->workpool);
+  active_pools--;
+  for (i=0; i < pool->nslots; i++)
+    release_kbnode (pool->slots[i].keyblock);
+  xfree (pool->slots);
+  xfree (pool);
+}
+
+
+/* Queue KEYBLOCK for processing.  The pool takes ownership of
+ * KEYBLOCK.  The caller must take a processed keyblock using
+ * kbpool_get after each call to this function.  */
+void
+kbpool_put (kbpool_t pool, kbnode_t keyblock)
+{
+  struct kbpool_slot_s *slot = pool->slots + workpool_fill (pool->workpool);
+
+  slot->keyblock = keyblock;
+  slot->result = 0;
+  workpool_queue (pool->workpool);
+}
+
+
+/* Return the oldest processed keyblock and store the value returned
+ * by the work function at R_RESULT.  If ALL is set wait until all
+ * queued keyblocks have been processed; else wait only if there is
+ * no free slot.  Returns NULL if there is no keyblock to take.  The
+ * caller owns the returned keyblock.  */
+kbnode_t
+kbpool_get (kbpool_t pool, int all, int *r_result)
+{
+  struct kbpool_slot_s *slot;
+  kbnode_t keyblock;
+  int slotidx;
+
+  slotidx = workpool_wait (pool->workpool, all);
+  if (slotidx == -1)
+    return NULL;
+  slot = pool->slots + slotidx;
+  keyblock = slot->keyblock;
+  *r_result = slot->result;
+  slot->keyblock = NULL;
+  workpool_pop (pool->workpool);
+
+  return keyblock;
+}
@@ -0,0 +1,37 @@
+/* kbpool.h - Process keyblocks in worker threads
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_KBPOOL_H
+#define GNUPG_G10_KBPOOL_H
+
+struct kbpool_s;
+typedef struct kbpool_s *kbpool_t;
+
+/* The work function run by the workers on each keyblock.  The
+ * returned value is passed back by kbpool_get.  */
+typedef int (*kbpool_fnc_t) (ctrl_t ctrl, kbnode_t keyblock, void *opaque);
+
+int kbpool_active_p (void);
+kbpool_t kbpool_new (ctrl_t ctrl, kbpool_fnc_t fnc, void *opaque);
+void kbpool_release (kbpool_t pool);
+void kbpool_put (kbpool_t pool, kbnode_t keyblock);
+kbnode_t kbpool_get (kbpool_t pool, int all, int *r_result);
+
+#endif /*GNUPG_G10_KBPOOL_H*/
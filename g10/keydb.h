@@ -194,6 +194,18 @@ gpg_error_t keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb);
 /* Insert a keyblock into one of the storage system.  */
 gpg_error_t keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
 
+/* Callback for a keyblock which was queued by keydb_insert_keyblock
+ * during a bulk import but could not be stored.  */
+typedef void (*keydb_insert_error_cb_t) (void *opaque,
+                                         const byte *fpr, size_t fprlen,
+                                         u32 *keyid, gpg_error_t err);
+
+/* Set the callback for errors storing queued keyblocks.  */
+void keydb_set_insert_error_cb (keydb_insert_error_cb_t cb, void *cb_arg);
+
+/* Store the keyblocks queued during a bulk import.  */
+gpg_error_t keydb_flush_inserts (ctrl_t ctrl);
+
 /* Delete the currently selected keyblock.  */
 gpg_error_t keydb_delete_keyblock (KEYDB_HANDLE hd);
 
@@ -327,6 +339,7 @@ void cache_public_key( PKT_public_key *pk );
 
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
+void getkey_flush_keyblock_cache (void);
 
 /* Return the public key used for signature SIG and store it at PK.  */
 gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
@@ -569,6 +582,7 @@ gpg_error_t hexkeygrip_from_pk (PKT_public_key *pk, char **r_grip);
 /*-- kbnode.c --*/
 KBNODE new_kbnode( PACKET *pkt );
 KBNODE clone_kbnode( KBNODE node );
+kbnode_t copy_keyblock (kbnode_t root);
 void release_kbnode( KBNODE n );
 void delete_kbnode( KBNODE node );
 void add_kbnode( KBNODE root, KBNODE node );
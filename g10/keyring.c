@@ -36,6 +36,8 @@
 #include "main.h" /*for check_key_signature()*/
 #include "../common/i18n.h"
 #include "../kbx/keybox.h"
+#include "kidfilter.h"
+#include "kbpool.h"
 
 
 typedef struct keyring_resource *KR_RESOURCE;
@@ -46,6 +48,8 @@ struct keyring_resource
   dotlock_t lockhd;
   int is_locked;
   int did_full_scan;
+  kidfilter_t filter;   /* The key ID filter or NULL.  */
+  int filter_loaded;    /* We already tried to load the filter.  */
   char fname[1];
 };
 typedef struct keyring_resource const * CONST_KR_RESOURCE;
@@ -177,6 +181,137 @@ key_present_hash_update_from_kb (key_present_hash_t tbl, KBNODE node)
     }
 }
 
+
+/* Return the resource for the keyring file FNAME; FNAME must be the
+ * name from a registered resource.  */
+static KR_RESOURCE
+resource_from_fname (const char *fname)
+{
+  KR_RESOURCE kr;
+
+  for (kr = kr_resources; kr; kr = kr->next)
+    if (kr->fname == fname)
+      return kr;
+  return NULL;
+}
+
+
+/* Return the key ID filter of KR if it is valid for the current
+ * content of the keyring.  */
+static kidfilter_t
+get_kidfilter (KR_RESOURCE kr)
+{
+  if (kr->filter && !kidfilter_current_p (kr->filter, kr->fname))
+    {
+      /* Another process may have changed the keyring and the
+       * filter; thus try to load it again.  */
+      kidfilter_release (kr->filter);
+      kr->filter = NULL;
+      kr->filter_loaded = 0;
+    }
+  if (!kr->filter && !kr->filter_loaded)
+    {
+      kr->filter = kidfilter_load (kr->fname);
+      kr->filter_loaded = 1;
+    }
+  return kr->filter;
+}
+
+
+/* Return true if the keyring FNAME has a valid key ID filter.  */
+static int
+have_kidfilter (const char *fname)
+{
+  KR_RESOURCE kr = resource_from_fname (fname);
+
+  return kr && get_kidfilter (kr);
+}
+
+
+/* Return true if the key ID filter of KR may be written to disk.
+ * The filter of a read-only resource is only kept in memory; this
+ * includes all keyrings used by gpgv, which may be system files.  */
+static int
+kidfilter_savable_p (KR_RESOURCE kr)
+{
+  return !kr->read_only && !gnupg_access (kr->fname, W_OK);
+}
+
+
+/* Update the key ID filter of the keyring FNAME after the keyblock KB
+ * has been written to it or a keyblock has been deleted (KB is NULL).
+ * WAS_CURRENT tells whether the filter was valid before the write.  */
+static void
+update_kidfilter (const char *fname, int was_current, kbnode_t kb)
+{
+  KR_RESOURCE kr = resource_from_fname (fname);
+  kbnode_t node;
+  u32 kid[2];
+
+  if (!kr || !kr->filter)
+    return;
+
+  if (was_current && kidfilter_savable_p (kr))
+    {
+      for (node = kb; node; node = node->next)
+        if (node->pkt->pkttype == PKT_PUBLIC_KEY
+            || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+          {
+            keyid_from_pk (node->pkt->pkt.public_key, kid);
+            kidfilter_add (kr->filter, kid);
+          }
+      if (!kidfilter_full_p (kr->filter)
+          && !kidfilter_save (kr->filter, kr->fname, NULL))
+        return;
+    }
+
+  /* The filter is rebuilt by the next full scan.  */
+  kidfilter_release (kr->filter);
+  kr->filter = NULL;
+}
+
+
+/* Build and save a new key ID filter for the keyring FNAME from the
+ * NKIDS key IDs in KIDS.  STAMP is the state of the keyring before
+ * the key IDs were collected.  */
+static void
+build_kidfilter (const char *fname, const kidfilter_stamp_t *stamp,
+                 u32 *kids, size_t nkids)
+{
+  KR_RESOURCE kr = resource_from_fname (fname);
+  kidfilter_t kf;
+  gpg_error_t err;
+  size_t n;
+
+  if (!kr || nkids > 0x7fffffff)
+    return;
+
+  kf = kidfilter_new (nkids);
+  for (n=0; n < nkids; n++)
+    kidfilter_add (kf, kids + 2*n);
+  if (kidfilter_savable_p (kr))
+    err = kidfilter_save (kf, fname, stamp);
+  else
+    {
+      /* If the keyring has been changed while we scanned it, the
+       * filter is dropped by the next get_kidfilter.  */
+      kidfilter_set_stamp (kf, stamp);
+      err = 0;
+    }
+  if (gpg_err_code (err) == GPG_ERR_CONFLICT)
+    {
+      /* The keyring was changed while we scanned it.  */
+      kidfilter_release (kf);
+      return;
+    }
+  /* On other errors (e.g. a read-only directory) we can still use
+   * the filter in this process.  */
+  kidfilter_release (kr->filter);
+  kr->filter = kf;
+  kr->filter_loaded = 1;
+}
+
+
 /*
  * Register a filename for plain keyring files.  ptr is set to a
  * pointer to be used to create a handles etc, or the already-issued
@@ -210,6 +345,8 @@ keyring_register_filename (const char *fname, int read_only, void **ptr)
     kr->lockhd = NULL;
     kr->is_locked = 0;
     kr->did_full_scan = 0;
+    kr->filter = NULL;
+    kr->filter_loaded = 0;
     /* keep a list of all issued pointers */
     kr->next = kr_resources;
     kr_resources = kr;
@@ -531,6 +668,7 @@ int
 keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb)
 {
     int rc;
+    int filter_current;
 
     if (!hd->found.kr)
         return -1; /* no successful prior search */
@@ -556,9 +694,11 @@ keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb)
     hd->current.iobuf = NULL;
 
     /* do the update */
+    filter_current = have_kidfilter (hd->found.kr->fname);
     rc = do_copy (3, hd->found.kr->fname, kb,
                   hd->found.offset, hd->found.n_packets );
     if (!rc) {
+      update_kidfilter (hd->found.kr->fname, filter_current, kb);
       if (key_present_hash)
         {
           key_present_hash_update_from_kb (key_present_hash, kb);
@@ -575,6 +715,7 @@ keyring_insert_keyblock (KEYRING_HANDLE hd, KBNODE kb)
 {
     int rc;
     const char *fname;
+    int filter_current;
 
     if (!hd)
         fname = NULL;
@@ -604,7 +745,10 @@ keyring_insert_keyblock (KEYRING_HANDLE hd, KBNODE kb)
     hd->current.iobuf = NULL;
 
     /* do the insert */
+    filter_current = have_kidfilter (fname);
     rc = do_copy (1, fname, kb, 0, 0 );
+    if (!rc)
+      update_kidfilter (fname, filter_current, kb);
     if (!rc && key_present_hash)
       {
         key_present_hash_update_from_kb (key_present_hash, kb);
@@ -618,6 +762,7 @@ int
 keyring_delete_keyblock (KEYRING_HANDLE hd)
 {
     int rc;
+    int filter_current;
 
     if (!hd->found.kr)
         return -1; /* no successful prior search */
@@ -644,9 +789,11 @@ keyring_delete_keyblock (KEYRING_HANDLE hd)
     hd->current.iobuf = NULL;
 
     /* do the delete */
+    filter_current = have_kidfilter (hd->found.kr->fname);
     rc = do_copy (2, hd->found.kr->fname, NULL,
                   hd->found.offset, hd->found.n_packets );
     if (!rc) {
+        update_kidfilter (hd->found.kr->fname, filter_current, NULL);
         /* better reset the found info */
         hd->found.kr = NULL;
         hd->found.offset = 0;
@@ -973,6 +1120,13 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   int initial_skip;
   int scanned_from_start;
   int use_key_present_hash;
+  int filterable;
+  int have_filter_stamp = 0;
+  KR_RESOURCE filter_kr;
+  u32 *filter_kids = NULL;     /* Key IDs collected to build a filter.  */
+  size_t filter_nkids = 0;
+  size_t filter_size = 0;
+  kidfilter_stamp_t filter_stamp;
   PKT_user_id *uid = NULL;
   PKT_public_key *pk = NULL;
   u32 aki[2];
@@ -980,8 +1134,12 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
   /* figure out what information we need */
   need_uid = need_words = need_keyid = need_fpr = any_skip = need_grip = 0;
+  filterable = !!ndesc;
   for (n=0; n < ndesc; n++)
     {
+      if (desc[n].mode != KEYDB_SEARCH_MODE_LONG_KID
+          && desc[n].mode != KEYDB_SEARCH_MODE_FPR)
+        filterable = 0;
       switch (desc[n].mode)
         {
         case KEYDB_SEARCH_MODE_EXACT:
@@ -1022,6 +1180,12 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     log_debug ("%s: need_uid = %d; need_words = %d; need_keyid = %d; need_fpr = %d; any_skip = %d\n",
                __func__, need_uid, need_words, need_keyid, need_fpr, any_skip);
 
+  /* Take the state of the keyring before it is opened so that a
+   * change while we scan it is detected.  */
+  if (filterable && !any_skip && !hd->current.iobuf && hd->resource
+      && !kidfilter_get_stamp (hd->resource->fname, &filter_stamp))
+    have_filter_stamp = 1;
+
   rc = prepare_search (hd);
   if (rc)
     {
@@ -1067,6 +1231,32 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
        */
     }
 
+  /* For key ID and fingerprint searches the key ID filter can tell
+   * us that the key is not in this keyring.  If there is no valid
+   * filter and we are going to scan the entire keyring, we build
+   * one.  */
+  filter_kr = (filterable && !any_skip && hd->current.kr)
+               ? resource_from_fname (hd->current.kr->fname) : NULL;
+  if (filter_kr && get_kidfilter (filter_kr))
+    {
+      if (kidfilter_rules_out (filter_kr->filter, desc, ndesc))
+        {
+          if (DBG_LOOKUP)
+            log_debug ("%s: key ID filter says not present\n", __func__);
+          hd->found.kr = NULL;
+          hd->current.eof = 1;
+          return -1;
+        }
+    }
+  else if (filter_kr && have_filter_stamp
+           && !iobuf_tell (hd->current.iobuf))
+    {
+      filter_size = 1024;
+      filter_kids = xtrymalloc (filter_size * 2 * sizeof *filter_kids);
+      if (filter_kids)
+        need_keyid = 1;
+    }
+
   if (need_words)
     {
       const char *name = NULL;
@@ -1154,6 +1344,33 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
               && !key_present_hash_ready
               && scanned_from_start)
             key_present_hash_update (key_present_hash, aki);
+
+          if (filter_kids)
+            {
+              if (filter_nkids == filter_size)
+                {
+                  u32 *tmp;
+
+                  tmp = xtryrealloc (filter_kids, (filter_size * 2)
+                                     * 2 * sizeof *filter_kids);
+                  if (!tmp)
+                    {
+                      xfree (filter_kids);
+                      filter_kids = NULL;
+                    }
+                  else
+                    {
+                      filter_kids = tmp;
+                      filter_size *= 2;
+                    }
+                }
+              if (filter_kids)
+                {
+                  filter_kids[2*filter_nkids] = aki[0];
+                  filter_kids[2*filter_nkids+1] = aki[1];
+                  filter_nkids++;
+                }
+            }
         }
       else if (pkt.pkttype == PKT_USER_ID)
         {
@@ -1284,6 +1501,10 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
           if (!kr)
             key_present_hash_ready = 1;
         }
+
+      if (filter_kids && scanned_from_start)
+        build_kidfilter (hd->current.kr->fname, &filter_stamp,
+                         filter_kids, filter_nkids);
     }
   else
     {
@@ -1293,6 +1514,7 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       hd->current.error = rc;
     }
 
+  xfree (filter_kids);
   free_packet (&pkt, &parsectx);
   deinit_parse_packet (&parsectx);
   set_packet_list_mode(save_mode);
@@ -1413,6 +1635,88 @@ write_keyblock (IOBUF fp, KBNODE keyblock)
   return 0;
 }
 
+/* Check all signatures of KEYBLOCK to set the signature's cache
+ * flags.  Returns the number of signatures.  This is also used as
+ * the work function for the keyblock pool.  */
+static int
+rebuild_check_keyblock (ctrl_t ctrl, kbnode_t keyblock, void *opaque)
+{
+  kbnode_t node;
+  int sigcount = 0;
+
+  (void)opaque;
+
+  for (node=keyblock; node; node=node->next)
+    {
+      /* Note that this doesn't cache the result of a
+         revocation issued by a designated revoker.  This is
+         because the pk in question does not carry the revkeys
+         as we haven't merged the key and selfsigs.  It is
+         questionable whether this matters very much since
+         there are very very few designated revoker revocation
+         packets out there. */
+      if (node->pkt->pkttype == PKT_SIGNATURE)
+        {
+          PKT_signature *sig=node->pkt->pkt.signature;
+
+          if(!opt.no_sig_cache && sig->flags.checked && sig->flags.valid
+             && (openpgp_md_test_algo(sig->digest_algo)
+                 || openpgp_pk_test_algo(sig->pubkey_algo)))
+            sig->flags.checked=sig->flags.valid=0;
+          else
+            check_key_signature (ctrl, keyblock, node, NULL);
+
+          sigcount++;
+        }
+    }
+
+  return sigcount;
+}
+
+
+/* Write the checked KEYBLOCK to the temporary file FP and show the
+ * progress.  */
+static int
+write_rebuilt_keyblock (IOBUF fp, kbnode_t keyblock,
+                        ulong *count, ulong sigcount, int noisy)
+{
+  int rc;
+
+  rc = write_keyblock (fp, keyblock);
+  if (rc)
+    return rc;
+
+  if ( !(++*count % 50) && noisy && !opt.quiet)
+    log_info (ngettext("%lu keys cached so far (%lu signature)\n",
+                       "%lu keys cached so far (%lu signatures)\n",
+                       sigcount),
+              *count, sigcount);
+  return 0;
+}
+
+
+/* Take the keyblocks checked by the workers of POOL and write them
+ * in their original order to FP.  If ALL is set wait for all
+ * keyblocks still in the pool.  */
+static int
+write_rebuilt_keyblocks (kbpool_t pool, int all, IOBUF fp,
+                         ulong *count, ulong *sigcount, int noisy)
+{
+  kbnode_t keyblock;
+  int n, rc;
+
+  while ((keyblock = kbpool_get (pool, all, &n)))
+    {
+      *sigcount += n;
+      rc = write_rebuilt_keyblock (fp, keyblock, count, *sigcount, noisy);
+      release_kbnode (keyblock);
+      if (rc)
+        return rc;
+    }
+  return 0;
+}
+
+
 /*
  * Walk over all public keyrings, check the signatures and replace the
  * keyring with a new one where the signature cache is then updated.
@@ -1423,17 +1727,20 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
 {
   KEYRING_HANDLE hd;
   KEYDB_SEARCH_DESC desc;
-  KBNODE keyblock = NULL, node;
+  KBNODE keyblock = NULL;
   const char *lastresname = NULL, *resname;
   IOBUF tmpfp = NULL;
   char *tmpfilename = NULL;
   char *bakfilename = NULL;
+  kbpool_t pool;
   int rc;
   ulong count = 0, sigcount = 0;
 
   hd = keyring_new (token);
   if (!hd)
     return gpg_error_from_syserror ();
+  /* With --jobs the signatures are checked by worker threads.  */
+  pool = kbpool_new (ctrl, rebuild_check_keyblock, NULL);
   memset (&desc, 0, sizeof desc);
   desc.mode = KEYDB_SEARCH_MODE_FIRST;
 
@@ -1453,6 +1760,13 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
         { /* we have switched to a new keyring - commit changes */
           if (tmpfp)
             {
+              if (pool)
+                {
+                  rc = write_rebuilt_keyblocks (pool, 1, tmpfp,
+                                                &count, &sigcount, noisy);
+                  if (rc)
+                    goto leave;
+                }
               if (iobuf_close (tmpfp))
                 {
                   rc = gpg_error_from_syserror ();
@@ -1517,41 +1831,23 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
         }
       else
         {
-          /* Check all signature to set the signature's cache flags. */
-          for (node=keyblock; node; node=node->next)
+          if (pool)
             {
-              /* Note that this doesn't cache the result of a
-                 revocation issued by a designated revoker.  This is
-                 because the pk in question does not carry the revkeys
-                 as we haven't merged the key and selfsigs.  It is
-                 questionable whether this matters very much since
-                 there are very very few designated revoker revocation
-                 packets out there. */
-              if (node->pkt->pkttype == PKT_SIGNATURE)
-                {
-                  PKT_signature *sig=node->pkt->pkt.signature;
-
-                  if(!opt.no_sig_cache && sig->flags.checked && sig->flags.valid
-                     && (openpgp_md_test_algo(sig->digest_algo)
-                         || openpgp_pk_test_algo(sig->pubkey_algo)))
-                    sig->flags.checked=sig->flags.valid=0;
-                  else
-                    check_key_signature (ctrl, keyblock, node, NULL);
-
-                  sigcount++;
-                }
+              /* Let a worker check the signatures and write out the
+               * keyblocks which are ready.  */
+              kbpool_put (pool, keyblock);
+              keyblock = NULL;
+              rc = write_rebuilt_keyblocks (pool, 0, tmpfp,
+                                            &count, &sigcount, noisy);
+            }
+          else
+            {
+              sigcount += rebuild_check_keyblock (ctrl, keyblock, NULL);
+              rc = write_rebuilt_keyblock (tmpfp, keyblock,
+                                           &count, sigcount, noisy);
             }
-
-          /* Write the keyblock to the temporary file.  */
-          rc = write_keyblock (tmpfp, keyblock);
           if (rc)
             goto leave;
-
-          if ( !(++count % 50) && noisy && !opt.quiet)
-            log_info (ngettext("%lu keys cached so far (%lu signature)\n",
-                               "%lu keys cached so far (%lu signatures)\n",
-                               sigcount),
-                      count, sigcount);
         }
     } /* end main loop */
   if (rc == -1)
@@ -1561,6 +1857,12 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
       log_error ("keyring_search failed: %s\n", gpg_strerror (rc));
       goto leave;
     }
+  if (pool)
+    {
+      rc = write_rebuilt_keyblocks (pool, 1, tmpfp, &count, &sigcount, noisy);
+      if (rc)
+        goto leave;
+    }
 
   if (noisy || opt.verbose)
     {
@@ -1594,6 +1896,7 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
   xfree (tmpfilename);
   xfree (bakfilename);
   release_kbnode (keyblock);
+  kbpool_release (pool);
   keyring_lock (hd, 0);
   keyring_release (hd);
   return rc;
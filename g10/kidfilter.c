@@ -0,0 +1,429 @@
+/* kidfilter.c - Bloom filter to quickly rule out key IDs
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A key ID filter is a Bloom filter over the long key IDs of all
+ * primary keys and subkeys in a keyring.  It is stored next to the
+ * keyring with the suffix ".flt":
+ *
+ *  - b4   Magic 'KIDf'
+ *  - byte Version number (1)
+ *  - byte Number of hash functions
+ *  - u16  RFU
+ *  - u64  Size of the keyring file
+ *  - u64  Modification time of the keyring file
+ *  - u32  Nanoseconds of the modification time or 0
+ *  - u32  RFU
+ *  - u64  Inode number of the keyring file
+ *  - u32  [NBITS] Number of bits in the filter; a power of 2.
+ *  - u32  Number of key IDs added to the filter.
+ *  - NBITS/8 bytes with the filter bits.
+ *
+ * The filter is only used if the size, the modification time and the
+ * inode number of the keyring match the values stored in the header.
+ * The inode changes when the keyring is replaced by a rename, as
+ * done by all our updates; the nanoseconds catch most changes within
+ * the same second.  Because a
+ * fingerprint search can be mapped to a key ID, the filter answers
+ * "definitely not present" for key ID and fingerprint searches
+ * without scanning the keyring.  Keys are never removed from the
+ * filter; deleted keys merely increase the false positive rate until
+ * the filter is rebuilt.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "keydb.h"
+#include "options.h"
+#include "kidfilter.h"
+
+#define FILTER_HEADER_LEN 48
+#define FILTER_VERSION    1
+
+/* With 10 bits per key and 7 hash functions the false positive rate
+ * is below 1%.  */
+#define FILTER_BITS_PER_KEY  10
+#define FILTER_NHASHES       7
+/* A new filter is sized for twice the number of keys but at least
+ * for this many.  */
+#define FILTER_MIN_KEYS      1024
+
+
+struct kidfilter_s
+{
+  u32 nbits;          /* Number of bits; a power of 2.  */
+  u32 nkeys;          /* Number of key IDs added.  */
+  kidfilter_stamp_t stamp;  /* The keyring described by the filter.  */
+  unsigned char bits[1];
+};
+
+
+static uint64_t
+get64 (const unsigned char *a)
+{
+  return (((uint64_t)buf32_to_u32 (a)) << 32) | buf32_to_u32 (a + 4);
+}
+
+static void
+put64 (unsigned char *a, uint64_t value)
+{
+  a[0] = value >> 56;
+  a[1] = value >> 48;
+  a[2] = value >> 40;
+  a[3] = value >> 32;
+  a[4] = value >> 24;
+  a[5] = value >> 16;
+  a[6] = value >> 8;
+  a[7] = value;
+}
+
+
+/* Return the name of the filter file for the keyring FNAME with
+ * SUFFIX appended.  */
+static char *
+filter_fname (const char *fname, const char *suffix)
+{
+  return xstrconcat (fname, EXTSEP_S "flt", suffix, NULL);
+}
+
+
+/* Store the size, modification time and inode number of the keyring
+ * FNAME at R_STAMP.  */
+gpg_error_t
+kidfilter_get_stamp (const char *fname, kidfilter_stamp_t *r_stamp)
+{
+  struct stat st;
+
+  if (gnupg_stat (fname, &st))
+    return gpg_error_from_syserror ();
+  r_stamp->size = st.st_size;
+  r_stamp->mtime = st.st_mtime;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  r_stamp->mtime_nsec = st.st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  r_stamp->mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+  r_stamp->mtime_nsec = 0;
+#endif
+  r_stamp->ino = st.st_ino;
+  return 0;
+}
+
+
+/* Return true if the stamps A and B are equal.  */
+static int
+same_stamp_p (const kidfilter_stamp_t *a, const kidfilter_stamp_t *b)
+{
+  return (a->size == b->size && a->mtime == b->mtime
+          && a->mtime_nsec == b->mtime_nsec && a->ino == b->ino);
+}
+
+
+/* Compute the two base hashes for KID.  The key IDs are already
+ * uniformly distributed, but the bits are mixed anyway so that
+ * crafted key IDs can't easily fill a single region.  */
+static void
+hash_kid (u32 *kid, u32 *r_h1, u32 *r_h2)
+{
+  uint64_t h = (((uint64_t)kid[0]) << 32) | kid[1];
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  *r_h1 = h;
+  *r_h2 = (h >> 32) | 1;
+}
+
+
+/* Create a new and empty filter sized for NKEYS keys.  */
+kidfilter_t
+kidfilter_new (unsigned int nkeys)
+{
+  kidfilter_t kf;
+  uint64_t want;
+  u32 nbits;
+
+  want = (uint64_t)(nkeys < FILTER_MIN_KEYS/2? FILTER_MIN_KEYS : 2*nkeys)
+         * FILTER_BITS_PER_KEY;
+  for (nbits = 8; nbits < want && nbits < 0x80000000; nbits <<= 1)
+    ;
+  kf = xcalloc (1, sizeof *kf + nbits/8);
+  kf->nbits = nbits;
+  return kf;
+}
+
+
+void
+kidfilter_release (kidfilter_t kf)
+{
+  xfree (kf);
+}
+
+
+/* Add the key ID KID to the filter KF.  */
+void
+kidfilter_add (kidfilter_t kf, u32 *kid)
+{
+  u32 h1, h2, bit;
+  int i;
+
+  hash_kid (kid, &h1, &h2);
+  for (i=0; i < FILTER_NHASHES; i++)
+    {
+      bit = (h1 + i * h2) & (kf->nbits - 1);
+      kf->bits[bit / 8] |= 1 << (bit % 8);
+    }
+  kf->nkeys++;
+}
+
+
+/* Return false if KID is definitely not in the filter KF.  */
+int
+kidfilter_test (kidfilter_t kf, u32 *kid)
+{
+  u32 h1, h2, bit;
+  int i;
+
+  hash_kid (kid, &h1, &h2);
+  for (i=0; i < FILTER_NHASHES; i++)
+    {
+      bit = (h1 + i * h2) & (kf->nbits - 1);
+      if (!(kf->bits[bit / 8] & (1 << (bit % 8))))
+        return 0;
+    }
+  return 1;
+}
+
+
+/* Return true if more keys have been added to KF than it has been
+ * sized for.  Such a filter should be rebuilt.  */
+int
+kidfilter_full_p (kidfilter_t kf)
+{
+  return kf->nkeys > kf->nbits / FILTER_BITS_PER_KEY;
+}
+
+
+/* Return true if the filter KF proves that none of the NDESC search
+ * descriptions in DESC can match.  Only key ID and fingerprint
+ * searches can be ruled out.  */
+int
+kidfilter_rules_out (kidfilter_t kf, KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  u32 kid[2];
+  size_t n;
+
+  for (n=0; n < ndesc; n++)
+    {
+      if (desc[n].skipfnc)
+        return 0;
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          if (kidfilter_test (kf, desc[n].u.kid))
+            return 0;
+          break;
+
+        case KEYDB_SEARCH_MODE_FPR:
+          /* A 20 byte fingerprint may also be the prefix of a v5
+           * fingerprint; thus we need to check both key IDs.  */
+          if (desc[n].fprlen == 20)
+            {
+              kid[0] = buf32_to_u32 (desc[n].u.fpr+12);
+              kid[1] = buf32_to_u32 (desc[n].u.fpr+16);
+              if (kidfilter_test (kf, kid))
+                return 0;
+            }
+          else if (desc[n].fprlen != 32)
+            return 0;
+          kid[0] = buf32_to_u32 (desc[n].u.fpr);
+          kid[1] = buf32_to_u32 (desc[n].u.fpr+4);
+          if (kidfilter_test (kf, kid))
+            return 0;
+          break;
+
+        default:
+          return 0;
+        }
+    }
+  return 1;
+}
+
+
+/* Return true if KF describes the current state of the keyring
+ * FNAME.  */
+int
+kidfilter_current_p (kidfilter_t kf, const char *fname)
+{
+  kidfilter_stamp_t stamp;
+
+  if (kidfilter_get_stamp (fname, &stamp))
+    return 0;
+  return same_stamp_p (&kf->stamp, &stamp);
+}
+
+
+/* Set the state of the keyring described by KF to STAMP.  This is
+ * used for a filter which is only kept in memory.  */
+void
+kidfilter_set_stamp (kidfilter_t kf, const kidfilter_stamp_t *stamp)
+{
+  kf->stamp = *stamp;
+}
+
+
+/* Read the filter for the keyring FNAME.  Returns NULL if there is
+ * no filter or it does not match the current state of the
+ * keyring.  */
+kidfilter_t
+kidfilter_load (const char *fname)
+{
+  char *fltfname;
+  estream_t fp;
+  unsigned char header[FILTER_HEADER_LEN];
+  kidfilter_t kf = NULL;
+  kidfilter_stamp_t stamp;
+  u32 nbits;
+
+  if (kidfilter_get_stamp (fname, &stamp))
+    return NULL;
+
+  fltfname = filter_fname (fname, NULL);
+  fp = es_fopen (fltfname, "rb");
+  if (!fp)
+    goto leave;
+
+  if (es_fread (header, sizeof header, 1, fp) != 1
+      || memcmp (header, "KIDf", 4)
+      || header[4] != FILTER_VERSION
+      || header[5] != FILTER_NHASHES
+      || get64 (header + 8) != stamp.size
+      || get64 (header + 16) != stamp.mtime
+      || buf32_to_u32 (header + 24) != stamp.mtime_nsec
+      || get64 (header + 32) != stamp.ino)
+    goto leave;
+
+  nbits = buf32_to_u32 (header + 40);
+  if (nbits < 8 || (nbits & (nbits - 1)))
+    goto leave;
+
+  kf = xtrycalloc (1, sizeof *kf + nbits/8);
+  if (!kf)
+    goto leave;
+  kf->nbits = nbits;
+  kf->nkeys = buf32_to_u32 (header + 44);
+  kf->stamp = stamp;
+  if (es_fread (kf->bits, nbits/8, 1, fp) != 1)
+    {
+      xfree (kf);
+      kf = NULL;
+    }
+
+ leave:
+  if (DBG_LOOKUP)
+    log_debug ("kidfilter: %s '%s'\n", kf? "using":"no valid", fltfname);
+  if (fp)
+    es_fclose (fp);
+  xfree (fltfname);
+  return kf;
+}
+
+
+/* Write the filter KF for the keyring FNAME.  If STAMP is NULL the
+ * filter is stamped with the current size and modification time of
+ * the keyring; this may only be done with the keyring locked and if
+ * KF reflects its current content.  If STAMP is given, it is the
+ * state of the keyring at the time the filter was built and the
+ * filter is only written if the keyring has not been changed since
+ * then.  */
+gpg_error_t
+kidfilter_save (kidfilter_t kf, const char *fname,
+                const kidfilter_stamp_t *stamp)
+{
+  gpg_error_t err;
+  char *fltfname, *tmpfname;
+  unsigned char header[FILTER_HEADER_LEN];
+  estream_t fp;
+  kidfilter_stamp_t curstamp;
+
+  err = kidfilter_get_stamp (fname, &curstamp);
+  if (err)
+    return err;
+  if (stamp && !same_stamp_p (stamp, &curstamp))
+    return gpg_error (GPG_ERR_CONFLICT);
+  kf->stamp = curstamp;
+
+  fltfname = filter_fname (fname, NULL);
+  tmpfname = filter_fname (fname, EXTSEP_S "tmp");
+
+  memset (header, 0, sizeof header);
+  memcpy (header, "KIDf", 4);
+  header[4] = FILTER_VERSION;
+  header[5] = FILTER_NHASHES;
+  put64 (header + 8, kf->stamp.size);
+  put64 (header + 16, kf->stamp.mtime);
+  ulongtobuf (header + 24, kf->stamp.mtime_nsec);
+  put64 (header + 32, kf->stamp.ino);
+  ulongtobuf (header + 40, kf->nbits);
+  ulongtobuf (header + 44, kf->nkeys);
+
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fwrite (header, sizeof header, 1, fp) != 1
+      || es_fwrite (kf->bits, kf->nbits/8, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  err = gnupg_rename_file (tmpfname, fltfname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+  else if (DBG_LOOKUP)
+    log_debug ("kidfilter: wrote '%s' (%u keys, %u bits)\n",
+               fltfname, kf->nkeys, kf->nbits);
+
+ leave:
+  xfree (tmpfname);
+  xfree (fltfname);
+  return err;
+}
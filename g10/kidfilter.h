@@ -0,0 +1,53 @@
+/* kidfilter.h - Bloom filter to quickly rule out key IDs
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_KIDFILTER_H
+#define GNUPG_G10_KIDFILTER_H
+
+struct kidfilter_s;
+typedef struct kidfilter_s *kidfilter_t;
+
+/* The state of a keyring file as used to check whether a filter is
+ * still valid.  */
+typedef struct
+{
+  uint64_t size;
+  uint64_t mtime;
+  uint32_t mtime_nsec;  /* 0 if not supported.  */
+  uint64_t ino;
+} kidfilter_stamp_t;
+
+gpg_error_t kidfilter_get_stamp (const char *fname,
+                                 kidfilter_stamp_t *r_stamp);
+
+kidfilter_t kidfilter_new (unsigned int nkeys);
+void kidfilter_release (kidfilter_t kf);
+void kidfilter_add (kidfilter_t kf, u32 *kid);
+int kidfilter_test (kidfilter_t kf, u32 *kid);
+int kidfilter_full_p (kidfilter_t kf);
+int kidfilter_rules_out (kidfilter_t kf, KEYDB_SEARCH_DESC *desc,
+                         size_t ndesc);
+int kidfilter_current_p (kidfilter_t kf, const char *fname);
+void kidfilter_set_stamp (kidfilter_t kf, const kidfilter_stamp_t *stamp);
+kidfilter_t kidfilter_load (const char *fname);
+gpg_error_t kidfilter_save (kidfilter_t kf, const char *fname,
+                            const kidfilter_stamp_t *stamp);
+
+#endif /*GNUPG_G10_KIDFILTER_H*/
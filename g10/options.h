@@ -62,6 +62,9 @@ struct
   /* The AEAD chunk size expressed as a power of 2.  */
   int chunk_size;
 
+  /* The maximum number of threads used to process bulk data.  */
+  int jobs;
+
   int dry_run;
   int autostart;
   int list_only;
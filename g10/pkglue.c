@@ -23,12 +23,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/util.h"
 #include "pkglue.h"
 #include "main.h"
 #include "options.h"
+#include "kbpool.h"
 
 /* FIXME: Better change the function name because mpi_ is used by
    gcrypt macros.  */
@@ -329,7 +331,17 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
     BUG ();
 
   if (!rc)
-    rc = gcry_pk_verify (s_sig, s_hash, s_pkey);
+    {
+      /* While keyblock workers are running let the other threads
+       * proceed during the public key operation.  */
+      int unprotect = kbpool_active_p ();
+
+      if (unprotect)
+        npth_unprotect ();
+      rc = gcry_pk_verify (s_sig, s_hash, s_pkey);
+      if (unprotect)
+        npth_protect ();
+    }
 
   gcry_sexp_release (s_sig);
   gcry_sexp_release (s_hash);
@@ -291,17 +291,19 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 	}
       else  /* Binary mode.  */
 	{
-	  byte *buffer = xmalloc (32768);
+	  /* Hash and write the data directly from the buffer of the
+	   * pipeline; this saves a copy.  */
+	  const byte *buffer;
+	  size_t len;
+
 	  while (pt->len)
 	    {
-	      int len = pt->len > 32768 ? 32768 : pt->len;
-	      len = iobuf_read (pt->buf, buffer, len);
-	      if (len == -1)
+	      buffer = iobuf_borrow (pt->buf, pt->len, &len);
+	      if (!buffer)
 		{
 		  err = gpg_error_from_syserror ();
 		  log_error ("problem reading source (%u bytes remaining)\n",
 			     (unsigned) pt->len);
-		  xfree (buffer);
 		  goto leave;
 		}
 	      if (mfx->md)
@@ -313,7 +315,6 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 		      log_error ("error writing to '%s': %s\n",
 				 fname, "exceeded --max-output limit\n");
 		      err = gpg_error (GPG_ERR_TOO_LARGE);
-		      xfree (buffer);
 		      goto leave;
 		    }
 		  else if (es_fwrite (buffer, 1, len, fp) != len)
@@ -321,13 +322,12 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 		      err = gpg_error_from_syserror ();
 		      log_error ("error writing to '%s': %s\n",
 				 fname, gpg_strerror (err));
-		      xfree (buffer);
 		      goto leave;
 		    }
 		}
+	      iobuf_consume (pt->buf, len);
 	      pt->len -= len;
 	    }
-	  xfree (buffer);
 	}
     }
   else if (!clearsig)
@@ -366,29 +366,14 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 	}
       else
 	{			/* binary mode */
-	  byte *buffer;
-	  int eof_seen = 0;
-
-          buffer = xtrymalloc (32768);
-          if (!buffer)
-            {
-              err = gpg_error_from_syserror ();
-              goto leave;
-            }
+	  const byte *buffer;
+	  size_t len;
 
-	  while (!eof_seen)
+	  /* We must stop at the first EOF: It has already popped the
+	   * block_filter off and reading on would cross the packet
+	   * boundary.  iobuf_borrow returns NULL exactly for that EOF.  */
+	  while ((buffer = iobuf_borrow (pt->buf, 32768, &len)))
 	    {
-	      /* Why do we check for len < 32768:
-	       * If we won't, we would practically read 2 EOFs but
-	       * the first one has already popped the block_filter
-	       * off and therefore we don't catch the boundary.
-	       * So, always assume EOF if iobuf_read returns less bytes
-	       * then requested */
-	      int len = iobuf_read (pt->buf, buffer, 32768);
-	      if (len == -1)
-		break;
-	      if (len < 32768)
-		eof_seen = 1;
 	      if (mfx->md)
 		gcry_md_write (mfx->md, buffer, len);
 	      if (fp)
@@ -398,7 +383,6 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 		      log_error ("error writing to '%s': %s\n",
 				 fname, "exceeded --max-output limit\n");
 		      err = gpg_error (GPG_ERR_TOO_LARGE);
-		      xfree (buffer);
 		      goto leave;
 		    }
 		  else if (es_fwrite (buffer, 1, len, fp) != len)
@@ -406,12 +390,11 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 		      err = gpg_error_from_syserror ();
 		      log_error ("error writing to '%s': %s\n",
 				 fname, gpg_strerror (err));
-		      xfree (buffer);
 		      goto leave;
 		    }
 		}
+	      iobuf_consume (pt->buf, len);
 	    }
-	  xfree (buffer);
 	}
       pt->buf = NULL;
     }
@@ -33,6 +33,7 @@
 #include "../common/i18n.h"
 #include "options.h"
 #include "pkglue.h"
+#include "sigcache.h"
 #include "../common/compliance.h"
 
 static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
@@ -508,6 +509,8 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
 {
   gcry_mpi_t result = NULL;
   int rc = 0;
+  int use_sigcache;
+  byte sigcache_id[SIGCACHE_IDLEN];
 
   if (!opt.flags.allow_weak_digest_algos)
     {
@@ -628,6 +631,16 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     }
     gcry_md_final( digest );
 
+    /* Key signatures are checked each time a key is loaded; thus we
+     * look at the persistent cache first.  */
+    use_sigcache = (!opt.no_sig_cache && (IS_CERT (sig) || IS_BACK_SIG (sig)));
+    if (use_sigcache)
+      {
+        sigcache_make_id (sigcache_id, pk, sig, digest);
+        if (sigcache_check (sigcache_id))
+          goto verified;
+      }
+
     /* Convert the digest to an MPI.  */
     result = encode_md_value (pk, digest, sig->digest_algo );
     if (!result)
@@ -640,6 +653,10 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     if (DBG_CLOCK && sig->sig_class <= 0x01)
       log_clock ("leave pk_verify");
     gcry_mpi_release (result);
+    if (!rc && use_sigcache)
+      sigcache_put (sigcache_id);
+
+ verified:
 
   if (!rc && sig->flags.unknown_critical)
     {
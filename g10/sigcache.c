@@ -0,0 +1,366 @@
+/* sigcache.c - Persistent cache for key signature verifications.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The keybox format has no place to store the result of a signature
+ * verification and thus, unlike with the old keyrings, every load of
+ * a key requires the verification of all its self-signatures.  This
+ * module keeps the identifiers of successfully verified key
+ * signatures in the file SIGCACHE_FILENAME in the home directory.
+ *
+ * An identifier is the SHA-256 hash over the fingerprint of the
+ * signing key, the final digest of the signed data, and the
+ * signature values.  Thus a cache entry can only match if exactly
+ * the same data has been signed by the same key; there is no need to
+ * ever invalidate an entry.  Only good signatures are stored.
+ *
+ * The file starts with a SIGCACHE_IDLEN byte header followed by the
+ * identifiers.  New identifiers are appended so that several
+ * processes may use the file at the same time.  If the file grows
+ * too large it is truncated and filled again.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "sigcache.h"
+
+#define SIGCACHE_FILENAME   "sigcache.bin"
+#define SIGCACHE_BUCKETS    4093
+#define SIGCACHE_MAX_ITEMS  65536
+
+/* The header of the file; padded with zeroes to SIGCACHE_IDLEN.  */
+#define SIGCACHE_MAGIC      "GnuPG signature cache v1\n"
+
+
+/* An item in the linked list of a bucket.  */
+typedef struct sigcache_item_s
+{
+  struct sigcache_item_s *next;
+  byte id[SIGCACHE_IDLEN];
+} *sigcache_item_t;
+
+static sigcache_item_t *sigcache_table;  /* The hash table.  */
+static unsigned int sigcache_items;      /* Number of items.  */
+static int sigcache_loaded;              /* The file has been read.  */
+static int sigcache_need_reset;          /* Truncate before writing.  */
+static int sigcache_write_failed;        /* Do not try to write again.  */
+static estream_t sigcache_fp;            /* Open for appending.  */
+
+static struct
+{
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int stored;
+} sigcache_stats;
+
+
+/* Print statistics for the signature cache.  */
+void
+sigcache_dump_stats (void)
+{
+  log_info ("sigcache: items=%u hits=%u misses=%u stored=%u\n",
+            sigcache_items, sigcache_stats.hits, sigcache_stats.misses,
+            sigcache_stats.stored);
+}
+
+
+static char *
+sigcache_filename (void)
+{
+  return make_filename (gnupg_homedir (), SIGCACHE_FILENAME, NULL);
+}
+
+
+static inline unsigned int
+sigcache_hash (const byte *id)
+{
+  /* The identifier is a hash value; thus any bytes will do.  */
+  return buf32_to_uint (id) % SIGCACHE_BUCKETS;
+}
+
+
+/* Return true if ID is in the in-memory table.  */
+static int
+sigcache_find (const byte *id)
+{
+  sigcache_item_t item;
+
+  for (item = sigcache_table[sigcache_hash (id)]; item; item = item->next)
+    if (!memcmp (item->id, id, SIGCACHE_IDLEN))
+      return 1;
+  return 0;
+}
+
+
+/* Add ID to the in-memory table.  Returns false if the item was
+ * already there.  */
+static int
+sigcache_add (const byte *id)
+{
+  sigcache_item_t item;
+  unsigned int hash = sigcache_hash (id);
+
+  if (sigcache_find (id))
+    return 0;
+  item = xmalloc (sizeof *item);
+  memcpy (item->id, id, SIGCACHE_IDLEN);
+  item->next = sigcache_table[hash];
+  sigcache_table[hash] = item;
+  sigcache_items++;
+  return 1;
+}
+
+
+/* Remove all items from the in-memory table.  */
+static void
+sigcache_clear (void)
+{
+  sigcache_item_t item, next;
+  unsigned int i;
+
+  for (i=0; i < SIGCACHE_BUCKETS; i++)
+    {
+      for (item = sigcache_table[i]; item; item = next)
+        {
+          next = item->next;
+          xfree (item);
+        }
+      sigcache_table[i] = NULL;
+    }
+  sigcache_items = 0;
+}
+
+
+/* Read the cache file into the in-memory table.  */
+static void
+sigcache_load (void)
+{
+  char *fname;
+  estream_t fp;
+  byte buffer[SIGCACHE_IDLEN];
+  size_t nread;
+
+  sigcache_loaded = 1;
+  sigcache_table = xcalloc (SIGCACHE_BUCKETS, sizeof *sigcache_table);
+
+  fname = sigcache_filename ();
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      if (gpg_err_code_from_syserror () != GPG_ERR_ENOENT)
+        log_info ("can't open '%s': %s\n",
+                  fname, gpg_strerror (gpg_error_from_syserror ()));
+      sigcache_need_reset = 1;
+      xfree (fname);
+      return;
+    }
+
+  memset (buffer, 0, sizeof buffer);
+  if (es_read (fp, buffer, SIGCACHE_IDLEN, &nread) || nread != SIGCACHE_IDLEN
+      || memcmp (buffer, SIGCACHE_MAGIC, strlen (SIGCACHE_MAGIC)))
+    {
+      if (opt.verbose)
+        log_info ("'%s' is not a signature cache - ignored\n", fname);
+      sigcache_need_reset = 1;
+    }
+  else
+    {
+      /* A partial record at the end (e.g. due to a full disk) is
+       * silently ignored.  */
+      while (!es_read (fp, buffer, SIGCACHE_IDLEN, &nread)
+             && nread == SIGCACHE_IDLEN)
+        {
+          if (sigcache_items >= SIGCACHE_MAX_ITEMS)
+            {
+              /* Too large; start over.  */
+              sigcache_clear ();
+              sigcache_need_reset = 1;
+              break;
+            }
+          sigcache_add (buffer);
+        }
+    }
+  if (DBG_CACHE)
+    log_debug ("sigcache: loaded %u items from '%s'\n", sigcache_items, fname);
+  es_fclose (fp);
+  xfree (fname);
+}
+
+
+/* Append ID to the cache file.  */
+static void
+sigcache_write (const byte *id)
+{
+  char *fname = NULL;
+  byte header[SIGCACHE_IDLEN];
+
+  if (sigcache_write_failed)
+    return;
+
+  if (!sigcache_fp)
+    {
+      fname = sigcache_filename ();
+      if (sigcache_need_reset)
+        {
+          if (DBG_CACHE)
+            log_debug ("sigcache: creating '%s'\n", fname);
+          sigcache_fp = es_fopen (fname, "wb");
+          if (!sigcache_fp)
+            goto leave;
+          memset (header, 0, sizeof header);
+          memcpy (header, SIGCACHE_MAGIC, strlen (SIGCACHE_MAGIC));
+          if (es_fwrite (header, SIGCACHE_IDLEN, 1, sigcache_fp) != 1)
+            goto leave;
+          if (es_fclose (sigcache_fp))
+            {
+              sigcache_fp = NULL;
+              goto leave;
+            }
+          sigcache_need_reset = 0;
+        }
+      sigcache_fp = es_fopen (fname, "ab");
+      if (!sigcache_fp)
+        goto leave;
+    }
+
+  /* Flush each record on its own so that the O_APPEND write of a
+   * record is atomic with respect to other processes.  */
+  if (es_fwrite (id, SIGCACHE_IDLEN, 1, sigcache_fp) != 1
+      || es_fflush (sigcache_fp))
+    goto leave;
+  xfree (fname);
+  return;
+
+ leave:
+  if (!fname)
+    fname = sigcache_filename ();
+  if (opt.verbose)
+    log_info ("error writing '%s': %s\n",
+              fname, gpg_strerror (gpg_error_from_syserror ()));
+  if (sigcache_fp)
+    es_fclose (sigcache_fp);
+  sigcache_fp = NULL;
+  sigcache_write_failed = 1;
+  xfree (fname);
+}
+
+
+/* Compute the cache identifier for the signature SIG made by PK over
+ * the data hashed into DIGEST.  DIGEST must have been finalized.  */
+void
+sigcache_make_id (byte *id, PKT_public_key *pk, PKT_signature *sig,
+                  gcry_md_hd_t digest)
+{
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  byte buf[4];
+  const void *p;
+  unsigned char *tmp;
+  unsigned int nbits;
+  size_t n;
+  int i;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    BUG ();
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_putc (md, fprlen);
+  gcry_md_write (md, fpr, fprlen);
+  gcry_md_putc (md, sig->pubkey_algo);
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_write (md, gcry_md_read (digest, sig->digest_algo),
+                 gcry_md_get_algo_dlen (sig->digest_algo));
+  for (i=0; i < pubkey_get_nsig (sig->pubkey_algo); i++)
+    {
+      tmp = NULL;
+      if (!sig->data[i])
+        {
+          p = NULL;
+          n = 0;
+        }
+      else if (gcry_mpi_get_flag (sig->data[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          p = gcry_mpi_get_opaque (sig->data[i], &nbits);
+          n = (nbits + 7) / 8;
+        }
+      else
+        {
+          if (gcry_mpi_aprint (GCRYMPI_FMT_USG, &tmp, &n, sig->data[i]))
+            BUG ();
+          p = tmp;
+        }
+      buf[0] = n >> 24;
+      buf[1] = n >> 16;
+      buf[2] = n >> 8;
+      buf[3] = n;
+      gcry_md_write (md, buf, 4);
+      if (n)
+        gcry_md_write (md, p, n);
+      gcry_free (tmp);
+    }
+
+  memcpy (id, gcry_md_read (md, GCRY_MD_SHA256), SIGCACHE_IDLEN);
+  gcry_md_close (md);
+}
+
+
+/* Return true if the signature with identifier ID is known to be
+ * good.  */
+int
+sigcache_check (const byte *id)
+{
+  if (!sigcache_loaded)
+    sigcache_load ();
+
+  if (sigcache_find (id))
+    {
+      sigcache_stats.hits++;
+      return 1;
+    }
+  sigcache_stats.misses++;
+  return 0;
+}
+
+
+/* Store the identifier ID of a good signature.  */
+void
+sigcache_put (const byte *id)
+{
+  if (!sigcache_loaded)
+    sigcache_load ();
+
+  if (sigcache_items >= SIGCACHE_MAX_ITEMS)
+    return; /* The next process will start over.  */
+
+  if (sigcache_add (id))
+    {
+      sigcache_stats.stored++;
+      sigcache_write (id);
+    }
+}
@@ -0,0 +1,33 @@
+/* sigcache.h - Persistent cache for key signature verifications.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_SIGCACHE_H
+#define GNUPG_G10_SIGCACHE_H
+
+/* The length of a signature cache identifier.  */
+#define SIGCACHE_IDLEN  32
+
+void sigcache_dump_stats (void);
+void sigcache_make_id (byte *id, PKT_public_key *pk, PKT_signature *sig,
+                       gcry_md_hd_t digest);
+int sigcache_check (const byte *id);
+void sigcache_put (const byte *id);
+
+#endif /*GNUPG_G10_SIGCACHE_H*/
@@ -1268,9 +1268,14 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
                     compress_algo_to_string (compr_algo), compr_algo);
         }
 
-      /* Algo 0 means no compression. */
+      /* Algo 0 means no compression.  Without encryption there is
+       * no reason to compress data which does not get smaller.  */
       if (compr_algo)
-        push_compress_filter (out, &zfx, compr_algo);
+        {
+          if (!encryptflag)
+            zfx.probe = 1;
+          push_compress_filter (out, &zfx, compr_algo);
+        }
     }
 
   /* Write the one-pass signature packets if needed */
@@ -1671,7 +1676,7 @@ sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr)
   if (default_compress_algo())
     {
       if (cfx.dek && (cfx.dek->use_mdc || cfx.dek->use_aead))
-        zfx.new_ctb = 1;
+        zfx.new_ctb = zfx.probe = 1;
       push_compress_filter (out, &zfx,default_compress_algo() );
     }
 
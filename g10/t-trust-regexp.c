@@ -0,0 +1,310 @@
+/* t-trust-regexp.c - Tests for the trust signature regexps
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "test.c"
+
+/* We include trust-regexp.c to compare the simple matcher with the
+ * regexp engine.  */
+#include "trust-regexp.c"
+
+
+/* Characters used for the random regexps and strings.  */
+static const char regexp_chars[] = "aAbBzZ09.@<>-_+";
+static const char string_chars[] = "aAbBzZ09.@<>-_+ ";
+
+
+/* Return the result of the regexp engine for the sanitized regexp
+ * REGEXP and STRING or -1 if REGEXP does not compile.  */
+static int
+regexec_match (const char *regexp, const char *string)
+{
+  regex_t pat;
+  int ret;
+
+  if (regcomp (&pat, regexp, REG_ICASE|REG_EXTENDED))
+    return -1;
+  ret = !regexec (&pat, string, 0, NULL, 0);
+  regfree (&pat);
+  return ret;
+}
+
+
+/* Compare the simple matcher for EXPR with the regexp engine for all
+ * STRINGS.  Returns the number of mismatches; sets *R_SIMPLE if the
+ * simple matcher could be used.  */
+static int
+compare_matchers (const char *expr, const char **strings, int nstrings,
+                  int *r_simple)
+{
+  struct regexp_cache_s rc;
+  char *regexp;
+  regex_t pat;
+  int i, a, b, mismatches = 0;
+
+  *r_simple = 0;
+  regexp = sanitize_regexp (expr);
+  if (regcomp (&pat, regexp, REG_ICASE|REG_EXTENDED))
+    {
+      xfree (regexp);
+      return 0;
+    }
+  memset (&rc, 0, sizeof rc);
+  if (compile_simple_regexp (&rc, regexp))
+    {
+      *r_simple = 1;
+      for (i=0; i < nstrings; i++)
+        {
+          a = match_simple_regexp (&rc, strings[i]);
+          b = !regexec (&pat, strings[i], 0, NULL, 0);
+          if (a != b)
+            {
+              if (verbose)
+                printf ("regexp '%s' on '%s': simple=%d regexec=%d\n",
+                        regexp, strings[i], a, b);
+              mismatches++;
+            }
+        }
+      xfree (rc.masks);
+    }
+  regfree (&pat);
+  xfree (regexp);
+  return mismatches;
+}
+
+
+static void
+random_string (char *buf, size_t len, const char *chars)
+{
+  size_t n = strlen (chars);
+
+  while (len--)
+    *buf++ = chars[rand () % n];
+  *buf = 0;
+}
+
+
+/* Known results for both forms and the edge cases.  */
+static void
+test_known (void)
+{
+  static struct {
+    const char *expr;
+    const char *string;
+    int expected;
+  } known[] = {
+    /* The bracketed form.  */
+    { "<[^>]+[@.]example\\.com>$", "Joe <joe@example.com>", 1 },
+    { "<[^>]+[@.]example\\.com>$", "<joe@sub.example.com>", 1 },
+    { "<[^>]+[@.]example\\.com>$", "<joe@EXAMPLE.Com>", 1 },
+    { "<[^>]+[@.]example\\.com>$", "<joe@example.com> ", 0 },
+    { "<[^>]+[@.]example\\.com>$", "<joe@example.org>", 0 },
+    { "<[^>]+[@.]example\\.com>$", "<joe@badexample.com>", 0 },
+    { "<[^>]+[@.]example\\.com>$", "<@example.com>", 0 },
+    { "<[^>]+[@.]example\\.com>$", "<j@example.com>", 1 },
+    { "<[^>]+[@.]example\\.com>$", "<j>@example.com>", 0 },
+    { "<[^>]+[@.]example\\.com>$", "<>j@example.com>", 0 },
+    { "<[^>]+[@.]example\\.com>$", "<<j@example.com>", 1 },
+    { "<[^>]+[@.]example\\.com>$", "joe@example.com>", 0 },
+    { "<[^>]+[@.]example\\.com>$", "<joe@examplexcom>", 0 },
+    { "<[^>]+[@.]example.com>$",   "<joe@examplexcom>", 1 },
+    { "<[^>]+[@.]a>$", "<b@a>", 1 },
+    { "<[^>]+[@.]a>$", "<@a>", 0 },
+    { "<[^>]+[@.]a>$", "", 0 },
+    { "<[^>]+[@.]>$",  "<b@>", 1 },
+    /* The bare form.  */
+    { "example.com", "joe@example.com", 1 },
+    { "example.com", "joe@exampleXcom", 1 },
+    { "example\\.com", "joe@exampleXcom", 0 },
+    { "EXAMPLE", "joe@example.com", 1 },
+    { "example", "exampl", 0 },
+    { "", "", 1 },
+    { "", "anything", 1 },
+    { ".", "", 0 },
+    { ".", "x", 1 },
+    /* Operators are escaped by sanitize_regexp.  */
+    { "a+b", "a+b", 1 },
+    { "a+b", "aab", 0 },
+    { "a*", "b", 0 },
+    { "(x|y)", "x", 0 },
+    { "(x|y)", "(x|y)", 1 },
+    { "^a$", "a", 0 },
+    { "^a$", "^a$", 1 },
+    { "a\\-b", "a-b", 1 },
+    { "a\\@b", "a@b", 1 },
+    /* Non-ASCII strings use the regexp engine.  */
+    { "<[^>]+[@.]example\\.com>$", "J\xc3\xb6rg <j@example.com>", 1 },
+    { "\xc3\xb6", "J\xc3\xb6rg", 1 },
+    { "\xc3\xb6", "Jorg", 0 }
+  };
+  int i;
+
+  TEST_GROUP ("known results");
+  for (i=0; i < DIM (known); i++)
+    {
+      TEST ("check_trust_regexp",
+            check_trust_regexp (known[i].expr, known[i].string),
+            known[i].expected);
+      /* Run it twice to also use the cached regexp.  */
+      TEST ("check_trust_regexp (cached)",
+            check_trust_regexp (known[i].expr, known[i].string),
+            known[i].expected);
+    }
+}
+
+
+/* Literal parts of the length the simple matcher can handle and one
+ * more.  */
+static void
+test_max_length (void)
+{
+  char lit[SIMPLE_REGEXP_MAX + 2];
+  char expr[SIMPLE_REGEXP_MAX + 20];
+  char string[SIMPLE_REGEXP_MAX + 20];
+  struct regexp_cache_s rc;
+  char *regexp;
+  int len;
+
+  TEST_GROUP ("maximum length");
+  for (len = SIMPLE_REGEXP_MAX - 1; len <= SIMPLE_REGEXP_MAX + 1; len++)
+    {
+      memset (lit, 'a', len);
+      lit[len] = 0;
+      snprintf (expr, sizeof expr, "<[^>]+[@.]%s>$", lit);
+      snprintf (string, sizeof string, "<x@%s>", lit);
+
+      regexp = sanitize_regexp (expr);
+      memset (&rc, 0, sizeof rc);
+      TEST ("simple matcher usable",
+            compile_simple_regexp (&rc, regexp), len <= SIMPLE_REGEXP_MAX);
+      if (rc.masks)
+        TEST ("simple match", match_simple_regexp (&rc, string), 1);
+      xfree (rc.masks);
+      xfree (regexp);
+      TEST ("check_trust_regexp", check_trust_regexp (expr, string), 1);
+      string[1] = '>';
+      TEST ("check_trust_regexp", check_trust_regexp (expr, string), 0);
+    }
+}
+
+
+/* Compare the simple matcher with the regexp engine for random
+ * regexps in both forms.  The strings are random or contain the
+ * literal part of the regexp.  */
+static void
+test_random (void)
+{
+  enum { NSTRINGS = 200 };
+  char lit[20], expr[80], noise[20];
+  char *strings[NSTRINGS];
+  int round, i, n, simple, nsimple = 0, mismatches = 0;
+
+  TEST_GROUP ("simple matcher versus regexp engine");
+  for (i=0; i < NSTRINGS; i++)
+    strings[i] = xmalloc (80);
+
+  for (round=0; round < 2000; round++)
+    {
+      random_string (lit, rand () % 6, regexp_chars);
+      /* Escape some of the punctuation.  */
+      n = 0;
+      for (i=0; lit[i]; i++)
+        {
+          if (strchr (".-@_", lit[i]) && (rand () & 1))
+            noise[n++] = '\\';
+          noise[n++] = lit[i];
+        }
+      noise[n] = 0;
+      if ((round & 1))
+        snprintf (expr, sizeof expr, "<[^>]+[@.]%s>$", noise);
+      else
+        snprintf (expr, sizeof expr, "%s", noise);
+
+      for (i=0; i < NSTRINGS; i++)
+        {
+          if (i < NSTRINGS / 2)
+            random_string (strings[i], rand () % 12, string_chars);
+          else
+            {
+              /* Surround a variant of the literal part.  */
+              random_string (noise, rand () % 4, string_chars);
+              snprintf (strings[i], 80, "%s%s%s%s",
+                        (i & 1)? "<" : "", noise, (i & 2)? "@" : ".", lit);
+              for (n=0; strings[i][n]; n++)
+                if ((rand () % 8) == 0)
+                  strings[i][n] = string_chars[rand () % strlen (string_chars)];
+                else if ((rand () & 1))
+                  strings[i][n] = ascii_toupper (strings[i][n]);
+              if ((i & 4))
+                strcat (strings[i], ">");
+            }
+        }
+      mismatches += compare_matchers (expr, (const char **)strings, NSTRINGS,
+                                      &simple);
+      nsimple += simple;
+    }
+  TEST ("no mismatches", mismatches, 0);
+  TEST_P ("simple matcher used", nsimple > 1000);
+
+  for (i=0; i < NSTRINGS; i++)
+    xfree (strings[i]);
+}
+
+
+/* Short strings around the length of a bracketed regexp.  */
+static void
+test_short_strings (void)
+{
+  static const char *exprs[] = { "<[^>]+[@.]a>$", "<[^>]+[@.]a\\.b>$",
+                                 "<[^>]+[@.].>$", "a", "a.b", "." };
+  char string[8];
+  const char *strings[1];
+  int i, len, k, simple, mismatches = 0;
+  unsigned int v;
+
+  TEST_GROUP ("short strings");
+  for (i=0; i < DIM (exprs); i++)
+    for (len=0; len <= 6; len++)
+      for (v=0; v < 2000; v++)
+        {
+          for (k=0; k < len; k++)
+            string[k] = "<>@.aAb"[(v * 7919 + k * 104729 + rand ()) % 7];
+          string[len] = 0;
+          strings[0] = string;
+          mismatches += compare_matchers (exprs[i], strings, 1, &simple);
+          if (!simple)
+            mismatches++;
+        }
+  TEST ("no mismatches", mismatches, 0);
+  TEST ("regexec sanity", regexec_match ("<[^>]+[@.]a>$", "<b@a>"), 1);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  (void)argc;
+  (void)argv;
+
+  srand (42);
+  test_known ();
+  test_max_length ();
+  test_random ();
+  test_short_strings ();
+}
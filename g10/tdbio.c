@@ -57,33 +57,54 @@
 #endif
 
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The records are cached in pages of TDBIO_PAGE_RECORDS records.
+ * A page is read with one system call and a record never spans two
+ * pages; thus a page is a bit smaller than the usual 4 KiB page of
+ * the OS.  The pages are found by a hash table on the page number
+ * and are kept in an LRU list for eviction.  Only modified records
+ * are written back; each page has a bitmap of its dirty records.
+ * mmap is not used because the trustdb is updated in place by other
+ * processes and must also work on systems without it.
  */
-typedef struct cache_ctrl_struct *CACHE_CTRL;
-struct cache_ctrl_struct
+#define TDBIO_PAGE_RECORDS  102
+#define TDBIO_PAGE_LEN      (TDBIO_PAGE_RECORDS * TRUST_RECORD_LEN)
+
+typedef struct cache_page_s *cache_page_t;
+struct cache_page_s
 {
-  CACHE_CTRL next;
-  struct {
-    unsigned used:1;
-    unsigned dirty:1;
-  } flags;
-  ulong recno;
-  char data[TRUST_RECORD_LEN];
+  cache_page_t next;      /* Next page in the hash bucket.  */
+  cache_page_t lru_prev;  /* More recently used page.  */
+  cache_page_t lru_next;  /* Less recently used page.  */
+  ulong pageno;
+  unsigned int nrecs;     /* Number of records available in DATA.  */
+  unsigned int ndirty;    /* Number of dirty records.  */
+  u32 dirty[(TDBIO_PAGE_RECORDS + 31) / 32];  /* Bitmap of dirty records.  */
+  byte data[TDBIO_PAGE_LEN];
 };
 
-/* Size of the cache.  The SOFT value is the general one.  While in a
-   transaction this may not be sufficient and thus we may increase it
-   then up to the HARD limit.  */
-#define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+/* Size of the cache in pages.  The SOFT value is the general one.
+   While in a transaction this may not be sufficient and thus we may
+   increase it then up to the HARD limit.  */
+#define MAX_CACHE_PAGES_SOFT  1024
+#define MAX_CACHE_PAGES_HARD  16384
 
+/* Number of buckets in the hash table; a prime.  */
+#define CACHE_BUCKETS  1021
 
 /* The cache is controlled by these variables.  */
-static CACHE_CTRL cache_list;
-static int cache_entries;
-static int cache_is_dirty;
+static cache_page_t cache_table[CACHE_BUCKETS];
+static cache_page_t cache_lru_head;  /* The most recently used page.  */
+static cache_page_t cache_lru_tail;  /* The least recently used page.  */
+static int cache_pages;
+static int cache_dirty_pages;
+
+static struct
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long writes;
+} cache_stats;
 
 
 /* An object to pass information to cmp_krec_fpr. */
@@ -115,12 +136,14 @@ static unsigned int is_locked;
 static int  db_fd = -1;
 
 /* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+static int in_transaction;
 
 
 
 static void open_db (void);
 static void create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type);
+static void revalidate_cache (void);
+static int commit_transaction (void);
 
 
 
@@ -147,6 +170,9 @@ take_write_lock (void)
     {
       if (dotlock_take (lockhandle, -1) )
         log_fatal ( _("can't lock '%s'\n"), db_name );
+      /* Another process may have changed the file while we did not
+       * hold the lock.  */
+      revalidate_cache ();
       rc = 0;
     }
   else
@@ -188,235 +214,422 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
-/*
- * Get the data from the record cache and return a pointer into that
- * cache.  Caller should copy the returned data.  NULL is returned on
- * a cache miss.
- */
-static const char *
-get_record_from_cache (ulong recno)
+static inline unsigned int
+cache_hash (ulong pageno)
 {
-  CACHE_CTRL r;
+  return pageno % CACHE_BUCKETS;
+}
 
-  for (r = cache_list; r; r = r->next)
-    {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
-    }
+
+/* Move PAGE to the front of the LRU list.  */
+static void
+lru_unlink (cache_page_t page)
+{
+  if (page->lru_prev)
+    page->lru_prev->lru_next = page->lru_next;
+  else
+    cache_lru_head = page->lru_next;
+  if (page->lru_next)
+    page->lru_next->lru_prev = page->lru_prev;
+  else
+    cache_lru_tail = page->lru_prev;
+  page->lru_prev = page->lru_next = NULL;
+}
+
+static void
+lru_push_front (cache_page_t page)
+{
+  page->lru_prev = NULL;
+  page->lru_next = cache_lru_head;
+  if (cache_lru_head)
+    cache_lru_head->lru_prev = page;
+  cache_lru_head = page;
+  if (!cache_lru_tail)
+    cache_lru_tail = page;
+}
+
+
+/* Return the cached page PAGENO or NULL.  */
+static cache_page_t
+find_page (ulong pageno)
+{
+  cache_page_t page;
+
+  for (page = cache_table[cache_hash (pageno)]; page; page = page->next)
+    if (page->pageno == pageno)
+      return page;
   return NULL;
 }
 
 
+/* Remove PAGE from the cache and release it.  */
+static void
+drop_page (cache_page_t page)
+{
+  cache_page_t *pp;
+
+  for (pp = &cache_table[cache_hash (page->pageno)]; *pp; pp = &(*pp)->next)
+    if (*pp == page)
+      {
+        *pp = page->next;
+        break;
+      }
+  lru_unlink (page);
+  if (page->ndirty)
+    cache_dirty_pages--;
+  cache_pages--;
+  xfree (page);
+}
+
+
+static inline int
+record_is_dirty (cache_page_t page, unsigned int idx)
+{
+  return !!(page->dirty[idx / 32] & (1u << (idx % 32)));
+}
+
+
+static void
+mark_record_dirty (cache_page_t page, unsigned int idx)
+{
+  if (record_is_dirty (page, idx))
+    return;
+  page->dirty[idx / 32] |= (1u << (idx % 32));
+  if (!page->ndirty++)
+    cache_dirty_pages++;
+}
+
+
+static void
+clear_dirty_marks (cache_page_t page)
+{
+  memset (page->dirty, 0, sizeof page->dirty);
+  if (page->ndirty)
+    cache_dirty_pages--;
+  page->ndirty = 0;
+}
+
+
 /*
- * Write a cached item back to the trustdb file.
+ * Read the page PAGENO from the trustdb file into BUFFER which must
+ * have a size of TDBIO_PAGE_LEN.  Stores the number of complete
+ * records read at R_NRECS.
  *
  * Returns: 0 on success or an error code.
  */
-static int
-write_cache_item (CACHE_CTRL r)
+static gpg_error_t
+read_page (ulong pageno, byte *buffer, unsigned int *r_nrecs)
 {
   gpg_error_t err;
+  size_t nread = 0;
   int n;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+  if (lseek (db_fd, (off_t)pageno * TDBIO_PAGE_LEN, SEEK_SET) == -1)
     {
       err = gpg_error_from_syserror ();
-      log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
+      log_error (_("trustdb: lseek failed: %s\n"), strerror (errno));
       return err;
     }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
-  if (n != TRUST_RECORD_LEN)
+  while (nread < TDBIO_PAGE_LEN)
     {
-      err = gpg_error_from_syserror ();
-      log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
-      return err;
+      n = read (db_fd, buffer + nread, TDBIO_PAGE_LEN - nread);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb: read failed (n=%d): %s\n"),
+                     n, strerror(errno));
+          return err;
+        }
+      if (!n)
+        break;  /* EOF */
+      nread += n;
     }
-  r->flags.dirty = 0;
+  /* A partial record at the end is not available.  */
+  *r_nrecs = nread / TRUST_RECORD_LEN;
+  memset (buffer + *r_nrecs * TRUST_RECORD_LEN, 0,
+          TDBIO_PAGE_LEN - *r_nrecs * TRUST_RECORD_LEN);
   return 0;
 }
 
 
 /*
- * Put data into the cache.  This function may flush
- * some cache entries if the cache is filled up.
+ * Write the dirty records of PAGE back to the trustdb file.  Adjacent
+ * dirty records are written with one system call.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-put_record_into_cache (ulong recno, const char *data)
+write_cache_page (cache_page_t page)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  gpg_error_t err;
+  unsigned int idx, end;
+  ulong recno;
+  int n;
 
-  /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  for (idx = 0; idx < page->nrecs; idx = end)
     {
-      if (!r->flags.used)
+      if (!record_is_dirty (page, idx))
         {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
+          end = idx + 1;
+          continue;
+        }
+      for (end = idx + 1; end < page->nrecs && record_is_dirty (page, end);
+           end++)
+        ;
+      recno = page->pageno * TDBIO_PAGE_RECORDS + idx;
+      if (lseek (db_fd, (off_t)recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
         {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb rec %lu: lseek failed: %s\n"),
+                     recno, strerror (errno));
+          return err;
+        }
+      n = write (db_fd, page->data + idx * TRUST_RECORD_LEN,
+                 (end - idx) * TRUST_RECORD_LEN);
+      if (n != (end - idx) * TRUST_RECORD_LEN)
         {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
+                     recno, n, strerror (errno) );
+          return err;
+        }
+      cache_stats.writes++;
     }
+  clear_dirty_marks (page);
+  return 0;
+}
+
+
+/*
+ * Make room for a new page by evicting the least recently used clean
+ * page.  If there are only dirty pages the least recently used one
+ * is written back first.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+evict_page (void)
+{
+  cache_page_t page;
+  int rc;
 
-  /* Not in the cache: add a new entry. */
-  if (unused)
+  for (page = cache_lru_tail; page; page = page->lru_prev)
+    if (!page->ndirty)
+      {
+        drop_page (page);
+        cache_stats.evictions++;
+        return 0;
+      }
+
+  /* No clean pages: We have to flush a dirty one.  */
+  if (in_transaction)
     {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      /* But we can't do this while in a transaction.  Thus we
+       * increase the cache size instead.  */
+      if (cache_pages < MAX_CACHE_PAGES_HARD)
+        {
+          if (opt.debug && !(cache_pages % 100))
+            log_debug ("increasing tdbio cache size\n");
+          return 0;
+        }
+      /* Hard limit for the cache size reached.  Commit what we have
+       * and continue with the same transaction; the trustdb is still
+       * consistent at this point.  */
+      if (opt.verbose)
+        log_info (_("trustdb transaction too large - committing\n"));
+      return commit_transaction ();
     }
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
+  page = cache_lru_tail;
+  log_assert (page);
+  take_write_lock ();
+  rc = write_cache_page (page);
+  release_write_lock ();
+  if (rc)
+    return rc;
+  drop_page (page);
+  cache_stats.evictions++;
+  return 0;
+}
+
+
+/*
+ * Return the page PAGENO from the cache.  The page is read from the
+ * file if it is not yet cached.  On error NULL is returned and the
+ * error code stored at R_ERR.
+ */
+static cache_page_t
+get_page (ulong pageno, gpg_error_t *r_err)
+{
+  cache_page_t page;
+  unsigned int hash;
+
+  *r_err = 0;
+  page = find_page (pageno);
+  if (page)
     {
-      /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      cache_stats.hits++;
+      if (page != cache_lru_head)
+        {
+          lru_unlink (page);
+          lru_push_front (page);
+        }
+      return page;
     }
+  cache_stats.misses++;
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
+  if (cache_pages >= MAX_CACHE_PAGES_SOFT)
     {
-      int n;
+      *r_err = evict_page ();
+      if (*r_err)
+        return NULL;
+    }
 
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
-      if (!n)
-        n = 1;
+  page = xmalloc (sizeof *page);
+  page->pageno = pageno;
+  page->ndirty = 0;
+  memset (page->dirty, 0, sizeof page->dirty);
+  *r_err = read_page (pageno, page->data, &page->nrecs);
+  if (*r_err)
+    {
+      xfree (page);
+      return NULL;
+    }
+  hash = cache_hash (pageno);
+  page->next = cache_table[hash];
+  cache_table[hash] = page;
+  lru_push_front (page);
+  cache_pages++;
+  return page;
+}
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+/*
+ * Get the data from the record cache and return a pointer into that
+ * cache.  Caller should copy the returned data.  NULL is returned
+ * and the error code stored at R_ERR if the record can't be read;
+ * GPG_ERR_EOF is used for a record behind the end of the file.
+ */
+static const byte *
+get_record_from_cache (ulong recno, gpg_error_t *r_err)
+{
+  cache_page_t page;
+  unsigned int idx = recno % TDBIO_PAGE_RECORDS;
+
+  page = get_page (recno / TDBIO_PAGE_RECORDS, r_err);
+  if (!page)
+    return NULL;
+  if (idx >= page->nrecs)
+    {
+      *r_err = gpg_error (GPG_ERR_EOF);
+      return NULL;
     }
+  return page->data + idx * TRUST_RECORD_LEN;
+}
 
-  /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
-  if (in_transaction)
+
+/*
+ * Put data into the cache.  This function may flush
+ * some cache entries if the cache is filled up.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+put_record_into_cache (ulong recno, const byte *data)
+{
+  gpg_error_t err;
+  cache_page_t page;
+  unsigned int idx = recno % TDBIO_PAGE_RECORDS;
+  byte *p;
+
+  page = get_page (recno / TDBIO_PAGE_RECORDS, &err);
+  if (!page)
+    return err;
+
+  p = page->data + idx * TRUST_RECORD_LEN;
+  if (idx >= page->nrecs)
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
-        {
-          if (opt.debug && !(cache_entries % 100))
-            log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
-          return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+      /* A new record at the end of the file.  Records skipped up to
+       * here read as zero records just like a gap in the file.  */
+      page->nrecs = idx + 1;
     }
-#endif
+  else if (!memcmp (p, data, TRUST_RECORD_LEN))
+    return 0;  /* Not changed.  */
 
-  if (dirty_count)
+  memcpy (p, data, TRUST_RECORD_LEN);
+  mark_record_dirty (page, idx);
+  return 0;
+}
+
+
+/*
+ * Update a cached page after the unused record RECNO has been
+ * appended to the file without using the cache.
+ */
+static void
+note_appended_record (ulong recno)
+{
+  cache_page_t page;
+  unsigned int idx = recno % TDBIO_PAGE_RECORDS;
+
+  page = find_page (recno / TDBIO_PAGE_RECORDS);
+  if (page && !record_is_dirty (page, idx))
     {
-      int n;
+      memset (page->data + idx * TRUST_RECORD_LEN, 0, TRUST_RECORD_LEN);
+      if (idx >= page->nrecs)
+        page->nrecs = idx + 1;
+    }
+}
 
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
-      if (!n)
-        n = 1;
 
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              int rc;
+/*
+ * Bring the cache in sync with the file after the write lock has been
+ * taken.  Clean pages are dropped and the clean records of dirty
+ * pages are read again.
+ */
+static void
+revalidate_cache (void)
+{
+  cache_page_t page, next;
+  byte *buffer = NULL;
+  unsigned int idx, nrecs;
 
-              rc = write_cache_item (r);
-              if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-      release_write_lock ();
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+  if (!cache_pages || db_fd == -1)
+    return;
+
+  for (page = cache_lru_head; page; page = next)
+    {
+      next = page->lru_next;
+      if (!page->ndirty)
+        {
+          drop_page (page);
+          continue;
+        }
+      if (!buffer)
+        buffer = xmalloc (TDBIO_PAGE_LEN);
+      if (read_page (page->pageno, buffer, &nrecs))
+        continue;  /* Keep what we have.  */
+      for (idx = 0; idx < nrecs; idx++)
+        if (!record_is_dirty (page, idx))
+          memcpy (page->data + idx * TRUST_RECORD_LEN,
+                  buffer + idx * TRUST_RECORD_LEN, TRUST_RECORD_LEN);
+      if (nrecs > page->nrecs)
+        page->nrecs = nrecs;
     }
+  xfree (buffer);
+}
 
-  /* We should never reach this.  */
-  BUG();
+
+/* Print statistics for the record cache.  */
+void
+tdbio_dump_cache_stats (void)
+{
+  log_info ("tdbio cache: pages=%d dirty=%d hits=%lu misses=%lu"
+            " evictions=%lu writes=%lu\n",
+            cache_pages, cache_dirty_pages, cache_stats.hits,
+            cache_stats.misses, cache_stats.evictions, cache_stats.writes);
 }
 
 
@@ -424,40 +637,39 @@ put_record_into_cache (ulong recno, const char *data)
 int
 tdbio_is_dirty()
 {
-  return cache_is_dirty;
+  return !!cache_dirty_pages;
 }
 
 
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction this does nothing; the
+ * records are then written by tdbio_end_transaction.
  */
 int
 tdbio_sync()
 {
-    CACHE_CTRL r;
+    cache_page_t page;
     int did_lock = 0;
 
     if( db_fd == -1 )
 	open_db();
-#if 0 /* Transactions are not yet used.  */
     if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
+	return 0;
 
-    if( !cache_is_dirty )
+    if( !cache_dirty_pages )
 	return 0;
 
     if (!take_write_lock ())
         did_lock = 1;
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
+    for (page = cache_lru_head; page && cache_dirty_pages;
+         page = page->lru_next) {
+	if (page->ndirty) {
+	    int rc = write_cache_page (page);
 	    if( rc )
 		return rc;
 	}
     }
-    cache_is_dirty = 0;
     if (did_lock)
         release_write_lock ();
 
@@ -465,17 +677,294 @@ tdbio_sync()
 }
 
 
-#if 0  /* Not yet used.  */
+
+/*************************************
+ ************* transactions **********
+ *************************************/
+
+/*
+ * Everything between begin_transaction and end/cancel_transaction is
+ * kept in the cache and written at the time of end_transaction.  The
+ * write lock is held for the entire transaction.
+ *
+ * To commit a transaction the dirty records are first written to the
+ * journal file "trustdb.gpg.jnl" which is then synced to the disk.
+ * Only then the records are written to the trustdb, the trustdb is
+ * synced and the journal removed.  If the process dies in between,
+ * the journal is replayed by the next process opening the trustdb.
+ * The journal consists of:
+ *
+ *  - JOURNAL_HEADER_LEN bytes header:
+ *    - JOURNAL_MAGIC padded with zeroes
+ *    - u32 Number of records
+ *  - For each record:
+ *    - u32 Record number
+ *    - TRUST_RECORD_LEN bytes record
+ *  - The SHA-256 hash over the header and the records.
+ *
+ * Note that a transaction may still append unused records to the
+ * trustdb (see tdbio_new_recnum); they are harmless if the
+ * transaction is canceled.
+ */
+#define JOURNAL_MAGIC       "GnuPG trustdb journal v1\n"
+#define JOURNAL_HEADER_LEN  32
+#define JOURNAL_ITEM_LEN    (4 + TRUST_RECORD_LEN)
+#define JOURNAL_HASH_LEN    32
+
+
+/* Return a malloced string with the name of the journal.  */
+static char *
+journal_fname (void)
+{
+  return xstrconcat (db_name, EXTSEP_S "jnl", NULL);
+}
+
+
+/* Sync the file FD to the disk if that is supported.  */
+static gpg_error_t
+sync_fd (int fd)
+{
+#ifdef HAVE_FSYNC
+  if (fsync (fd))
+    return gpg_error_from_syserror ();
+#else
+  (void)fd;
+#endif
+  return 0;
+}
+
+
+/* Write all dirty records to the new journal file FNAME.  */
+static gpg_error_t
+write_journal (const char *fname)
+{
+  gpg_error_t err = 0;
+  gcry_md_hd_t md = NULL;
+  estream_t fp = NULL;
+  cache_page_t page;
+  byte header[JOURNAL_HEADER_LEN];
+  byte item[JOURNAL_ITEM_LEN];
+  unsigned long nrecs = 0;
+  unsigned int idx;
+  ulong recno;
+  int fd;
+
+  for (page = cache_lru_head; page; page = page->lru_next)
+    nrecs += page->ndirty;
+
+  fd = gnupg_open (fname, O_WRONLY | O_CREAT | O_TRUNC | MY_O_BINARY,
+                   S_IRUSR | S_IWUSR);
+  if (fd == -1 || !(fp = es_fdopen (fd, "wb")))
+    {
+      err = gpg_error_from_syserror ();
+      if (fd != -1)
+        close (fd);
+      goto leave;
+    }
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    goto leave;
+
+  memset (header, 0, sizeof header);
+  memcpy (header, JOURNAL_MAGIC, strlen (JOURNAL_MAGIC));
+  ulongtobuf (header + JOURNAL_HEADER_LEN - 4, nrecs);
+  gcry_md_write (md, header, sizeof header);
+  if (es_fwrite (header, sizeof header, 1, fp) != 1)
+    goto write_error;
+
+  for (page = cache_lru_head; page; page = page->lru_next)
+    {
+      if (!page->ndirty)
+        continue;
+      for (idx = 0; idx < page->nrecs; idx++)
+        {
+          if (!record_is_dirty (page, idx))
+            continue;
+          recno = page->pageno * TDBIO_PAGE_RECORDS + idx;
+          ulongtobuf (item, recno);
+          memcpy (item + 4, page->data + idx * TRUST_RECORD_LEN,
+                  TRUST_RECORD_LEN);
+          gcry_md_write (md, item, sizeof item);
+          if (es_fwrite (item, sizeof item, 1, fp) != 1)
+            goto write_error;
+        }
+    }
+
+  if (es_fwrite (gcry_md_read (md, GCRY_MD_SHA256), JOURNAL_HASH_LEN, 1, fp)
+      != 1
+      || es_fflush (fp))
+    goto write_error;
+  err = sync_fd (fd);
+  goto leave;
+
+ write_error:
+  err = gpg_error_from_syserror ();
+ leave:
+  gcry_md_close (md);
+  if (fp && es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      log_error (_("error writing '%s': %s\n"), fname, gpg_strerror (err));
+      gnupg_remove (fname);
+    }
+  return err;
+}
+
+
 /*
- * Simple transactions system:
- * Everything between begin_transaction and end/cancel_transaction
- * is not immediately written but at the time of end_transaction.
+ * Write the dirty records of the current transaction to the trustdb
+ * using the journal.  This is called with the write lock held.
  *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * Returns: 0 on success or an error code.
+ */
+static int
+commit_transaction (void)
+{
+  gpg_error_t err;
+  cache_page_t page;
+  char *fname;
+
+  if (!cache_dirty_pages)
+    return 0;
+
+  fname = journal_fname ();
+  err = write_journal (fname);
+  if (err)
+    goto leave;
+
+  for (page = cache_lru_head; page && cache_dirty_pages;
+       page = page->lru_next)
+    if (page->ndirty)
+      {
+        err = write_cache_page (page);
+        if (err)
+          goto leave;  /* The journal will be replayed.  */
+      }
+  err = sync_fd (db_fd);
+  if (err)
+    {
+      log_error ("trustdb: fsync failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+  if (gnupg_remove (fname))
+    log_error (_("error removing '%s': %s\n"),
+               fname, gpg_strerror (gpg_error_from_syserror ()));
+  if (DBG_TRUST)
+    log_debug ("tdbio: transaction committed\n");
+
+ leave:
+  xfree (fname);
+  return err;
+}
+
+
+/*
+ * Replay a left over journal.  This is called after the trustdb has
+ * been opened.
+ */
+static void
+replay_journal (void)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  estream_t fp = NULL;
+  gcry_md_hd_t md = NULL;
+  byte header[JOURNAL_HEADER_LEN];
+  byte item[JOURNAL_ITEM_LEN];
+  byte hash[JOURNAL_HASH_LEN];
+  unsigned long nrecs, n;
+  ulong recno;
+  int complete = 0;
+  int rc;
+
+  fname = journal_fname ();
+  if (gnupg_access (fname, F_OK))
+    {
+      xfree (fname);
+      return;  /* No journal - the usual case.  */
+    }
+
+  take_write_lock ();
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    goto leave;  /* Already replayed by another process.  */
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    goto leave;
+
+  /* First check that the journal has been completely written.  */
+  if (es_fread (header, sizeof header, 1, fp) != 1
+      || memcmp (header, JOURNAL_MAGIC, strlen (JOURNAL_MAGIC)))
+    goto leave;
+  gcry_md_write (md, header, sizeof header);
+  nrecs = buf32_to_ulong (header + JOURNAL_HEADER_LEN - 4);
+  for (n = 0; n < nrecs; n++)
+    {
+      if (es_fread (item, sizeof item, 1, fp) != 1)
+        goto leave;
+      gcry_md_write (md, item, sizeof item);
+    }
+  if (es_fread (hash, sizeof hash, 1, fp) != 1
+      || memcmp (hash, gcry_md_read (md, GCRY_MD_SHA256), sizeof hash))
+    goto leave;
+  complete = 1;
+
+  /* Now apply it.  */
+  log_info (_("%s: replaying the journal of an unfinished transaction\n"),
+            db_name);
+  if (es_fseek (fp, JOURNAL_HEADER_LEN, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (n = 0; n < nrecs; n++)
+    {
+      if (es_fread (item, sizeof item, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      recno = buf32_to_ulong (item);
+      if (lseek (db_fd, (off_t)recno * TRUST_RECORD_LEN, SEEK_SET) == -1
+          || (rc = write (db_fd, item + 4, TRUST_RECORD_LEN))
+              != TRUST_RECORD_LEN)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+  err = sync_fd (db_fd);
+
+ leave:
+  gcry_md_close (md);
+  if (fp)
+    es_fclose (fp);
+  if (err)
+    log_fatal (_("%s: error replaying the journal: %s\n"),
+               db_name, gpg_strerror (err));
+  if (fp)
+    {
+      /* An incomplete journal is from a transaction which has not
+       * been committed; the trustdb has not been touched.  */
+      if (!complete)
+        log_info (_("%s: removing an incomplete journal\n"), db_name);
+      if (gnupg_remove (fname))
+        log_error (_("error removing '%s': %s\n"),
+                   fname, gpg_strerror (gpg_error_from_syserror ()));
+    }
+  release_write_lock ();
+  xfree (fname);
+}
+
+
+/*
+ * Start a transaction.  Nested transactions are not supported.
+ *
+ * Returns: 0 on success or an error code.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_transaction ()
 {
   int rc;
 
@@ -485,56 +974,61 @@ tdbio_begin_transaction ()  /* Not yet used.  */
   rc = tdbio_sync();
   if (rc)
     return rc;
+  take_write_lock ();
   in_transaction = 1;
   return 0;
 }
 
+
+/*
+ * Commit the current transaction.
+ *
+ * Returns: 0 on success or an error code.
+ */
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction ()
 {
   int rc;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
-  take_write_lock ();
   gnupg_block_all_signals ();
+  rc = commit_transaction ();
   in_transaction = 0;
-  rc = tdbio_sync();
   gnupg_unblock_all_signals();
   release_write_lock ();
   return rc;
 }
 
+
+/*
+ * Cancel the current transaction and forget all changes done since
+ * tdbio_begin_transaction.
+ */
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction ()
 {
-  CACHE_CTRL r;
+  cache_page_t page, next;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
 
-  /* Remove all dirty marked entries, so that the original ones are
-   * read back the next time.  */
-  if (cache_is_dirty)
+  /* Remove all dirty pages, so that the original records are read
+   * back the next time.  */
+  for (page = cache_lru_head; page && cache_dirty_pages; page = next)
     {
-      for (r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
-	}
-      cache_is_dirty = 0;
+      next = page->lru_next;
+      if (page->ndirty)
+        drop_page (page);
     }
 
   in_transaction = 0;
+  release_write_lock ();
   return 0;
 }
-#endif  /* Not yet used.  */
 
 
-
+
 /********************************************************
  **************** cached I/O functions ******************
  ********************************************************/
@@ -830,6 +1324,10 @@ open_db ()
 #endif /*!HAVE_W32CE_SYSTEM*/
   register_secured_file (db_name);
 
+  /* Finish a transaction interrupted by a crash.  */
+  if (db_fd != -1)
+    replay_journal ();
+
   /* Read the version record. */
   if (tdbio_read_record (0, &rec, RECTYPE_VER ) )
     log_fatal( _("%s: invalid trustdb\n"), db_name );
@@ -1515,37 +2013,16 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
 int
 tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
 {
-  byte readbuf[TRUST_RECORD_LEN];
   const byte *buf, *p;
   gpg_error_t err = 0;
-  int n, i;
+  int i;
 
   if (db_fd == -1)
     open_db ();
 
-  buf = get_record_from_cache( recnum );
+  buf = get_record_from_cache (recnum, &err);
   if (!buf)
-    {
-      if (lseek (db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET) == -1)
-        {
-          err = gpg_error_from_syserror ();
-          log_error (_("trustdb: lseek failed: %s\n"), strerror (errno));
-          return err;
-	}
-      n = read (db_fd, readbuf, TRUST_RECORD_LEN);
-      if (!n)
-        {
-          return gpg_error (GPG_ERR_EOF);
-	}
-      else if (n != TRUST_RECORD_LEN)
-        {
-          err = gpg_error_from_syserror ();
-          log_error (_("trustdb: read failed (n=%d): %s\n"),
-                     n, strerror(errno));
-          return err;
-	}
-      buf = readbuf;
-    }
+    return err;
   rec->recnum = recnum;
   rec->dirty = 0;
   p = buf;
@@ -1863,6 +2340,8 @@ tdbio_new_recnum (ctrl_t ctrl)
               log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
                          recnum, n, gpg_strerror (rc));
 	    }
+          else
+            note_appended_record (recnum);
 	}
 
       if (rc)
@@ -42,22 +42,88 @@
 			  /* to make sure that a warning is displayed while */
 			  /* creating a message */
 
+/* The size of the input buffer.  It needs to be larger than
+   MAX_LINELEN so that a complete line always fits.  */
+#define TEXT_BUFFER_SIZE 65536
+
+
+/* Return the length of LINE without trailing characters from
+   TRIMCHARS.  */
 static unsigned
 len_without_trailing_chars( byte *line, unsigned len, const char *trimchars )
 {
-    byte *p, *mark;
+    while( len && strchr( trimchars, line[len-1] ) )
+	len--;
+    return len;
+}
+
+
+/* Return the length of the next line in the buffer of TFX including
+   the LF.  Lines are truncated the same way iobuf_read_line does it
+   with a limit of MAX_LINELEN.  Returns 0 if more input is required
+   or at EOF.  */
+static unsigned
+find_line( text_filter_context_t *tfx )
+{
+    byte *start, *p;
     unsigned n;
 
-    for(mark=NULL, p=line, n=0; n < len; n++, p++ ) {
-	if( strchr( trimchars, *p ) ) {
-	    if( !mark )
-		mark = p;
+    if( !tfx->buffer )
+	return 0;
+
+    start = tfx->buffer + tfx->buffer_pos;
+    n = tfx->buffer_len - tfx->buffer_pos;
+    if( tfx->skip_line ) {
+	/* skip the rest of a truncated line */
+	p = memchr( start, '\n', n );
+	if( !p ) {
+	    tfx->buffer_pos = tfx->buffer_len;
+	    return 0;
 	}
-	else
-	    mark = NULL;
+	tfx->skip_line = 0;
+	tfx->buffer_pos += p - start + 1;
+	start = p + 1;
+	n = tfx->buffer_len - tfx->buffer_pos;
     }
 
-    return mark? (mark - line) : len;
+    if( n > MAX_LINELEN - 1 )
+	n = MAX_LINELEN - 1;
+    p = memchr( start, '\n', n );
+    if( p )
+	return p - start + 1;
+    if( n == MAX_LINELEN - 1 ) {
+	start[n-1] = '\n';
+	tfx->truncated++;
+	tfx->skip_line = 1;
+	return n;
+    }
+    return tfx->eof? n : 0;
+}
+
+
+/* Move an incomplete line to the begin of the buffer of TFX and read
+   more data from A.  */
+static void
+fill_buffer( text_filter_context_t *tfx, IOBUF a )
+{
+    int nread;
+
+    if( !tfx->buffer ) {
+	tfx->buffer_size = TEXT_BUFFER_SIZE;
+	tfx->buffer = xmalloc( tfx->buffer_size );
+    }
+    if( tfx->buffer_pos ) {
+	memmove( tfx->buffer, tfx->buffer + tfx->buffer_pos,
+		 tfx->buffer_len - tfx->buffer_pos );
+	tfx->buffer_len -= tfx->buffer_pos;
+	tfx->buffer_pos = 0;
+    }
+    nread = iobuf_read( a, tfx->buffer + tfx->buffer_len,
+			tfx->buffer_size - tfx->buffer_len );
+    if( nread == -1 )
+	tfx->eof = 1;
+    else
+	tfx->buffer_len += nread;
 }
 
 
@@ -65,33 +131,36 @@ static int
 standard( text_filter_context_t *tfx, IOBUF a,
 	  byte *buf, size_t size, size_t *ret_len)
 {
-    int rc=0;
     size_t len = 0;
-    unsigned maxlen;
-
-    log_assert( size > 10 );
-    size -= 2;	/* reserve 2 bytes to append CR,LF */
-    while( !rc && len < size ) {
-	int lf_seen;
+    unsigned n;
 
-	while( len < size && tfx->buffer_pos < tfx->buffer_len )
-	    buf[len++] = tfx->buffer[tfx->buffer_pos++];
-	if( len >= size )
+    while( len < size ) {
+	/* copy the rest of the current line */
+	if( tfx->line_len ) {
+	    n = tfx->line_len;
+	    if( n > size - len )
+		n = size - len;
+	    memcpy( buf + len, tfx->buffer + tfx->buffer_pos, n );
+	    len += n;
+	    tfx->buffer_pos += n;
+	    tfx->line_len -= n;
 	    continue;
+	}
+	if( tfx->pending_lf ) {
+	    buf[len++] = tfx->pending_lf == 2? '\r' : '\n';
+	    tfx->pending_lf--;
+	    continue;
+	}
+	tfx->buffer_pos += tfx->trim_len;
+	tfx->trim_len = 0;
 
-	/* read the next line */
-	maxlen = MAX_LINELEN;
-	tfx->buffer_pos = 0;
-	tfx->buffer_len = iobuf_read_line( a, &tfx->buffer,
-					   &tfx->buffer_size, &maxlen );
-	if( !maxlen )
-	    tfx->truncated++;
-	if( !tfx->buffer_len ) {
-	    if( !len )
-		rc = -1; /* eof */
-	    break;
+	n = find_line( tfx );
+	if( !n ) {
+	    if( tfx->eof )
+		break;
+	    fill_buffer( tfx, a );
+	    continue;
 	}
-	lf_seen = tfx->buffer[tfx->buffer_len-1] == '\n';
 
 	/* The story behind this is that 2440 says that textmode
 	   hashes should canonicalize line endings to CRLF and remove
@@ -110,19 +179,18 @@ standard( text_filter_context_t *tfx, IOBUF a,
 	   this actually makes us compatible with PGP textmode
 	   detached signatures for the first time. */
 	if(opt.rfc2440_text)
-	  tfx->buffer_len=trim_trailing_chars(tfx->buffer,tfx->buffer_len,
-					      " \t\r\n");
+	  tfx->line_len=len_without_trailing_chars(tfx->buffer+tfx->buffer_pos,
+						   n, " \t\r\n");
 	else
-	  tfx->buffer_len=trim_trailing_chars(tfx->buffer,tfx->buffer_len,
-					      "\r\n");
+	  tfx->line_len=len_without_trailing_chars(tfx->buffer+tfx->buffer_pos,
+						   n, "\r\n");
+	tfx->trim_len = n - tfx->line_len;
 
-	if( lf_seen ) {
-	    tfx->buffer[tfx->buffer_len++] = '\r';
-	    tfx->buffer[tfx->buffer_len++] = '\n';
-	}
+	if( tfx->buffer[tfx->buffer_pos+n-1] == '\n' )
+	    tfx->pending_lf = 2; /* append CR,LF */
     }
     *ret_len = len;
-    return rc;
+    return len? 0 : -1; /* eof */
 }
 
 
@@ -154,6 +222,20 @@ text_filter( void *opaque, int control,
 }
 
 
+/* Write the LEN bytes of lines at LINES to OUT.  Unless dash escaping
+   is used the lines are also hashed in one go.  */
+static void
+write_lines( IOBUF out, gcry_md_hd_t md, int escape_dash,
+	     const byte *lines, unsigned len )
+{
+    if( !len )
+	return;
+    if( !escape_dash )
+	gcry_md_write( md, lines, len );
+    iobuf_write( out, lines, len );
+}
+
+
 /****************
  * Copy data from INP to OUT and do some escaping if requested.
  * md is updated as required by rfc2440
@@ -162,72 +244,61 @@ int
 copy_clearsig_text( IOBUF out, IOBUF inp, gcry_md_hd_t md,
 		    int escape_dash, int escape_from)
 {
-    unsigned int maxlen;
-    byte *buffer = NULL;      /* malloced buffer */
-    unsigned int bufsize = 0; /* and size of this buffer */
-    unsigned int n;
-    int truncated = 0;
+    text_filter_context_t tfx;
+    byte *line;
+    unsigned n;
+    unsigned runlen = 0; /* length of the lines not yet written */
     int pending_lf = 0;
 
-   if( !escape_dash )
+    if( !escape_dash )
 	escape_from = 0;
 
     write_status_begin_signing (md);
 
+    memset( &tfx, 0, sizeof tfx );
     for(;;) {
-	maxlen = MAX_LINELEN;
-	n = iobuf_read_line( inp, &buffer, &bufsize, &maxlen );
-	if( !maxlen )
-	    truncated++;
-
-	if( !n )
-	    break; /* read_line has returned eof */
+	n = find_line( &tfx );
+	if( !n ) {
+	    /* flush the lines before the buffer gets refilled */
+	    write_lines( out, md, escape_dash,
+			 tfx.buffer + tfx.buffer_pos - runlen, runlen );
+	    runlen = 0;
+	    if( tfx.eof )
+		break;
+	    fill_buffer( &tfx, inp );
+	    continue;
+	}
+	line = tfx.buffer + tfx.buffer_pos;
 
-	/* update the message digest */
+	/* update the message digest; without dash escaping this is
+	   done by write_lines */
 	if( escape_dash ) {
 	    if( pending_lf ) {
 		gcry_md_putc ( md, '\r' );
 		gcry_md_putc ( md, '\n' );
 	    }
-	    gcry_md_write ( md, buffer,
-                            len_without_trailing_chars (buffer, n, " \t\r\n"));
+	    gcry_md_write ( md, line,
+                            len_without_trailing_chars (line, n, " \t\r\n"));
 	}
-	else
-            gcry_md_write ( md, buffer, n );
-	pending_lf = buffer[n-1] == '\n';
+	pending_lf = line[n-1] == '\n';
 
 	/* write the output */
-	if(    ( escape_dash && *buffer == '-')
-	    || ( escape_from && n > 4 && !memcmp(buffer, "From ", 5 ) ) ) {
+	if(    ( escape_dash && *line == '-')
+	    || ( escape_from && n > 4 && !memcmp(line, "From ", 5 ) ) ) {
+	    write_lines( out, md, escape_dash, line - runlen, runlen );
+	    runlen = 0;
 	    iobuf_put( out, '-' );
 	    iobuf_put( out, ' ' );
 	}
+	runlen += n;
+	tfx.buffer_pos += n;
 
-#if  0 /*defined(HAVE_DOSISH_SYSTEM)*/
-	/* We don't use this anymore because my interpretation of rfc2440 7.1
-	 * is that there is no conversion needed.  If one decides to
-	 * clearsign a unix file on a DOS box he will get a mixed line endings.
-	 * If at some point it turns out, that a conversion is a nice feature
-	 * we can make an option out of it.
-	 */
-	/* make sure the lines do end in CR,LF */
-	if( n > 1 && ( (buffer[n-2] == '\r' && buffer[n-1] == '\n' )
-			    || (buffer[n-2] == '\n' && buffer[n-1] == '\r'))) {
-	    iobuf_write( out, buffer, n-2 );
-	    iobuf_put( out, '\r');
-	    iobuf_put( out, '\n');
+	/* the rest of a truncated line will be skipped */
+	if( tfx.skip_line ) {
+	    write_lines( out, md, escape_dash,
+			 tfx.buffer + tfx.buffer_pos - runlen, runlen );
+	    runlen = 0;
 	}
-	else if( n && buffer[n-1] == '\n' ) {
-	    iobuf_write( out, buffer, n-1 );
-	    iobuf_put( out, '\r');
-	    iobuf_put( out, '\n');
-	}
-	else
-	    iobuf_write( out, buffer, n );
-
-#else
-	iobuf_write( out, buffer, n );
-#endif
     }
 
     /* at eof */
@@ -237,9 +308,9 @@ copy_clearsig_text( IOBUF out, IOBUF inp, gcry_md_hd_t md,
 	    gcry_md_putc( md, '\n' );
     }
 
-    if( truncated )
+    if( tfx.truncated )
 	log_info(_("input line longer than %d characters\n"), MAX_LINELEN );
 
-    xfree (buffer);
+    xfree (tfx.buffer);
     return 0; /* okay */
 }
@@ -71,6 +71,9 @@ struct tofu_dbs_s
   {
     sqlite3_stmt *savepoint_batch;
     sqlite3_stmt *savepoint_batch_commit;
+    sqlite3_stmt *savepoint_inner;
+    sqlite3_stmt *savepoint_inner_release;
+    sqlite3_stmt *savepoint_inner_rollback;
 
     sqlite3_stmt *record_binding_get_old_policy;
     sqlite3_stmt *record_binding_update;
@@ -82,11 +85,17 @@ struct tofu_dbs_s
     sqlite3_stmt *register_already_seen;
     sqlite3_stmt *register_signature;
     sqlite3_stmt *register_encryption;
+    sqlite3_stmt *show_statistics_signature_stats;
+    sqlite3_stmt *show_statistics_signature_days;
+    sqlite3_stmt *show_statistics_encryption_stats;
+    sqlite3_stmt *show_statistics_encryption_days;
+    sqlite3_stmt *notice_key_changed;
   } s;
 
   int in_batch_transaction;
   int in_transaction;
   time_t batch_update_started;
+  time_t batch_transaction_started;
 };
 
 
@@ -108,6 +117,11 @@ struct tofu_dbs_s
 #define TIME_AGO_UNIT_LARGE (365 * 24 * 60 * 60)
 #define TIME_AGO_LARGE_THRESHOLD (2 * TIME_AGO_UNIT_LARGE)
 
+/* A batch transaction is committed after this many seconds even if
+   no other process wants the lock.  This limits the updates lost if
+   gpg is terminated without closing the database.  */
+#define BATCH_COMMIT_INTERVAL 10
+
 /* Local prototypes.  */
 static gpg_error_t end_transaction (ctrl_t ctrl, int only_batch);
 static char *email_from_user_id (const char *user_id);
@@ -207,6 +221,9 @@ begin_transaction (ctrl_t ctrl, int only_batch)
            * not result in the other process getting the lock.  */
           gnupg_usleep (100000);
         }
+      else if (gnupg_get_time () - dbs->batch_transaction_started
+               >= BATCH_COMMIT_INTERVAL)
+        end_transaction (ctrl, 2);
       else
         dbs->batch_update_started = gnupg_get_time ();
     }
@@ -236,6 +253,7 @@ begin_transaction (ctrl_t ctrl, int only_batch)
 
       dbs->in_batch_transaction = 1;
       dbs->batch_update_started = gnupg_get_time ();
+      dbs->batch_transaction_started = dbs->batch_update_started;
 
       if (gnupg_stat (dbs->want_lock_file, &statbuf) == 0)
         dbs->want_lock_file_ctime = statbuf.st_ctime;
@@ -247,9 +265,16 @@ begin_transaction (ctrl_t ctrl, int only_batch)
   log_assert (dbs->in_transaction >= 0);
   dbs->in_transaction ++;
 
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "savepoint inner%d;",
-                           dbs->in_transaction);
+  /* Transactions are rarely nested; thus we only keep a prepared
+     statement for the outermost save point.  */
+  if (dbs->in_transaction == 1)
+    rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_inner,
+                       NULL, NULL, &err,
+                       "savepoint inner1;", GPGSQL_ARG_END);
+  else
+    rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
+                             "savepoint inner%d;",
+                             dbs->in_transaction);
   if (rc)
     {
       log_error (_("error beginning transaction on TOFU database: %s\n"),
@@ -314,8 +339,13 @@ end_transaction (ctrl_t ctrl, int only_batch)
   log_assert (dbs);
   log_assert (dbs->in_transaction > 0);
 
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "release inner%d;", dbs->in_transaction);
+  if (dbs->in_transaction == 1)
+    rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_inner_release,
+                       NULL, NULL, &err,
+                       "release inner1;", GPGSQL_ARG_END);
+  else
+    rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
+                             "release inner%d;", dbs->in_transaction);
 
   dbs->in_transaction --;
 
@@ -343,9 +373,14 @@ rollback_transaction (ctrl_t ctrl)
 
   /* Be careful to not undo any progress made by closed transactions in
      batch mode.  */
-  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
-                           "rollback to inner%d;",
-                           dbs->in_transaction);
+  if (dbs->in_transaction == 1)
+    rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_inner_rollback,
+                       NULL, NULL, &err,
+                       "rollback to inner1;", GPGSQL_ARG_END);
+  else
+    rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
+                             "rollback to inner%d;",
+                             dbs->in_transaction);
 
   dbs->in_transaction --;
 
@@ -904,6 +939,75 @@ initdb (sqlite3 *db)
     }
 }
 
+/* Callback for the journal_mode pragma.  Sets the int at COOKIE if
+   the database is in WAL mode.  */
+static int
+journal_mode_cb (void *cookie, int argc, char **argv, char **azColName)
+{
+  int *is_wal = cookie;
+
+  (void) azColName;
+
+  if (argc == 1 && argv[0] && !ascii_strcasecmp (argv[0], "wal"))
+    *is_wal = 1;
+
+  return 0;
+}
+
+/* Switch the database DB to write-ahead logging.  With WAL readers
+   don't block the writer and a commit does not need to sync the
+   database; it is only synced at checkpoints.  WAL uses shared
+   memory for its locks which does not work for processes on
+   different hosts.  Because SQLite can't detect that, we keep the
+   rollback journal if the home directory is on a network file
+   system.  */
+static void
+set_journal_mode (sqlite3 *db)
+{
+  char *err = NULL;
+  int is_wal = 0;
+  int rc;
+
+  if (gnupg_is_network_fs (gnupg_homedir ()))
+    {
+      if (DBG_TRUST)
+        log_debug ("TOFU: not using WAL mode on a network file system\n");
+      /* The journal mode is stored in the database; thus switch back
+         if it has been created on a local file system.  */
+      rc = sqlite3_exec (db, "pragma journal_mode;",
+                         journal_mode_cb, &is_wal, &err);
+      if (!rc && is_wal)
+        rc = sqlite3_exec (db, "pragma journal_mode = delete;",
+                           NULL, NULL, &err);
+      if (rc)
+        {
+          log_debug ("TOFU: error setting journal mode: %s\n", err);
+          sqlite3_free (err);
+        }
+      return;
+    }
+
+  rc = sqlite3_exec (db, "pragma journal_mode = wal;",
+                     journal_mode_cb, &is_wal, &err);
+  if (rc)
+    {
+      if (DBG_TRUST)
+        log_debug ("TOFU: can't switch to WAL mode: %s\n", err);
+      sqlite3_free (err);
+      return;
+    }
+  if (!is_wal)
+    return;
+
+  /* In WAL mode this is still safe against corruption.  */
+  rc = sqlite3_exec (db, "pragma synchronous = normal;", NULL, NULL, &err);
+  if (rc)
+    {
+      log_debug ("TOFU: error setting synchronous mode: %s\n", err);
+      sqlite3_free (err);
+    }
+}
+
 static int
 busy_handler (void *cookie, int call_count)
 {
@@ -965,6 +1069,7 @@ opendbs (ctrl_t ctrl)
         {
           sqlite3_busy_timeout (db, 5 * 1000);
           sqlite3_busy_handler (db, busy_handler, ctrl);
+          set_journal_mode (db);
         }
 
       if (db && initdb (db))
@@ -3012,14 +3117,16 @@ show_statistics (tofu_dbs_t dbs,
   fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
   /* Get the signature stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.show_statistics_signature_stats,
+     strings_collect_cb2, &strlist, &err,
      "select count (*), coalesce (min (signatures.time), 0),\n"
      "  coalesce (max (signatures.time), 0)\n"
      " from signatures\n"
      " left join bindings on signatures.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
+     " where fingerprint = ? and email = ?;",
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3028,15 +3135,17 @@ show_statistics (tofu_dbs_t dbs,
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
     }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.show_statistics_signature_days,
+     strings_collect_cb2, &strlist, &err,
      "select count (*) from\n"
      "  (select round(signatures.time / (24 * 60 * 60)) day\n"
      "    from signatures\n"
      "    left join bindings on signatures.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
+     "    where fingerprint = ? and email = ?\n"
      "    group by day);",
-     fingerprint, email);
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3066,14 +3175,16 @@ show_statistics (tofu_dbs_t dbs,
     }
 
   /* Get the encryption stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.show_statistics_encryption_stats,
+     strings_collect_cb2, &strlist, &err,
      "select count (*), coalesce (min (encryptions.time), 0),\n"
      "  coalesce (max (encryptions.time), 0)\n"
      " from encryptions\n"
      " left join bindings on encryptions.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
+     " where fingerprint = ? and email = ?;",
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3082,15 +3193,17 @@ show_statistics (tofu_dbs_t dbs,
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
     }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.show_statistics_encryption_days,
+     strings_collect_cb2, &strlist, &err,
      "select count (*) from\n"
      "  (select round(encryptions.time / (24 * 60 * 60)) day\n"
      "    from encryptions\n"
      "    left join bindings on encryptions.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
+     "    where fingerprint = ? and email = ?\n"
      "    group by day);",
-     fingerprint, email);
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -4027,7 +4140,7 @@ tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
   if (!fingerprint)
     return gpg_error_from_syserror ();
 
-  rc = gpgsql_stepx (dbs->db, NULL, NULL, NULL, &sqlerr,
+  rc = gpgsql_stepx (dbs->db, &dbs->s.notice_key_changed, NULL, NULL, &sqlerr,
                      "update bindings set effective_policy = ?"
                      " where fingerprint = ?;",
                      GPGSQL_ARG_INT, (int) TOFU_POLICY_NONE,
@@ -0,0 +1,313 @@
+/* trust-regexp.c - Regular expressions of trust signatures
+ * Copyright (C) 1998-2012 Free Software Foundation, Inc.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../regexp/jimregexp.h"
+#include "options.h"
+#include "trust-regexp.h"
+
+
+/* Returns a sanitized copy of the regexp (which might be "", but not
+   NULL). */
+/* Operator characters except '.' and backslash.
+   See regex(7) on BSD.  */
+#define REGEXP_OPERATOR_CHARS "^[$()|*+?{"
+
+static char *
+sanitize_regexp(const char *old)
+{
+  size_t start=0,len=strlen(old),idx=0;
+  int escaped=0,standard_bracket=0;
+  char *new=xmalloc((len*2)+1); /* enough to \-escape everything if we
+				   have to */
+
+  /* There are basically two commonly-used regexps here.  GPG and most
+     versions of PGP use "<[^>]+[@.]example\.com>$" and PGP (9)
+     command line uses "example.com" (i.e. whatever the user specifies,
+     and we can't expect users know to use "\." instead of ".").  So
+     here are the rules: we're allowed to start with "<[^>]+[@.]" and
+     end with ">$" or start and end with nothing.  In between, the
+     only legal regex character is ".", and everything else gets
+     escaped.  Part of the gotcha here is that some regex packages
+     allow more than RFC-4880 requires.  For example, 4880 has no "{}"
+     operator, but GNU regex does.  Commenting removes these operators
+     from consideration.  A possible future enhancement is to use
+     commenting to effectively back off a given regex to the Henry
+     Spencer syntax in 4880. -dshaw */
+
+  /* Are we bracketed between "<[^>]+[@.]" and ">$" ? */
+  if(len>=12 && strncmp(old,"<[^>]+[@.]",10)==0
+     && old[len-2]=='>' && old[len-1]=='$')
+    {
+      strcpy(new,"<[^>]+[@.]");
+      idx=strlen(new);
+      standard_bracket=1;
+      start+=10;
+      len-=2;
+    }
+
+  /* Walk the remaining characters and ensure that everything that is
+     left is not an operational regex character. */
+  for(;start<len;start++)
+    {
+      if(!escaped && old[start]=='\\')
+	escaped=1;
+      else if (!escaped && strchr (REGEXP_OPERATOR_CHARS, old[start]))
+	new[idx++]='\\';
+      else
+	escaped=0;
+
+      new[idx++]=old[start];
+    }
+
+  new[idx]='\0';
+
+  /* Note that the (sub)string we look at might end with a bare "\".
+     If it does, leave it that way.  If the regexp actually ended with
+     ">$", then it was escaping the ">" and is fine.  If the regexp
+     actually ended with the bare "\", then it's an illegal regexp and
+     regcomp should kick it out. */
+
+  if(standard_bracket)
+    strcat(new,">$");
+
+  return new;
+}
+
+/* Number of compiled trust signature regexps we keep.  */
+#define REGEXP_CACHE_SIZE 16
+
+/* Maximum length of the literal part of a regexp which can be handled
+ * by the simple matcher.  */
+#define SIMPLE_REGEXP_MAX 64
+
+/* The prefix and suffix of a bracketed regexp; see sanitize_regexp. */
+#define REGEXP_BRACKET_PREFIX "<[^>]+[@.]"
+#define REGEXP_BRACKET_SUFFIX ">$"
+
+/* A compiled regexp from a trust signature.  */
+struct regexp_cache_s
+{
+  char *expr;          /* The regexp from the signature or NULL.  */
+  unsigned long used;  /* For the LRU replacement.  */
+  int bad;             /* The regexp does not compile.  */
+  regex_t pat;         /* The compiled regexp.  */
+  int bracketed;       /* The regexp is "<[^>]+[@.]...>$".  */
+  unsigned int npos;   /* Number of characters in the pattern.  */
+  uint64_t *masks;     /* For each ASCII character the positions of
+                          the pattern it matches; NULL if the simple
+                          matcher can't be used.  */
+};
+
+static struct regexp_cache_s regexp_cache[REGEXP_CACHE_SIZE];
+static unsigned long regexp_cache_clock;
+
+
+/* Try to compile the sanitized regexp REGEXP for the simple matcher.
+ * This works for the regexps created by sanitize_regexp which use
+ * ASCII characters and only "." and escaped punctuation characters.
+ * A bit-parallel matcher is used for them which runs in linear time.
+ * Returns true on success.  */
+static int
+compile_simple_regexp (struct regexp_cache_s *rc, const char *regexp)
+{
+  size_t len = strlen (regexp);
+  size_t prefixlen = strlen (REGEXP_BRACKET_PREFIX);
+  const unsigned char *s;
+  uint64_t bit;
+  int c;
+
+  rc->bracketed = 0;
+  if (len >= prefixlen + 2
+      && !strncmp (regexp, REGEXP_BRACKET_PREFIX, prefixlen)
+      && !strcmp (regexp + len - 2, REGEXP_BRACKET_SUFFIX))
+    {
+      rc->bracketed = 1;
+      regexp += prefixlen;
+      len -= prefixlen + 2;
+    }
+
+  rc->masks = xcalloc (128, sizeof *rc->masks);
+  rc->npos = 0;
+  for (s = (const unsigned char *)regexp; len; s++, len--)
+    {
+      if (rc->npos == SIMPLE_REGEXP_MAX || (*s & 0x80))
+        goto fail;
+
+      bit = (uint64_t)1 << rc->npos++;
+      if (*s == '.')
+        {
+          for (c = 1; c < 128; c++)
+            rc->masks[c] |= bit;
+          continue;
+        }
+      if (*s == '\\')
+        {
+          /* Escaped letters and digits have a special meaning.  */
+          s++;
+          len--;
+          if (!len || *s <= ' ' || *s >= 0x7f || alnump (s)
+              || *s == '<' || *s == '>')
+            goto fail;
+        }
+      else if (strchr (REGEXP_OPERATOR_CHARS, *s))
+        goto fail;
+      rc->masks[ascii_tolower (*s)] |= bit;
+      rc->masks[ascii_toupper (*s)] |= bit;
+    }
+
+  return 1;
+
+ fail:
+  xfree (rc->masks);
+  rc->masks = NULL;
+  return 0;
+}
+
+
+/* Match the regexp compiled by compile_simple_regexp against the ASCII
+ * STRING.  */
+static int
+match_simple_regexp (struct regexp_cache_s *rc, const char *string)
+{
+  const unsigned char *s = (const unsigned char *)string;
+  size_t len = strlen (string);
+  size_t i, j, n;
+  uint64_t state;
+
+  if (rc->bracketed)
+    {
+      /* The literal part must be followed by ">" at the end and be
+       * preceded by "<", at least one character other than ">", and
+       * "@" or ".".  */
+      n = rc->npos;
+      if (len < n + 4 || s[len-1] != '>')
+        return 0;
+      for (i = 0; i < n; i++)
+        if (!(rc->masks[s[len-1-n+i]] & ((uint64_t)1 << i)))
+          return 0;
+      i = len - 2 - n;
+      if (s[i] != '@' && s[i] != '.')
+        return 0;
+      for (j = i; j-- > 0 && s[j] != '>'; )
+        if (s[j] == '<' && j + 1 < i)
+          return 1;
+      return 0;
+    }
+
+  if (!rc->npos)
+    return 1;
+  state = 0;
+  for (i = 0; i < len; i++)
+    {
+      state = ((state << 1) | 1) & rc->masks[s[i]];
+      if ((state & ((uint64_t)1 << (rc->npos - 1))))
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Return the cache entry for the regexp EXPR from a trust signature.
+ * The entry is compiled if it is not yet in the cache.  */
+static struct regexp_cache_s *
+get_cached_regexp (const char *expr)
+{
+  struct regexp_cache_s *rc, *lru;
+  char *regexp;
+  int i;
+
+  lru = regexp_cache;
+  for (i = 0; i < REGEXP_CACHE_SIZE; i++)
+    {
+      rc = regexp_cache + i;
+      if (rc->expr && !strcmp (rc->expr, expr))
+        {
+          rc->used = ++regexp_cache_clock;
+          return rc;
+        }
+      if (rc->used < lru->used)
+        lru = rc;
+    }
+
+  rc = lru;
+  if (rc->expr)
+    {
+      if (!rc->bad)
+        regfree (&rc->pat);
+      xfree (rc->masks);
+      xfree (rc->expr);
+    }
+  memset (rc, 0, sizeof *rc);
+
+  /* The regexp is also compiled for use with non-ASCII strings.  */
+  regexp = sanitize_regexp (expr);
+  rc->bad = !!regcomp (&rc->pat, regexp, REG_ICASE|REG_EXTENDED);
+  if (!rc->bad)
+    compile_simple_regexp (rc, regexp);
+  if (DBG_TRUST)
+    log_debug ("regexp '%s' ('%s') compiled%s%s\n", regexp, expr,
+               rc->masks? " (simple)":"", rc->bad? " (bad)":"");
+  xfree (regexp);
+
+  rc->expr = xstrdup (expr);
+  rc->used = ++regexp_cache_clock;
+  return rc;
+}
+
+
+/* Used by validate_one_keyblock to confirm a regexp within a trust
+   signature.  Returns 1 for match, and 0 for no match or regex
+   error. */
+int
+check_trust_regexp (const char *expr, const char *string)
+{
+  struct regexp_cache_s *rc;
+  const char *s;
+  int ret;
+
+  rc = get_cached_regexp (expr);
+  if (rc->bad)
+    ret = 0;
+  else
+    {
+      /* The simple matcher does not know about UTF-8 and the case
+         folding of non-ASCII characters.  */
+      for (s = string; *s && !(*s & 0x80); s++)
+        ;
+      if (rc->masks && !*s)
+        ret = match_simple_regexp (rc, string);
+      else
+        ret = !regexec (&rc->pat, string, 0, NULL, 0);
+    }
+
+  if(DBG_TRUST)
+    log_debug("regexp '%s' on '%s': %s\n",
+	      expr,string,ret?"YES":"NO");
+
+  return ret;
+}
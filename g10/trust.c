@@ -293,6 +293,19 @@ revalidation_mark (ctrl_t ctrl)
 }
 
 
+/* Same as revalidation_mark but used after PK has been imported or
+   updated; this allows to revalidate only PK.  */
+void
+revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+#ifdef NO_TRUST_MODELS
+  (void)pk;
+#else
+  tdb_revalidation_mark_key (ctrl, pk);
+#endif
+}
+
+
 void
 check_trustdb_stale (ctrl_t ctrl)
 {
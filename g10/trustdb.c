@@ -26,7 +26,6 @@
 #include "gpg.h"
 #include "../common/status.h"
 #include "../common/iobuf.h"
-#include "../regexp/jimregexp.h"
 #include "keydb.h"
 #include "../common/util.h"
 #include "options.h"
@@ -38,6 +37,8 @@
 #include "trustdb.h"
 #include "tofu.h"
 #include "key-clean.h"
+#include "kbpool.h"
+#include "trust-regexp.h"
 
 static u32
 keyid_from_fpr20 (ctrl_t ctrl, const byte *fpr, u32 *keyid)
@@ -111,7 +112,20 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 
 static int pending_check_trustdb;
 
+/* Keys queued for an incremental revalidation and the value of the
+ * nextcheck field before they have been queued.  The list is ignored
+ * if PENDING_CHECK_TRUSTDB is set.  */
+static struct key_item *pending_keys;
+static ulong pending_keys_nextcheck;
+
+/* The value of the nextcheck field while keys are queued for an
+ * incremental revalidation.  Like the 1 written by
+ * tdb_revalidation_mark it lets other processes run a full check but
+ * it tells us whether such a check has been requested meanwhile.  */
+#define NEXTCHECK_PENDING_KEYS 2
+
 static int validate_keys (ctrl_t ctrl, int interactive);
+static gpg_error_t revalidate_pending_keys (ctrl_t ctrl);
 
 
 /**********************************************
@@ -644,14 +658,20 @@ tdb_revalidation_mark (ctrl_t ctrl)
 int
 trustdb_pending_check(void)
 {
-  return pending_check_trustdb;
+  return pending_check_trustdb || pending_keys;
 }
 
 /* If the trustdb is dirty, and we're interactive, update it.
-   Otherwise, check it unless no-auto-check-trustdb is set. */
+   Otherwise, check it unless no-auto-check-trustdb is set.  Keys
+   queued by tdb_revalidation_mark_key are revalidated on their own
+   if possible. */
 void
 tdb_check_or_update (ctrl_t ctrl)
 {
+  if (!pending_check_trustdb && pending_keys
+      && !opt.interactive && !opt.no_auto_check_trustdb)
+    revalidate_pending_keys (ctrl);
+
   if (trustdb_pending_check ())
     {
       if (opt.interactive)
@@ -784,6 +804,75 @@ tdb_get_min_ownertrust (ctrl_t ctrl, PKT_public_key *pk, int no_create)
 }
 
 
+/* Return the highest validity stored for any user ID of the key with
+ * the trust record TREC.  */
+static unsigned int
+max_stored_validity (TRUSTREC *trec)
+{
+  TRUSTREC vrec;
+  ulong recno;
+  unsigned int validity = TRUST_UNKNOWN;
+
+  for (recno = trec->r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK) > validity)
+        validity = (vrec.r.valid.validity & TRUST_MASK);
+    }
+
+  return validity;
+}
+
+
+/* Return true if the key PK may introduce other keys into the web of
+ * trust, i.e. it is ultimately trusted or has an ownertrust of at
+ * least marginal.  This is also true if the trust record of PK can't
+ * be read.  */
+static int
+may_introduce_p (ctrl_t ctrl, PKT_public_key *pk)
+{
+  TRUSTREC rec;
+  gpg_error_t err;
+  u32 kid[2];
+
+  keyid_from_pk (pk, kid);
+  if (tdb_keyid_is_utk (kid))
+    return 1;
+
+  err = read_trust_record (ctrl, pk, &rec);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    return 0;
+  if (err)
+    return 1;
+
+  return ((rec.r.trust.ownertrust & TRUST_MASK) >= TRUST_MARGINAL
+          || rec.r.trust.min_ownertrust >= TRUST_MARGINAL);
+}
+
+
+/* Return true if changing the ownertrust of the key with the trust
+ * record REC (NULL for a key without a record) from OLD to NEW may
+ * change the validity of any key.  Only fully valid keys with at
+ * least marginal ownertrust count in the web of trust.  */
+static int
+ownertrust_change_matters (TRUSTREC *rec, unsigned int old, unsigned int new)
+{
+  old &= TRUST_MASK;
+  new &= TRUST_MASK;
+
+  if (old == new)
+    return 0;  /* Only the disabled flag changed.  */
+  if (old == TRUST_ULTIMATE || new == TRUST_ULTIMATE)
+    return 1;
+  if (old < TRUST_MARGINAL && new < TRUST_MARGINAL)
+    return 0;
+  if (trustdb_pending_check ())
+    return 1;  /* The stored validity can't be used.  */
+
+  return rec && max_stored_validity (rec) >= TRUST_FULLY;
+}
+
+
 /*
  * Set the trust value of the given public key to the new value.
  * The key should be a primary one.
@@ -793,6 +882,7 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
 {
   TRUSTREC rec;
   gpg_error_t err;
+  int mark;
 
   if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
     return;
@@ -805,9 +895,12 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
                    (unsigned int)rec.r.trust.ownertrust, new_trust );
       if (rec.r.trust.ownertrust != new_trust)
         {
+          mark = ownertrust_change_matters (&rec, rec.r.trust.ownertrust,
+                                            new_trust);
           rec.r.trust.ownertrust = new_trust;
           write_record (ctrl, &rec);
-          tdb_revalidation_mark (ctrl);
+          if (mark)
+            tdb_revalidation_mark (ctrl);
           do_sync ();
         }
     }
@@ -822,7 +915,8 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
       fpr20_from_pk (pk, rec.r.trust.fingerprint);
       rec.r.trust.ownertrust = new_trust;
       write_record (ctrl, &rec);
-      tdb_revalidation_mark (ctrl);
+      if (ownertrust_change_matters (NULL, TRUST_UNKNOWN, new_trust))
+        tdb_revalidation_mark (ctrl);
       do_sync ();
     }
   else
@@ -1053,6 +1147,10 @@ tdb_check_trustdb_stale (ctrl_t ctrl)
       ulong scheduled;
 
       did_nextcheck = 1;
+      if (!pending_check_trustdb && pending_keys
+          && !opt.no_auto_check_trustdb)
+        revalidate_pending_keys (ctrl);
+
       scheduled = tdbio_read_nextcheck ();
       if ((scheduled && scheduled <= make_timestamp ())
 	  || pending_check_trustdb)
@@ -1319,7 +1417,7 @@ tdb_get_validity_core (ctrl_t ctrl,
 #endif /*!USE_TOFU*/
 
   if (opt.trust_model != TM_TOFU
-      && pending_check_trustdb)
+      && trustdb_pending_check ())
     validity |= TRUST_FLAG_PENDING_CHECK;
 
   return validity;
@@ -1549,105 +1647,6 @@ store_validation_status (ctrl_t ctrl, int depth,
 }
 
 
-/* Returns a sanitized copy of the regexp (which might be "", but not
-   NULL). */
-/* Operator characters except '.' and backslash.
-   See regex(7) on BSD.  */
-#define REGEXP_OPERATOR_CHARS "^[$()|*+?{"
-
-static char *
-sanitize_regexp(const char *old)
-{
-  size_t start=0,len=strlen(old),idx=0;
-  int escaped=0,standard_bracket=0;
-  char *new=xmalloc((len*2)+1); /* enough to \-escape everything if we
-				   have to */
-
-  /* There are basically two commonly-used regexps here.  GPG and most
-     versions of PGP use "<[^>]+[@.]example\.com>$" and PGP (9)
-     command line uses "example.com" (i.e. whatever the user specifies,
-     and we can't expect users know to use "\." instead of ".").  So
-     here are the rules: we're allowed to start with "<[^>]+[@.]" and
-     end with ">$" or start and end with nothing.  In between, the
-     only legal regex character is ".", and everything else gets
-     escaped.  Part of the gotcha here is that some regex packages
-     allow more than RFC-4880 requires.  For example, 4880 has no "{}"
-     operator, but GNU regex does.  Commenting removes these operators
-     from consideration.  A possible future enhancement is to use
-     commenting to effectively back off a given regex to the Henry
-     Spencer syntax in 4880. -dshaw */
-
-  /* Are we bracketed between "<[^>]+[@.]" and ">$" ? */
-  if(len>=12 && strncmp(old,"<[^>]+[@.]",10)==0
-     && old[len-2]=='>' && old[len-1]=='$')
-    {
-      strcpy(new,"<[^>]+[@.]");
-      idx=strlen(new);
-      standard_bracket=1;
-      start+=10;
-      len-=2;
-    }
-
-  /* Walk the remaining characters and ensure that everything that is
-     left is not an operational regex character. */
-  for(;start<len;start++)
-    {
-      if(!escaped && old[start]=='\\')
-	escaped=1;
-      else if (!escaped && strchr (REGEXP_OPERATOR_CHARS, old[start]))
-	new[idx++]='\\';
-      else
-	escaped=0;
-
-      new[idx++]=old[start];
-    }
-
-  new[idx]='\0';
-
-  /* Note that the (sub)string we look at might end with a bare "\".
-     If it does, leave it that way.  If the regexp actually ended with
-     ">$", then it was escaping the ">" and is fine.  If the regexp
-     actually ended with the bare "\", then it's an illegal regexp and
-     regcomp should kick it out. */
-
-  if(standard_bracket)
-    strcat(new,">$");
-
-  return new;
-}
-
-/* Used by validate_one_keyblock to confirm a regexp within a trust
-   signature.  Returns 1 for match, and 0 for no match or regex
-   error. */
-static int
-check_regexp(const char *expr,const char *string)
-{
-  int ret;
-  char *regexp;
-
-  regexp=sanitize_regexp(expr);
-
-  {
-    regex_t pat;
-
-    ret=regcomp(&pat,regexp,REG_ICASE|REG_EXTENDED);
-    if(ret==0)
-      {
-	ret=regexec(&pat,string,0,NULL,0);
-	regfree(&pat);
-      }
-    ret=(ret==0);
-  }
-
-  if(DBG_TRUST)
-    log_debug("regexp '%s' ('%s') on '%s': %s\n",
-	      regexp,expr,string,ret?"YES":"NO");
-
-  xfree(regexp);
-
-  return ret;
-}
-
 /*
  * Return true if the key is signed by one of the keys in the given
  * key ID list.  User IDs with a valid signature are marked by node
@@ -1727,8 +1726,8 @@ validate_one_keyblock (ctrl_t ctrl, kbnode_t kb, struct key_item *klist,
                      || !(opt.trust_model == TM_PGP
                           || opt.trust_model == TM_TOFU_PGP)
                      || (uidnode
-                         && check_regexp(kr->trust_regexp,
-                                         uidnode->pkt->pkt.user_id->name))))
+                         && check_trust_regexp (kr->trust_regexp,
+                                    uidnode->pkt->pkt.user_id->name))))
             {
 	      /* Are we part of a trust sig chain?  We always favor
                  the latest trust sig, rather than the greater or
@@ -1833,12 +1832,104 @@ search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
 }
 
 
+/* Values returned by validate_key_worker.  */
+#define VALIDATE_KEY_SKIP     0  /* Key is not signed by klist.  */
+#define VALIDATE_KEY_EXPIRED  1  /* Key is expired or revoked.   */
+#define VALIDATE_KEY_SIGNED   2  /* Key is signed by klist.      */
+
+/* The parameters for validate_key_worker.  */
+struct validate_key_parm_s
+{
+  struct key_item *klist;
+  u32 curtime;
+  u32 *next_expire;
+};
+
+
+/* Prepare and validate the KEYBLOCK.  This is the part of
+ * validate_key_list which does not depend on the other keys and thus
+ * may run in a worker thread.  Returns one of the VALIDATE_KEY_
+ * constants.  */
+static int
+validate_key_worker (ctrl_t ctrl, kbnode_t keyblock, void *opaque)
+{
+  struct validate_key_parm_s *parm = opaque;
+  PKT_public_key *pk;
+
+  /* prepare the keyblock for further processing */
+  merge_keys_and_selfsig (ctrl, keyblock);
+  clear_kbnode_flags (keyblock);
+  pk = keyblock->pkt->pkt.public_key;
+  if (pk->has_expired || pk->flags.revoked)
+    return VALIDATE_KEY_EXPIRED;
+  if (!validate_one_keyblock (ctrl, keyblock, parm->klist,
+                              parm->curtime, parm->next_expire))
+    return VALIDATE_KEY_SKIP;
+
+  if (pk->expiredate && pk->expiredate >= parm->curtime
+      && pk->expiredate < *parm->next_expire)
+    *parm->next_expire = pk->expiredate;
+  return VALIDATE_KEY_SIGNED;
+}
+
+
+/* Take the result RESULT of validate_key_worker for KEYBLOCK and add
+ * the keyblock to KEYS if it has been signed.  Returns true if
+ * KEYBLOCK has been stored in KEYS.  */
+static int
+validate_key_done (kbnode_t keyblock, int result, KeyHashTable full_trust,
+                   struct key_array **keys, size_t *nkeys, size_t *maxkeys)
+{
+  kbnode_t node;
+  u32 kid[2];
+
+  /* With worker threads a key may have been queued a second time
+   * (i.e. from another resource) before its first instance has been
+   * marked as seen; ignore it as the skip function would have done
+   * without workers.  */
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+  if (test_key_hash_table (full_trust, kid))
+    return 0;
+
+  if (result == VALIDATE_KEY_EXPIRED)
+    {
+      /* it does not make sense to look further at those keys */
+      mark_keyblock_seen (full_trust, keyblock);
+      return 0;
+    }
+  if (result != VALIDATE_KEY_SIGNED)
+    return 0;
+
+  if (*nkeys == *maxkeys) {
+    *maxkeys += 1000;
+    *keys = xrealloc (*keys, (*maxkeys+1) * sizeof **keys);
+  }
+  (*keys)[(*nkeys)++].keyblock = keyblock;
+
+  /* Optimization - if all uids are fully trusted, then we
+     never need to consider this key as a candidate again. */
+
+  for (node=keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+      break;
+
+  if(node==NULL)
+    mark_keyblock_seen (full_trust, keyblock);
+
+  return 1;
+}
+
+
 /*
  * Scan all keys and return a key_array of all suitable keys from
  * klist.  The caller has to pass keydb handle so that we don't use
  * to create our own.  Returns either a key_array or NULL in case of
  * an error.  No results found are indicated by an empty array.
  * Caller hast to release the returned array.
+ *
+ * With --jobs the keyblocks are validated by worker threads; the
+ * results are taken in the order of the keyblocks in the database so
+ * that the outcome does not depend on the scheduling.
  */
 static struct key_array *
 validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
@@ -1847,8 +1938,10 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
   KBNODE keyblock = NULL;
   struct key_array *keys = NULL;
   size_t nkeys, maxkeys;
-  int rc;
+  int rc, result;
   KEYDB_SEARCH_DESC desc;
+  struct validate_key_parm_s parm;
+  kbpool_t pool = NULL;
 
   maxkeys = 1000;
   keys = xmalloc ((maxkeys+1) * sizeof *keys);
@@ -1878,11 +1971,14 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       goto die;
     }
 
+  parm.klist = klist;
+  parm.curtime = curtime;
+  parm.next_expire = next_expire;
+  pool = kbpool_new (ctrl, validate_key_worker, &parm);
+
   desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
   do
     {
-      PKT_public_key *pk;
-
       rc = keydb_get_keyblock (hd, &keyblock);
       if (rc)
         {
@@ -1899,41 +1995,23 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
           continue;
         }
 
-      /* prepare the keyblock for further processing */
-      merge_keys_and_selfsig (ctrl, keyblock);
-      clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
+      if (pool)
         {
-          /* it does not make sense to look further at those keys */
-          mark_keyblock_seen (full_trust, keyblock);
+          kbpool_put (pool, keyblock);
+          keyblock = NULL;
+          while ((keyblock = kbpool_get (pool, 0, &result)))
+            {
+              if (!validate_key_done (keyblock, result, full_trust,
+                                      &keys, &nkeys, &maxkeys))
+                release_kbnode (keyblock);
+            }
         }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
+      else
         {
-	  KBNODE node;
-
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
-
-          if (nkeys == maxkeys) {
-            maxkeys += 1000;
-            keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
-          }
-          keys[nkeys++].keyblock = keyblock;
-
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
-
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
-
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
-
-          keyblock = NULL;
+          result = validate_key_worker (ctrl, keyblock, &parm);
+          if (validate_key_done (keyblock, result, full_trust,
+                                 &keys, &nkeys, &maxkeys))
+            keyblock = NULL;
         }
 
       release_kbnode (keyblock);
@@ -1947,10 +2025,22 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       goto die;
     }
 
+  if (pool)
+    {
+      while ((keyblock = kbpool_get (pool, 1, &result)))
+        {
+          if (!validate_key_done (keyblock, result, full_trust,
+                                  &keys, &nkeys, &maxkeys))
+            release_kbnode (keyblock);
+        }
+      kbpool_release (pool);
+    }
+
   keys[nkeys].keyblock = NULL;
   return keys;
 
  die:
+  kbpool_release (pool);
   keys[nkeys].keyblock = NULL;
   release_key_array (keys);
   return NULL;
@@ -2039,6 +2129,7 @@ validate_keys (ctrl_t ctrl, int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
   u32 start_time, next_expire;
+  int in_transaction = 0;
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
@@ -2057,6 +2148,19 @@ validate_keys (ctrl_t ctrl, int interactive)
   used = new_key_hash_table ();
   full_trust = new_key_hash_table ();
 
+  /* Write all updates with one commit.  This keeps the trustdb
+   * locked; thus we don't do this if we may need to ask the user.  */
+  if (!interactive)
+    {
+      rc = tdbio_begin_transaction ();
+      if (rc)
+        {
+          log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc));
+          goto leave;
+        }
+      in_transaction = 1;
+    }
+
   reset_trust_records (ctrl);
 
   /* Fixme: Instead of always building a UTK list, we could just build it
@@ -2284,7 +2388,354 @@ validate_keys (ctrl_t ctrl, int interactive)
 
       do_sync ();
       pending_check_trustdb = 0;
+      release_key_items (pending_keys);
+      pending_keys = NULL;
+    }
+
+  if (in_transaction)
+    {
+      if (rc)
+        tdbio_cancel_transaction ();
+      else
+        {
+          int rc2 = tdbio_end_transaction ();
+          if (rc2)
+            {
+              log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc2));
+              g10_exit (2);
+            }
+        }
     }
 
   return rc;
 }
+
+
+
+/***********************************************
+ *********  Incremental revalidation  **********
+ ***********************************************/
+
+/* Mark the trustdb for revalidation after the public key PK has been
+ * imported or updated.  A key which can't introduce other keys into
+ * the web of trust affects only its own validity; such a key is
+ * queued for an incremental revalidation.  For all other keys a full
+ * check is scheduled.  */
+void
+tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+  struct key_item *k;
+  u32 kid[2];
+  ulong nextcheck;
+
+  init_trustdb (ctrl, 0);
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  if (pending_check_trustdb
+      || !(opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC
+           || opt.trust_model == TM_TOFU_PGP)
+      || may_introduce_p (ctrl, pk))
+    {
+      tdb_revalidation_mark (ctrl);
+      return;
+    }
+
+  keyid_from_pk (pk, kid);
+  for (k = pending_keys; k; k = k->next)
+    if (k->kid[0] == kid[0] && k->kid[1] == kid[1])
+      return;  /* Already queued.  */
+
+  if (!pending_keys)
+    {
+      nextcheck = tdbio_read_nextcheck ();
+      if (nextcheck && nextcheck <= make_timestamp ())
+        {
+          /* A full check is due anyway.  */
+          tdb_revalidation_mark (ctrl);
+          return;
+        }
+
+      /* Schedule a check in the trustdb as we would do for a full
+       * check; this is reverted after the revalidation.  */
+      pending_keys_nextcheck = nextcheck;
+      if (tdbio_write_nextcheck (ctrl, NEXTCHECK_PENDING_KEYS))
+        do_sync ();
+    }
+
+  k = new_key_item ();
+  k->kid[0] = kid[0];
+  k->kid[1] = kid[1];
+  k->next = pending_keys;
+  pending_keys = k;
+}
+
+
+/* Return true if the keyblock KB carries a trust signature from
+ * another key.  */
+static int
+has_trust_signature_p (kbnode_t kb)
+{
+  kbnode_t node;
+  u32 kid[2];
+
+  keyid_from_pk (kb->pkt->pkt.public_key, kid);
+  for (node = kb; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE
+        && node->pkt->pkt.signature->trust_depth
+        && !(node->pkt->pkt.signature->keyid[0] == kid[0]
+             && node->pkt->pkt.signature->keyid[1] == kid[1]))
+      return 1;
+
+  return 0;
+}
+
+
+/* Clear the stored validity of all user IDs of PK.  This is
+ * reset_trust_records for a single key.  Caller must sync.  */
+static void
+reset_key_validity (ctrl_t ctrl, PKT_public_key *pk)
+{
+  TRUSTREC trec, vrec;
+  ulong recno;
+
+  if (read_trust_record (ctrl, pk, &trec))
+    return;
+
+  for (recno = trec.r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK)
+          || vrec.r.valid.marginal_count || vrec.r.valid.full_count)
+        {
+          vrec.r.valid.validity &= ~TRUST_MASK;
+          vrec.r.valid.marginal_count = vrec.r.valid.full_count = 0;
+          write_record (ctrl, &vrec);
+        }
+    }
+}
+
+
+/* Check whether the key SIGNER_KID which signed another key takes
+ * part in the web of trust.  If so, a new key_item is stored at
+ * R_ITEM and the depth at which the key introduces other keys at
+ * R_DEPTH; otherwise NULL is stored at R_ITEM.  Returns
+ * GPG_ERR_NOT_SUPPORTED if this can't be decided from the trustdb.  */
+static gpg_error_t
+get_introducer (ctrl_t ctrl, u32 *signer_kid,
+                struct key_item **r_item, int *r_depth)
+{
+  gpg_error_t err = 0;
+  kbnode_t keyblock;
+  PKT_public_key *pk;
+  TRUSTREC trec;
+  struct key_item *k;
+  unsigned int ownertrust;
+
+  *r_item = NULL;
+  *r_depth = 0;
+
+  if (tdb_keyid_is_utk (signer_kid))
+    {
+      k = new_key_item ();
+      k->kid[0] = signer_kid[0];
+      k->kid[1] = signer_kid[1];
+      k->ownertrust = TRUST_ULTIMATE;
+      *r_item = k;
+      return 0;
+    }
+
+  keyblock = get_pubkeyblock (ctrl, signer_kid);
+  if (!keyblock)
+    return 0;  /* Unknown signer.  */
+  pk = keyblock->pkt->pkt.public_key;
+  if (pk->has_expired || pk->flags.revoked)
+    goto leave;
+
+  err = read_trust_record (ctrl, pk, &trec);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      err = 0;
+      goto leave;
+    }
+  if (err)
+    goto leave;
+
+  ownertrust = (trec.r.trust.ownertrust & TRUST_MASK);
+  if (trec.r.trust.min_ownertrust > ownertrust)
+    {
+      /* The ownertrust has been raised by a trust signature.  */
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  if (!(ownertrust == TRUST_MARGINAL || ownertrust == TRUST_FULLY)
+      || max_stored_validity (&trec) < TRUST_FULLY)
+    goto leave;
+
+  /* The depth of a key may be larger than the one at which it has
+   * been put into the key list for the first time; thus we are too
+   * strict here which only results in a full check.  A trust
+   * signature on the signer may restrict it by a regexp which is not
+   * stored in the trustdb.  */
+  if (trec.r.trust.depth + 1 >= opt.max_cert_depth
+      || has_trust_signature_p (keyblock))
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  k = new_key_item ();
+  k->kid[0] = signer_kid[0];
+  k->kid[1] = signer_kid[1];
+  k->ownertrust = ownertrust;
+  k->min_ownertrust = trec.r.trust.min_ownertrust;
+  *r_item = k;
+  *r_depth = trec.r.trust.depth + 1;
+
+ leave:
+  release_kbnode (keyblock);
+  return err;
+}
+
+
+/* Revalidate the key with KID which has been queued by
+ * tdb_revalidation_mark_key.  The key list is built from the keys
+ * which signed that key and are valid introducers according to the
+ * trustdb.  Returns GPG_ERR_NOT_SUPPORTED if the result may differ
+ * from a full check.  */
+static gpg_error_t
+revalidate_one_key (ctrl_t ctrl, u32 *kid, u32 curtime, u32 *next_expire,
+                    KeyHashTable stored)
+{
+  gpg_error_t err = 0;
+  kbnode_t keyblock, node;
+  struct key_item *klist = NULL;
+  struct key_item *k;
+  struct validate_key_parm_s parm;
+  KeyHashTable seen;
+  int depth = 0;
+  int d;
+
+  keyblock = get_pubkeyblock (ctrl, kid);
+  if (!keyblock)
+    return 0;  /* The key has been deleted meanwhile.  */
+
+  /* The key may have changed since it has been queued.  */
+  if (may_introduce_p (ctrl, keyblock->pkt->pkt.public_key)
+      || has_trust_signature_p (keyblock))
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  seen = new_key_hash_table ();
+  for (node = keyblock; node && !err; node = node->next)
+    {
+      PKT_signature *sig;
+
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if ((sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1])
+          || test_key_hash_table (seen, sig->keyid))
+        continue;
+      add_key_hash_table (seen, sig->keyid);
+
+      err = get_introducer (ctrl, sig->keyid, &k, &d);
+      if (!err && k)
+        {
+          k->next = klist;
+          klist = k;
+          if (d > depth)
+            depth = d;
+        }
+    }
+  release_key_hash_table (seen);
+  if (err)
+    goto leave;
+
+  reset_key_validity (ctrl, keyblock->pkt->pkt.public_key);
+  if (klist)
+    {
+      parm.klist = klist;
+      parm.curtime = curtime;
+      parm.next_expire = next_expire;
+      if (validate_key_worker (ctrl, keyblock, &parm) == VALIDATE_KEY_SIGNED)
+        store_validation_status (ctrl, depth, keyblock, stored);
+    }
+  do_sync ();
+
+ leave:
+  release_key_items (klist);
+  release_kbnode (keyblock);
+  return err;
+}
+
+
+/* Revalidate the keys queued by tdb_revalidation_mark_key.  On error
+ * a full check is scheduled.  */
+static gpg_error_t
+revalidate_pending_keys (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  struct key_item *k;
+  KeyHashTable stored;
+  u32 curtime, next_expire;
+  int count = 0;
+
+  err = tdbio_begin_transaction ();
+  if (err)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  curtime = make_timestamp ();
+  if (pending_keys_nextcheck)
+    next_expire = pending_keys_nextcheck;
+  else
+    next_expire = 0xffffffff;
+  stored = new_key_hash_table ();
+  for (k = pending_keys; k && !err; k = k->next, count++)
+    err = revalidate_one_key (ctrl, k->kid, curtime, &next_expire, stored);
+  release_key_hash_table (stored);
+
+  if (err)
+    {
+      tdbio_cancel_transaction ();
+      goto leave;
+    }
+
+  /* We hold the write lock and thus read the current value.  If
+   * another process requested or did a full check after we queued
+   * the keys, the nextcheck field is not ours to restore.  */
+  if (tdbio_read_nextcheck () != NEXTCHECK_PENDING_KEYS)
+    ;
+  else if (next_expire == 0xffffffff || next_expire < curtime)
+    tdbio_write_nextcheck (ctrl, 0);
+  else
+    tdbio_write_nextcheck (ctrl, next_expire);
+
+  err = tdbio_end_transaction ();
+  if (err)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (err));
+      g10_exit (2);
+    }
+
+  if (opt.verbose)
+    log_info (ngettext ("%d key revalidated\n",
+                        "%d keys revalidated\n", count), count);
+
+ leave:
+  if (err)
+    {
+      if (opt.verbose)
+        log_info (_("incremental trustdb update not possible: %s\n"),
+                  gpg_strerror (err));
+      pending_check_trustdb = 1;
+    }
+  release_key_items (pending_keys);
+  pending_keys = NULL;
+  return err;
+}
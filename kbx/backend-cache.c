@@ -19,9 +19,37 @@
  */
 
 /*
- * This cache backend is designed to be queried first and to deliver
- * cached items (which may also be not-found).  A set a maintenance
- * functions is used used by the frontend to fill the cache.
+ * This cache is designed to be queried by the frontend before the
+ * actual database and to deliver cached items (which may also be
+ * not-found).  A set of maintenance functions is used by the frontend
+ * and the backends to fill and invalidate the cache.
+ *
+ * All items are kept in a single hash table and in a list ordered by
+ * the time of their last use.  The size of the blobs and the items
+ * themselves are charged against a byte budget; if the budget is
+ * exceeded the least recently used items are evicted.  There are
+ * three kinds of items:
+ *
+ *  - A blob indexed by its UBID.
+ *  - A fingerprint mapped to the UBID of its blob or marked as
+ *    not-found.
+ *  - A long keyid marked as not-found.
+ *
+ * A fingerprint item records the serial number of the blob item it
+ * was derived from; if that blob has been replaced or dropped the
+ * fingerprint item is stale and ignored.
+ *
+ * A search may run without holding the nPth lock and thus see the
+ * database as it was before a concurrent update.  To avoid caching
+ * outdated results, each update increments a generation counter and
+ * results are only put into the cache if no update happened since the
+ * search was started.
+ *
+ * Note that all functions are called with the nPth lock held and
+ * thus there is no need for extra locking.  However, returning a blob
+ * to the client may release the lock; thus items carry a reference
+ * counter.
+ *
  * FIXME: Support x.509
  */
 
@@ -38,12 +66,14 @@
 #include "keybox-defs.h"
 
 
-/* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
-#define NO_OF_KEY_ITEM_BUCKETS          383
-#define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
-#define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
+/* The initial number of buckets of the hash table.  The table is
+ * doubled in size if it holds more than 2 items per bucket.  */
+#define INITIAL_CACHE_BUCKETS  1021
+
+/* Bit values to describe the public key types covered by a not-found
+ * mark.  */
+#define CACHE_FILTER_OPGP  1
+#define CACHE_FILTER_X509  2
 
 
 /* Our definition of the backend handle.  */
@@ -54,808 +84,517 @@ struct backend_handle_s
 };
 
 
-/* The object holding a blob.  */
-typedef struct blob_s
-{
-  struct blob_s *next;
-  enum pubkey_types pktype;
-  unsigned int refcount;
-  unsigned int usecount;
-  unsigned int datalen;
-  unsigned char *data;        /* The actual data of length DATALEN.  */
-  unsigned char ubid[UBID_LEN];
-} *blob_t;
-
-
-static blob_t *blob_table;                /* Hash table with the blobs.   */
-static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int blob_table_added;     /* Number of items added.       */
-static unsigned int blob_table_dropped;   /* Number of items dropped.     */
-static blob_t blob_attic;                 /* List of freed blobs.         */
-
-
-/* A list item to blob data.  This is so that a next operation on a
- * cached key item can actually work.  Things are complicated because
- * we do not want to force caching all object before we get a next
- * request from the client.  To accomplish this we keep a flag
- * indicating that the search needs to continue instead of delivering
- * the previous item from the cache.  */
-typedef struct bloblist_s
-{
-  struct bloblist_s *next;
-  unsigned int final_kid:1;     /* The final blob for KID searches. */
-  unsigned int final_fpr:1;     /* The final blob for FPR searches. */
-  unsigned int ubid_valid:1;    /* The blobid below is valid.   */
-  unsigned int subkey:1;        /* The entry is for a subkey.   */
-  unsigned int fprlen:8;        /* The length of the fingerprint or 0.  */
-  char fpr[32];                 /* The buffer for the fingerprint.  */
-  unsigned char ubid[UBID_LEN]; /* The Unique-Blob-ID of the blob.  */
-} *bloblist_t;
-
-static bloblist_t bloblist_attic;  /* List of freed items.  */
-
-/* The cache object.  For indexing we could use the fingerprint
- * directly as a hash value.  However, we use the keyid instead
- * because the keyid is used by OpenPGP in encrypted packets and older
- * signatures to identify a key.  Since v4 OpenPGP keys the keyid is
- * anyway a part of the fingerprint so it quickly extracted from a
- * fingerprint.  Note that v3 keys are not supported by gpg.
- * FIXME: Add support for X.509.
- */
-typedef struct key_item_s
-{
-  struct key_item_s *next;
-  bloblist_t  blist;       /* List of blobs or NULL for not-found.  */
-  unsigned int usecount;
-  unsigned int refcount;   /* Reference counter for this item.  */
-  u32 kid_h;               /* Upper 4 bytes of the keyid.  */
-  u32 kid_l;               /* Lower 4 bytes of the keyid.  */
-} *key_item_t;
-
-static key_item_t *key_table;            /* Hash table with the keys.    */
-static size_t key_table_size;            /* Number of allocated buckets. */
-static unsigned int key_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int key_table_added;     /* Number of items added.       */
-static unsigned int key_table_dropped;   /* Number of items dropped.     */
-static key_item_t key_item_attic;        /* List of freed items.         */
-
-
-
-
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
+/* The types of the cache items.  */
+enum cache_item_types
+  {
+    CACHE_ITEM_BLOB,  /* A blob indexed by its UBID.                   */
+    CACHE_ITEM_FPR,   /* A fingerprint mapped to a UBID or not-found.  */
+    CACHE_ITEM_KID    /* A not-found mark for a long keyid.            */
+  };
+
+
+/* The cache item object.  */
+typedef struct cache_item_s
+{
+  struct cache_item_s *next;      /* Next item in the hash chain.  */
+  struct cache_item_s *lru_prev;  /* Next more recently used item.  */
+  struct cache_item_s *lru_next;  /* Next less recently used item.  */
+  unsigned int refcount;          /* One for the table plus users.  */
+  unsigned int hashval;           /* The full hash value of the key.  */
+  unsigned int type:2;            /* The cache_item_types.  */
+  unsigned int in_table:1;        /* Linked into the table.  */
+  unsigned int not_found:1;       /* This is a not-found mark.  */
+  unsigned int filter:2;          /* CACHE_FILTER_* of the mark.  */
+  unsigned int is_ephemeral:1;    /* The blob is ephemeral.  */
+  unsigned int is_revoked:1;      /* The blob is revoked.  */
+  unsigned int keylen:8;          /* The used length of KEY.  */
+  unsigned char key[32];          /* The UBID, fingerprint, or keyid.  */
+  unsigned int serial;            /* The serial number of the blob.  */
+  unsigned int pk_no;             /* For fingerprints the key number.  */
+  unsigned char ubid[UBID_LEN];   /* For fingerprints the blob's UBID.  */
+  enum pubkey_types pktype;       /* For blobs the type of the blob.  */
+  size_t charge;                  /* Number of bytes charged.  */
+  size_t datalen;                 /* For blobs the length of DATA.  */
+  unsigned char data[1];          /* For blobs the actual data.  */
+} *cache_item_t;
+
+
+static cache_item_t *cache_table;   /* The hash table.                   */
+static unsigned int cache_table_size;/* Number of allocated buckets.     */
+static unsigned int cache_nitems;   /* Number of items in the table.     */
+static size_t cache_bytes;          /* Number of bytes charged.          */
+static size_t cache_budget = DEFAULT_KBXD_CACHE_SIZE; /* Max. bytes.     */
+static cache_item_t lru_head;       /* The most recently used item.      */
+static cache_item_t lru_tail;       /* The least recently used item.     */
+static unsigned int blob_serial;    /* Last used blob serial number.     */
+static unsigned int cache_generation; /* Incremented on each update.     */
+
+/* Counters to judge the effectiveness of the cache.  */
+static struct
+{
+  unsigned long hits;       /* Keys returned from the cache.           */
+  unsigned long neg_hits;   /* Not-found returned from the cache.      */
+  unsigned long misses;     /* Lookups not answered by the cache.      */
+  unsigned long added;      /* Items added to the cache.               */
+  unsigned long evictions;  /* Items evicted due to the budget.        */
+  unsigned long invalidations; /* Items dropped due to updates.        */
+} cache_stats;
+
+
+
+
+/* The hash function we use for the cache table.  All keys are
+ * fingerprints, keyids or UBIDs and thus already well distributed.  */
 static inline unsigned int
-blob_table_hasher (const unsigned char *ubid)
+cache_hasher (enum cache_item_types type, const unsigned char *key)
 {
-  return (ubid[0] << 16 | ubid[1]) % blob_table_size;
+  return buf32_to_u32 (key) ^ type;
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the hash table.  */
 static gpg_error_t
-blob_table_init (void)
+cache_table_init (void)
 {
-  if (blob_table)
+  if (cache_table)
     return 0;
-  blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
-  blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
-  if (!blob_table)
+  cache_table_size = INITIAL_CACHE_BUCKETS;
+  cache_table = xtrycalloc (cache_table_size, sizeof *cache_table);
+  if (!cache_table)
     return gpg_error_from_syserror ();
   return 0;
 }
 
-/* Free a blob.  This is done by moving it to the attic list.  */
+
+/* Double the size of the hash table.  On error the table is kept
+ * as it is.  */
 static void
-blob_unref (blob_t blob)
-{
-  void *p;
+cache_table_grow (void)
+{
+  cache_item_t *newtable, item, item_next;
+  unsigned int newsize, idx, hash;
+
+  newsize = 2 * cache_table_size + 1;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - keep the longer chains.  */
+  for (idx=0; idx < cache_table_size; idx++)
+    for (item = cache_table[idx]; item; item = item_next)
+      {
+        item_next = item->next;
+        hash = item->hashval % newsize;
+        item->next = newtable[hash];
+        newtable[hash] = item;
+      }
+  xfree (cache_table);
+  cache_table = newtable;
+  cache_table_size = newsize;
+}
 
-  if (!blob)
+
+/* Release a reference to ITEM.  */
+static void
+cache_item_unref (cache_item_t item)
+{
+  if (!item)
     return;
-  log_assert (blob->refcount);
-  if (!--blob->refcount)
+  log_assert (item->refcount);
+  if (!--item->refcount)
     {
-      p = blob->data;
-      blob->data = NULL;
-      blob->next = blob_attic;
-      blob_attic = blob;
-      xfree (p);
+      log_assert (!item->in_table);
+      xfree (item);
     }
 }
 
 
-/* Given the hash value and the ubid, find the blob in the bucket.
- * Returns NULL if not found or the blob item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  */
-static blob_t
-find_blob (unsigned int hash, const unsigned char *ubid,
-           unsigned int *r_count)
+/* Move ITEM to the head of the LRU list.  */
+static void
+lru_touch (cache_item_t item)
 {
-  blob_t b;
-  unsigned int count = 0;
-
-  for (b = blob_table[hash]; b; b = b->next, count++)
-    if (!memcmp (b->ubid, ubid, UBID_LEN))
-      break;
-  if (r_count)
-    *r_count = count;
-  return b;
+  if (item == lru_head)
+    return;
+  /* Unlink.  */
+  item->lru_prev->lru_next = item->lru_next;
+  if (item->lru_next)
+    item->lru_next->lru_prev = item->lru_prev;
+  else
+    lru_tail = item->lru_prev;
+  /* Insert at the head.  */
+  item->lru_prev = NULL;
+  item->lru_next = lru_head;
+  lru_head->lru_prev = item;
+  lru_head = item;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
-{
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
-
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
+/* Remove ITEM from the table and the LRU list and release the
+ * reference held by the table.  */
+static void
+cache_item_remove (cache_item_t item)
+{
+  cache_item_t *itemp;
+
+  log_assert (item->in_table);
+  for (itemp = &cache_table[item->hashval % cache_table_size];
+       *itemp; itemp = &(*itemp)->next)
+    if (*itemp == item)
+      {
+        *itemp = item->next;
+        break;
+      }
+  item->next = NULL;
+
+  if (item->lru_prev)
+    item->lru_prev->lru_next = item->lru_next;
   else
-    return 1;
+    lru_head = item->lru_next;
+  if (item->lru_next)
+    item->lru_next->lru_prev = item->lru_prev;
+  else
+    lru_tail = item->lru_prev;
+  item->lru_prev = item->lru_next = NULL;
+
+  item->in_table = 0;
+  cache_nitems--;
+  cache_bytes -= item->charge;
+  cache_item_unref (item);
 }
 
 
-/* Put the blob (BLOBDATA, BLOBDATALEN) into the cache using UBID as
- * the index.  If it is already in the cache nothing happens.  */
+/* Evict the least recently used items until the charged bytes plus
+ * NEEDED fit into the budget.  */
 static void
-blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
-                const void *blobdata, unsigned int blobdatalen)
+cache_evict (size_t needed)
 {
-  unsigned int hash;
-  blob_t b;
-  unsigned int count, n;
-  void *blobdatacopy = NULL;
-
-  hash = blob_table_hasher (ubid);
- find_again:
-  b = find_blob (hash, ubid, &count);
-  if (b)
-    {
-      xfree (blobdatacopy);
-      return;  /* Already got this blob.  */
-    }
-
-  /* Create a copy of the blob if not yet done.  */
-  if (!blobdatacopy)
-    {
-      blobdatacopy = xtrymalloc (blobdatalen);
-      if (!blobdatacopy)
-        {
-          log_info ("Note: malloc failed while copying blob to the cache: %s\n",
-                    gpg_strerror (gpg_error_from_syserror ()));
-          return;  /* Out of core - ignore.  */
-        }
-      memcpy (blobdatacopy, blobdata, blobdatalen);
-    }
-
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
+  while (lru_tail && cache_bytes + needed > cache_budget)
     {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
-        {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
-        }
+      cache_item_remove (lru_tail);
+      cache_stats.evictions++;
     }
+}
 
-  /* Add an item to the bucket.  We allocate a whole block of items
-   * for cache performance reasons.  */
-  if (!blob_attic)
-    {
-      blob_t b_block;
-      int b_blocksize = 256;
 
-      b_block = xtrymalloc (b_blocksize * sizeof *b_block);
-      if (!b_block)
-        {
-          log_info ("Note: malloc failed while adding blob to the cache: %s\n",
-                    gpg_strerror (gpg_error_from_syserror ()));
-          xfree (blobdatacopy);
-          return;  /* Out of core - ignore.  */
-        }
-      for (n = 0; n < b_blocksize; n++)
-        {
-          b = b_block + n;
-          b->next = blob_attic;
-          blob_attic = b;
-        }
-
-      /* During the malloc another thread might have changed the
-       * bucket.  Thus we need to start over.  */
-      goto find_again;
-    }
+/* Find the item of TYPE with (KEY,KEYLEN) in the cache.  Returns NULL
+ * if not found.  The returned item is not referenced.  */
+static cache_item_t
+cache_find (enum cache_item_types type,
+            const unsigned char *key, unsigned int keylen)
+{
+  cache_item_t item;
+  unsigned int hashval;
 
-  /* We now know that there is an item in the attic.  Put it into the
-   * chain.  Note that we may not use any system call here. */
-  b = blob_attic;
-  blob_attic = b->next;
-  b->next = NULL;
-  b->pktype = pktype;
-  b->data = blobdatacopy;
-  b->datalen = blobdatalen;
-  memcpy (b->ubid, ubid, UBID_LEN);
-  b->usecount = 1;
-  b->refcount = 1;
-  b->next = blob_table[hash];
-  blob_table[hash] = b;
-  blob_table_added++;
+  if (!cache_table)
+    return NULL;
+  hashval = cache_hasher (type, key);
+  for (item = cache_table[hashval % cache_table_size]; item; item = item->next)
+    if (item->hashval == hashval
+        && item->type == type
+        && item->keylen == keylen
+        && !memcmp (item->key, key, keylen))
+      break;
+  return item;
 }
 
 
-/* Given the UBID return a cached blob item.  The caller must
- * release that item using blob_unref.  */
-static blob_t
-blob_table_get (const unsigned char *ubid)
+/* Create a new item of TYPE for (KEY,KEYLEN) with room for DATALEN
+ * bytes of data and put it into the table as the most recently used
+ * item.  The caller needs to make sure that no such item exists.
+ * Returns NULL if the cache is disabled, the item is too large, or
+ * we are out of core.  The returned item is not referenced.  */
+static cache_item_t
+cache_add (enum cache_item_types type,
+           const unsigned char *key, unsigned int keylen, size_t datalen)
 {
+  cache_item_t item;
+  size_t charge;
   unsigned int hash;
-  blob_t b;
-
-  hash = blob_table_hasher (ubid);
-  b = find_blob (hash, ubid, NULL);
-  if (b)
-    {
-      b->usecount++;
-      b->refcount++;
-      return b;  /* Found  */
-    }
 
-  return NULL;
-}
+  log_assert (keylen <= sizeof item->key);
 
+  if (!cache_table)
+    return NULL;
+  charge = sizeof *item + datalen;
+  if (charge > cache_budget)
+    return NULL;  /* Does not fit or cache disabled.  */
+  cache_evict (charge);
 
-
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
-static inline unsigned int
-key_table_hasher (u32 kid_l)
-{
-  return kid_l % key_table_size;
+  item = xtrycalloc (1, sizeof *item + datalen);
+  if (!item)
+    {
+      log_info ("Note: malloc failed while adding to the cache: %s\n",
+                gpg_strerror (gpg_error_from_syserror ()));
+      return NULL;  /* Out of core - ignore.  */
+    }
+  item->type = type;
+  item->keylen = keylen;
+  memcpy (item->key, key, keylen);
+  item->hashval = cache_hasher (type, key);
+  item->charge = charge;
+  item->datalen = datalen;
+  item->refcount = 1;
+
+  if (cache_nitems > 2 * cache_table_size)
+    cache_table_grow ();
+  hash = item->hashval % cache_table_size;
+  item->next = cache_table[hash];
+  cache_table[hash] = item;
+
+  item->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = item;
+  else
+    lru_tail = item;
+  lru_head = item;
+
+  item->in_table = 1;
+  cache_nitems++;
+  cache_bytes += charge;
+  cache_stats.added++;
+  return item;
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
-static gpg_error_t
-key_table_init (void)
-{
-  if (key_table)
-    return 0;
-  key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_threshold  = KEY_ITEMS_PER_BUCKET_THRESHOLD;
-  key_table = xtrycalloc (key_table_size, sizeof *key_table);
-  if (!key_table)
-    return gpg_error_from_syserror ();
-  return 0;
-}
-
-/* Free a key_item.  This is done by moving it to the attic list.  */
+/* Drop the item of TYPE with (KEY,KEYLEN) from the cache.  */
 static void
-key_item_unref (key_item_t ki)
+cache_drop (enum cache_item_types type,
+            const unsigned char *key, unsigned int keylen)
 {
-  bloblist_t bl, bl2;
+  cache_item_t item;
 
-  if (!ki)
-    return;
-  log_assert (ki->refcount);
-  if (!--ki->refcount)
+  item = cache_find (type, key, keylen);
+  if (item)
     {
-      bl = ki->blist;
-      ki->blist = NULL;
-      ki->next = key_item_attic;
-      key_item_attic = ki;
-
-      if (bl)
-        {
-          for (bl2 = bl; bl2->next; bl2 = bl2->next)
-            ;
-          bl2->next = bloblist_attic;
-          bloblist_attic = bl;
-        }
+      cache_item_remove (item);
+      cache_stats.invalidations++;
     }
 }
 
 
-/* Given the hash value and the search info, find the key item in the
- * bucket.  Return NULL if not found or the key item if found.  Always
- * returns the the number of items searched, which is in the case of a
- * not-found the length of the chain.  Note that FPR may only be NULL
- * if FPRLEN is 0. */
-static key_item_t
-find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l,
-               unsigned int *r_count)
+/* Return the CACHE_FILTER_* bits for the current search.  */
+static unsigned int
+search_filter (ctrl_t ctrl)
 {
-  key_item_t ki = key_table[hash];
-  unsigned int count = 0;
+  unsigned int filter = 0;
 
-  for (; ki; ki = ki->next, count++)
-    if (ki->kid_h == kid_h && ki->kid_l == kid_l)
-      break;
-  if (r_count)
-    *r_count = count;
-  return ki;
+  if (ctrl->filter_opgp)
+    filter |= CACHE_FILTER_OPGP;
+  if (ctrl->filter_x509)
+    filter |= CACHE_FILTER_X509;
+  if (!filter)
+    filter = CACHE_FILTER_OPGP | CACHE_FILTER_X509;
+  return filter;
 }
 
 
-/* Helper for the qsort in key_table_put.  */
+/* Return true if no update happened since the current search of the
+ * session CTRL was started.  */
 static int
-compare_key_items (const void *arg_a, const void *arg_b)
+is_current_search (ctrl_t ctrl)
 {
-  const key_item_t a = *(const key_item_t *)arg_a;
-  const key_item_t b = *(const key_item_t *)arg_b;
-
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
+  return ctrl->db_req && ctrl->db_req->cache_generation == cache_generation;
 }
 
 
-/* Allocate new key items.  They are put to the attic so that the
- * caller can take them from there.  On allocation failure a note
- * is printed and an error returned.  */
-static gpg_error_t
-alloc_more_key_items (void)
+/* Return true if ITEM is a not-found mark which is valid for the
+ * search types FILTER.  */
+static int
+is_not_found_mark (cache_item_t item, unsigned int filter)
 {
-  gpg_error_t err;
-  key_item_t kiblock, ki;
-  int kiblocksize = 256;
-  unsigned int n;
-
-  kiblock = xtrymalloc (kiblocksize * sizeof *kiblock);
-  if (!kiblock)
-    {
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while adding to the cache: %s\n",
-                gpg_strerror (err));
-      return err;
-    }
-  for (n = 0; n < kiblocksize; n++)
-    {
-      ki = kiblock + n;
-      ki->next = key_item_attic;
-      key_item_attic = ki;
-    }
-  return 0;
+  return (item && item->not_found && !(filter & ~item->filter));
 }
 
 
-/* Allocate new bloblist items.  They are put to the attic so that the
- * caller can take them from there.  On allocation failure a note is
- * printed and an error returned.  */
-static gpg_error_t
-alloc_more_bloblist_items (void)
+/* Put a not-found mark of TYPE for (KEY,KEYLEN) valid for FILTER into
+ * the cache.  */
+static void
+put_not_found (enum cache_item_types type,
+               const unsigned char *key, unsigned int keylen,
+               unsigned int filter)
 {
-  gpg_error_t err;
-  bloblist_t bl;
-  bloblist_t blistblock;
-  int blistblocksize = 256;
-  unsigned int n;
+  cache_item_t item;
 
-  blistblock = xtrymalloc (blistblocksize * sizeof *blistblock);
-  if (!blistblock)
+  item = cache_find (type, key, keylen);
+  if (item)
     {
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while adding to the cache: %s\n",
-                gpg_strerror (err));
-      return err;
+      if (item->not_found)
+        item->filter |= filter;
+      /* Else: A concurrent search found the key - keep that.  */
+      lru_touch (item);
+      return;
     }
-  for (n = 0; n < blistblocksize; n++)
+  item = cache_add (type, key, keylen, 0);
+  if (item)
     {
-      bl = blistblock + n;
-      bl->next = bloblist_attic;
-      bloblist_attic = bl;
+      item->not_found = 1;
+      item->filter = filter;
     }
-  return 0;
-}
-
-
-/* Helper for key_table_put.  This function assumes that
- * bloblist_attaci is not NULL.  Returns a new bloblist item.  Be
- * aware that no system calls may be done - even not log
- * functions!  */
-static bloblist_t
-new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
-                   const unsigned char *ubid, int subkey)
-{
-  bloblist_t bl;
-
-  bl = bloblist_attic;
-  bloblist_attic = bl->next;
-  bl->next = NULL;
-
-  if (ubid)
-    memcpy (bl->ubid, ubid, UBID_LEN);
-  else
-    memset (bl->ubid, 0, UBID_LEN);
-  bl->ubid_valid = 1;
-  bl->final_kid = 0;
-  bl->final_fpr = 0;
-  bl->subkey = !!subkey;
-  bl->fprlen = fprlen;
-  memcpy (bl->fpr, fpr, fprlen);
-  return bl;
 }
 
 
-/* If the list of key item in the bucken HASH is full remove a couple
- * of them.  On error a diagnostic is printed and an error code
- * return.  Note that the error code GPG_ERR_TRUE is returned if any
- * flush and thus system calls were done.
- */
-static gpg_error_t
-maybe_flush_some_key_buckets (unsigned int hash, unsigned int count)
+/* Put the blob (BLOB,BLOBLEN) into the cache and return its serial
+ * number or 0 if it could not be cached.  */
+static unsigned int
+put_blob (const unsigned char *ubid, enum pubkey_types pktype,
+          const void *blob, size_t bloblen, int is_ephemeral, int is_revoked)
 {
-  gpg_error_t err;
-  key_item_t ki, list_head, *list_tailp, ki_next;
-  key_item_t *array;
-  int narray, idx;
-
-  if (count < key_table_threshold)
-    return 0;  /* Nothing to do.  */
-
-  /* Unlink from the global list so that other threads don't disturb
-   * us.  If another thread adds or removes something only one will be
-   * the winner.  Bad luck for the dropped cache items but after all
-   * it is just a cache.  */
-  list_head = key_table[hash];
-  key_table[hash] = NULL;
-
-  /* Put all items into an array for sorting.  */
-  array = xtrycalloc (count, sizeof *array);
-  if (!array)
-    {
-      /* That's bad; give up all items of the bucket.  */
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while purging from the cache: %s\n",
-                gpg_strerror (err));
-      goto leave;
-    }
-  narray = 0;
-  for (ki = list_head; ki; ki = ki_next)
-    {
-      ki_next = ki->next;
-      array[narray++] = ki;
-      ki->next = NULL;
-    }
-  log_assert (narray == count);
+  cache_item_t item;
 
-  /* Sort the array and put half of it onto a new list.  */
-  qsort (array, narray, sizeof *array, compare_key_items);
-  list_head = NULL;
-  list_tailp = &list_head;
-  for (idx=0; idx < narray/2; idx++)
+  item = cache_find (CACHE_ITEM_BLOB, ubid, UBID_LEN);
+  if (item)
     {
-      *list_tailp = array[idx];
-      list_tailp = &array[idx]->next;
-    }
-
-  /* Put the new list into the bucket.  */
-  ki = key_table[hash];
-  key_table[hash] = list_head;
-  list_head = ki;
-
-  /* Free the remaining items and the array.  */
-  for (; idx < narray; idx++)
-    {
-      key_item_unref (array[idx]);
-      key_table_dropped++;
+      if (item->datalen == bloblen && !memcmp (item->data, blob, bloblen)
+          && item->is_ephemeral == !!is_ephemeral
+          && item->is_revoked == !!is_revoked)
+        {
+          lru_touch (item);
+          return item->serial;  /* Already got this blob.  */
+        }
+      /* The blob has been updated in the meantime.  */
+      cache_item_remove (item);
     }
-  xfree (array);
-  err = gpg_error (GPG_ERR_TRUE);
 
- leave:
-  /* Free any items added in the meantime by other threads.  This is
-   * also used in case of a malloc problem (which won't update the
-   * counters, though). */
-  for ( ; list_head; list_head = ki_next)
-    {
-      ki_next = list_head->next;
-      key_item_unref (list_head);
-    }
-  return err;
+  item = cache_add (CACHE_ITEM_BLOB, ubid, UBID_LEN, bloblen);
+  if (!item)
+    return 0;
+  memcpy (item->data, blob, bloblen);
+  item->pktype = pktype;
+  item->is_ephemeral = !!is_ephemeral;
+  item->is_revoked = !!is_revoked;
+  if (!++blob_serial)
+    blob_serial++;  /* We use 0 to indicate "not cached".  */
+  item->serial = blob_serial;
+  return item->serial;
 }
 
 
-/* This is the core of
- *   key_table_put,
- *   key_table_put_no_fpr,
- *   key_table_put_no_kid.
- */
+/* Map the fingerprint (FPR,FPRLEN) to the blob with UBID and SERIAL;
+ * PK_NO is the number of the key in the blob.  */
 static void
-do_key_table_put (u32 kid_h, u32 kid_l,
-                  const unsigned char *fpr, unsigned int fprlen,
-                  const unsigned char *ubid, int subkey)
+put_fpr (const unsigned char *fpr, unsigned int fprlen,
+         const unsigned char *ubid, unsigned int serial, unsigned int pk_no)
 {
-  unsigned int hash;
-  key_item_t ki;
-  bloblist_t bl, bl_tail;
-  unsigned int count;
-  int do_find_again;
-  int mark_not_found = !fpr;
-
-  hash = key_table_hasher (kid_l);
- find_again:
-  do_find_again = 0;
-  ki = find_in_chain (hash, kid_h, kid_l, &count);
-  if (ki)
-    {
-      if (mark_not_found)
-        return; /* Can't put the mark because meanwhile a entry was
-                 * added.  */
-
-      for (bl = ki->blist; bl; bl = bl->next)
-        if (bl->fprlen
-            && bl->fprlen == fprlen
-            && !memcmp (bl->fpr, fpr, fprlen))
-          break;
-      if (bl)
-        return;  /* Already in the bloblist for the keyid  */
-
-      /* Append to the list.  */
-      if (!bloblist_attic)
-        {
-          if (alloc_more_bloblist_items ())
-            return;  /* Out of core - ignore.  */
-          goto find_again; /* Need to start over due to the malloc.  */
-        }
-      for (bl_tail = NULL, bl = ki->blist; bl; bl_tail = bl, bl = bl->next)
-        ;
-      bl = new_bloblist_item (fpr, fprlen, ubid, subkey);
-      if (bl_tail)
-        bl_tail->next = bl;
-      else
-        ki->blist = bl;
-
-      return;
-    }
+  cache_item_t item;
 
-  /* If the bucket is full remove a couple of items. */
-  if (maybe_flush_some_key_buckets (hash, count))
-    {
-      /* During the function call another thread might have changed
-       * the bucket.  Thus we need to start over.  */
-      do_find_again = 1;
-    }
-
-  if (!key_item_attic)
-    {
-      if (alloc_more_key_items ())
-        return;  /* Out of core - ignore.  */
-      do_find_again = 1;
-    }
-
-  if (!bloblist_attic)
-    {
-      if (alloc_more_bloblist_items ())
-        return;  /* Out of core - ignore.  */
-      do_find_again = 1;
-    }
-
-  if (do_find_again)
-    goto find_again;
-
-  /* We now know that there are items in the attics.  Put them into
-   * the chain.  Note that we may not use any system call here. */
-  ki = key_item_attic;
-  key_item_attic = ki->next;
-  ki->next = NULL;
+  if (fprlen < 20 || fprlen > 32)
+    return;  /* No support for v3 keys or unknown key versions.  */
 
-  if (mark_not_found)
-    ki->blist = NULL;
+  item = cache_find (CACHE_ITEM_FPR, fpr, fprlen);
+  if (item)
+    lru_touch (item);
   else
-    ki->blist = new_bloblist_item (fpr, fprlen, ubid, subkey);
-
-  ki->kid_h = kid_h;
-  ki->kid_l = kid_l;
-  ki->usecount = 1;
-  ki->refcount = 1;
-
-  ki->next = key_table[hash];
-  key_table[hash] = ki;
-  key_table_added++;
+    item = cache_add (CACHE_ITEM_FPR, fpr, fprlen, 0);
+  if (!item)
+    return;
+  item->not_found = 0;
+  item->filter = 0;
+  memcpy (item->ubid, ubid, UBID_LEN);
+  item->serial = serial;
+  item->pk_no = pk_no;
 }
 
 
-/* Given the fingerprint (FPR,FPRLEN) put the UBID into the cache.
- * SUBKEY indicates that the fingerprint is from a subkey.  */
-static void
-key_table_put (const unsigned char *fpr, unsigned int fprlen,
-               const unsigned char *ubid, int subkey)
+/* Return the blob for UBID and, if SERIAL is not 0, only if it
+ * matches the serial number.  The caller must release the returned
+ * item using cache_item_unref.  */
+static cache_item_t
+get_blob (const unsigned char *ubid, unsigned int serial)
 {
-  u32 kid_h, kid_l;
+  cache_item_t item;
 
-  if (fprlen < 20 || fprlen > 32)
-    return;  /* No support for v3 keys or unknown key versions.  */
-
-  if (fprlen == 20)  /* v4 key */
-    {
-      kid_h = buf32_to_u32 (fpr+12);
-      kid_l = buf32_to_u32 (fpr+16);
-    }
-  else  /* v5 or later key */
-    {
-      kid_h = buf32_to_u32 (fpr);
-      kid_l = buf32_to_u32 (fpr+4);
-    }
-  do_key_table_put (kid_h, kid_l, fpr, fprlen, ubid, subkey);
+  item = cache_find (CACHE_ITEM_BLOB, ubid, UBID_LEN);
+  if (!item || (serial && item->serial != serial))
+    return NULL;
+  lru_touch (item);
+  item->refcount++;
+  return item;
 }
 
 
-/* Given the fingerprint (FPR,FPRLEN) put a flag into the cache that
- * this fingerprint was not found.  */
-static void
-key_table_put_no_fpr (const unsigned char *fpr, unsigned int fprlen)
+/* Return the blob item for a fingerprint search.  On success the
+ * fingerprint item is stored at R_FPRITEM; the caller must release
+ * the returned blob item.  If the fingerprint is marked as not-found
+ * GPG_ERR_NOT_FOUND is returned and GPG_ERR_EOF on a cache miss.  */
+static gpg_error_t
+query_by_fpr (const unsigned char *fpr, unsigned int fprlen,
+              unsigned int filter,
+              cache_item_t *r_fpritem, cache_item_t *r_blob)
 {
-  u32 kid_h, kid_l;
+  cache_item_t item, blob;
 
-  if (fprlen < 20 || fprlen > 32)
-    return;  /* No support for v3 keys or unknown key versions.  */
-
-  if (fprlen == 20)  /* v4 key */
+  item = cache_find (CACHE_ITEM_FPR, fpr, fprlen);
+  if (!item)
+    return gpg_error (GPG_ERR_EOF);
+  if (item->not_found)
     {
-      kid_h = buf32_to_u32 (fpr+12);
-      kid_l = buf32_to_u32 (fpr+16);
+      if (!is_not_found_mark (item, filter))
+        return gpg_error (GPG_ERR_EOF);
+      lru_touch (item);
+      return gpg_error (GPG_ERR_NOT_FOUND);
     }
-  else  /* v5 or later key */
+  if (!(filter & CACHE_FILTER_OPGP))
+    return gpg_error (GPG_ERR_EOF);  /* We only cache OpenPGP keys.  */
+
+  blob = get_blob (item->ubid, item->serial);
+  if (!blob)
     {
-      kid_h = buf32_to_u32 (fpr);
-      kid_l = buf32_to_u32 (fpr+4);
+      /* Stale item - the blob has been evicted or updated.  */
+      cache_item_remove (item);
+      return gpg_error (GPG_ERR_EOF);
     }
-  /* Note that our not-found chaching is only based on the keyid. */
-  do_key_table_put (kid_h, kid_l, NULL, 0, NULL, 0);
+  lru_touch (item);
+  *r_fpritem = item;
+  *r_blob = blob;
+  return 0;
 }
 
 
-/* Given the keyid (KID_H, KID_L) put a flag into the cache that this
- * keyid was not found. */
-static void
-key_table_put_no_kid (u32 kid_h, u32 kid_l)
-{
-  do_key_table_put (kid_h, kid_l, NULL, 0, NULL, 0);
-}
 
 
-/* Given the keyid or the fingerprint return the key item from the
- * cache.  The caller must release the result using key_item_unref.
- * NULL is returned if not found.  */
-static key_item_t
-key_table_get (u32 kid_h, u32 kid_l)
+/* Make sure the tables are initialized.  */
+gpg_error_t
+be_cache_initialize (void)
 {
-  unsigned int hash;
-  key_item_t ki;
-
-  hash = key_table_hasher (kid_l);
-  ki = find_in_chain (hash, kid_h, kid_l, NULL);
-  if (ki)
-    {
-      ki->usecount++;
-      ki->refcount++;
-      return ki;  /* Found  */
-    }
-
-  return NULL;
+  return cache_table_init ();
 }
 
 
-/* Return a key item by searching for the keyid.  The caller must use
- * key_item_unref on it.  */
-static key_item_t
-query_by_kid (u32 kid_h, u32 kid_l)
+/* Set the byte budget for the cache to NBYTES and evict items as
+ * needed.  A value of 0 disables the cache.  */
+void
+be_cache_set_size (size_t nbytes)
 {
-  return key_table_get (kid_h, kid_l);
+  cache_budget = nbytes;
+  cache_evict (0);
 }
 
 
-/* Return a key item by searching for the fingerprint.  The caller
- * must use key_item_unref on it.  Note that the returned key item may
- * not actually carry the fingerprint; the caller needs to scan the
- * bloblist of the keyitem.  We can't do that here because the
- * reference counting is done on the keyitem s and thus this needs to
- * be returned. */
-static key_item_t
-query_by_fpr (const unsigned char *fpr, unsigned int fprlen)
+/* Drop all items from the cache.  This is used after a rollback
+ * because the cache may then hold keys which are not anymore in the
+ * database.  */
+void
+be_cache_flush (void)
 {
-  u32 kid_h, kid_l;
-
-  if (fprlen < 20 || fprlen > 32 )
-    return NULL;  /* No support for v3 keys or unknown key versions.  */
-
-  if (fprlen == 20)  /* v4 key */
-    {
-      kid_h = buf32_to_u32 (fpr+12);
-      kid_l = buf32_to_u32 (fpr+16);
-    }
-  else  /* v5 or later key */
+  cache_generation++;
+  while (lru_tail)
     {
-      kid_h = buf32_to_u32 (fpr);
-      kid_l = buf32_to_u32 (fpr+4);
+      cache_item_remove (lru_tail);
+      cache_stats.invalidations++;
     }
-
-  return key_table_get (kid_h, kid_l);
 }
 
 
-
-
-
-/* Make sure the tables are initialized.  */
-gpg_error_t
-be_cache_initialize (void)
+/* Return a malloced string with the cache statistics.  Returns NULL
+ * on error.  */
+char *
+be_cache_stats_string (void)
 {
-  gpg_error_t err;
-
-  err = blob_table_init ();
-  if (!err)
-    err = key_table_init ();
-  return err;
+  return xtryasprintf ("hits=%lu neg_hits=%lu misses=%lu added=%lu"
+                       " evictions=%lu invalidations=%lu"
+                       " items=%u bytes=%zu size=%zu",
+                       cache_stats.hits, cache_stats.neg_hits,
+                       cache_stats.misses, cache_stats.added,
+                       cache_stats.evictions, cache_stats.invalidations,
+                       cache_nitems, cache_bytes, cache_budget);
 }
 
 
@@ -901,236 +640,125 @@ be_cache_release_resource (ctrl_t ctrl, backend_handle_t hd)
     return;
   hd->db_type = DB_TYPE_NONE;
 
-  /* Fixme: Free the key_table.  */
-
   xfree (hd);
 }
 
 
 /* Search for the keys described by (DESC,NDESC) and return them to
- * the caller.  BACKEND_HD is the handle for this backend and REQUEST
- * is the current database request object.  On a cache hit either 0 or
- * GPG_ERR_NOT_FOUND is returned.  The former returns the item; the
- * latter indicates that the cache has known that the item won't be
- * found in any databases.  On a cache miss GPG_ERR_EOF is
- * returned.  */
+ * the caller.  REQUEST is the current database request object.  On a
+ * cache hit either 0 or GPG_ERR_NOT_FOUND is returned.  The former
+ * returns the item; the latter indicates that the cache has known
+ * that the item won't be found in the database.  On a cache miss
+ * GPG_ERR_EOF is returned.  Only the search modes which find at most
+ * one key are answered with a key; thus on success the search is
+ * marked as final.  */
 gpg_error_t
-be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
+be_cache_search (ctrl_t ctrl, db_request_t request,
                  KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
 {
   gpg_error_t err;
-  db_request_part_t reqpart;
   unsigned int n;
-  blob_t b;
-  key_item_t ki;
-  bloblist_t bl;
-  int not_found = 0;
-  int descidx = 0;
-  int found_bykid = 0;
-
-  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_CACHE);
-  log_assert (request);
+  unsigned int filter;
+  cache_item_t item;
+  cache_item_t blob = NULL;
+  cache_item_t fpritem = NULL;
 
-  err = be_find_request_part (backend_hd, request, &reqpart);
-  if (err)
-    goto leave;
+  log_assert (request);
 
   if (!desc)
     {
       /* Reset operation.  */
       request->last_cached_valid = 0;
       request->last_cached_final = 0;
-      reqpart->cache_seqno.fpr = 0;
-      reqpart->cache_seqno.kid = 0;
-      reqpart->cache_seqno.grip = 0;
-      reqpart->cache_seqno.ubid = 0;
-      err = 0;
-      goto leave;
+      request->cache_generation = cache_generation;
+      return 0;
     }
 
-  for (ki = NULL, n=0; n < ndesc && !ki; n++)
+  if (!cache_table || !cache_budget || !ndesc)
+    return gpg_error (GPG_ERR_EOF);
+
+  filter = search_filter (ctrl);
+
+  /* With several descriptions we can only answer if all of them are
+   * known not to exist.  */
+  if (ndesc > 1)
     {
-      descidx = n;
-      switch (desc[n].mode)
+      for (n=0; n < ndesc; n++)
         {
-        case KEYDB_SEARCH_MODE_LONG_KID:
-          ki = query_by_kid (desc[n].u.kid[0], desc[n].u.kid[1]);
-          if (ki && ki->blist)
+          if (desc[n].mode == KEYDB_SEARCH_MODE_LONG_KID)
             {
-              not_found = 0;
-              /* Note that in a bloblist all keyids are the same.  */
-              for (n=0, bl = ki->blist; bl; bl = bl->next)
-                if (n++ == reqpart->cache_seqno.kid)
-                  break;
-              if (!bl)
-                {
-                  key_item_unref (ki);
-                  ki = NULL;
-                }
-              else
-                {
-                  found_bykid = 1;
-                  reqpart->cache_seqno.kid++;
-                }
-            }
-          else if (ki)
-            not_found = 1;
-          break;
+              unsigned char kidbuf[8];
 
-        case KEYDB_SEARCH_MODE_FPR:
-          ki = query_by_fpr (desc[n].u.fpr, desc[n].fprlen);
-          if (ki && ki->blist)
-            {
-              not_found = 0;
-              for (n=0, bl = ki->blist; bl; bl = bl->next)
-                if (bl->fprlen
-                    && bl->fprlen == desc[n].fprlen
-                    && !memcmp (bl->fpr, desc[n].u.fpr, desc[n].fprlen)
-                    && n++ == reqpart->cache_seqno.fpr)
-                  break;
-              if (!bl)
-                {
-                  key_item_unref (ki);
-                  ki = NULL;
-                }
-              else
-                reqpart->cache_seqno.fpr++;
+              ulongtobuf (kidbuf, desc[n].u.kid[0]);
+              ulongtobuf (kidbuf+4, desc[n].u.kid[1]);
+              item = cache_find (CACHE_ITEM_KID, kidbuf, 8);
             }
-          else if (ki)
-            not_found = 1;
-          break;
-
-        /* case KEYDB_SEARCH_MODE_KEYGRIP: */
-        /*   ki = query_by_grip (desc[n].u.fpr, desc[n].fprlen); */
-        /*   break; */
-
-        case KEYDB_SEARCH_MODE_UBID:
-          /* This is the quite special UBID mode: If this is
-           * encountered in the search list we will return just this
-           * one and obviously look only into the blob cache.  */
-          if (reqpart->cache_seqno.ubid)
-            err = gpg_error (GPG_ERR_NOT_FOUND);
+          else if (desc[n].mode == KEYDB_SEARCH_MODE_FPR)
+            item = cache_find (CACHE_ITEM_FPR, desc[n].u.fpr, desc[n].fprlen);
           else
-            {
-              b = blob_table_get (desc[n].u.ubid);
-              if (b)
-                {
-                  err = be_return_pubkey (ctrl, b->data, b->datalen,
-                                          b->pktype, desc[n].u.ubid,
-                                          0, 0, 0, 0);
-                  blob_unref (b);
-                  reqpart->cache_seqno.ubid++;
-                }
-              else
-                err = gpg_error (GPG_ERR_EOF);
-            }
-          goto leave;
-
-        default:
-          ki = NULL;
-          break;
+            item = NULL;
+          if (!is_not_found_mark (item, filter))
+            break;
         }
-    }
-
-  if (not_found)
-    {
-      err = gpg_error (GPG_ERR_NOT_FOUND);
-      key_item_unref (ki);
-    }
-  else if (ki)
-    {
-      if (bl && bl->ubid_valid)
+      if (n < ndesc)
+        goto miss;
+      cache_stats.neg_hits++;
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      {
+        unsigned char kidbuf[8];
+
+        ulongtobuf (kidbuf, desc->u.kid[0]);
+        ulongtobuf (kidbuf+4, desc->u.kid[1]);
+        item = cache_find (CACHE_ITEM_KID, kidbuf, 8);
+        if (!is_not_found_mark (item, filter))
+          goto miss;
+        lru_touch (item);
+        cache_stats.neg_hits++;
+        return gpg_error (GPG_ERR_NOT_FOUND);
+      }
+
+    case KEYDB_SEARCH_MODE_FPR:
+      err = query_by_fpr (desc->u.fpr, desc->fprlen, filter,
+                          &fpritem, &blob);
+      if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
         {
-          memcpy (request->last_cached_ubid, bl->ubid, UBID_LEN);
-          request->last_cached_valid = 1;
-          request->last_cached_fprlen = desc[descidx].fprlen;
-          memcpy (request->last_cached_fpr,
-                  desc[descidx].u.fpr, desc[descidx].fprlen);
-          request->last_cached_kid_h = ki->kid_h;
-          request->last_cached_kid_l = ki->kid_l;
-          request->last_cached_valid = 1;
-          if ((bl->final_kid && found_bykid)
-              || (bl->final_fpr && !found_bykid))
-            request->last_cached_final = 1;
-          else
-            request->last_cached_final = 0;
-
-          b = blob_table_get (bl->ubid);
-          if (b)
-            {
-              err = be_return_pubkey (ctrl, b->data, b->datalen,
-                                      PUBKEY_TYPE_OPGP, bl->ubid, 0, 0, 0, 0);
-              blob_unref (b);
-            }
-          else
-            {
-              /* FIXME - return a different code so that the caller
-               * can lookup using the UBID.  */
-              err = gpg_error (GPG_ERR_MISSING_VALUE);
-            }
+          cache_stats.neg_hits++;
+          return err;
         }
-      else if (bl)
-        err = gpg_error (GPG_ERR_MISSING_VALUE);
-      else
-        err = gpg_error (GPG_ERR_NOT_FOUND);
-      key_item_unref (ki);
-    }
-  else
-    err = gpg_error (GPG_ERR_EOF);
-
- leave:
-  return err;
-}
-
-
-/* Mark the last cached item as the final item.  This is called when
- * the actual database returned EOF in respond to a restart from the
- * last cached UBID.  */
-void
-be_cache_mark_final (ctrl_t ctrl, db_request_t request)
-{
-  key_item_t ki;
-  bloblist_t bl, blfound;
-
-  (void)ctrl;
-
-  log_assert (request);
+      else if (err)
+        goto miss;
+      break;
 
-  if (!request->last_cached_valid)
-    return;
+    case KEYDB_SEARCH_MODE_UBID:
+      if (!(filter & CACHE_FILTER_OPGP))
+        goto miss;
+      blob = get_blob (desc->u.ubid, 0);
+      if (!blob)
+        goto miss;
+      break;
 
-  if (!request->last_cached_fprlen) /* Was cached via keyid.  */
-    {
-      ki = query_by_kid (request->last_cached_kid_h,
-                         request->last_cached_kid_l);
-      if (ki && (bl = ki->blist))
-        {
-          for (blfound=NULL; bl; bl = bl->next)
-            blfound = bl;
-          if (blfound)
-            blfound->final_kid = 1;
-        }
-      key_item_unref (ki);
-    }
-  else /* Was cached via fingerprint.  */
-    {
-      ki = query_by_fpr (request->last_cached_fpr,
-                         request->last_cached_fprlen);
-      if (ki && (bl = ki->blist))
-        {
-          for (blfound=NULL; bl; bl = bl->next)
-            if (bl->fprlen
-                && bl->fprlen == request->last_cached_fprlen
-                && !memcmp (bl->fpr, request->last_cached_fpr,
-                            request->last_cached_fprlen))
-              blfound = bl;
-          if (blfound)
-            blfound->final_fpr = 1;
-        }
-      key_item_unref (ki);
+    default:
+      goto miss;
     }
 
-  request->last_cached_valid = 0;
+  /* Note that the returned key will be the only one.  */
+  request->last_cached_valid = 1;
+  request->last_cached_final = 1;
+  cache_stats.hits++;
+  err = be_return_pubkey (ctrl, blob->data, blob->datalen, blob->pktype,
+                          blob->key, blob->is_ephemeral, blob->is_revoked,
+                          0, fpritem? fpritem->pk_no : 0);
+  cache_item_unref (blob);
+  return err;
+
+ miss:
+  cache_stats.misses++;
+  return gpg_error (GPG_ERR_EOF);
 }
 
 
@@ -1138,16 +766,19 @@ be_cache_mark_final (ctrl_t ctrl, db_request_t request)
 void
 be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                  const void *blob, unsigned int bloblen,
-                 enum pubkey_types pubkey_type)
+                 enum pubkey_types pubkey_type,
+                 int is_ephemeral, int is_revoked)
 {
   gpg_error_t err;
 
-  (void)ctrl;
+  if (!cache_table || !cache_budget || !is_current_search (ctrl))
+    return;
 
   if (pubkey_type == PUBKEY_TYPE_OPGP)
     {
       struct _keybox_openpgp_info info;
       struct _keybox_openpgp_key_info *kinfo;
+      unsigned int serial, pk_no;
 
       err = _keybox_parse_openpgp (blob, bloblen, NULL, &info);
       if (err)
@@ -1157,13 +788,18 @@ be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
           return;
         }
 
-      blob_table_put (ubid, pubkey_type, blob, bloblen);
-
-      kinfo = &info.primary;
-      key_table_put (kinfo->fpr, kinfo->fprlen, ubid, 0);
-      if (info.nsubkeys)
-        for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next)
-          key_table_put (kinfo->fpr, kinfo->fprlen, ubid, 1);
+      serial = put_blob (ubid, pubkey_type, blob, bloblen,
+                         is_ephemeral, is_revoked);
+      if (serial)
+        {
+          /* The key numbers match those of the sqlite backend.  */
+          pk_no = 1;
+          kinfo = &info.primary;
+          put_fpr (kinfo->fpr, kinfo->fprlen, ubid, serial, pk_no);
+          if (info.nsubkeys)
+            for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next)
+              put_fpr (kinfo->fpr, kinfo->fprlen, ubid, serial, ++pk_no);
+        }
 
       _keybox_destroy_openpgp_info (&info);
     }
@@ -1171,27 +807,38 @@ be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
 }
 
 
-/* Put the a non-found mark for PUBKEY_TYPE into the cache.  The
- * indices are taken from the search descriptors (DESC,NDESC).  */
+/* Put the a non-found mark for the search types of the current
+ * session into the cache.  The indices are taken from the search
+ * descriptors (DESC,NDESC).  This must only be called if the search
+ * did not return any key at all.  */
 void
 be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                     KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
 {
   unsigned int n;
+  unsigned int filter;
+  unsigned char kidbuf[8];
 
-  (void)ctrl;
   (void)pubkey_type;
 
+  if (!cache_table || !cache_budget || !is_current_search (ctrl))
+    return;
+
+  filter = search_filter (ctrl);
   for (n=0; n < ndesc; n++)
     {
-      switch (desc->mode)
+      switch (desc[n].mode)
         {
         case KEYDB_SEARCH_MODE_LONG_KID:
-          key_table_put_no_kid (desc[n].u.kid[0], desc[n].u.kid[1]);
+          ulongtobuf (kidbuf, desc[n].u.kid[0]);
+          ulongtobuf (kidbuf+4, desc[n].u.kid[1]);
+          put_not_found (CACHE_ITEM_KID, kidbuf, 8, filter);
           break;
 
         case KEYDB_SEARCH_MODE_FPR:
-          key_table_put_no_fpr (desc[n].u.fpr, desc[n].fprlen);
+          if (desc[n].fprlen >= 20 && desc[n].fprlen <= 32)
+            put_not_found (CACHE_ITEM_FPR, desc[n].u.fpr, desc[n].fprlen,
+                           filter);
           break;
 
         default:
@@ -1199,3 +846,62 @@ be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
         }
     }
 }
+
+
+/* Drop the fingerprint item and the keyid item of the key KINFO.  */
+static void
+drop_key_items (struct _keybox_openpgp_key_info *kinfo)
+{
+  if (kinfo->fprlen >= 20 && kinfo->fprlen <= 32)
+    cache_drop (CACHE_ITEM_FPR, kinfo->fpr, kinfo->fprlen);
+  cache_drop (CACHE_ITEM_KID, kinfo->keyid, 8);
+}
+
+
+/* Drop all cached information about the blob with UBID.  This must be
+ * called before a blob is stored or deleted.  If the new blob
+ * (BLOB,BLOBLEN) of PUBKEY_TYPE is given, the not-found marks for its
+ * keys are also dropped.  */
+void
+be_cache_invalidate (const unsigned char *ubid,
+                     const void *blob, size_t bloblen,
+                     enum pubkey_types pubkey_type)
+{
+  cache_item_t item, item_next;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *kinfo;
+
+  if (!cache_table)
+    return;
+
+  cache_generation++;
+
+  /* Dropping the blob also invalidates all fingerprint items
+   * referencing it.  */
+  cache_drop (CACHE_ITEM_BLOB, ubid, UBID_LEN);
+  if (!blob)
+    return;
+
+  if (pubkey_type == PUBKEY_TYPE_OPGP
+      && !_keybox_parse_openpgp (blob, bloblen, NULL, &info))
+    {
+      drop_key_items (&info.primary);
+      if (info.nsubkeys)
+        for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next)
+          drop_key_items (kinfo);
+      _keybox_destroy_openpgp_info (&info);
+      return;
+    }
+
+  /* For other types or if the blob can't be parsed we don't know the
+   * affected keys; thus drop all not-found marks.  */
+  for (item = lru_head; item; item = item_next)
+    {
+      item_next = item->lru_next;
+      if (item->not_found)
+        {
+          cache_item_remove (item);
+          cache_stats.invalidations++;
+        }
+    }
+}
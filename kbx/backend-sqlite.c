@@ -65,6 +65,19 @@ struct be_sqlite_local_s
   /* Flag indicating that LASTUBID has a value.  */
   unsigned int lastubid_valid : 1;
 
+  /* The current select statement uses the full-text index.  */
+  unsigned int select_fts : 1;
+
+  /* Opening a private read connection failed; don't try again.  */
+  unsigned int no_readhd : 1;
+
+  /* The private read-only connection of this request or NULL.  */
+  sqlite3 *readhd;
+
+  /* The connection used by the current search; this is either
+   * DATABASE_HD or READHD.  */
+  sqlite3 *select_hd;
+
   /* The current description index.  */
   unsigned int descidx;
 
@@ -88,6 +101,11 @@ static npth_mutex_t database_mutex = NPTH_MUTEX_INITIALIZER;
 static sqlite3 *database_hd;
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
+/* Set if the full-text index USERIDFTS is available.  */
+static int have_useridfts;
+/* Set if searches may use private read-only connections.  This
+ * requires the WAL journal mode and a thread-safe SQLite.  */
+static int use_read_connections;
 
 /* The version of our current database schema.  */
 #define DATABASE_VERSION 1
@@ -185,6 +203,24 @@ static struct
   };
 
 
+/* Definitions for the optional full-text index used for substring
+ * searches on the user ids and mail addresses.  It uses the FTS5
+ * trigram tokenizer which requires SQLite 3.34.  The rowid is the
+ * rowid of the userid table.  The index is updated along with the
+ * userid table by store_into_userid and delete_useridfts.  We don't
+ * use triggers for this because they would let all writes to the
+ * userid table fail with an SQLite lacking FTS5.  */
+static const char *useridfts_definitions[] =
+  {
+   "CREATE VIRTUAL TABLE useridfts USING fts5 ("
+   "uid, addrspec, tokenize = 'trigram')",
+
+   /* Index the already existing user ids.  */
+   "INSERT INTO useridfts(rowid,uid,addrspec)"
+   " SELECT rowid,uid,addrspec FROM userid"
+  };
+
+
 /*-- prototypes --*/
 static gpg_error_t get_config_value (const char *name, char **r_value);
 static gpg_error_t set_config_value (const char *name, const char *value);
@@ -315,12 +351,13 @@ run_sql_reset (sqlite3_stmt *stmt)
 }
 
 
-/* Run an SQL prepare for SQLSTR and return a statement at R_STMT.  If
- * EXTRA or EXTRA2 are not NULL these parts are appended to the SQL
- * statement.  */
+/* Run an SQL prepare for SQLSTR on the connection HD and return a
+ * statement at R_STMT.  If EXTRA or EXTRA2 are not NULL these parts
+ * are appended to the SQL statement.  */
 static gpg_error_t
-run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
-                 sqlite3_stmt **r_stmt)
+run_sql_prepare_hd (sqlite3 *hd, const char *sqlstr,
+                    const char *extra, const char *extra2,
+                    sqlite3_stmt **r_stmt)
 {
   gpg_error_t err;
   int res;
@@ -334,7 +371,7 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
       sqlstr = buffer;
     }
 
-  res = sqlite3_prepare_v2 (database_hd, sqlstr, -1, r_stmt, NULL);
+  res = sqlite3_prepare_v2 (hd, sqlstr, -1, r_stmt, NULL);
   if (res)
     err = diag_prepare_err (res, sqlstr);
   else
@@ -344,6 +381,15 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
 }
 
 
+/* Run an SQL prepare for SQLSTR on the main connection.  */
+static gpg_error_t
+run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+                 sqlite3_stmt **r_stmt)
+{
+  return run_sql_prepare_hd (database_hd, sqlstr, extra, extra2, r_stmt);
+}
+
+
 /* Helper to bind a BLOB parameter to a statement.  */
 static gpg_error_t
 run_sql_bind_blob (sqlite3_stmt *stmt, int no,
@@ -465,7 +511,16 @@ run_sql_step_for_select (sqlite3_stmt *stmt)
   gpg_error_t err;
   int res;
 
-  res = sqlite3_step (stmt);
+  if (sqlite3_db_handle (stmt) != database_hd)
+    {
+      /* A private read connection is only used by the calling thread
+       * and thus we can let the other threads run meanwhile.  */
+      npth_unprotect ();
+      res = sqlite3_step (stmt);
+      npth_protect ();
+    }
+  else
+    res = sqlite3_step (stmt);
   if (res == SQLITE_DONE || res == SQLITE_ROW)
     err = gpg_error (gpg_err_code_from_sqlite (res));
   else
@@ -521,6 +576,210 @@ run_sql_statement (const char *sqlstr)
 }
 
 
+/* Return true if the full-text index has the same rows as the userid
+ * table.  This is not the case if the database has been updated by a
+ * keyboxd without support for the index.  */
+static int
+useridfts_current_p (void)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+  int current = 0;
+
+  err = run_sql_prepare
+    ("SELECT (SELECT count(*) FROM userid) = (SELECT count(*) FROM useridfts)"
+     " AND NOT EXISTS (SELECT 1 FROM userid AS u"
+     "  LEFT JOIN useridfts AS f ON f.rowid = u.rowid"
+     "  WHERE f.rowid IS NULL OR f.uid IS NOT u.uid"
+     "  OR f.addrspec IS NOT u.addrspec)",
+     NULL, NULL, &stmt);
+  if (err)
+    return 0;
+  err = run_sql_step_for_select (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    current = sqlite3_column_int (stmt, 0);
+  sqlite3_finalize (stmt);
+  return current;
+}
+
+
+/* Make sure that the full-text index for the userid table exists and
+ * is up to date and set HAVE_USERIDFTS accordingly.  For an existing
+ * database without that index the index is created and filled with
+ * all current user ids.  Failure to do so is not an error because the
+ * searches fall back to a LIKE on the userid table.  */
+static void
+migrate_useridfts (void)
+{
+  static const char *old_triggers[] =
+    { "useridfts_insert", "useridfts_delete", "useridfts_update" };
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+  char *sqlstr;
+  int idx;
+  int exists;
+
+  have_useridfts = 0;
+
+  /* Remove the triggers created by former versions.  */
+  for (idx=0; idx < DIM (old_triggers); idx++)
+    {
+      sqlstr = xasprintf ("DROP TRIGGER IF EXISTS %s", old_triggers[idx]);
+      err = run_sql_statement (sqlstr);
+      xfree (sqlstr);
+      if (err)
+        log_error ("error removing trigger %s: %s\n",
+                   old_triggers[idx], gpg_strerror (err));
+    }
+
+  if (opt.disable_fulltext_index)
+    return;
+  if (sqlite3_libversion_number () < 3034000
+      || !sqlite3_compileoption_used ("ENABLE_FTS5"))
+    {
+      if (opt.verbose)
+        log_info ("full-text index for user ids not supported by SQLite\n");
+      return;
+    }
+
+  err = run_sql_prepare ("SELECT name FROM sqlite_master"
+                         " WHERE type = 'table' AND name = 'useridfts'",
+                         NULL, NULL, &stmt);
+  if (err)
+    return;
+  err = run_sql_step_for_select (stmt);
+  sqlite3_finalize (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    exists = 1;
+  else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
+    exists = 0;
+  else
+    return;
+
+  if (exists && useridfts_current_p ())
+    {
+      have_useridfts = 1;
+      return;
+    }
+
+  if (!opt.quiet)
+    log_info ("%s full-text index for user ids\n",
+              exists? "rebuilding" : "creating");
+  err = run_sql_statement ("begin transaction");
+  if (err)
+    return;
+  /* An existing index is emptied instead of created.  */
+  if (exists)
+    err = run_sql_statement ("DELETE FROM useridfts");
+  for (idx = exists? 1 : 0; !err && idx < DIM(useridfts_definitions); idx++)
+    err = run_sql_statement (useridfts_definitions[idx]);
+  if (!err)
+    err = run_sql_statement ("commit");
+  if (err)
+    {
+      log_info ("error creating full-text index for user ids: %s\n",
+                gpg_strerror (err));
+      if (run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+      return;
+    }
+
+  have_useridfts = 1;
+}
+
+
+/* Remove the user ids of the blob UBID from the full-text index.
+ * This needs to be called before they are deleted from the userid
+ * table.  */
+static gpg_error_t
+delete_useridfts (const unsigned char *ubid)
+{
+  if (!have_useridfts)
+    return 0;
+  return run_sql_statement_bind_ubid
+    ("DELETE FROM useridfts WHERE rowid IN"
+     " (SELECT rowid FROM userid WHERE ubid = ?1)", ubid);
+}
+
+
+/* Switch the database FILENAME to the write-ahead log journal mode.
+ * With that mode readers on other connections see the last committed
+ * state and are not blocked by a writer.  If this is not possible we
+ * do all searches on the main connection.  WAL is not used on network
+ * file systems because its shared memory locks don't work across
+ * hosts.  */
+static void
+enable_wal (const char *filename)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+  const char *s;
+  int network_fs;
+
+  use_read_connections = 0;
+
+  network_fs = gnupg_is_network_fs (filename);
+  if (network_fs)
+    log_info ("database is on a network file system - not using WAL\n");
+  else if (!sqlite3_threadsafe ())
+    {
+      if (opt.verbose)
+        log_info ("SQLite is not thread-safe - not using read connections\n");
+      return;
+    }
+
+  /* The journal mode is stored in the database and thus a database
+   * created on a local file system needs to be switched back.  */
+  err = run_sql_prepare (network_fs? "PRAGMA journal_mode = DELETE"
+                         : "PRAGMA journal_mode = WAL",
+                         NULL, NULL, &stmt);
+  if (err)
+    return;
+  err = run_sql_step_for_select (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      /* The pragma returns the new journal mode.  */
+      s = (const char *)sqlite3_column_text (stmt, 0);
+      if (network_fs)
+        ;
+      else if (s && !ascii_strcasecmp (s, "wal"))
+        use_read_connections = 1;
+      else
+        log_info ("can't switch database to WAL mode (mode is '%s')\n",
+                  s? s : "?");
+    }
+  sqlite3_finalize (stmt);
+}
+
+
+/* Open a private read-only connection to the database FILENAME for
+ * use by a single request and store it at R_HD.  */
+static gpg_error_t
+open_read_connection (const char *filename, sqlite3 **r_hd)
+{
+  gpg_error_t err;
+  int res;
+
+  res = sqlite3_open_v2 (filename, r_hd,
+                         (SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX),
+                         NULL);
+  if (res)
+    {
+      err = gpg_error (gpg_err_code_from_sqlite (res));
+      log_error ("error opening '%s' for reading: %s\n",
+                 filename, sqlite3_errstr (res));
+      sqlite3_close (*r_hd);
+      *r_hd = NULL;
+      return err;
+    }
+  sqlite3_extended_result_codes (*r_hd, 1);
+  /* A reader may only be blocked briefly while the WAL is recovered
+   * or the index is rebuilt after a crash.  */
+  sqlite3_busy_timeout (*r_hd, 1000);
+  return 0;
+}
+
+
 /* Create and initialize a new SQL database file if it does not
  * exists; else open it and check that all required objects are
  * available.  */
@@ -566,9 +825,10 @@ create_or_open_database (const char *filename)
 
   /* Database has not yet been opened.  Open or create it, make sure
    * the tables exist, and prepare the required statements.  We use
-   * our own locking instead of the more complex serialization sqlite
-   * would have to do and it avoid that we call
-   * npth_unprotect/protect.  */
+   * our own locking for this main connection instead of the more
+   * complex serialization sqlite would have to do and it avoid that
+   * we call npth_unprotect/protect.  Searches may instead use their
+   * own read-only connections; see open_read_connection.  */
   res = sqlite3_open_v2 (filename,
                          &database_hd,
                          (SQLITE_OPEN_READWRITE
@@ -638,6 +898,8 @@ create_or_open_database (const char *filename)
         err = set_config_value ("created", isotimestamp (gnupg_get_time ()));
     }
 
+  migrate_useridfts ();
+  enable_wal (filename);
 
   err = 0;
 
@@ -722,6 +984,8 @@ be_sqlite_release_local (be_sqlite_local_t ctx)
 {
   if (ctx->select_stmt)
     sqlite3_finalize (ctx->select_stmt);
+  if (ctx->readhd)
+    sqlite3_close (ctx->readhd);
   xfree (ctx);
 }
 
@@ -841,6 +1105,7 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
   unsigned char kidbuf[8];
   const char *s;
   size_t n;
+  int use_fts;
 
 
   descidx = ctx->descidx;
@@ -850,9 +1115,21 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       goto leave;
     }
 
+  /* The trigram index can't help with patterns shorter than 3
+   * characters and would then be slower than a plain scan.  */
+  use_fts = (have_useridfts
+             && (desc[descidx].mode == KEYDB_SEARCH_MODE_MAILSUB
+                 || desc[descidx].mode == KEYDB_SEARCH_MODE_SUBSTR)
+             && desc[descidx].u.name && strlen (desc[descidx].u.name) >= 3);
+
   /* Check whether we can re-use the current select statement.  */
   if (!ctx->select_stmt)
     ;
+  else if (sqlite3_db_handle (ctx->select_stmt) != ctx->select_hd)
+    {
+      sqlite3_finalize (ctx->select_stmt);
+      ctx->select_stmt = NULL;
+    }
   else if (ctx->select_mode != desc[descidx].mode)
     {
       sqlite3_finalize (ctx->select_stmt);
@@ -865,10 +1142,16 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       sqlite3_finalize (ctx->select_stmt);
       ctx->select_stmt = NULL;
     }
+  else if (ctx->select_fts != use_fts)
+    {
+      sqlite3_finalize (ctx->select_stmt);
+      ctx->select_stmt = NULL;
+    }
 
   ctx->select_mode = desc[descidx].mode;
   ctx->filter_opgp = ctrl->filter_opgp;
   ctx->filter_x509 = ctrl->filter_x509;
+  ctx->select_fts = use_fts;
 
   /* Prepare the select and bind the parameters.  */
   if (ctx->select_stmt)
@@ -901,22 +1184,26 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_EXACT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.uid = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
     case KEYDB_SEARCH_MODE_MAIL:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         {
           s = desc[descidx].u.name;
@@ -934,14 +1221,30 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
         }
       break;
 
+    /* For substring searches we use the full-text index to find the
+     * candidate rows; the LIKE on the userid table is still required
+     * because the index folds the case of non-ASCII characters.  */
     case KEYDB_SEARCH_MODE_MAILSUB:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (!ctx->select_stmt && ctx->select_fts)
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid"
+           " AND u.rowid IN (SELECT rowid FROM useridfts"
+           "                 WHERE addrspec LIKE ?1)"
+           " AND u.addrspec LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      else if (!ctx->select_stmt)
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -949,12 +1252,25 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_SUBSTR:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (!ctx->select_stmt && ctx->select_fts)
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid"
+           " AND u.rowid IN (SELECT rowid FROM useridfts"
+           "                 WHERE uid LIKE ?1)"
+           " AND u.uid LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      else if (!ctx->select_stmt)
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -967,12 +1283,14 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_ISSUER:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob"
-                               " FROM pubkey as p, issuer as i"
-                               " WHERE p.ubid = i.ubid"
-                               " AND i.dn = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob"
+           " FROM pubkey as p, issuer as i"
+           " WHERE p.ubid = i.ubid"
+           " AND i.dn = $1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -988,13 +1306,15 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       else
         {
           if (!ctx->select_stmt)
-            err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                                   " p.revoked, p.keyblob"
-                                   " FROM pubkey as p, issuer as i"
-                                   " WHERE p.ubid = i.ubid"
-                                   " AND i.sn = $1 AND i.dn = $2",
-                                   extra, " ORDER BY p.ubid",
-                                   &ctx->select_stmt);
+            err = run_sql_prepare_hd
+              (ctx->select_hd,
+               "SELECT p.ubid, p.type, p.ephemeral,"
+               " p.revoked, p.keyblob"
+               " FROM pubkey as p, issuer as i"
+               " WHERE p.ubid = i.ubid"
+               " AND i.sn = $1 AND i.dn = $2",
+               extra, " ORDER BY p.ubid",
+               &ctx->select_stmt);
           if (!err)
             err = run_sql_bind_ntext (ctx->select_stmt, 1,
                                       desc[descidx].sn, desc[descidx].snlen);
@@ -1014,12 +1334,14 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SUBJECT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid"
-                               " AND u.uid = $1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, u.uidno"
+           " FROM pubkey as p, userid as u"
+           " WHERE p.ubid = u.ubid"
+           " AND u.uid = $1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -1028,12 +1350,14 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SHORT_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND"
-                               " substr(f.kid,5) = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND"
+           " substr(f.kid,5) = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf)+4,
@@ -1043,11 +1367,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_LONG_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.kid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.kid = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf),
@@ -1057,11 +1383,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_FPR:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.fpr = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral,"
+           " p.revoked, p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.fpr = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.fpr, desc[descidx].fprlen);
@@ -1070,11 +1398,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_KEYGRIP:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+           " p.keyblob, f.subkey"
+           " FROM pubkey as p, fingerprint as f"
+           " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
+           extra, " ORDER BY p.ubid", &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.grip, KEYGRIP_LEN);
@@ -1082,10 +1412,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_UBID:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
-                               " FROM pubkey as p"
-                               " WHERE ubid = ?1",
-                               extra, NULL, &ctx->select_stmt);
+        err = run_sql_prepare_hd
+          (ctx->select_hd,
+           "SELECT ubid, type, ephemeral, revoked, keyblob"
+           " FROM pubkey as p"
+           " WHERE ubid = ?1",
+           extra, NULL, &ctx->select_stmt);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.ubid, UBID_LEN);
@@ -1103,10 +1435,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
           else
             extra = " ORDER by ubid";
 
-          err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
-                                 " keyblob"
-                                 " FROM pubkey as p",
-                                 extra, NULL, &ctx->select_stmt);
+          err = run_sql_prepare_hd
+            (ctx->select_hd,
+             "SELECT ubid, type, ephemeral, revoked,"
+             " keyblob"
+             " FROM pubkey as p",
+             extra, NULL, &ctx->select_stmt);
         }
       break;
 
@@ -1135,12 +1469,11 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  int got_mutex = 0;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
 
-  acquire_mutex ();
-
   /* Find the specific request part or allocate it.  */
   err = be_find_request_part (backend_hd, request, &part);
   if (err)
@@ -1149,7 +1482,11 @@ be_sqlite_search (ctrl_t ctrl,
 
   if (!desc)
     {
-      /* Reset */
+      /* Reset.  Also reset the statement so that it does not keep
+       * its read transaction open.  That would prevent checkpoints
+       * and let the WAL grow without limit.  */
+      if (ctx->select_stmt)
+        sqlite3_reset (ctx->select_stmt);
       ctx->select_done = 0;
       ctx->select_eof = 0;
       ctx->descidx = 0;
@@ -1165,8 +1502,32 @@ be_sqlite_search (ctrl_t ctrl,
       goto leave;
     }
 
+  /* Decide which connection to use.  A continued search sticks to
+   * the connection of its select.  A new search uses the private
+   * read connection of the request so that it needs no mutex and can
+   * run in parallel to other searches and a writer.  However, in a
+   * global transaction we must use the main connection because
+   * otherwise the not yet committed changes would not be seen.  */
+  if (ctx->select_done && ctx->select_stmt)
+    ctx->select_hd = sqlite3_db_handle (ctx->select_stmt);
+  else if (use_read_connections && !opt.in_transaction && !ctx->no_readhd)
+    {
+      if (!ctx->readhd
+          && open_read_connection (backend_hd->filename, &ctx->readhd))
+        ctx->no_readhd = 1;
+      ctx->select_hd = ctx->readhd? ctx->readhd : database_hd;
+    }
+  else
+    ctx->select_hd = database_hd;
+
+  if (ctx->select_hd == database_hd)
+    {
+      acquire_mutex ();
+      got_mutex = 1;
+    }
+
   /* Start a global transaction if needed.  */
-  if (!opt.active_transaction && opt.in_transaction)
+  if (got_mutex && !opt.active_transaction && opt.in_transaction)
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -1202,7 +1563,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
       if (!ubid || n < 0)
         {
-          if (!ubid && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!ubid && sqlite3_errcode (ctx->select_hd) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1235,7 +1596,7 @@ be_sqlite_search (ctrl_t ctrl,
       ctx->lastubid_valid = 1;
 
       n = sqlite3_column_int (ctx->select_stmt, 1);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_hd) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1246,7 +1607,7 @@ be_sqlite_search (ctrl_t ctrl,
       pubkey_type = n;
 
       n = sqlite3_column_int (ctx->select_stmt, 2);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_hd) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1257,7 +1618,7 @@ be_sqlite_search (ctrl_t ctrl,
       is_ephemeral = !!n;
 
       n = sqlite3_column_int (ctx->select_stmt, 3);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_hd) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1271,7 +1632,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 4);
       if (!keyblob || n < 0)
         {
-          if (!keyblob && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!keyblob && sqlite3_errcode (ctx->select_hd) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1285,7 +1646,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_uidno)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_uidno);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->select_hd) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1304,7 +1665,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_subkey)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_subkey);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->select_hd) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1323,7 +1684,8 @@ be_sqlite_search (ctrl_t ctrl,
       err = be_return_pubkey (ctrl, keyblob, keybloblen, pubkey_type,
                               ubid, is_ephemeral, is_revoked, uid_no, pk_no);
       if (!err)
-        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type);
+        be_cache_pubkey (ctrl, ubid, keyblob, keybloblen, pubkey_type,
+                         is_ephemeral, is_revoked);
     }
   else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
     {
@@ -1334,6 +1696,8 @@ be_sqlite_search (ctrl_t ctrl,
         }
       err = gpg_error (GPG_ERR_EOF);
       ctx->select_eof = 1;
+      /* Reset the statement to end its read transaction.  */
+      sqlite3_reset (ctx->select_stmt);
     }
   else
     {
@@ -1341,7 +1705,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
  leave:
-  release_mutex ();
+  if (got_mutex)
+    release_mutex ();
   return err;
 }
 
@@ -1472,6 +1837,14 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
     goto leave;
 
   err = run_sql_step (stmt);
+  if (err)
+    goto leave;
+
+  if (have_useridfts)
+    err = run_sql_statement
+      ("INSERT INTO useridfts(rowid,uid,addrspec)"
+       " SELECT rowid,uid,addrspec FROM userid"
+       " WHERE rowid = last_insert_rowid()");
 
  leave:
   if (stmt)
@@ -1604,6 +1977,9 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
    * or changed user ids and subkeys.  */
   err = run_sql_statement_bind_ubid
     ("DELETE FROM fingerprint WHERE ubid = ?1", ubid);
+  if (err)
+    goto leave;
+  err = delete_useridfts (ubid);
   if (err)
     goto leave;
   err = run_sql_statement_bind_ubid
@@ -1799,8 +2175,10 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
     }
   in_transaction = 1;
 
-  err = run_sql_statement_bind_ubid
-    ("DELETE from userid WHERE ubid = ?1", ubid);
+  err = delete_useridfts (ubid);
+  if (!err)
+    err = run_sql_statement_bind_ubid
+      ("DELETE from userid WHERE ubid = ?1", ubid);
   if (!err)
     err = run_sql_statement_bind_ubid
       ("DELETE from fingerprint WHERE ubid = ?1", ubid);
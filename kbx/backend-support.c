@@ -28,6 +28,7 @@
 #include "../common/i18n.h"
 #include "../common/asshelp.h"
 #include "../common/tlv.h"
+#include "../common/host2net.h"
 #include "backend.h"
 #include "keybox-defs.h"
 
@@ -172,6 +173,31 @@ be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
   gpg_error_t err;
   char hexubid[2*UBID_LEN+1];
 
+  if (ctrl->framed_return)
+    {
+      /* Return one frame per result; see cmd_search for the format.  */
+      unsigned char *frame;
+      size_t n = ctrl->no_data_return? 0 : buflen;
+
+      frame = xtrymalloc (4 + 36 + n);
+      if (!frame)
+        return gpg_error_from_syserror ();
+      n += 36;
+      ulongtobuf (frame, n);
+      ulongtobuf (frame + 4, ctrl->frame_descidx);
+      frame[8] = pubkey_type;
+      frame[9] = ((is_ephemeral? 1:0) | (is_revoked? 2:0));
+      frame[10] = frame[11] = 0;
+      ulongtobuf (frame + 12, uid_no);
+      ulongtobuf (frame + 16, pk_no);
+      memcpy (frame + 20, ubid, UBID_LEN);
+      if (n > 36)
+        memcpy (frame + 40, buffer, n - 36);
+      err = kbxd_write_data_line (ctrl, frame, 4 + n);
+      xfree (frame);
+      return err;
+    }
+
   bin2hex (ubid, UBID_LEN, hexubid);
   err = status_printf (ctrl, "PUBKEY_INFO", "%d %s %c%c %d %d",
                        pubkey_type, hexubid,
@@ -173,9 +173,29 @@ kbxd_release_session_info (ctrl_t ctrl)
 
 
 
+/* Set the size of the key cache to NBYTES.  */
+void
+kbxd_set_cache_size (size_t nbytes)
+{
+  be_cache_set_size (nbytes);
+}
+
+
+/* Return a malloced string with the statistics of the key cache or
+ * NULL on error.  */
+char *
+kbxd_cache_stats (void)
+{
+  return be_cache_stats_string ();
+}
+
+
+
 gpg_error_t
 kbxd_rollback (void)
 {
+  /* The cache may now have keys which were never committed.  */
+  be_cache_flush ();
   return be_sqlite_rollback ();
 }
 
@@ -183,7 +203,12 @@ kbxd_rollback (void)
 gpg_error_t
 kbxd_commit (void)
 {
-  return be_sqlite_commit ();
+  gpg_error_t err;
+
+  err = be_sqlite_commit ();
+  if (err)
+    be_cache_flush ();
+  return err;
 }
 
 
@@ -334,19 +359,39 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
       request->any_search = 0;
       request->any_found = 0;
       request->next_dbidx = 0;
+      be_cache_search (ctrl, request, NULL, 0);
       if (!desc) /* Reset only mode */
         {
           err = 0;
           goto leave;
         }
+
+      /* Try to answer a new search from the cache.  */
+      err = be_cache_search (ctrl, request, desc, ndesc);
+      if (gpg_err_code (err) != GPG_ERR_EOF)
+        {
+          if (DBG_LOOKUP)
+            log_debug ("%s: searched cache => %s\n",
+                       __func__, gpg_strerror (err));
+          request->any_search = 1;
+          if (!err)
+            request->any_found = 1;
+          goto leave;
+        }
+    }
+  else if (request->last_cached_final)
+    {
+      /* The previous key was returned from the cache and there can't
+       * be another one.  */
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
     }
 
   /* Divert to the backend for the actual search.  */
   switch (the_database.db_type)
     {
     case DB_TYPE_CACHE:
-      err = be_cache_search (ctrl, the_database.backend_handle, request,
-                             desc, ndesc);
+      err = be_cache_search (ctrl, request, desc, ndesc);
       /* Expected error codes from the cache lookup are:
        *  0 - found and returned via the cache
        *  GPG_ERR_NOT_FOUND - marked in the cache as not available
@@ -380,14 +425,10 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
     }
   else if (gpg_err_code (err) == GPG_ERR_EOF)
     {
-      if (the_database.db_type == DB_TYPE_CACHE && request->last_cached_valid)
-        {
-          if (request->last_cached_final)
-            goto leave;
-        }
       request->next_dbidx++;
       /* FIXME: We need to see which pubkey type we need to insert.  */
-      be_cache_not_found (ctrl, PUBKEY_TYPE_UNKNOWN, desc, ndesc);
+      if (!request->any_found)
+        be_cache_not_found (ctrl, PUBKEY_TYPE_UNKNOWN, desc, ndesc);
       err = gpg_error (GPG_ERR_NOT_FOUND);
       goto leave;
     }
@@ -443,6 +484,8 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
   if (err)
     goto leave;
 
+  be_cache_invalidate (ubid, blob, bloblen, pktype);
+
   if (the_database.db_type == DB_TYPE_KBX)
     {
       err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
@@ -528,6 +571,8 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
       goto leave;
     }
 
+  be_cache_invalidate (ubid, NULL, 0, PUBKEY_TYPE_UNKNOWN);
+
   if (the_database.db_type == DB_TYPE_KBX)
     {
       err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
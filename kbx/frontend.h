@@ -28,6 +28,9 @@ gpg_error_t kbxd_set_database (ctrl_t ctrl,
 
 void kbxd_release_session_info (ctrl_t ctrl);
 
+void kbxd_set_cache_size (size_t nbytes);
+char *kbxd_cache_stats (void);
+
 gpg_error_t kbxd_rollback (void);
 gpg_error_t kbxd_commit (void);
 gpg_error_t kbxd_search (ctrl_t ctrl,
@@ -0,0 +1,275 @@
+/* kbxd-bench.c - Benchmark parallel searches on the keyboxd
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0+
+ */
+
+/*
+
+   This is a program for manual tests.  It forks several processes,
+   each of which opens its own session with the keyboxd of the
+   current GNUPGHOME and runs a SEARCH for every given pattern.  The
+   total number of searches per second is printed at the end.
+
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/time.h>
+# include <sys/wait.h>
+#endif
+
+#include <assuan.h>
+#include "../common/util.h"
+#include "../common/init.h"
+#include "../common/asshelp.h"
+#include "../common/strlist.h"
+
+#define PGM "kbxd-bench"
+
+static int verbose;
+static int opt_no_data;
+
+
+/* Count the bytes returned by a search.  */
+static gpg_error_t
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  size_t *nbytes = opaque;
+
+  (void)buffer;
+  *nbytes += length;
+  return 0;
+}
+
+
+/* Open a new session and run LOOPS rounds of searches for all
+ * PATTERNS.  SESSIONNO is only used for diagnostics.  Returns true on
+ * error.  */
+static int
+run_session (int sessionno, strlist_t patterns, int loops)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  char line[ASSUAN_LINELENGTH];
+  strlist_t sl;
+  unsigned long nfound = 0;
+  unsigned long nnotfound = 0;
+  size_t nbytes = 0;
+  int i;
+
+  err = start_new_keyboxd (&ctx, GPG_ERR_SOURCE_DEFAULT, NULL,
+                           1, verbose > 1, 0, NULL, NULL);
+  if (err)
+    {
+      log_error ("session %d: error connecting the keyboxd: %s\n",
+                 sessionno, gpg_strerror (err));
+      return 1;
+    }
+
+  for (i=0; i < loops; i++)
+    for (sl = patterns; sl; sl = sl->next)
+      {
+        snprintf (line, sizeof line, "SEARCH %s-- %s",
+                  opt_no_data? "--no-data ":"", sl->d);
+        err = assuan_transact (ctx, line, data_cb, &nbytes,
+                               NULL, NULL, NULL, NULL);
+        if (!err)
+          nfound++;
+        else if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+          nnotfound++;
+        else
+          {
+            log_error ("session %d: error searching '%s': %s\n",
+                       sessionno, sl->d, gpg_strerror (err));
+            assuan_release (ctx);
+            return 1;
+          }
+      }
+
+  if (verbose)
+    log_info ("session %d: %lu found, %lu not found, %zu bytes\n",
+              sessionno, nfound, nnotfound, nbytes);
+  assuan_release (ctx);
+  return 0;
+}
+
+
+/* Read the patterns from FNAME, one per line, and append them to
+ * PATTERNS.  */
+static void
+read_patterns (const char *fname, strlist_t *patterns)
+{
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  size_t maxlen;
+  ssize_t n;
+
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    log_fatal ("can't open '%s': %s\n",
+               fname, gpg_strerror (gpg_error_from_syserror ()));
+  for (;;)
+    {
+      maxlen = 1024;
+      n = es_read_line (fp, &line, &linelen, &maxlen);
+      if (n < 0)
+        log_fatal ("error reading '%s': %s\n",
+                   fname, gpg_strerror (gpg_error_from_syserror ()));
+      if (!n)
+        break;
+      if (!maxlen)
+        log_fatal ("line too long in '%s'\n", fname);
+      trim_spaces (line);
+      if (*line && *line != '#')
+        append_to_strlist (patterns, line);
+    }
+  es_free (line);
+  es_fclose (fp);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int last_argc = -1;
+  int nsessions = 4;
+  int loops = 100;
+  strlist_t patterns = NULL;
+#ifndef HAVE_W32_SYSTEM
+  struct timeval start, stop;
+  double elapsed;
+  unsigned long nsearches;
+  pid_t pid;
+  int i, status;
+  int failed = 0;
+#endif
+
+  early_system_init ();
+  log_set_prefix (PGM, GPGRT_LOG_WITH_PREFIX);
+  init_common_subsystems (&argc, &argv);
+  assuan_set_gpg_err_source (0);
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          fputs ("usage: " PGM " [options] [PATTERN...]\n"
+                 "Options:\n"
+                 "  --verbose         print per session results\n"
+                 "  --sessions N      run N sessions in parallel\n"
+                 "  --loops N         search all patterns N times\n"
+                 "  --no-data         do not return the keyblocks\n"
+                 "  --patterns FILE   read the patterns from FILE\n"
+                 , stdout);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose++;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--no-data"))
+        {
+          opt_no_data = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--sessions") && argc > 1)
+        {
+          nsessions = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--loops") && argc > 1)
+        {
+          loops = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--patterns") && argc > 1)
+        {
+          read_patterns (argv[1], &patterns);
+          argc -= 2; argv += 2;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          log_error ("unknown option '%s'\n", *argv);
+          exit (2);
+        }
+    }
+  for (; argc; argc--, argv++)
+    append_to_strlist (&patterns, *argv);
+
+  if (!patterns || nsessions < 1 || loops < 1)
+    {
+      fputs ("usage: " PGM " [options] [PATTERN...]\n", stderr);
+      exit (2);
+    }
+
+#ifdef HAVE_W32_SYSTEM
+  log_error ("this program is not yet supported on Windows\n");
+  return 1;
+#else
+  /* Make sure that the keyboxd is running before we take the time.  */
+  if (run_session (-1, NULL, 0))
+    exit (1);
+
+  gettimeofday (&start, NULL);
+  for (i=0; i < nsessions; i++)
+    {
+      pid = fork ();
+      if (pid == (pid_t)(-1))
+        log_fatal ("fork failed: %s\n",
+                   gpg_strerror (gpg_error_from_syserror ()));
+      if (!pid)
+        exit (run_session (i, patterns, loops));
+    }
+  for (i=0; i < nsessions; i++)
+    {
+      if (wait (&status) == (pid_t)(-1))
+        log_fatal ("wait failed: %s\n",
+                   gpg_strerror (gpg_error_from_syserror ()));
+      if (!WIFEXITED (status) || WEXITSTATUS (status))
+        failed++;
+    }
+  gettimeofday (&stop, NULL);
+
+  elapsed = (stop.tv_sec - start.tv_sec)
+            + (stop.tv_usec - start.tv_usec) / 1000000.0;
+  nsearches = (unsigned long)nsessions * loops * strlist_length (patterns);
+  printf ("%d sessions, %lu searches in %.3fs: %.0f searches/s\n",
+          nsessions, nsearches, elapsed,
+          elapsed > 0? nsearches / elapsed : 0.0);
+  if (failed)
+    log_error ("%d sessions failed\n", failed);
+
+  free_strlist (patterns);
+  return !!failed;
+#endif
+}
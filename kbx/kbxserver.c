@@ -299,19 +299,113 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Helper for cmd_search to run a batch search.  The patterns are
+ * inquired from the client, one per line, and all keys matching each
+ * pattern are returned as frames.  */
+static gpg_error_t
+do_multi_search (assuan_context_t ctx, ctrl_t ctrl)
+{
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  char *buffer, *p, *pend;
+  KEYBOX_SEARCH_DESC desc;
+  unsigned int idx;
+
+  err = assuan_inquire (ctx, "PATTERNS", &value, &valuelen, 0);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+  if (!valuelen) /* No data received. */
+    {
+      err = gpg_error (GPG_ERR_MISSING_VALUE);
+      goto leave;
+    }
+
+  /* Make sure that the last pattern is terminated.  */
+  buffer = xtryrealloc (value, valuelen + 1);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  value = (unsigned char *)buffer;
+  buffer[valuelen] = 0;
+
+  err = prepare_outstream (ctrl);
+  if (err)
+    goto leave;
+
+  ctrl->framed_return = 1;
+  for (idx=0, p = buffer; p < buffer + valuelen; idx++, p = pend + 1)
+    {
+      pend = strchr (p, '\n');
+      if (!pend)
+        pend = buffer + valuelen;
+      *pend = 0;
+      trim_spaces (p);
+      if (!*p)
+        {
+          err = set_error (GPG_ERR_INV_ARG, "empty pattern");
+          goto leave;
+        }
+
+      err = classify_user_id (p, &desc, 1);
+      if (err)
+        goto leave;
+
+      ctrl->frame_descidx = idx;
+      err = kbxd_search (ctrl, &desc, 1, 1);
+      while (!err)
+        err = kbxd_search (ctrl, &desc, 1, 0);
+      if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+        goto leave;
+      err = 0;
+    }
+
+ leave:
+  ctrl->framed_return = 0;
+  xfree (value);
+  return err;
+}
+
+
 static const char hlp_search[] =
   "SEARCH [--no-data] [--openpgp|--x509] [[--more] PATTERN]\n"
+  "SEARCH [--no-data] [--openpgp|--x509] --multi\n"
   "\n"
   "Search for the keys identified by PATTERN.  With --more more\n"
   "patterns to be used for the search are expected with the next\n"
   "command.  With --no-data only the search status is returned but\n"
   "not the actual data.  With --openpgp or --x509 only the respective\n"
-  "keys are returned.  See also \"NEXT\".";
+  "keys are returned.  See also \"NEXT\".\n"
+  "\n"
+  "With --multi the patterns are requested using\n"
+  "  INQUIRE PATTERNS\n"
+  "with one pattern per line and each pattern is resolved on its own\n"
+  "to all matching keys.  Instead of PUBKEY_INFO status lines the\n"
+  "data is a sequence of frames, one per found key, with all numbers\n"
+  "in network byte order:\n"
+  "\n"
+  "  u32  length of the frame not including this field\n"
+  "  u32  0-based index of the matching pattern\n"
+  "  byte pubkey type\n"
+  "  byte flags: bit 0 = ephemeral, bit 1 = revoked\n"
+  "  u16  reserved\n"
+  "  u32  number of the matching user id or 0\n"
+  "  u32  number of the matching key or 0\n"
+  "  20 bytes UBID\n"
+  "  the keyblock (empty with --no-data)\n"
+  "\n"
+  "Patterns without a match return no frame.  NEXT may not be\n"
+  "used after a --multi search.";
 static gpg_error_t
 cmd_search (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_more, opt_no_data, opt_openpgp, opt_x509;
+  int opt_more, opt_no_data, opt_openpgp, opt_x509, opt_multi;
   gpg_error_t err;
   unsigned int n, k;
 
@@ -319,10 +413,31 @@ cmd_search (assuan_context_t ctx, char *line)
   opt_more = has_option (line, "--more");
   opt_openpgp = has_option (line, "--openpgp");
   opt_x509 = has_option (line, "--x509");
+  opt_multi = has_option (line, "--multi");
   line = skip_options (line);
 
   ctrl->server_local->search_any_found = 0;
 
+  if (opt_multi)
+    {
+      if (opt_more || *line)
+        err = set_error (GPG_ERR_INV_ARG, "--multi takes no pattern");
+      else if (ctrl->server_local->search_expecting_more)
+        err = set_error (GPG_ERR_INV_ARG, "--more pending");
+      else
+        {
+          ctrl->server_local->multi_search_desc_len = 0;
+          ctrl->server_local->inhibit_data_logging = 1;
+          ctrl->server_local->inhibit_data_logging_now = 0;
+          ctrl->server_local->inhibit_data_logging_count = 0;
+          ctrl->no_data_return = opt_no_data;
+          ctrl->filter_opgp = opt_openpgp;
+          ctrl->filter_x509 = opt_x509;
+          err = do_multi_search (ctx, ctrl);
+        }
+      goto leave;
+    }
+
   if (!*line)
     {
       if (opt_more)
@@ -546,20 +661,99 @@ cmd_next (assuan_context_t ctx, char *line)
 }
 
 
+/* Helper for cmd_store to store the keys from a STORE --multi.  The
+ * keys in (VALUE,VALUELEN) are each prefixed by a 4 byte length.  */
+static gpg_error_t
+do_multi_store (assuan_context_t ctx, ctrl_t ctrl,
+                const unsigned char *value, size_t valuelen,
+                enum kbxd_store_modes mode)
+{
+  gpg_error_t err, err2;
+  const unsigned char *p;
+  size_t n, nleft;
+  unsigned int idx, nkeys, nstored;
+  int own_transaction = 0;
+  char okline[50];
+
+  /* Check the framing first so that we do not start to store a
+   * truncated batch.  */
+  for (nkeys=0, p = value, nleft = valuelen; nleft; nkeys++)
+    {
+      if (nleft < 4)
+        return set_error (GPG_ERR_INV_LENGTH, "truncated length field");
+      n = buf32_to_size_t (p);
+      if (!n || n > nleft - 4)
+        return set_error (GPG_ERR_INV_LENGTH, "invalid key length");
+      p += 4 + n;
+      nleft -= 4 + n;
+    }
+
+  /* Unless the client already runs a transaction we use our own for
+   * the entire batch so that only one commit is required.  */
+  if (!opt.in_transaction)
+    {
+      opt.in_transaction = 1;
+      opt.transaction_pid = assuan_get_pid (ctx);
+      own_transaction = 1;
+    }
+
+  err = 0;
+  for (idx=nstored=0, p = value; idx < nkeys; idx++, p += 4 + n)
+    {
+      n = buf32_to_size_t (p);
+      err2 = kbxd_store (ctrl, p + 4, n, mode);
+      if (!err2)
+        nstored++;
+      else
+        {
+          /* Errors for single keys are reported but do not abort the
+           * batch; this is what a sequence of STOREs would do.  */
+          err = status_printf (ctrl, "STORE_ERROR", "%u %u", idx, err2);
+          if (err)
+            break;
+        }
+    }
+
+  if (own_transaction)
+    {
+      if (err)
+        kbxd_rollback ();
+      else
+        err = kbxd_commit ();
+    }
+
+  if (!err)
+    {
+      snprintf (okline, sizeof okline, "%u of %u stored", nstored, nkeys);
+      err = assuan_set_okay_line (ctx, okline);
+    }
+  return err;
+}
+
+
 static const char hlp_store[] =
-  "STORE [--update|--insert]\n"
+  "STORE [--update|--insert] [--multi]\n"
   "\n"
   "Insert a key into the database.  Whether to insert or update\n"
   "the key is decided by looking at the primary key's fingerprint.\n"
   "With option --update the key must already exist.\n"
   "With option --insert the key must not already exist.\n"
   "The actual key material is requested by this function using\n"
-  "  INQUIRE BLOB";
+  "  INQUIRE BLOB\n"
+  "\n"
+  "With option --multi the key material is requested using\n"
+  "  INQUIRE BLOBS\n"
+  "and the inquired data is a sequence of keys, each\n"
+  "prefixed by its length as a 4 byte big endian number.  All keys\n"
+  "are stored in one transaction; for each key which could not be\n"
+  "stored the status line\n"
+  "  STORE_ERROR <index> <errorcode>\n"
+  "is emitted with INDEX being the 0-based number of the key.";
 static gpg_error_t
 cmd_store (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_update, opt_insert;
+  int opt_update, opt_insert, opt_multi;
   enum kbxd_store_modes mode;
   gpg_error_t err;
   unsigned char *value = NULL;
@@ -567,6 +761,7 @@ cmd_store (assuan_context_t ctx, char *line)
 
   opt_update = has_option (line, "--update");
   opt_insert = has_option (line, "--insert");
+  opt_multi = has_option (line, "--multi");
   line = skip_options (line);
   if (*line)
     {
@@ -581,7 +776,8 @@ cmd_store (assuan_context_t ctx, char *line)
     mode = KBXD_STORE_AUTO;
 
   /* Ask for the key material.  */
-  err = assuan_inquire (ctx, "BLOB", &value, &valuelen, 0);
+  err = assuan_inquire (ctx, opt_multi? "BLOBS" : "BLOB",
+                        &value, &valuelen, 0);
   if (err)
     {
       log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
@@ -594,7 +790,10 @@ cmd_store (assuan_context_t ctx, char *line)
       goto leave;
     }
 
-  err = kbxd_store (ctrl, value, valuelen, mode);
+  if (opt_multi)
+    err = do_multi_store (ctx, ctrl, value, valuelen, mode);
+  else
+    err = kbxd_store (ctrl, value, valuelen, mode);
 
 
  leave:
@@ -724,6 +923,7 @@ static const char hlp_getinfo[] =
   "pid         - Return the process id of the server.\n"
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
+  "cache_stats - Return the statistics of the key cache.\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -754,6 +954,17 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%u", ctrl->server_local->session_id);
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char *s = kbxd_cache_stats ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
   else if (!strncmp (line, "getenv", 6)
            && (line[6] == ' ' || line[6] == '\t' || !line[6]))
     {
@@ -35,6 +35,10 @@
    |      2 | OpenPGP blob |
    |      3 | X.509 blob   |
 
+   Inserted and updated blobs are appended to the file.  Deleted and
+   replaced blobs are turned into empty blobs by setting their type to
+   0; keybox_compress removes them.
+
 ** The First blob
 
    The first blob of a plain KBX file has a special format:
@@ -172,8 +172,23 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 
 
 /*-- keybox-file.c --*/
+/* The maximum length of a blob.  */
+#define IMAGELEN_LIMIT (5*1024*1024)
+
 int _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp);
+gpg_error_t _keybox_sync_file (estream_t fp);
+
+/*-- keybox-index.c --*/
+gpg_error_t _keybox_index_build (const char *fname, int force);
+estream_t _keybox_index_begin_update (const char *fname);
+void _keybox_index_end_update (estream_t idxfp, const char *fname,
+                               KEYBOXBLOB blob, off_t off);
+void _keybox_index_remove (const char *fname);
+gpg_error_t _keybox_index_lookup (estream_t kbfp, const char *fname,
+                                  KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                                  off_t startoff,
+                                  off_t **r_offs, size_t *r_noffs);
 
 /*-- keybox-search.c --*/
 gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
@@ -23,13 +23,11 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "keybox-defs.h"
 
 
-#define IMAGELEN_LIMIT (5*1024*1024)
-
-
 #if !defined(HAVE_FTELLO) && !defined(ftello)
 static off_t
 ftello (FILE *stream)
@@ -188,3 +186,17 @@ _keybox_write_header_blob (estream_t fp, int for_openpgp)
 
   return 0;
 }
+
+
+/* Flush FP and make sure that the data has been written to the disk.  */
+gpg_error_t
+_keybox_sync_file (estream_t fp)
+{
+  if (es_fflush (fp))
+    return gpg_error_from_syserror ();
+#ifdef HAVE_FSYNC
+  if (fsync (es_fileno (fp)))
+    return gpg_error_from_syserror ();
+#endif
+  return 0;
+}
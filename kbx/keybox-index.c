@@ -0,0 +1,981 @@
+/* keybox-index.c - Sidecar index for exact-match searches
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The index file is stored next to the keybox with the suffix
+   ".idx" and maps the exact-match search keys of all blobs to the
+   file offsets of the blobs:
+
+   - b4   Magic 'KBXi'
+   - byte Version number (1)
+   - byte Flags
+          bit 0 - Keygrips are not indexed (X.509 blobs seen)
+   - u16  RFU
+   - uint64_t  Size of the keybox file
+   - uint64_t  Modification time of the keybox file
+   - u32  Nanoseconds of the modification time or 0
+   - u32  RFU
+   - uint64_t  Inode number of the keybox file
+   - u32  [NSORTED] Number of sorted entries
+   - u32  [NTOTAL] Number of all entries
+   - NSORTED times, sorted by memcmp:
+      - byte Key type (one of IDXKEY_*)
+      - b3   RFU
+      - b20  The key.  Key IDs are left aligned and zero padded, only
+             the leftmost 20 bytes of a 32 byte fingerprint are used
+             and mail addresses are stored as SHA-1 of the lowercased
+             addr-spec.
+      - uint64_t  Offset of the blob
+   - NTOTAL - NSORTED unsorted entries appended by updates.  They are
+     merged into the sorted part when there are too many of them.
+     Data after the NTOTAL entries is ignored.
+
+   The index is only used if the size, the modification time and the
+   inode of the keybox match the values stored in the header.  The
+   entries are synced to the disk before the header is updated so
+   that a header never refers to entries lost in a crash.  It is build by
+   keybox_compress and kept up to date by the other update functions;
+   a keybox modified by other software thus just falls back to a
+   linear search until the next compress run.  All found candidates
+   are checked against the real blob, thus the index only needs to be
+   complete but may return false positives.  Note that blobs are
+   never moved except by keybox_compress; in-place changes like
+   deleting a blob or changing a flag only require an update of the
+   header.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+#include "../common/mbox-util.h"
+
+
+#define INDEX_HEADER_LEN 48
+#define INDEX_ENTRY_LEN  32
+#define INDEX_KEY_LEN    24  /* The part of an entry without the offset.  */
+#define INDEX_VERSION    1
+
+/* The part of the header describing the state of the keybox.  */
+#define INDEX_STAMP_OFF  8
+#define INDEX_STAMP_LEN  32
+#define INDEX_NSORTED_OFF 40
+#define INDEX_NTOTAL_OFF  44
+#define INDEX_FLAG_NO_KEYGRIP 1
+
+/* Merge the appended entries into the sorted part when there are
+   more of them.  They are scanned linearly by each lookup.  */
+#define INDEX_MAX_TAIL   2048
+
+enum
+  {
+    IDXKEY_SHORT_KID = 1,
+    IDXKEY_LONG_KID  = 2,
+    IDXKEY_FPR       = 3,
+    IDXKEY_KEYGRIP   = 4,
+    IDXKEY_UBID      = 5,
+    IDXKEY_MAIL      = 6
+  };
+
+
+#define get16(a) buf16_to_ulong ((a))
+#define get32(a) buf32_to_ulong ((a))
+
+
+/* A growing array of index entries.  */
+struct entry_array_s
+{
+  unsigned char *data;
+  size_t count;
+  size_t size;
+  int flags;
+  int oom;
+};
+
+
+static uint64_t
+get64 (const unsigned char *a)
+{
+  return (((uint64_t)buf32_to_u32 (a)) << 32) | buf32_to_u32 (a + 4);
+}
+
+static void
+put64 (unsigned char *a, uint64_t value)
+{
+  a[0] = value >> 56;
+  a[1] = value >> 48;
+  a[2] = value >> 40;
+  a[3] = value >> 32;
+  a[4] = value >> 24;
+  a[5] = value >> 16;
+  a[6] = value >>  8;
+  a[7] = value;
+}
+
+
+/* Store the stamp for the keybox with the stat info ST at STAMP,
+   which has a length of INDEX_STAMP_LEN.  */
+static void
+make_stamp (unsigned char *stamp, struct stat *st)
+{
+  unsigned long nsec;
+
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  nsec = st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  nsec = st->st_mtimespec.tv_nsec;
+#else
+  nsec = 0;
+#endif
+
+  memset (stamp, 0, INDEX_STAMP_LEN);
+  put64 (stamp, st->st_size);
+  put64 (stamp + 8, st->st_mtime);
+  ulongtobuf (stamp + 16, nsec);
+  put64 (stamp + 24, st->st_ino);
+}
+
+
+/* Return true if the stamp in HEADER matches the stat info ST.  */
+static int
+same_stamp_p (const unsigned char *header, struct stat *st)
+{
+  unsigned char stamp[INDEX_STAMP_LEN];
+
+  make_stamp (stamp, st);
+  return !memcmp (header + INDEX_STAMP_OFF, stamp, INDEX_STAMP_LEN);
+}
+
+
+static char *
+index_fname (const char *fname, const char *suffix)
+{
+  return strconcat (fname, EXTSEP_S "idx", suffix, NULL);
+}
+
+
+/* Fill the first INDEX_KEY_LEN bytes of ENTRY.  */
+static void
+make_key (unsigned char *entry, int type, const void *key, size_t keylen)
+{
+  memset (entry, 0, INDEX_KEY_LEN);
+  entry[0] = type;
+  if (keylen > INDEX_KEY_LEN - 4)
+    keylen = INDEX_KEY_LEN - 4;
+  memcpy (entry + 4, key, keylen);
+}
+
+
+/* Make the key for the mail address NAME,NAMELEN.  */
+static void
+make_mail_key (unsigned char *entry, const void *name, size_t namelen)
+{
+  const unsigned char *s = name;
+  unsigned char *lower;
+  unsigned char digest[20];
+  size_t n;
+
+  lower = xtrymalloc (namelen + 1);
+  if (!lower)
+    {
+      /* We can't return an error here; use a key which never matches
+         a real mail address.  */
+      make_key (entry, IDXKEY_MAIL, "", 0);
+      return;
+    }
+  for (n=0; n < namelen; n++)
+    lower[n] = ascii_tolower (s[n]);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, digest, lower, namelen);
+  xfree (lower);
+  make_key (entry, IDXKEY_MAIL, digest, 20);
+}
+
+
+static void
+add_entry (struct entry_array_s *array, const unsigned char *key, off_t off)
+{
+  unsigned char *p;
+
+  if (array->oom)
+    return;
+  if (array->count == array->size)
+    {
+      size_t newsize = array->size? 2 * array->size : 256;
+
+      p = xtryrealloc (array->data, newsize * INDEX_ENTRY_LEN);
+      if (!p)
+        {
+          array->oom = 1;
+          return;
+        }
+      array->data = p;
+      array->size = newsize;
+    }
+  p = array->data + array->count++ * INDEX_ENTRY_LEN;
+  memcpy (p, key, INDEX_KEY_LEN);
+  put64 (p + INDEX_KEY_LEN, off);
+}
+
+
+/* Add the mail addresses of BLOB.  This mirrors the extraction done
+   by blob_cmp_mail.  */
+static void
+add_mail_entries (struct entry_array_s *array,
+                  const unsigned char *buffer, size_t length, int x509,
+                  off_t off)
+{
+  unsigned char key[INDEX_KEY_LEN];
+  size_t pos, uidoff, len, mypos, mylen;
+  size_t nkeys, keyinfolen, nuids, uidinfolen, nserial;
+  int idx;
+
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18 );
+  if (keyinfolen < 28)
+    return;
+  pos = 20 + keyinfolen*nkeys;
+  if (pos+2 > length)
+    return;
+  nserial = get16 (buffer+pos);
+  pos += 2 + nserial;
+  if (pos+4 > length)
+    return;
+  nuids = get16 (buffer + pos);  pos += 2;
+  uidinfolen = get16 (buffer + pos);  pos += 2;
+  if (uidinfolen < 12)
+    return;
+  if (pos + uidinfolen*nuids > length)
+    return;
+
+  for (idx=!!x509; idx < nuids; idx++)
+    {
+      mypos = pos + idx*uidinfolen;
+      uidoff = get32 (buffer+mypos);
+      len = get32 (buffer+mypos+4);
+      if ((uint64_t)uidoff+(uint64_t)len > (uint64_t)length)
+        return;
+      if (x509)
+        {
+          if (len < 2 || buffer[uidoff] != '<')
+            continue;
+          len--;
+          if (len < 3 || buffer[uidoff+len] != '>')
+            continue;
+          uidoff++;
+          len--;
+        }
+      else
+        {
+          mypos = uidoff;
+          mylen = len;
+          for ( ; len && buffer[uidoff] != '<'; len--, uidoff++)
+            ;
+          if (len < 2 || buffer[uidoff] != '<')
+            {
+              uidoff = mypos;
+              len = mylen;
+              if (!is_valid_mailbox_mem (buffer+uidoff, len))
+                continue;
+            }
+          else
+            {
+              uidoff++;
+              len--;
+              for (mypos=uidoff; len && buffer[mypos] != '>'; len--, mypos++)
+                ;
+              if (!len || buffer[mypos] != '>' || uidoff == mypos)
+                continue;
+              len = mypos - uidoff;
+            }
+        }
+      if (!len)
+        continue;
+      make_mail_key (key, buffer + uidoff, len);
+      add_entry (array, key, off);
+    }
+}
+
+
+/* Add the keygrips of the OpenPGP BLOB.  */
+static void
+add_keygrip_entries (struct entry_array_s *array,
+                     const unsigned char *buffer, size_t length, off_t off)
+{
+  unsigned char key[INDEX_KEY_LEN];
+  size_t cert_off, cert_len;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *k;
+
+  cert_off = get32 (buffer+8);
+  cert_len = get32 (buffer+12);
+  if ((uint64_t)cert_off+(uint64_t)cert_len > (uint64_t)length)
+    return;
+  if (_keybox_parse_openpgp (buffer + cert_off, cert_len, NULL, &info))
+    return;  /* Such a blob is never found by a keygrip search.  */
+
+  make_key (key, IDXKEY_KEYGRIP, info.primary.grip, 20);
+  add_entry (array, key, off);
+  if (info.nsubkeys)
+    for (k = &info.subkeys; k; k = k->next)
+      {
+        make_key (key, IDXKEY_KEYGRIP, k->grip, 20);
+        add_entry (array, key, off);
+      }
+  _keybox_destroy_openpgp_info (&info);
+}
+
+
+/* Add all index entries for BLOB stored at offset OFF to ARRAY.  */
+static void
+add_blob_entries (struct entry_array_s *array, KEYBOXBLOB blob, off_t off)
+{
+  const unsigned char *buffer;
+  unsigned char key[INDEX_KEY_LEN];
+  size_t length, nkeys, keyinfolen, idx, pos;
+  int blobtype, fpr32, fprlen;
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  blobtype = blob_get_type (blob);
+  if (blobtype != KEYBOX_BLOBTYPE_PGP && blobtype != KEYBOX_BLOBTYPE_X509)
+    return;
+  if (length < 48)
+    return;
+  fpr32 = buffer[5] == 2;
+
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (!nkeys || keyinfolen < (fpr32? 56:28)
+      || 20 + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return;
+
+  for (idx=0; idx < nkeys; idx++)
+    {
+      pos = 20 + idx*keyinfolen;
+      if (fpr32)
+        fprlen = (get16 (buffer + pos + 32) & 0x80)? 32:20;
+      else
+        fprlen = 20;
+
+      make_key (key, IDXKEY_FPR, buffer + pos, fprlen);
+      add_entry (array, key, off);
+      if (!idx)
+        {
+          make_key (key, IDXKEY_UBID, buffer + pos, UBID_LEN);
+          add_entry (array, key, off);
+        }
+
+      /* See has_short_kid and has_long_kid.  */
+      make_key (key, IDXKEY_SHORT_KID, buffer + pos + (fpr32? 0:16), 4);
+      add_entry (array, key, off);
+      make_key (key, IDXKEY_LONG_KID, buffer + pos + (fpr32? 0:12), 8);
+      add_entry (array, key, off);
+    }
+
+  add_mail_entries (array, buffer, length,
+                    blobtype == KEYBOX_BLOBTYPE_X509, off);
+
+  if (blobtype == KEYBOX_BLOBTYPE_PGP)
+    add_keygrip_entries (array, buffer, length, off);
+  else
+    array->flags |= INDEX_FLAG_NO_KEYGRIP;
+}
+
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_ENTRY_LEN);
+}
+
+
+/* Write a new index for the keybox with the stat info ST and the
+   entries ARRAY.  */
+static gpg_error_t
+write_index (const char *fname, struct stat *st, struct entry_array_s *array)
+{
+  gpg_error_t err;
+  char *idxfname, *tmpfname;
+  unsigned char header[INDEX_HEADER_LEN];
+  estream_t fp;
+
+  if (array->count > 0xffffffff)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  idxfname = index_fname (fname, NULL);
+  tmpfname = index_fname (fname, EXTSEP_S "tmp");
+  if (!idxfname || !tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  qsort (array->data, array->count, INDEX_ENTRY_LEN, compare_entries);
+
+  memset (header, 0, sizeof header);
+  memcpy (header, "KBXi", 4);
+  header[4] = INDEX_VERSION;
+  header[5] = array->flags;
+  make_stamp (header + INDEX_STAMP_OFF, st);
+  ulongtobuf (header + INDEX_NSORTED_OFF, array->count);
+  ulongtobuf (header + INDEX_NTOTAL_OFF, array->count);
+
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_fwrite (header, sizeof header, 1, fp) != 1
+      || (array->count
+          && es_fwrite (array->data, array->count * INDEX_ENTRY_LEN, 1, fp)
+          != 1))
+    err = gpg_error_from_syserror ();
+  else  /* The new index must be on the disk before the rename.  */
+    err = _keybox_sync_file (fp);
+  if (err)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  err = gnupg_rename_file (tmpfname, idxfname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+
+ leave:
+  xfree (tmpfname);
+  xfree (idxfname);
+  return err;
+}
+
+
+/* Open the index for the keybox FNAME with the stat info ST and
+   check that it is valid.  On success the header is stored at
+   HEADER and the file pointer is positioned after it.  */
+static estream_t
+open_index (const char *fname, struct stat *st, const char *mode,
+            unsigned char *header)
+{
+  char *idxfname;
+  estream_t fp;
+  struct stat idxst;
+
+  idxfname = index_fname (fname, NULL);
+  if (!idxfname)
+    return NULL;
+  fp = es_fopen (idxfname, mode);
+  xfree (idxfname);
+  if (!fp)
+    return NULL;
+  /* We only do small reads at random positions.  */
+  es_setvbuf (fp, NULL, _IONBF, 0);
+
+  if (es_fread (header, INDEX_HEADER_LEN, 1, fp) != 1
+      || memcmp (header, "KBXi", 4)
+      || header[4] != INDEX_VERSION
+      || !same_stamp_p (header, st)
+      || get32 (header + INDEX_NSORTED_OFF) > get32 (header + INDEX_NTOTAL_OFF)
+      || fstat (es_fileno (fp), &idxst)
+      || ((uint64_t)idxst.st_size
+          < INDEX_HEADER_LEN
+          + (uint64_t)get32 (header + INDEX_NTOTAL_OFF) * INDEX_ENTRY_LEN))
+    {
+      es_fclose (fp);
+      return NULL;
+    }
+
+  return fp;
+}
+
+
+/* Build the index for the keybox FNAME unless a valid index already
+   exists.  With FORCE set the index is always rebuilt.  This
+   function must be called with the keybox locked.  */
+gpg_error_t
+_keybox_index_build (const char *fname, int force)
+{
+  gpg_error_t err;
+  estream_t fp, idxfp;
+  struct stat st, st2;
+  unsigned char header[INDEX_HEADER_LEN];
+  unsigned char stamp[INDEX_STAMP_LEN], stamp2[INDEX_STAMP_LEN];
+  struct entry_array_s array;
+  KEYBOXBLOB blob = NULL;
+  int read_rc;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (fstat (es_fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      return err;
+    }
+
+  if (!force && (idxfp = open_index (fname, &st, "rb", header)))
+    {
+      es_fclose (idxfp);
+      es_fclose (fp);
+      return 0;
+    }
+
+  memset (&array, 0, sizeof array);
+  while (!(read_rc = _keybox_read_blob (&blob, fp, NULL))
+         || (gpg_err_code (read_rc) == GPG_ERR_TOO_LARGE
+             && gpg_err_source (read_rc) == GPG_ERR_SOURCE_KEYBOX))
+    {
+      if (blob)
+        add_blob_entries (&array, blob, _keybox_get_blob_fileoffset (blob));
+      _keybox_release_blob (blob);
+      blob = NULL;
+    }
+  if (read_rc == -1)
+    err = 0;
+  else
+    err = read_rc;
+
+  /* Don't write an index for a file which has been changed meanwhile.  */
+  if (!err && fstat (es_fileno (fp), &st2))
+    err = gpg_error_from_syserror ();
+  if (!err)
+    {
+      make_stamp (stamp, &st);
+      make_stamp (stamp2, &st2);
+      if (memcmp (stamp, stamp2, INDEX_STAMP_LEN))
+        err = gpg_error (GPG_ERR_CONFLICT);
+    }
+  es_fclose (fp);
+
+  if (!err && array.oom)
+    err = gpg_error (GPG_ERR_ENOMEM);
+  if (!err)
+    err = write_index (fname, &st, &array);
+  xfree (array.data);
+  return err;
+}
+
+
+/* Read all entries from the index IDXFP with HEADER and write a new
+   index for the keybox FNAME with the stat info ST.  IDXFP is
+   closed.  */
+static gpg_error_t
+merge_index (estream_t idxfp, const unsigned char *header,
+             const char *fname, struct stat *st)
+{
+  gpg_error_t err;
+  struct entry_array_s array;
+
+  memset (&array, 0, sizeof array);
+  array.flags = header[5];
+  if (es_fseeko (idxfp, INDEX_HEADER_LEN, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (idxfp);
+      return err;
+    }
+  array.count = array.size = get32 (header + INDEX_NTOTAL_OFF);
+  array.data = xtrymalloc (array.size * INDEX_ENTRY_LEN + 1);
+  if (!array.data)
+    err = gpg_error_from_syserror ();
+  else if (array.count
+           && es_fread (array.data, array.count * INDEX_ENTRY_LEN, 1, idxfp)
+           != 1)
+    err = gpg_error (GPG_ERR_TOO_SHORT);
+  else
+    err = 0;
+  es_fclose (idxfp);
+
+  if (!err)
+    err = write_index (fname, st, &array);
+  xfree (array.data);
+  return err;
+}
+
+
+/* Return the index of the keybox FNAME for update if it matches the
+   keybox.  This must be called with the keybox locked and before the
+   keybox is modified.  Returns NULL if there is no valid index.  */
+estream_t
+_keybox_index_begin_update (const char *fname)
+{
+  struct stat st;
+  unsigned char header[INDEX_HEADER_LEN];
+
+  if (gnupg_stat (fname, &st))
+    return NULL;
+  return open_index (fname, &st, "r+b", header);
+}
+
+
+/* Finish an update of the keybox FNAME started with
+   _keybox_index_begin_update.  IDXFP may be NULL.  If BLOB is not
+   NULL it has been appended to the keybox at offset OFF and its
+   entries are added to the index.  The index is then marked as valid
+   for the current state of the keybox.  */
+void
+_keybox_index_end_update (estream_t idxfp, const char *fname,
+                          KEYBOXBLOB blob, off_t off)
+{
+  unsigned char header[INDEX_HEADER_LEN];
+  struct entry_array_s array;
+  struct stat st;
+  size_t ntotal, nnew;
+  int flags;
+  int failed = 0;
+
+  if (!idxfp)
+    return;
+
+  memset (&array, 0, sizeof array);
+  if (blob)
+    add_blob_entries (&array, blob, off);
+
+  /* Append the new entries and make sure that they are on the disk
+     before the header refers to them.  */
+  ntotal = 0;
+  if (es_fseeko (idxfp, 0, SEEK_SET)
+      || es_fread (header, sizeof header, 1, idxfp) != 1)
+    failed = 1;
+  else
+    ntotal = get32 (header + INDEX_NTOTAL_OFF);
+  if (failed
+      || array.oom
+      || ntotal + array.count > 0xffffffff
+      || (array.count
+          && (es_fseeko (idxfp,
+                         INDEX_HEADER_LEN + (off_t)ntotal * INDEX_ENTRY_LEN,
+                         SEEK_SET)
+              || es_fwrite (array.data, array.count * INDEX_ENTRY_LEN, 1,
+                            idxfp) != 1
+              || _keybox_sync_file (idxfp)))
+      || gnupg_stat (fname, &st))
+    failed = 1;
+  nnew = array.count;
+  flags = array.flags;
+  xfree (array.data);
+  if (failed)
+    {
+      /* Better make sure that the index won't be used.  */
+      es_fseeko (idxfp, 0, SEEK_SET);
+      es_fwrite ("\0\0\0\0", 4, 1, idxfp);
+      es_fclose (idxfp);
+      return;
+    }
+
+  header[5] |= flags;
+  ntotal += nnew;
+  ulongtobuf (header + INDEX_NTOTAL_OFF, ntotal);
+  if (ntotal - get32 (header + INDEX_NSORTED_OFF) > INDEX_MAX_TAIL)
+    {
+      /* Merge the tail into the sorted part.  */
+      if (merge_index (idxfp, header, fname, &st))
+        _keybox_index_remove (fname);
+      return;
+    }
+
+  make_stamp (header + INDEX_STAMP_OFF, &st);
+  if (es_fseeko (idxfp, 0, SEEK_SET)
+      || es_fwrite (header, sizeof header, 1, idxfp) != 1)
+    {
+      es_fclose (idxfp);
+      _keybox_index_remove (fname);
+      return;
+    }
+  if (es_fclose (idxfp))
+    _keybox_index_remove (fname);
+}
+
+
+/* Remove the index of the keybox FNAME.  */
+void
+_keybox_index_remove (const char *fname)
+{
+  char *idxfname = index_fname (fname, NULL);
+
+  if (idxfname)
+    gnupg_remove (idxfname);
+  xfree (idxfname);
+}
+
+
+/* Return the number of keys for the search description DESC and
+   store them at KEYS, which needs space for two keys.  Returns -1 if
+   the search mode is not supported by the index.  */
+static int
+desc_to_keys (KEYBOX_SEARCH_DESC *desc, unsigned char *keys)
+{
+  unsigned char buf[8];
+  const char *name;
+  size_t namelen;
+  int nkeys;
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+      ulongtobuf (buf, desc->u.kid[1]);
+      make_key (keys, IDXKEY_SHORT_KID, buf, 4);
+      return 1;
+
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      ulongtobuf (buf, desc->u.kid[0]);
+      ulongtobuf (buf+4, desc->u.kid[1]);
+      make_key (keys, IDXKEY_LONG_KID, buf, 8);
+      return 1;
+
+    case KEYDB_SEARCH_MODE_FPR:
+      if (desc->fprlen != 20 && desc->fprlen != 32)
+        return 0;  /* Never matches.  */
+      make_key (keys, IDXKEY_FPR, desc->u.fpr, 20);
+      return 1;
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      make_key (keys, IDXKEY_KEYGRIP, desc->u.grip, 20);
+      return 1;
+
+    case KEYDB_SEARCH_MODE_UBID:
+      make_key (keys, IDXKEY_UBID, desc->u.ubid, UBID_LEN);
+      return 1;
+
+    case KEYDB_SEARCH_MODE_MAIL:
+      /* See has_mail; the leading '<' is only removed for OpenPGP,
+         thus we need two keys in this case.  */
+      name = desc->u.name;
+      if (!name)
+        return 0;
+      nkeys = 0;
+      namelen = strlen (name);
+      if (namelen && name[namelen-1] == '>')
+        namelen--;
+      if (*name == '<')
+        {
+          if (namelen > 1)
+            make_mail_key (keys + INDEX_KEY_LEN * nkeys++, name+1, namelen-1);
+        }
+      if (namelen)
+        make_mail_key (keys + INDEX_KEY_LEN * nkeys++, name, namelen);
+      return nkeys;
+
+    default:
+      return -1;
+    }
+}
+
+
+/* Read the sorted entry IDX from the index FP into ENTRY.  */
+static gpg_error_t
+read_entry (estream_t fp, size_t idx, unsigned char *entry)
+{
+  if (es_fseeko (fp, INDEX_HEADER_LEN + (off_t)idx * INDEX_ENTRY_LEN,
+                 SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_fread (entry, INDEX_ENTRY_LEN, 1, fp) != 1)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  return 0;
+}
+
+
+/* Add the offset stored in ENTRY to the array at R_OFFS,R_NOFFS if it
+   is not below STARTOFF.  */
+static gpg_error_t
+add_offset (const unsigned char *entry, off_t startoff,
+            off_t **r_offs, size_t *r_noffs, size_t *r_size)
+{
+  off_t off = get64 (entry + INDEX_KEY_LEN);
+  off_t *p;
+
+  if (off < startoff)
+    return 0;
+  if (*r_noffs == *r_size)
+    {
+      *r_size = *r_size? 2 * *r_size : 16;
+      p = xtryrealloc (*r_offs, *r_size * sizeof *p);
+      if (!p)
+        return gpg_error_from_syserror ();
+      *r_offs = p;
+    }
+  (*r_offs)[(*r_noffs)++] = off;
+  return 0;
+}
+
+
+static int
+compare_offsets (const void *a, const void *b)
+{
+  off_t x = *(const off_t *)a;
+  off_t y = *(const off_t *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Use the index of the keybox FNAME, which is open at KBFP, to find
+   the candidates for the search DESC,NDESC.  On success a sorted
+   array with the offsets of all candidate blobs at or after STARTOFF
+   is stored at R_OFFS and their number at R_NOFFS; the caller needs
+   to check whether these blobs really match.  An error is returned
+   if the index can't be used for this search, in which case a
+   linear search must be done.  */
+gpg_error_t
+_keybox_index_lookup (estream_t kbfp, const char *fname,
+                      KEYBOX_SEARCH_DESC *desc, size_t ndesc, off_t startoff,
+                      off_t **r_offs, size_t *r_noffs)
+{
+  gpg_error_t err;
+  estream_t fp;
+  struct stat st;
+  unsigned char header[INDEX_HEADER_LEN];
+  unsigned char entry[INDEX_ENTRY_LEN];
+  unsigned char *keys = NULL;
+  unsigned char *tail = NULL;
+  int *nkeys = NULL;
+  size_t n, i, nsorted, ntail, lo, hi, size;
+  int k;
+
+  *r_offs = NULL;
+  *r_noffs = 0;
+
+  if (!ndesc || startoff < 0)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  keys = xtrymalloc (ndesc * 2 * INDEX_KEY_LEN);
+  nkeys = xtrycalloc (ndesc, sizeof *nkeys);
+  if (!keys || !nkeys)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (keys);
+      xfree (nkeys);
+      return err;
+    }
+  for (n=0; n < ndesc; n++)
+    if ((nkeys[n] = desc_to_keys (desc + n, keys + n*2*INDEX_KEY_LEN)) < 0)
+      {
+        xfree (keys);
+        xfree (nkeys);
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      }
+
+  fp = NULL;
+  if (fstat (es_fileno (kbfp), &st)
+      || !(fp = open_index (fname, &st, "rb", header)))
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+  if ((header[5] & INDEX_FLAG_NO_KEYGRIP))
+    for (n=0; n < ndesc; n++)
+      if (desc[n].mode == KEYDB_SEARCH_MODE_KEYGRIP)
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          goto leave;
+        }
+
+  /* Read the unsorted tail.  open_index has checked that all entries
+     are there.  */
+  nsorted = get32 (header + INDEX_NSORTED_OFF);
+  ntail = get32 (header + INDEX_NTOTAL_OFF) - nsorted;
+  if (ntail)
+    {
+      tail = xtrymalloc (ntail * INDEX_ENTRY_LEN);
+      if (!tail)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (es_fseeko (fp, INDEX_HEADER_LEN + (off_t)nsorted * INDEX_ENTRY_LEN,
+                     SEEK_SET)
+          || es_fread (tail, ntail * INDEX_ENTRY_LEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_TOO_SHORT);
+          goto leave;
+        }
+    }
+
+  size = 0;
+  err = 0;
+  for (n=0; n < ndesc && !err; n++)
+    for (k=0; k < nkeys[n] && !err; k++)
+      {
+        const unsigned char *key = keys + (n*2 + k) * INDEX_KEY_LEN;
+
+        /* Binary search for the first matching entry.  */
+        lo = 0;
+        hi = nsorted;
+        while (lo < hi && !err)
+          {
+            i = lo + (hi - lo) / 2;
+            err = read_entry (fp, i, entry);
+            if (memcmp (entry, key, INDEX_KEY_LEN) < 0)
+              lo = i + 1;
+            else
+              hi = i;
+          }
+        for (i = lo; i < nsorted && !err; i++)
+          {
+            err = read_entry (fp, i, entry);
+            if (err || memcmp (entry, key, INDEX_KEY_LEN))
+              break;
+            err = add_offset (entry, startoff, r_offs, r_noffs, &size);
+          }
+
+        for (i=0; i < ntail && !err; i++)
+          if (!memcmp (tail + i * INDEX_ENTRY_LEN, key, INDEX_KEY_LEN))
+            err = add_offset (tail + i * INDEX_ENTRY_LEN, startoff,
+                              r_offs, r_noffs, &size);
+      }
+  if (err)
+    goto leave;
+
+  /* Sort and remove duplicates.  */
+  if (*r_noffs > 1)
+    {
+      qsort (*r_offs, *r_noffs, sizeof **r_offs, compare_offsets);
+      for (i=n=1; i < *r_noffs; i++)
+        if ((*r_offs)[i] != (*r_offs)[n-1])
+          (*r_offs)[n++] = (*r_offs)[i];
+      *r_noffs = n;
+    }
+
+ leave:
+  if (err)
+    {
+      xfree (*r_offs);
+      *r_offs = NULL;
+      *r_noffs = 0;
+    }
+  xfree (tail);
+  xfree (keys);
+  xfree (nkeys);
+  if (fp)
+    es_fclose (fp);
+  return err;
+}
@@ -943,6 +943,9 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
   off_t lastfoundoff;
+  off_t *idxoffs = NULL;
+  size_t nidxoffs, idxpos;
+  int use_index;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -1088,6 +1091,13 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  /* For exact-match searches the index gives us the offsets of all
+     candidate blobs after the current position.  They are processed
+     by the same code as in a linear search.  */
+  use_index = !_keybox_index_lookup (hd->fp, hd->kb->fname, desc, ndesc,
+                                     es_ftello (hd->fp),
+                                     &idxoffs, &nidxoffs);
+  idxpos = 0;
 
   pk_no = uid_no = 0;
   for (;;)
@@ -1096,7 +1106,27 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       int blobtype;
 
       _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp, NULL);
+      if (use_index)
+        {
+          off_t off;
+
+          if (idxpos == nidxoffs)
+            {
+              rc = -1;
+              break;
+            }
+          off = idxoffs[idxpos++];
+          if (es_fseeko (hd->fp, off, SEEK_SET))
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+          rc = _keybox_read_blob (&blob, hd->fp, NULL);
+          if (rc == -1 || (!rc && _keybox_get_blob_fileoffset (blob) != off))
+            continue; /* The blob has been deleted.  */
+        }
+      else
+        rc = _keybox_read_blob (&blob, hd->fp, NULL);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
@@ -1241,6 +1271,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  xfree (idxoffs);
 
   return rc;
 }
@@ -37,6 +37,10 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+#if defined(HAVE_DOSISH_SYSTEM) && !defined(ftruncate)
+#define ftruncate chsize
+#endif
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -354,6 +358,122 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 }
 
 
+/* Write TYPE to the type field of the blob at offset OFF in FP.  A
+   type of 0 flags the blob as deleted.  */
+static gpg_error_t
+set_blob_type (estream_t fp, off_t off, int type)
+{
+  if (es_fseeko (fp, off + 4, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (es_putc (type, fp) == EOF)
+    return gpg_error_from_syserror ();
+  return _keybox_sync_file (fp);
+}
+
+
+/* Append BLOB to the keybox FNAME instead of copying the entire file.
+   The blob is first written flagged as deleted so that readers skip
+   it; its real type is written only after the blob has been synced
+   to the disk.  If OLD_OFF is not -1 the blob at that offset is then
+   flagged as deleted; if that fails the new blob is removed again.
+   Thus a crash may leave the old and the new blob but never none of
+   them.  The space of deleted blobs is
+   reclaimed by keybox_compress.  If FOR_OPENPGP is set the OpenPGP
+   flag in the header blob is set.  Returns GPG_ERR_ENOENT if the file
+   does not exist.  */
+static gpg_error_t
+blob_append (const char *fname, KEYBOXBLOB blob, int for_openpgp,
+             off_t old_off)
+{
+  gpg_error_t err;
+  estream_t fp, idxfp;
+  const unsigned char *image;
+  size_t length;
+  unsigned char header[8];
+  off_t off = (off_t)-1;
+  int appended = 0;
+
+  image = _keybox_get_blob_image (blob, &length);
+  if (length < 5)
+    return gpg_error (GPG_ERR_BUG);
+  if (length > IMAGELEN_LIMIT)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  fp = es_fopen (fname, "r+b");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  idxfp = _keybox_index_begin_update (fname);
+  /* We don't want buffered data to be written after a truncate.  */
+  es_setvbuf (fp, NULL, _IONBF, 0);
+
+  /* Make sure that the OpenPGP flag is set in the header.  */
+  if (for_openpgp && es_fread (header, sizeof header, 1, fp) == 1
+      && header[4] == KEYBOX_BLOBTYPE_HEADER && !(header[7] & 0x02))
+    {
+      if (es_fseeko (fp, 7, SEEK_SET)
+          || es_putc (header[7] | 0x02, fp) == EOF)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  if (es_fseeko (fp, 0, SEEK_END) || (off = es_ftello (fp)) == (off_t)-1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Write the blob flagged as deleted and sync it.  */
+  memcpy (header, image, 4);
+  header[4] = 0;
+  if (es_fwrite (header, 5, 1, fp) != 1
+      || (length > 5 && es_fwrite (image + 5, length - 5, 1, fp) != 1))
+    err = gpg_error_from_syserror ();
+  else
+    err = _keybox_sync_file (fp);
+
+  /* Now make it visible.  */
+  if (!err)
+    err = set_blob_type (fp, off, image[4]);
+  if (err)
+    {
+      /* Remove the partly written blob.  */
+      if (ftruncate (es_fileno (fp), off))
+        log_info ("truncating '%s' failed: %s\n", fname, strerror (errno));
+      goto leave;
+    }
+
+  appended = 1;
+
+  /* Finally delete the old blob.  */
+  if (old_off != (off_t)-1 && (err = set_blob_type (fp, old_off, 0)))
+    {
+      /* Roll back so that only the old blob is visible.  If even that
+         fails both are visible and we can only warn: the new blob has
+         been stored and an error would tell the caller otherwise.  */
+      if (!set_blob_type (fp, off, 0))
+        {
+          if (ftruncate (es_fileno (fp), off))
+            log_info ("truncating '%s' failed: %s\n", fname, strerror (errno));
+          appended = 0;
+        }
+      else
+        {
+          log_info ("Warning: error deleting the old keyblock in '%s': %s\n",
+                    fname, gpg_strerror (err));
+          err = 0;
+        }
+    }
+
+ leave:
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  _keybox_index_end_update (idxfp, fname, appended? blob : NULL, off);
+  return err;
+}
+
+
 /* Insert the OpenPGP keyblock {IMAGE,IMAGELEN} into HD. */
 gpg_error_t
 keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
@@ -387,7 +507,9 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      err = blob_append (fname, blob, 1, (off_t)-1);
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -440,7 +562,7 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   /* Update the keyblock.  */
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
+      err = blob_append (fname, blob, 1, off);
       _keybox_release_blob (blob);
     }
   return err;
@@ -473,7 +595,9 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
-      rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      rc = blob_append (fname, blob, 0, (off_t)-1);
+      if (gpg_err_code (rc) == GPG_ERR_ENOENT)
+        rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -504,7 +628,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
 {
   off_t off;
   const char *fname;
-  estream_t fp;
+  estream_t fp, idxfp;
   gpg_err_code_t ec;
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
@@ -539,6 +663,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   fp = es_fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
+  idxfp = _keybox_index_begin_update (fname);
 
   ec = 0;
   if (es_fseeko (fp, off, SEEK_SET))
@@ -571,6 +696,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
       if (!ec)
         ec = gpg_err_code_from_syserror ();
     }
+  _keybox_index_end_update (idxfp, fname, NULL, 0);
 
   return gpg_error (ec);
 }
@@ -582,7 +708,7 @@ keybox_delete (KEYBOX_HANDLE hd)
 {
   off_t off;
   const char *fname;
-  estream_t fp;
+  estream_t fp, idxfp;
   int rc;
 
   if (!hd)
@@ -604,6 +730,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   fp = es_fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
+  idxfp = _keybox_index_begin_update (fname);
 
   if (es_fseeko (fp, off, SEEK_SET))
     rc = gpg_error_from_syserror ();
@@ -617,6 +744,7 @@ keybox_delete (KEYBOX_HANDLE hd)
       if (!rc)
         rc = gpg_error_from_syserror ();
     }
+  _keybox_index_end_update (idxfp, fname, NULL, 0);
 
   return rc;
 }
@@ -681,6 +809,8 @@ keybox_compress (KEYBOX_HANDLE hd)
             {
               es_fclose (fp);
               _keybox_release_blob (blob);
+              /* But create the index if it is missing or stale.  */
+              _keybox_index_build (fname, 0);
               return 0; /* Compress run not yet needed. */
             }
         }
@@ -793,6 +923,10 @@ keybox_compress (KEYBOX_HANDLE hd)
   else
     rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
 
+  /* The blobs have been moved thus we need a new index.  */
+  if (!rc)
+    _keybox_index_build (fname, any_changes);
+
   xfree(bakfname);
   xfree(tmpfname);
   return rc;
@@ -90,6 +90,8 @@ enum cmd_and_opt_values
     oFakedSystemTime,
     oListenBacklog,
     oDisableCheckOwnSocket,
+    oCacheSize,
+    oDisableFulltextIndex,
 
     oDummy
   };
@@ -122,6 +124,9 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oCacheSize, "cache-size",
+                N_("|N|use N KiB of memory for the key cache")),
+  ARGPARSE_s_n (oDisableFulltextIndex, "disable-fulltext-index", "@"),
 
   ARGPARSE_end () /* End of list */
 };
@@ -380,6 +385,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.quiet = 0;
       opt.verbose = 0;
       opt.debug = 0;
+      opt.cache_size = DEFAULT_KBXD_CACHE_SIZE;
       disable_check_own_socket = 0;
       return 1;
     }
@@ -408,6 +414,10 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
 
     case oDisableCheckOwnSocket: disable_check_own_socket = 1; break;
 
+    case oCacheSize:
+      opt.cache_size = (size_t)pargs->r.ret_ulong * 1024;
+      break;
+
     default:
       return 0; /* not handled */
     }
@@ -420,6 +430,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
 static void
 finalize_rereadable_options (void)
 {
+  kbxd_set_cache_size (opt.cache_size);
 }
 
 
@@ -587,6 +598,8 @@ main (int argc, char **argv )
           listen_backlog = pargs.r.ret_int;
           break;
 
+        case oDisableFulltextIndex: opt.disable_fulltext_index = 1; break;
+
         default:
           if (configname)
             pargs.err = ARGPARSE_PRINT_WARNING;
@@ -31,6 +31,8 @@
 #include "../common/membuf.h"
 #include "../common/sysutils.h" /* (gnupg_fd_t) */
 
+/* The default size of the key cache in bytes.  */
+#define DEFAULT_KBXD_CACHE_SIZE (16*1024*1024)
 
 /* A large struct name "opt" to keep global flags */
 EXTERN_UNLESS_MAIN_MODULE
@@ -42,6 +44,10 @@ struct
   int dry_run;         /* Don't change any persistent data */
   /* True if we are running detached from the tty. */
   int running_detached;
+  /* The size of the key cache in bytes.  */
+  size_t cache_size;
+  /* Don't use the full-text index even if SQLite supports it.  */
+  int disable_fulltext_index;
 
   /*
    * Global state variables.
@@ -125,6 +131,10 @@ struct server_control_s
   unsigned int filter_x509 : 1;
   /* Used by SEARCH and NEXT.  */
   unsigned int no_data_return : 1;
+  /* Used by SEARCH --multi to return each result as a frame tagged
+   * with the index of the matching pattern (FRAME_DESCIDX).  */
+  unsigned int framed_return : 1;
+  unsigned int frame_descidx;
 
 };
 
@@ -0,0 +1,325 @@
+/* t-keybox-index.c - Module tests for keybox-index.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include "../common/sysutils.h"
+
+#define PGM "t-keybox-index"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+static int verbose;
+static int errcount;
+
+/* The keybox used by the tests and its index.  */
+static char *kbxfname;
+static char *idxfname;
+
+/* Keys of the test keybox.  Both keyblocks have a user id with the
+   first mail address.  */
+static const char mail_both[] = "wk@gnupg.org";
+static const char mail_first[] = "werner@eifzilla.de";
+static const char fpr_first[] = "80615870F5BAD690333686D0F2AD85AC1E42B367";
+static const char fpr_first_sub[] = "16CC3D3B02382A7F67B5C2111E0FE11D664D7444";
+static const char fpr_second[] = "26895E25E8446D44A26D8FAF2F7998F3DBFC6AD9";
+
+
+/* Copy the test keybox to a new file in the current directory.  */
+static void
+setup_keybox (void)
+{
+  const char *srcdir = getenv ("abs_top_srcdir");
+  char *srcfname;
+  estream_t in, out;
+  char buffer[4096];
+  size_t n;
+
+  srcfname = xstrconcat (srcdir? srcdir : "..",
+                         "/g10/t-keydb-keyring.kbx", NULL);
+  kbxfname = xstrdup (PGM ".kbx");
+  idxfname = xstrdup (PGM ".kbx.idx");
+  gnupg_remove (idxfname);
+
+  in = es_fopen (srcfname, "rb");
+  out = es_fopen (kbxfname, "wb");
+  if (!in || !out)
+    {
+      fprintf (stderr, PGM ": can't copy '%s': %s\n",
+               srcfname, strerror (errno));
+      exit (1);
+    }
+  while ((n = es_fread (buffer, 1, sizeof buffer, in)))
+    es_fwrite (buffer, n, 1, out);
+  es_fclose (in);
+  if (es_fclose (out))
+    {
+      fprintf (stderr, PGM ": error writing '%s'\n", kbxfname);
+      exit (1);
+    }
+  xfree (srcfname);
+}
+
+
+static void
+fpr_desc (KEYBOX_SEARCH_DESC *desc, const char *hexfpr)
+{
+  memset (desc, 0, sizeof *desc);
+  desc->mode = KEYDB_SEARCH_MODE_FPR;
+  hex2bin (hexfpr, desc->u.fpr, 20);
+  desc->fprlen = 20;
+}
+
+
+static void
+mail_desc (KEYBOX_SEARCH_DESC *desc, const char *mail)
+{
+  memset (desc, 0, sizeof *desc);
+  desc->mode = KEYDB_SEARCH_MODE_MAIL;
+  desc->u.name = mail;
+}
+
+
+/* Return the number of blobs found by a search for DESC.  */
+static int
+count_matches (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc)
+{
+  gpg_error_t err;
+  int count = 0;
+
+  keybox_search_reset (hd);
+  while (!(err = keybox_search (hd, desc, 1, KEYBOX_BLOBTYPE_PGP,
+                                NULL, NULL)))
+    count++;
+  if (gpg_err_code (err) != GPG_ERR_EOF && err != -1)
+    {
+      if (verbose)
+        fprintf (stderr, PGM ": search failed: %s\n", gpg_strerror (err));
+      return -1;
+    }
+  return count;
+}
+
+
+/* Return the number of candidates the index returns for DESC or -1
+   if the index can't be used.  */
+static int
+count_candidates (KEYBOX_SEARCH_DESC *desc)
+{
+  gpg_error_t err;
+  estream_t fp;
+  off_t *offs;
+  size_t noffs;
+
+  fp = es_fopen (kbxfname, "rb");
+  if (!fp)
+    return -1;
+  err = _keybox_index_lookup (fp, kbxfname, desc, 1, 0, &offs, &noffs);
+  es_fclose (fp);
+  if (err)
+    return -1;
+  xfree (offs);
+  return noffs;
+}
+
+
+/* Check that the searches give the EXPECTED number of blobs with and
+   without the index.  If USABLE is set the index must be used.  */
+static void
+check_searches (KEYBOX_HANDLE hd, int testno, int usable, const int *expected)
+{
+  KEYBOX_SEARCH_DESC desc[5];
+  int i, n;
+
+  mail_desc (desc + 0, mail_both);
+  mail_desc (desc + 1, mail_first);
+  fpr_desc (desc + 2, fpr_first);
+  fpr_desc (desc + 3, fpr_first_sub);
+  fpr_desc (desc + 4, fpr_second);
+
+  for (i=0; i < DIM (desc); i++)
+    {
+      n = count_matches (hd, desc + i);
+      if (n != expected[i])
+        {
+          if (verbose)
+            fprintf (stderr, PGM ": search %d: got %d, expected %d\n",
+                     i, n, expected[i]);
+          fail (testno);
+        }
+      n = count_candidates (desc + i);
+      if (usable? n < expected[i] : n != -1)
+        {
+          if (verbose)
+            fprintf (stderr, PGM ": lookup %d: got %d candidates\n", i, n);
+          fail (testno);
+        }
+    }
+}
+
+
+/* Replace the keybox by a copy of itself.  This keeps the size and
+   maybe the modification time but changes the inode.  */
+static void
+replace_keybox (void)
+{
+  char *tmpfname;
+  estream_t in, out;
+  char buffer[4096];
+  size_t n;
+
+  tmpfname = xstrconcat (kbxfname, ".tmp", NULL);
+  in = es_fopen (kbxfname, "rb");
+  out = es_fopen (tmpfname, "wb");
+  if (!in || !out)
+    {
+      fail (0);
+      es_fclose (in);
+      es_fclose (out);
+      xfree (tmpfname);
+      return;
+    }
+  while ((n = es_fread (buffer, 1, sizeof buffer, in)))
+    es_fwrite (buffer, n, 1, out);
+  es_fclose (in);
+  if (es_fclose (out) || gnupg_rename_file (tmpfname, kbxfname, NULL))
+    fail (0);
+  xfree (tmpfname);
+}
+
+
+static void
+run_tests (void)
+{
+  static const int initial[5] = { 2, 1, 1, 1, 1 };
+  static const int appended[5] = { 3, 2, 2, 2, 1 };
+  static const int deleted[5] = { 2, 1, 1, 1, 1 };
+  gpg_error_t err;
+  void *token;
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  void *image;
+  size_t imagelen;
+  struct stat st;
+
+  err = keybox_register_file (kbxfname, 0, &token);
+  if (err)
+    {
+      fprintf (stderr, PGM ": can't register keybox: %s\n",
+               gpg_strerror (err));
+      exit (1);
+    }
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    {
+      fprintf (stderr, PGM ": can't create handle\n");
+      exit (1);
+    }
+
+  /* Without an index.  */
+  check_searches (hd, 1, 0, initial);
+
+  /* Build the index.  */
+  err = _keybox_index_build (kbxfname, 0);
+  if (err || gnupg_stat (idxfname, &st))
+    fail (2);
+  check_searches (hd, 3, 1, initial);
+
+  /* Append a copy of the first keyblock.  The index must be updated
+     and stay valid.  */
+  fpr_desc (&desc, fpr_first);
+  keybox_search_reset (hd);
+  err = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (!err)
+    err = keybox_get_data (hd, &image, &imagelen, NULL, NULL);
+  if (err)
+    fail (4);
+  else
+    {
+      err = keybox_insert_keyblock (hd, image, imagelen);
+      if (err)
+        fail (5);
+      xfree (image);
+    }
+  check_searches (hd, 6, 1, appended);
+
+  /* Delete the copy again; the index still returns it as a candidate
+     but the search must skip it.  */
+  keybox_search_reset (hd);
+  if (keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL)
+      || keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL)
+      || keybox_delete (hd))
+    fail (7);
+  check_searches (hd, 8, 1, deleted);
+
+  /* A keybox replaced without updating the index makes it stale.  */
+  keybox_release (hd);
+  replace_keybox ();
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    {
+      fprintf (stderr, PGM ": can't create handle\n");
+      exit (1);
+    }
+  check_searches (hd, 9, 0, deleted);
+
+  /* Rebuild it.  A stale index is replaced even without force.  */
+  err = _keybox_index_build (kbxfname, 0);
+  if (err)
+    fail (10);
+  check_searches (hd, 11, 1, deleted);
+
+  /* An index with missing entries, as left by a crash, is not
+     used.  */
+  if (gnupg_stat (idxfname, &st) || truncate (idxfname, st.st_size - 32))
+    fail (12);
+  check_searches (hd, 13, 0, deleted);
+
+  keybox_release (hd);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  setup_keybox ();
+  run_tests ();
+
+  gnupg_remove (idxfname);
+  gnupg_remove (kbxfname);
+  xfree (idxfname);
+  xfree (kbxfname);
+  return !!errcount;
+}
@@ -0,0 +1,237 @@
+/* t-keybox-update.c - Module tests for keybox-update.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "keybox-defs.h"
+
+/* Writes of the blob type go through es_putc.  We replace it to
+   inject write errors at given file offsets.  Each fault fails the
+   write after skipping SKIP writes at OFF.  */
+static struct
+{
+  off_t off;
+  int skip;
+} faults[2];
+
+static int
+faulty_putc (int c, estream_t fp)
+{
+  off_t off = es_ftello (fp);
+  int i;
+
+  for (i=0; i < DIM (faults); i++)
+    if (faults[i].off != (off_t)-1 && faults[i].off == off)
+      {
+        if (faults[i].skip)
+          faults[i].skip--;
+        else
+          {
+            faults[i].off = (off_t)-1;
+            gpg_err_set_errno (EIO);
+            return EOF;
+          }
+      }
+  return es_putc (c, fp);
+}
+#undef es_putc
+#define es_putc(c,fp) faulty_putc ((c), (fp))
+
+/* We include keybox-update.c to test the error paths of
+   blob_append.  */
+#include "keybox-update.c"
+
+#define PGM "t-keybox-update"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+static int verbose;
+static int errcount;
+
+/* The keybox used by the tests.  */
+static char *kbxfname;
+
+/* The primary key of the first keyblock of the test keybox.  */
+static const char fpr_first[] = "80615870F5BAD690333686D0F2AD85AC1E42B367";
+
+
+/* Copy the test keybox to a new file in the current directory.  */
+static void
+setup_keybox (void)
+{
+  const char *srcdir = getenv ("abs_top_srcdir");
+  char *srcfname;
+  estream_t in, out;
+  char buffer[4096];
+  size_t n;
+
+  srcfname = xstrconcat (srcdir? srcdir : "..",
+                         "/g10/t-keydb-keyring.kbx", NULL);
+  kbxfname = xstrdup (PGM ".kbx");
+
+  in = es_fopen (srcfname, "rb");
+  out = es_fopen (kbxfname, "wb");
+  if (!in || !out)
+    {
+      fprintf (stderr, PGM ": can't copy '%s': %s\n",
+               srcfname, strerror (errno));
+      exit (1);
+    }
+  while ((n = es_fread (buffer, 1, sizeof buffer, in)))
+    es_fwrite (buffer, n, 1, out);
+  es_fclose (in);
+  if (es_fclose (out))
+    {
+      fprintf (stderr, PGM ": error writing '%s'\n", kbxfname);
+      exit (1);
+    }
+  xfree (srcfname);
+}
+
+
+static off_t
+file_size (void)
+{
+  struct stat st;
+
+  if (gnupg_stat (kbxfname, &st))
+    return (off_t)-1;
+  return st.st_size;
+}
+
+
+/* Search for the first keyblock.  Returns the number of visible
+   copies and stores the offset of the first one at R_OFF.  */
+static int
+find_first (KEYBOX_HANDLE hd, off_t *r_off)
+{
+  KEYBOX_SEARCH_DESC desc;
+  int count = 0;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  hex2bin (fpr_first, desc.u.fpr, 20);
+  desc.fprlen = 20;
+
+  *r_off = (off_t)-1;
+  keybox_search_reset (hd);
+  while (!keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL))
+    {
+      if (!count++)
+        *r_off = _keybox_get_blob_fileoffset (hd->found.blob);
+    }
+  /* Leave the first one selected.  */
+  keybox_search_reset (hd);
+  keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  return count;
+}
+
+
+static void
+run_tests (void)
+{
+  gpg_error_t err;
+  void *token;
+  KEYBOX_HANDLE hd;
+  void *image;
+  size_t imagelen;
+  off_t off, newoff, size;
+
+  err = keybox_register_file (kbxfname, 0, &token);
+  if (err)
+    {
+      fprintf (stderr, PGM ": can't register keybox: %s\n",
+               gpg_strerror (err));
+      exit (1);
+    }
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    {
+      fprintf (stderr, PGM ": can't create handle\n");
+      exit (1);
+    }
+
+  if (find_first (hd, &off) != 1
+      || keybox_get_data (hd, &image, &imagelen, NULL, NULL))
+    {
+      fprintf (stderr, PGM ": test keyblock not found\n");
+      exit (1);
+    }
+  faults[0].off = faults[1].off = (off_t)-1;
+
+  /* Deleting the old blob fails: the new one is removed again and an
+     error is returned.  */
+  size = file_size ();
+  faults[0].off = off + 4;
+  err = keybox_update_keyblock (hd, image, imagelen);
+  if (!err)
+    fail (1);
+  if (file_size () != size)
+    fail (2);
+  if (find_first (hd, &newoff) != 1 || newoff != off)
+    fail (3);
+
+  /* A successful update replaces the old blob.  */
+  size = file_size ();
+  err = keybox_update_keyblock (hd, image, imagelen);
+  if (err)
+    fail (4);
+  if (find_first (hd, &newoff) != 1 || newoff != size)
+    fail (5);
+  off = newoff;
+
+  /* Deleting the old blob and the rollback fail: the update succeeds
+     but both blobs are visible.  */
+  size = file_size ();
+  faults[0].off = off + 4;
+  faults[1].off = size + 4;
+  faults[1].skip = 1;  /* Fail the rollback, not making it visible.  */
+  err = keybox_update_keyblock (hd, image, imagelen);
+  if (err)
+    fail (6);
+  if (find_first (hd, &newoff) != 2 || newoff != off)
+    fail (7);
+
+  xfree (image);
+  keybox_release (hd);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  setup_keybox ();
+  run_tests ();
+
+  gnupg_remove (kbxfname);
+  xfree (kbxfname);
+  return !!errcount;
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "trust-pgp" "common.scm"))
+
+(unless (flag "--use-keyboxd" *args*)
+	(skip "keyboxd not used"))
+
+(display "Checking the full-text index of the keyboxd...\n")
+
+(setup-environment)
+(call-check `(,@GPG --import
+		    ,(in-srcdir "tests" "openpgp" "trust-pgp" "scenario1.asc")))
+
+(call-check `(,@GPG --armor --output carol.asc --export ,CAROL))
+(call-check `(,@GPG --armor --output grace.asc --export ,GRACE))
+
+;; Return the fingerprints of the primary keys found for PATTERN.
+(define (search pattern)
+  (let ((result (call-with-io `(,@GPG --with-colons --list-keys ,pattern) "")))
+    (if (= 0 (:retcode result))
+	(let loop ((lines (map (lambda (line) (string-split line #\:))
+			       (string-split-newlines (:stdout result))))
+		   (primary #f)
+		   (acc '()))
+	  (cond
+	   ((null? lines) (reverse acc))
+	   ((equal? 'pub (:type (car lines)))
+	    (loop (cdr lines) #t acc))
+	   ((and primary (equal? 'fpr (:type (car lines))))
+	    (loop (cdr lines) #f (cons (:fpr (car lines)) acc)))
+	   (else
+	    (loop (cdr lines) primary acc))))
+	'())))
+
+;; Check that searching for PATTERN finds exactly the keys EXPECTED.
+(define (check-search pattern . expected)
+  (let ((found (search pattern)))
+    (unless (and (= (length found) (length expected))
+		 (all (lambda (fpr) (member fpr found)) expected))
+	    (fail "Searching for" pattern "found" found
+		  "but expected" expected))))
+
+;; Check the searches while all keys but those in DELETED exist.
+(define (check-searches . deleted)
+  (define (present . fprs)
+    (filter (lambda (fpr) (not (member fpr deleted))) fprs))
+  (apply check-search "arol" (present CAROL))
+  (apply check-search "example.org" (present ALICE DAVID))
+  (apply check-search "@example.net" (present CAROL GRACE))
+  (apply check-search "race" (present GRACE))
+  (check-search "nosuchuser"))
+
+;; Restart the keyboxd with the configuration LINES.
+(define (restart-keyboxd . lines)
+  (gpg-conf '--kill 'keyboxd)
+  (apply create-file "keyboxd.conf" lines))
+
+(info "Searching with the index...")
+(check-searches)
+
+;; Without the index the keyboxd must still be able to update the
+;; database and fall back to LIKE for the searches.
+(info "Updating and searching without the index...")
+(restart-keyboxd "disable-fulltext-index")
+(call-check `(,@GPG --delete-keys ,GRACE))
+(call-check `(,@GPG --delete-keys ,CAROL))
+(call-check `(,@GPG --import carol.asc))
+(check-searches GRACE)
+
+;; The index is now out of date and must be rebuilt.
+(info "Searching with the rebuilt index...")
+(restart-keyboxd)
+(check-searches GRACE)
+(call-check `(,@GPG --import grace.asc))
+(call-check `(,@GPG --delete-keys ,DAVID))
+(check-searches DAVID)
@@ -0,0 +1,91 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "trust-pgp" "common.scm"))
+
+(display "Checking incremental revalidation of imported keys...\n")
+
+(initscenario "scenario1")
+
+(setownertrust BOBBY FULLTRUST)
+(setownertrust CAROL MARGINALTRUST)
+(setownertrust DAVID MARGINALTRUST)
+(updatetrustdb)
+
+;; Frank's and Grace's keys don't introduce other keys; thus an import
+;; of them can be handled without a full check.  Save them for the
+;; re-imports below.
+(define (keyfile keyfpr) (string-append keyfpr ".asc"))
+(for-each
+ (lambda (keyfpr)
+   (call-check `(,@GPG --armor --output ,(keyfile keyfpr)
+		       --export ,keyfpr)))
+ (list FRANK GRACE))
+
+;; Delete the key KEYFPR and import it again.  Returns true if the
+;; import revalidated the key on its own instead of scheduling a full
+;; check.  The test environment disables the automatic check; we need
+;; it here.
+(define (reimport keyfpr)
+  (call-check `(,@GPG --delete-keys ,keyfpr))
+  (updatetrustdb)
+  (let ((result (call-with-io `(,@GPG --verbose --auto-check-trustdb
+				      --import ,(keyfile keyfpr)) "")))
+    (unless (= 0 (:retcode result))
+	    (fail "Importing" keyfpr "failed:" (:stderr result)))
+    (string-contains? (:stderr result) "revalidated")))
+
+;; Re-import the key KEYFPR and check that its validity is
+;; EXPECTED-TRUST before and after a full check.  INCREMENTAL tells
+;; whether the import is expected to revalidate the key on its own.
+(define (check-reimport keyfpr expected-trust incremental)
+  (let ((revalidated (if (reimport keyfpr) #t #f)))
+    (unless (eq? incremental revalidated)
+	    (fail keyfpr ": Expected incremental revalidation to be"
+		  incremental "but got" revalidated)))
+  (checktrust keyfpr expected-trust)
+  (updatetrustdb)
+  (checktrust keyfpr expected-trust))
+
+;; Frank is signed by Bobby (full ownertrust, depth 1); Grace is
+;; signed by Carol and David (marginal ownertrust, depth 2) and by
+;; Frank (no ownertrust).
+(check-reimport FRANK "f" #t)
+(check-reimport GRACE "m" #t)	;; Only two of three needed marginals.
+
+(let ((marginals-needed (gpg-config 'gpg "marginals-needed")))
+  (marginals-needed::update 2))
+(updatetrustdb)
+(check-reimport GRACE "f" #t)	;; Now two marginals are enough.
+
+(let ((completes-needed (gpg-config 'gpg "completes-needed")))
+  (completes-needed::update 2))
+(updatetrustdb)
+(check-reimport FRANK "m" #t)	;; Only one of two needed completes.
+(check-reimport GRACE "-" #t)	;; Carol and David are only marginally
+				;; valid and can't introduce Grace.
+
+(let ((completes-needed (gpg-config 'gpg "completes-needed")))
+  (completes-needed::clear))
+(let ((max-cert-depth (gpg-config 'gpg "max-cert-depth")))
+  (max-cert-depth::update 2))
+(updatetrustdb)
+(check-reimport FRANK "f" #t)
+(check-reimport GRACE "-" #f)	;; Grace is one step too far; this
+				;; needs a full check.